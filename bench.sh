@@ -0,0 +1,121 @@
+#!/bin/bash
+# end to end benchmark: reliable_sender -> relay -> reliable_receiver on loopback
+# every scenario (an impaired path) x file size x congestion control is one run and one row in the results
+#
+# settings come from the environment, make bench passes its variables through:
+#   BENCH_SCENARIOS    names from the table below (default: all of them)
+#   BENCH_SIZES        file sizes in MB (default: 1 16 64)
+#   BENCH_CC           congestion control algorithms (default: reno)
+#   BENCH_SENDER_ARGS  extra sender flags, e.g. "-o -n 2"
+#   BENCH_RECVR_ARGS   extra receiver flags, e.g. "-w direct"
+#   BENCH_OUT          results file, csv, or -o (default: $TMPDIR/bench.csv, outside the source tree)
+#   BENCH_BASELINE     results of an earlier run, goodput drops past BENCH_TOLERANCE % are flagged
+#   BENCH_TOLERANCE    (default: 10)
+#   BENCH_TIMEOUT      secs a run may take (default: 120)
+set -u
+
+OUT=${BENCH_OUT:-${TMPDIR:-/tmp}/bench.csv}
+while getopts o: opt; do
+	case $opt in
+	o) OUT=$OPTARG ;;
+	*) echo "usage: $0 [-o results.csv]" >&2; exit 1 ;;
+	esac
+done
+
+# paths are the caller's, the runs happen in the source tree
+case $OUT in /*) ;; *) OUT="$PWD/$OUT" ;; esac
+BASELINE=${BENCH_BASELINE:-}
+case $BASELINE in /*|"") ;; *) BASELINE="$PWD/$BASELINE" ;; esac
+cd "$(dirname "$0")"
+
+# name|relay flags (./relay without arguments lists them), every direction gets the same path
+SCENARIO_TABLE="
+clean|
+lan|-d 0.1 -j 0.05
+wan|-d 20 -j 1 -w 200 -q 2048
+lossy|-d 10 -l 1
+bursty|-d 10 -l 1 -b 8
+reorder|-d 5 -r 5 -R 2
+duplicate|-d 5 -u 2
+narrow|-d 5 -w 50 -q 256
+"
+
+SCENARIOS=${BENCH_SCENARIOS:-$(echo "$SCENARIO_TABLE" | cut -d'|' -f1 | xargs)}
+SIZES=${BENCH_SIZES:-1 16 64}
+CCS=${BENCH_CC:-reno}
+TIMEOUT=${BENCH_TIMEOUT:-120}
+TOLERANCE=${BENCH_TOLERANCE:-10}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+echo "scenario,size_mb,cc,ok,seconds,goodput_mbit,packets_sent,retransmitted,retransmit_pct" > "$OUT"
+printf "%-10s %8s %6s %4s %9s %12s %10s\n" scenario size_mb cc ok seconds goodput_mbit retx_pct
+
+for size in $SIZES; do
+	input="$WORK/in-$size"
+	head -c $((size * 1000000)) /dev/urandom > "$input"
+
+	for name in $SCENARIOS; do
+		line=$(echo "$SCENARIO_TABLE" | grep "^$name|")
+		if [ -z "$line" ]; then
+			echo "bench: no scenario $name" >&2
+			exit 1
+		fi
+		relay_flags=${line#*|}
+
+		for cc in $CCS; do
+			port=$((20000 + RANDOM % 20000))
+			output="$WORK/out"
+			rm -f "$output"
+
+			./relay -s 1 $relay_flags $port 127.0.0.1 $((port + 1)) 2> "$WORK/relay.log" &
+			relay_pid=$!
+			timeout $TIMEOUT ./reliable_receiver ${BENCH_RECVR_ARGS:-} $((port + 1)) "$output" > /dev/null 2>&1 &
+			recvr_pid=$!
+			sleep 0.2
+
+			start=$(date +%s%N)
+			timeout $TIMEOUT ./reliable_sender -s -c $cc ${BENCH_SENDER_ARGS:-} 127.0.0.1 $port "$input" $((size * 1000000)) > /dev/null 2> "$WORK/sender.log"
+			end=$(date +%s%N)
+			wait $recvr_pid
+			kill $relay_pid 2> /dev/null
+			wait $relay_pid 2> /dev/null
+
+			ok=0
+			if cmp -s "$input" "$output"; then
+				ok=1
+			fi
+			seconds=$(awk -v ns=$((end - start)) 'BEGIN { printf "%.3f", ns / 1e9 }')
+			goodput=$(awk -v bytes=$((size * 1000000)) -v s=$seconds 'BEGIN { printf "%.1f", (s > 0 ? bytes * 8 / s / 1e6 : 0) }')
+			# summed over the streams: "packets: N sent, N acks, N retransmitted ..."
+			read sent retransmitted <<< $(awk '/^packets:/ { sent += $2; retx += $6 } END { print sent + 0, retx + 0 }' "$WORK/sender.log")
+			retransmit_pct=$(awk -v r=$retransmitted -v s=$sent 'BEGIN { printf "%.2f", (s > 0 ? 100 * r / s : 0) }')
+
+			echo "$name,$size,$cc,$ok,$seconds,$goodput,$sent,$retransmitted,$retransmit_pct" >> "$OUT"
+			printf "%-10s %8s %6s %4s %9s %12s %10s\n" $name $size $cc $ok $seconds $goodput $retransmit_pct
+		done
+	done
+done
+
+failed=$(awk -F, 'NR > 1 && $4 != 1' "$OUT" | wc -l)
+echo "results in $OUT, $failed failed runs"
+
+# goodput against the baseline, row by row on scenario, size and cc
+if [ -n "$BASELINE" ]; then
+	awk -F, -v tolerance=$TOLERANCE '
+		FNR == 1 { next }
+		NR == FNR { baseline[$1 "," $2 "," $3] = $6; next }
+		{
+			key = $1 "," $2 "," $3
+			if (!(key in baseline) || baseline[key] == 0) next
+			change = 100 * ($6 - baseline[key]) / baseline[key]
+			flag = change < -tolerance ? "  REGRESSION" : ""
+			printf "%-24s %10.1f -> %10.1f Mbit/s %+7.1f%%%s\n", key, baseline[key], $6, change, flag
+			if (flag != "") regressions += 1
+		}
+		END { if (regressions > 0) exit 1 }
+	' "$BASELINE" "$OUT" || failed=$((failed + 1))
+fi
+
+[ "$failed" -eq 0 ]
@@ -0,0 +1,128 @@
+#include "blake2b.h"
+
+#include <string.h>
+
+static const unsigned long long blake2b_iv[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const unsigned char blake2b_sigma[12][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+	{ 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+	{ 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+	{ 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+	{ 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+	{ 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+	{ 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+	{ 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+	{ 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+static inline unsigned long long rotr64(unsigned long long x, int n) {
+	return (x >> n) | (x << (64 - n));
+}
+
+#define G(a, b, c, d, x, y) do { \
+	v[a] = v[a] + v[b] + (x); \
+	v[d] = rotr64(v[d] ^ v[a], 32); \
+	v[c] = v[c] + v[d]; \
+	v[b] = rotr64(v[b] ^ v[c], 24); \
+	v[a] = v[a] + v[b] + (y); \
+	v[d] = rotr64(v[d] ^ v[a], 16); \
+	v[c] = v[c] + v[d]; \
+	v[b] = rotr64(v[b] ^ v[c], 63); \
+} while (0)
+
+static void blake2b_compress(blake2b_t *state, const unsigned char *block, int last) {
+	unsigned long long m[16];
+	unsigned long long v[16];
+	memcpy(m, block, sizeof(m)); // little endian, as the x86 and arm hosts this runs on are
+
+	for (int i = 0; i < 8; i++) {
+		v[i] = state->h[i];
+		v[i + 8] = blake2b_iv[i];
+	}
+	v[12] ^= state->t[0];
+	v[13] ^= state->t[1];
+	if (last) {
+		v[14] = ~v[14];
+	}
+
+	for (int round = 0; round < 12; round++) {
+		const unsigned char *s = blake2b_sigma[round];
+		G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+		G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+		G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+		G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+		G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+		G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+		G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+		G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+	}
+
+	for (int i = 0; i < 8; i++) {
+		state->h[i] ^= v[i] ^ v[i + 8];
+	}
+}
+
+static void blake2b_count(blake2b_t *state, size_t size) {
+	state->t[0] += size;
+	if (state->t[0] < size) {
+		state->t[1] += 1;
+	}
+}
+
+void blake2b_init(blake2b_t *state, size_t size) {
+	memcpy(state->h, blake2b_iv, sizeof(state->h));
+	state->h[0] ^= 0x01010000ULL ^ size; // depth 1, fanout 1, no key
+	state->t[0] = 0;
+	state->t[1] = 0;
+	state->block_fill = 0;
+	state->size = size;
+}
+
+// the last block is held back until final, it's compressed with the last block flag
+void blake2b_update(blake2b_t *state, const void *data, size_t size) {
+	const unsigned char *in = data;
+	if (size == 0) {
+		return;
+	}
+
+	size_t room = BLAKE2B_BLOCK_SIZE - state->block_fill;
+	if (size > room) {
+		memcpy(state->block + state->block_fill, in, room);
+		blake2b_count(state, BLAKE2B_BLOCK_SIZE);
+		blake2b_compress(state, state->block, 0);
+		state->block_fill = 0;
+		in += room;
+		size -= room;
+
+		// whole blocks straight from the input, the copy is only for the remainder
+		while (size > BLAKE2B_BLOCK_SIZE) {
+			blake2b_count(state, BLAKE2B_BLOCK_SIZE);
+			blake2b_compress(state, in, 0);
+			in += BLAKE2B_BLOCK_SIZE;
+			size -= BLAKE2B_BLOCK_SIZE;
+		}
+	}
+	memcpy(state->block + state->block_fill, in, size);
+	state->block_fill += size;
+}
+
+void blake2b_final(blake2b_t *state, void *digest) {
+	blake2b_count(state, state->block_fill);
+	memset(state->block + state->block_fill, 0, BLAKE2B_BLOCK_SIZE - state->block_fill);
+	blake2b_compress(state, state->block, 1);
+	memcpy(digest, state->h, state->size);
+}
+
+void blake2b(void *digest, size_t digest_size, const void *data, size_t size) {
+	blake2b_t state;
+	blake2b_init(&state, digest_size);
+	blake2b_update(&state, data, size);
+	blake2b_final(&state, digest);
+}
@@ -0,0 +1,28 @@
+#ifndef BLAKE2B_H
+#define BLAKE2B_H
+
+#include <stddef.h>
+
+// blake2b (rfc 7693), unkeyed, for what a crc can't be trusted with: a collision has to be found, not computed
+#define BLAKE2B_BLOCK_SIZE 128
+#define BLAKE2B_MAX_SIZE 64 // digest bytes
+
+typedef struct blake2b {
+	unsigned long long h[8];
+	unsigned long long t[2]; // bytes compressed so far
+	unsigned char block[BLAKE2B_BLOCK_SIZE];
+	size_t block_fill;
+	size_t size; // of the digest
+} blake2b_t;
+
+// size is the digest's, 1 to BLAKE2B_MAX_SIZE bytes, it's part of the hash, not a truncation
+void blake2b_init(blake2b_t *state, size_t size);
+
+void blake2b_update(blake2b_t *state, const void *data, size_t size);
+
+void blake2b_final(blake2b_t *state, void *digest);
+
+// the three at once
+void blake2b(void *digest, size_t digest_size, const void *data, size_t size);
+
+#endif /* BLAKE2B_H */
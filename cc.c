@@ -0,0 +1,427 @@
+#include "cc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PACING_GAIN_SLOW_START 2.0 // pace ahead of cwnd/rtt so the window can still grow
+#define PACING_GAIN 1.25
+
+#define CUBIC_C 0.4 // window growth scale, packets/sec^3
+#define CUBIC_BETA 0.7 // window kept on a loss
+
+#define BBR_STARTUP 0
+#define BBR_DRAIN 1
+#define BBR_PROBE_BW 2
+#define BBR_PROBE_RTT 3
+
+#define BBR_HIGH_GAIN 2.885 // 2/ln(2), doubles the sending rate every round
+#define BBR_MIN_RTT_WINDOW 10 * 1000 * 1000 // 10 secs in microsecs
+#define BBR_PROBE_RTT_TIME 200 * 1000 // 200 ms in microsecs
+
+static const double bbr_cycle_gains[BBR_CYCLE_LENGTH] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static unsigned long long cc_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
+static void cc_clamp_window(cc_t *cc) {
+	if (cc->window_size > cc->max_window_size) {
+		cc->window_size = cc->max_window_size;
+	}
+	if (cc->window_size < 1) {
+		cc->window_size = 1;
+	}
+}
+
+// window based algorithms pace at cwnd per rtt, faster while in slow start
+static double cc_window_pacing_rate(cc_t *cc) {
+	if (cc->srtt <= 0) {
+		return 0;
+	}
+
+	double gain = PACING_GAIN;
+	if (cc->window_size < cc->optimal_window_size) {
+		gain = PACING_GAIN_SLOW_START;
+	}
+	return (gain * cc->window_size * 1e6) / cc->srtt;
+}
+
+/*** Reno ***/
+
+// cogestion control increase, per ack for acked new packets
+static void reno_on_ack(cc_t *cc, int acked, int in_flight, int in_recovery) {
+	if (in_recovery) {
+		return;
+	}
+
+	int window_size = cc->window_size;
+
+	// additive incr if over congestion threshold (optimal window size), 1 per window of acks
+	if (window_size >= cc->optimal_window_size) {
+		cc->window_acked += acked;
+		if (cc->window_acked >= window_size) {
+			cc->window_acked -= window_size;
+			window_size += 1;
+		}
+	}
+	// exp incr if under congestion threshold (optimal window size), 1 per ack doubles every rtt
+	else {
+		window_size += acked;
+	}
+
+	cc->window_size = window_size;
+	cc_clamp_window(cc);
+}
+
+static void reno_on_loss(cc_t *cc) {
+	int window_size = cc->window_size / 2;
+	if (window_size == 0) {
+		window_size = 1;
+	}
+	cc->optimal_window_size = window_size;
+	cc->window_size = window_size;
+	cc->window_acked = 0;
+}
+
+// TCP slow start
+static void reno_on_timeout(cc_t *cc) {
+	// half congestion window size threshold (optimal_window_size)
+	int optimal_window_size = cc->optimal_window_size / 2;
+	if (optimal_window_size == 0) {
+		optimal_window_size = 1; // don't let it get to 0
+	}
+
+	cc->window_size = 1;
+	cc->optimal_window_size = optimal_window_size;
+	cc->window_acked = 0;
+}
+
+static const cc_ops_t reno_ops = {
+	"reno", 0, reno_on_ack, reno_on_loss, reno_on_timeout, cc_window_pacing_rate
+};
+
+/*** Cubic ***/
+
+// RFC 8312: after a loss the window follows a cubic in time since the loss,
+// flat around the old maximum and steep away from it, so long fat pipes refill fast
+static void cubic_on_ack(cc_t *cc, int acked, int in_flight, int in_recovery) {
+	if (in_recovery) {
+		return;
+	}
+
+	if (cc->cubic_window < cc->optimal_window_size) {
+		cc->cubic_window += acked; // slow start
+	} else {
+		unsigned long long now = cc_now();
+		if (cc->cubic_epoch_start == 0) {
+			cc->cubic_epoch_start = now;
+			cc->cubic_w_tcp = cc->cubic_window;
+			if (cc->cubic_window < cc->cubic_w_max) {
+				cc->cubic_k = cbrt((cc->cubic_w_max - cc->cubic_window) / CUBIC_C);
+				cc->cubic_origin = cc->cubic_w_max;
+			} else {
+				cc->cubic_k = 0;
+				cc->cubic_origin = cc->cubic_window;
+			}
+		}
+
+		// where the window should be one rtt from now
+		double t = ((now - cc->cubic_epoch_start) + cc->min_rtt) / 1e6;
+		double target = cc->cubic_origin + (CUBIC_C * pow(t - cc->cubic_k, 3));
+
+		// tcp friendly region, never slower than reno would be
+		cc->cubic_w_tcp += ((3 * (1 - CUBIC_BETA)) / (1 + CUBIC_BETA)) * acked / cc->cubic_window;
+		if (cc->cubic_w_tcp > target) {
+			target = cc->cubic_w_tcp;
+		}
+
+		if (target > cc->cubic_window) {
+			cc->cubic_window += ((target - cc->cubic_window) * acked) / cc->cubic_window;
+		} else {
+			cc->cubic_window += (0.01 * acked) / cc->cubic_window;
+		}
+	}
+
+	if (cc->cubic_window > cc->max_window_size) {
+		cc->cubic_window = cc->max_window_size;
+	}
+	cc->window_size = cc->cubic_window;
+	cc_clamp_window(cc);
+}
+
+static void cubic_on_loss(cc_t *cc) {
+	// fast convergence: a loss below the last maximum gives up bandwidth to newer flows
+	if (cc->cubic_window < cc->cubic_w_max) {
+		cc->cubic_w_max = cc->cubic_window * ((1 + CUBIC_BETA) / 2);
+	} else {
+		cc->cubic_w_max = cc->cubic_window;
+	}
+
+	cc->cubic_window *= CUBIC_BETA;
+	if (cc->cubic_window < 1) {
+		cc->cubic_window = 1;
+	}
+	cc->cubic_epoch_start = 0;
+
+	cc->optimal_window_size = cc->cubic_window;
+	cc->window_size = cc->cubic_window;
+	cc_clamp_window(cc);
+}
+
+static void cubic_on_timeout(cc_t *cc) {
+	cubic_on_loss(cc);
+	cc->cubic_window = 1;
+	cc->window_size = 1;
+}
+
+static const cc_ops_t cubic_ops = {
+	"cubic", 0, cubic_on_ack, cubic_on_loss, cubic_on_timeout, cc_window_pacing_rate
+};
+
+/*** BBR ***/
+
+// model based: paces at the max delivery rate seen over the last rounds, and keeps
+// about two bandwidth delay products in flight, loss alone doesn't shrink the window
+
+static double bbr_bdp(cc_t *cc) {
+	return (cc->bbr_btl_bw * cc->min_rtt) / 1e6;
+}
+
+static void bbr_set_state(cc_t *cc, int state, unsigned long long now) {
+	cc->bbr_state = state;
+	switch (state) {
+		case BBR_STARTUP:
+			cc->bbr_pacing_gain = BBR_HIGH_GAIN;
+			cc->bbr_cwnd_gain = BBR_HIGH_GAIN;
+			break;
+		case BBR_DRAIN:
+			cc->bbr_pacing_gain = 1 / BBR_HIGH_GAIN; // empties the queue startup built
+			cc->bbr_cwnd_gain = BBR_HIGH_GAIN;
+			break;
+		case BBR_PROBE_BW:
+			cc->bbr_cycle_index = (cc->bbr_rounds % (BBR_CYCLE_LENGTH - 1)) + 1; // anywhere but the 0.75 phase
+			cc->bbr_cycle_stamp = now;
+			cc->bbr_pacing_gain = bbr_cycle_gains[cc->bbr_cycle_index];
+			cc->bbr_cwnd_gain = 2;
+			break;
+		case BBR_PROBE_RTT:
+			cc->bbr_pacing_gain = 1;
+			cc->bbr_cwnd_gain = 1;
+			cc->bbr_probe_rtt_done = now + BBR_PROBE_RTT_TIME;
+			break;
+	}
+}
+
+static void bbr_round_end(cc_t *cc, double bw_sample) {
+	cc->bbr_bw_samples[cc->bbr_rounds % BBR_BW_ROUNDS] = bw_sample;
+	cc->bbr_rounds += 1;
+
+	cc->bbr_btl_bw = 0;
+	for (int i = 0; i < BBR_BW_ROUNDS; i++) {
+		if (cc->bbr_bw_samples[i] > cc->bbr_btl_bw) {
+			cc->bbr_btl_bw = cc->bbr_bw_samples[i];
+		}
+	}
+
+	// the pipe is full once 3 rounds in a row grew the bandwidth by less than 25%
+	if (!cc->bbr_filled_pipe) {
+		if (cc->bbr_btl_bw >= cc->bbr_full_bw * 1.25) {
+			cc->bbr_full_bw = cc->bbr_btl_bw;
+			cc->bbr_full_bw_count = 0;
+		} else {
+			cc->bbr_full_bw_count += 1;
+			if (cc->bbr_full_bw_count >= 3) {
+				cc->bbr_filled_pipe = 1;
+			}
+		}
+	}
+}
+
+static void bbr_on_ack(cc_t *cc, int acked, int in_flight, int in_recovery) {
+	unsigned long long now = cc_now();
+	cc->bbr_delivered += acked;
+
+	// one delivery rate sample per round trip, a round is over once what was in flight at its start is acked
+	if (cc->bbr_delivered >= cc->bbr_round_end) {
+		if (cc->bbr_round_start != 0 && now > cc->bbr_round_start) {
+			double secs = (now - cc->bbr_round_start) / 1e6;
+			bbr_round_end(cc, (cc->bbr_delivered - cc->bbr_round_delivered) / secs);
+		}
+		cc->bbr_round_start = now;
+		cc->bbr_round_delivered = cc->bbr_delivered;
+		cc->bbr_round_end = cc->bbr_delivered + in_flight;
+	}
+
+	double bdp = bbr_bdp(cc);
+	switch (cc->bbr_state) {
+		case BBR_STARTUP:
+			if (cc->bbr_filled_pipe) {
+				bbr_set_state(cc, BBR_DRAIN, now);
+			}
+			break;
+		case BBR_DRAIN:
+			if (in_flight <= bdp) {
+				bbr_set_state(cc, BBR_PROBE_BW, now);
+			}
+			break;
+		case BBR_PROBE_BW:
+			if (now - cc->bbr_cycle_stamp > (unsigned long long)cc->min_rtt) {
+				cc->bbr_cycle_index = (cc->bbr_cycle_index + 1) % BBR_CYCLE_LENGTH;
+				cc->bbr_cycle_stamp = now;
+				cc->bbr_pacing_gain = bbr_cycle_gains[cc->bbr_cycle_index];
+			}
+			break;
+		case BBR_PROBE_RTT:
+			if (now > cc->bbr_probe_rtt_done) {
+				cc->min_rtt_stamp = now;
+				bbr_set_state(cc, cc->bbr_filled_pipe ? BBR_PROBE_BW : BBR_STARTUP, now);
+			}
+			break;
+	}
+
+	// min rtt hasn't been seen in a while, drain the queue to measure it again
+	if (cc->min_rtt_expired && cc->bbr_state != BBR_PROBE_RTT) {
+		bbr_set_state(cc, BBR_PROBE_RTT, now);
+	}
+
+	// grow like slow start up to the target, cwnd_gain bdps
+	double target = (cc->bbr_cwnd_gain * bdp) + CC_MIN_WINDOW;
+	int window_size = cc->window_size + acked;
+	if (cc->bbr_filled_pipe && window_size > target) {
+		window_size = target;
+	}
+	if (window_size < CC_MIN_WINDOW) {
+		window_size = CC_MIN_WINDOW;
+	}
+	if (cc->bbr_state == BBR_PROBE_RTT) {
+		window_size = CC_MIN_WINDOW;
+	}
+
+	cc->window_size = window_size;
+	cc_clamp_window(cc);
+}
+
+static void bbr_on_loss(cc_t *cc) {
+	// the model is built from delivery rate, not loss
+}
+
+static void bbr_on_timeout(cc_t *cc) {
+	// everything in flight is gone, restart from a small window, the model brings it back
+	cc->window_size = CC_MIN_WINDOW;
+	cc_clamp_window(cc);
+}
+
+static double bbr_pacing_rate(cc_t *cc) {
+	if (cc->bbr_btl_bw > 0) {
+		return cc->bbr_pacing_gain * cc->bbr_btl_bw;
+	}
+	if (cc->srtt <= 0) {
+		return 0;
+	}
+	return (cc->bbr_pacing_gain * cc->window_size * 1e6) / cc->srtt;
+}
+
+static const cc_ops_t bbr_ops = {
+	"bbr", 1, bbr_on_ack, bbr_on_loss, bbr_on_timeout, bbr_pacing_rate
+};
+
+/*** Congestion Control Functions ***/
+
+static const cc_ops_t *cc_algorithms[] = { &reno_ops, &cubic_ops, &bbr_ops };
+
+// returns NULL for an unknown algorithm
+cc_t* cc_create(const char *name, int max_window_size) {
+	const cc_ops_t *ops = NULL;
+	for (size_t i = 0; i < sizeof(cc_algorithms) / sizeof(cc_algorithms[0]); i++) {
+		if (strcmp(cc_algorithms[i]->name, name) == 0) {
+			ops = cc_algorithms[i];
+		}
+	}
+	if (ops == NULL) {
+		return NULL;
+	}
+
+	cc_t *cc = calloc(1, sizeof(cc_t));
+	cc->ops = ops;
+
+	// implementing TCP slow start/congestion control
+	cc->window_size = 1;
+	cc->optimal_window_size = max_window_size;
+	cc->max_window_size = max_window_size;
+
+	cc->srtt = 0;
+	cc->min_rtt = 0;
+
+	cc->cubic_window = 1;
+
+	bbr_set_state(cc, BBR_STARTUP, 0);
+	if (ops == &bbr_ops) {
+		cc->window_size = CC_MIN_WINDOW;
+		cc_clamp_window(cc);
+	}
+	return cc;
+}
+
+void cc_on_rtt(cc_t *cc, long rtt_sample) {
+	if (rtt_sample <= 0) {
+		return;
+	}
+
+	unsigned long long now = cc_now();
+	if (cc->srtt == 0) {
+		cc->srtt = rtt_sample;
+	} else {
+		cc->srtt = ((7 * cc->srtt) + rtt_sample) / 8;
+	}
+
+	cc->min_rtt_expired = cc->min_rtt != 0 && now - cc->min_rtt_stamp > BBR_MIN_RTT_WINDOW;
+	if (cc->min_rtt == 0 || rtt_sample <= cc->min_rtt || cc->min_rtt_expired) {
+		cc->min_rtt = rtt_sample;
+		cc->min_rtt_stamp = now;
+	}
+}
+
+void cc_on_ack(cc_t *cc, int acked, int in_flight, int in_recovery) {
+	cc->ops->on_ack(cc, acked, in_flight, in_recovery);
+}
+
+void cc_on_loss(cc_t *cc) {
+	cc->ops->on_loss(cc);
+}
+
+void cc_on_timeout(cc_t *cc) {
+	cc->ops->on_timeout(cc);
+}
+
+// the recvr's window can be smaller than the one the cc was created with
+void cc_limit_window(cc_t *cc, int max_window_size) {
+	cc->max_window_size = max_window_size;
+	if (cc->optimal_window_size > max_window_size) {
+		cc->optimal_window_size = max_window_size;
+	}
+	cc_clamp_window(cc);
+}
+
+int cc_window(cc_t *cc) {
+	return cc->window_size;
+}
+
+double cc_pacing_rate(cc_t *cc) {
+	return cc->ops->pacing_rate(cc);
+}
+
+const char* cc_name(cc_t *cc) {
+	return cc->ops->name;
+}
+
+int cc_is_paced(cc_t *cc) {
+	return cc->ops->paced;
+}
+
+void cc_delete(cc_t *cc) {
+	free(cc);
+}
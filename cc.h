@@ -0,0 +1,87 @@
+#ifndef CC_H
+#define CC_H
+
+#define CC_MIN_WINDOW 4 // packets, floor for the model based windows
+
+#define BBR_BW_ROUNDS 10 // bandwidth filter length, in round trips
+#define BBR_CYCLE_LENGTH 8 // probe_bw gain cycle
+
+typedef struct cc cc_t;
+
+// congestion control algorithm, picked by name in cc_create
+typedef struct cc_ops {
+	const char *name;
+	int paced; // the window alone would burst, the sender should pace at pacing_rate
+
+	void (*on_ack)(cc_t *cc, int acked, int in_flight, int in_recovery);
+	void (*on_loss)(cc_t *cc); // once per fast recovery
+	void (*on_timeout)(cc_t *cc);
+	double (*pacing_rate)(cc_t *cc); // packets per sec, 0 when there is nothing to go on yet
+} cc_ops_t;
+
+struct cc {
+	const cc_ops_t *ops;
+
+	int window_size; // packets allowed in flight
+	int optimal_window_size; // slow start threshold
+	int max_window_size;
+
+	// fed by cc_on_rtt on every ack, microsecs
+	long srtt;
+	long min_rtt;
+	unsigned long long min_rtt_stamp;
+	int min_rtt_expired;
+
+	// reno
+	int window_acked; // acks counted towards the next additive increase
+
+	// cubic
+	double cubic_window;
+	double cubic_w_max; // window at the last loss
+	double cubic_k; // secs from the epoch start back to w_max
+	double cubic_origin;
+	double cubic_w_tcp; // what reno would have by now
+	unsigned long long cubic_epoch_start;
+
+	// bbr
+	int bbr_state;
+	double bbr_btl_bw; // packets per sec, max of the samples
+	double bbr_bw_samples[BBR_BW_ROUNDS];
+	unsigned long long bbr_rounds;
+	unsigned long long bbr_delivered;
+	unsigned long long bbr_round_delivered; // delivered when the round started
+	unsigned long long bbr_round_end; // the round is over once delivered gets here
+	unsigned long long bbr_round_start;
+	double bbr_full_bw;
+	int bbr_full_bw_count;
+	int bbr_filled_pipe;
+	double bbr_pacing_gain;
+	double bbr_cwnd_gain;
+	int bbr_cycle_index;
+	unsigned long long bbr_cycle_stamp;
+	unsigned long long bbr_probe_rtt_done;
+};
+
+cc_t* cc_create(const char *name, int max_window_size);
+
+void cc_on_rtt(cc_t *cc, long rtt_sample);
+
+void cc_on_ack(cc_t *cc, int acked, int in_flight, int in_recovery);
+
+void cc_on_loss(cc_t *cc);
+
+void cc_on_timeout(cc_t *cc);
+
+void cc_limit_window(cc_t *cc, int max_window_size);
+
+int cc_window(cc_t *cc);
+
+double cc_pacing_rate(cc_t *cc);
+
+const char* cc_name(cc_t *cc);
+
+int cc_is_paced(cc_t *cc);
+
+void cc_delete(cc_t *cc);
+
+#endif /* CC_H */
@@ -0,0 +1,168 @@
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78 // reflected 0x1edc6f41
+
+// slicing by 8: table[k][b] is the crc of byte b followed by k zero bytes
+static unsigned int crc32c_table[8][256];
+
+// x^(2^k) mod p, for shifting a crc past n zero bytes in log n steps
+static unsigned int crc32c_x2n[32];
+
+// x^(8 * CRC32C_LANE - 33) mod p, folds one lane into the next with a carry-less multiply
+static unsigned int crc32c_lane_power;
+
+static unsigned int (*crc32c_update)(unsigned int crc, const unsigned char *buf, size_t size);
+
+// a * b mod p, bit 31 is x^0 (reflected), a must not be 0
+static unsigned int crc32c_multmodp(unsigned int a, unsigned int b) {
+	unsigned int m = 1U << 31;
+	unsigned int p = 0;
+	while (1) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+// x^(n * 2^k) mod p
+static unsigned int crc32c_x2nmodp(unsigned long long n, int k) {
+	unsigned int p = 1U << 31;
+	while (n) {
+		if (n & 1) {
+			p = crc32c_multmodp(crc32c_x2n[k & 31], p);
+		}
+		n >>= 1;
+		k += 1;
+	}
+	return p;
+}
+
+// crc register in and out, no pre or post inversion
+static unsigned int crc32c_update_table(unsigned int crc, const unsigned char *buf, size_t size) {
+	while (size >= 8) {
+		unsigned int lo;
+		unsigned int hi;
+		memcpy(&lo, buf, 4);
+		memcpy(&hi, buf + 4, 4);
+		lo ^= crc;
+		crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+			^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+			^ crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff]
+			^ crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+		buf += 8;
+		size -= 8;
+	}
+	while (size > 0) {
+		crc = crc32c_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+		buf += 1;
+		size -= 1;
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+// crc * x^(8 * CRC32C_LANE): the product carries an extra x, the crc32 instruction another x^32
+__attribute__((target("sse4.2,pclmul")))
+static unsigned long long crc32c_shift_lane(unsigned long long crc) {
+	__m128i product = _mm_clmulepi64_si128(_mm_cvtsi64_si128(crc), _mm_cvtsi64_si128(crc32c_lane_power), 0);
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+// three independent lanes keep the crc32 unit busy (3 cycle latency, 1 per cycle throughput)
+__attribute__((target("sse4.2,pclmul")))
+static unsigned int crc32c_update_sse42(unsigned int crc, const unsigned char *buf, size_t size) {
+	unsigned long long crc0 = crc;
+	while (size >= 3 * CRC32C_LANE) {
+		unsigned long long crc1 = 0;
+		unsigned long long crc2 = 0;
+		for (size_t i = 0; i < CRC32C_LANE; i += 8) {
+			unsigned long long word0;
+			unsigned long long word1;
+			unsigned long long word2;
+			memcpy(&word0, buf + i, 8);
+			memcpy(&word1, buf + CRC32C_LANE + i, 8);
+			memcpy(&word2, buf + (2 * CRC32C_LANE) + i, 8);
+			crc0 = _mm_crc32_u64(crc0, word0);
+			crc1 = _mm_crc32_u64(crc1, word1);
+			crc2 = _mm_crc32_u64(crc2, word2);
+		}
+		crc0 = crc32c_shift_lane(crc0) ^ crc1;
+		crc0 = crc32c_shift_lane(crc0) ^ crc2;
+		buf += 3 * CRC32C_LANE;
+		size -= 3 * CRC32C_LANE;
+	}
+
+	while (size >= 8) {
+		unsigned long long word;
+		memcpy(&word, buf, 8);
+		crc0 = _mm_crc32_u64(crc0, word);
+		buf += 8;
+		size -= 8;
+	}
+	while (size > 0) {
+		crc0 = _mm_crc32_u8(crc0, *buf);
+		buf += 1;
+		size -= 1;
+	}
+	return crc0;
+}
+#endif
+
+void crc32c_init(void) {
+	if (crc32c_update != NULL) {
+		return;
+	}
+
+	for (int b = 0; b < 256; b++) {
+		unsigned int crc = b;
+		for (int k = 0; k < 8; k++) {
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		crc32c_table[0][b] = crc;
+	}
+	for (int b = 0; b < 256; b++) {
+		for (int k = 1; k < 8; k++) {
+			unsigned int crc = crc32c_table[k - 1][b];
+			crc32c_table[k][b] = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+		}
+	}
+
+	unsigned int p = 1U << 30; // x^1
+	crc32c_x2n[0] = p;
+	for (int k = 1; k < 32; k++) {
+		p = crc32c_multmodp(p, p);
+		crc32c_x2n[k] = p;
+	}
+	crc32c_lane_power = crc32c_x2nmodp((8 * CRC32C_LANE) - 33, 0);
+
+	crc32c_update = crc32c_update_table;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+		crc32c_update = crc32c_update_sse42;
+	}
+#endif
+}
+
+unsigned int crc32c(unsigned int crc, const void *buf, size_t size) {
+	return ~crc32c_update(~crc, buf, size);
+}
+
+unsigned int crc32c_combine_gen(unsigned long long size) {
+	return crc32c_x2nmodp(size, 3);
+}
+
+unsigned int crc32c_combine_op(unsigned int crc_a, unsigned int crc_b, unsigned int op) {
+	return crc32c_multmodp(op, crc_a) ^ crc_b;
+}
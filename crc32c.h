@@ -0,0 +1,19 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+
+// crc32c (castagnoli), what the sse4.2 crc32 instruction computes, with a table driven fallback
+// used like zlib's crc32: start from 0, feed the previous result back in to continue
+#define CRC32C_LANE 128 // bytes per lane, the hardware path runs three lanes at once
+
+void crc32c_init(void);
+
+unsigned int crc32c(unsigned int crc, const void *buf, size_t size);
+
+// crc of a followed by b from the crcs of both, op is crc32c_combine_gen(size of b)
+unsigned int crc32c_combine_gen(unsigned long long size);
+
+unsigned int crc32c_combine_op(unsigned int crc_a, unsigned int crc_b, unsigned int op);
+
+#endif /* CRC32C_H */
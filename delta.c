@@ -0,0 +1,318 @@
+#include "delta.h"
+#include "blake2b.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// encoded chunk: ops of literal size (16 bits), copy size (16 bits), the literals, then the copy's base offset (64 bits)
+#define DELTA_OP_SIZE 4
+#define DELTA_COPY_SIZE 8
+
+struct delta_index {
+	const delta_signature_t *signatures;
+	unsigned int count;
+	size_t block_size;
+	unsigned int *slots; // open addressing on the weak checksum, block index + 1, 0 is empty
+	unsigned int mask;
+};
+
+static unsigned int delta_weak_scalar(const unsigned char *buf, size_t size, unsigned int a, unsigned int b) {
+	for (size_t i = 0; i < size; i++) {
+		a += buf[i];
+		b += a;
+	}
+	return (a & 0xffff) | (b << 16);
+}
+
+#if defined(__x86_64__)
+static unsigned int delta_hsum(__m128i v) {
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+// 16 bytes a step: a grows by their sum, b by 16 times a before them plus their sum weighted 16 down to 1
+// only the low 16 bits of a and b are kept, so the 32 bit lanes are free to wrap
+__attribute__((target("ssse3")))
+static unsigned int delta_weak_ssse3(const unsigned char *buf, size_t size) {
+	const __m128i weights = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	__m128i prefix = zero; // a before each step, summed
+	__m128i weighted = zero;
+
+	size_t steps = size / 16;
+	for (size_t i = 0; i < steps; i++) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(buf + (16 * i)));
+		prefix = _mm_add_epi32(prefix, sum);
+		sum = _mm_add_epi32(sum, _mm_sad_epu8(bytes, zero));
+		weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_maddubs_epi16(bytes, weights), ones));
+	}
+
+	unsigned int a = delta_hsum(sum);
+	unsigned int b = (16 * delta_hsum(prefix)) + delta_hsum(weighted);
+	return delta_weak_scalar(buf + (16 * steps), size - (16 * steps), a, b);
+}
+#endif
+
+unsigned int delta_weak(const unsigned char *buf, size_t size) {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("ssse3")) {
+		return delta_weak_ssse3(buf, size);
+	}
+#endif
+	return delta_weak_scalar(buf, size, 0, 0);
+}
+
+void delta_sign(const unsigned char *buf, size_t size, size_t block_size, delta_signature_t *signatures) {
+	for (size_t i = 0; i < size / block_size; i++) {
+		signatures[i].weak = delta_weak(buf + (i * block_size), block_size);
+		blake2b(signatures[i].strong, DELTA_STRONG_SIZE, buf + (i * block_size), block_size);
+	}
+}
+
+static unsigned int delta_slot(unsigned int weak) {
+	return weak * 2654435761u;
+}
+
+delta_index_t* delta_index_create(const delta_signature_t *signatures, unsigned int count, size_t block_size) {
+	delta_index_t *index = malloc(sizeof(delta_index_t));
+	index->signatures = signatures;
+	index->count = count;
+	index->block_size = block_size;
+
+	unsigned int slot_count = 16;
+	while (slot_count < 2 * count) {
+		slot_count *= 2;
+	}
+	index->slots = calloc(slot_count, sizeof(unsigned int));
+	index->mask = slot_count - 1;
+
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int slot = delta_slot(signatures[i].weak) & index->mask;
+		while (index->slots[slot] != 0) {
+			const delta_signature_t *other = &signatures[index->slots[slot] - 1];
+			if (other->weak == signatures[i].weak && memcmp(other->strong, signatures[i].strong, DELTA_STRONG_SIZE) == 0) {
+				break; // the same block again (zeros, say), the first one does for both
+			}
+			slot = (slot + 1) & index->mask;
+		}
+		if (index->slots[slot] == 0) {
+			index->slots[slot] = i + 1;
+		}
+	}
+	return index;
+}
+
+void delta_index_delete(delta_index_t *index) {
+	if (index != NULL) {
+		free(index->slots);
+		free(index);
+	}
+}
+
+// the block that continues the last match is tried first, so unchanged stretches stay one run
+static long long delta_index_find(delta_index_t *index, unsigned int weak, const unsigned char *block, unsigned int hint) {
+	const delta_signature_t *signatures = index->signatures;
+	unsigned char strong[DELTA_STRONG_SIZE];
+	int have_strong = 0;
+
+	if (hint < index->count && signatures[hint].weak == weak) {
+		blake2b(strong, DELTA_STRONG_SIZE, block, index->block_size);
+		have_strong = 1;
+		if (memcmp(signatures[hint].strong, strong, DELTA_STRONG_SIZE) == 0) {
+			return hint;
+		}
+	}
+
+	for (unsigned int slot = delta_slot(weak) & index->mask; index->slots[slot] != 0; slot = (slot + 1) & index->mask) {
+		unsigned int i = index->slots[slot] - 1;
+		if (signatures[i].weak != weak) {
+			continue;
+		}
+		if (!have_strong) {
+			blake2b(strong, DELTA_STRONG_SIZE, block, index->block_size);
+			have_strong = 1;
+		}
+		if (memcmp(signatures[i].strong, strong, DELTA_STRONG_SIZE) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int delta_scan(delta_index_t *index, const unsigned char *src, size_t size, unsigned long long offset, delta_match_t **matches) {
+	size_t block_size = index->block_size;
+	delta_match_t *list = NULL;
+	int count = 0;
+	int capacity = 0;
+
+	*matches = NULL;
+	if (index->count == 0 || size < block_size) {
+		return 0;
+	}
+
+	size_t pos = 0;
+	unsigned int weak = delta_weak(src, block_size);
+	unsigned int a = weak & 0xffff;
+	unsigned int b = weak >> 16;
+	unsigned int hint = index->count;
+	while (1) {
+		long long block = delta_index_find(index, (a & 0xffff) | (b << 16), src + pos, hint);
+		if (block >= 0) {
+			unsigned long long base_offset = block * block_size;
+			delta_match_t *last = count > 0 ? &list[count - 1] : NULL;
+			if (last != NULL && last->offset + last->size == offset + pos && last->base_offset + last->size == base_offset) {
+				last->size += block_size;
+			} else {
+				if (count == capacity) {
+					capacity = capacity == 0 ? 64 : capacity * 2;
+					list = realloc(list, capacity * sizeof(delta_match_t));
+				}
+				list[count].offset = offset + pos;
+				list[count].base_offset = base_offset;
+				list[count].size = block_size;
+				count += 1;
+			}
+			hint = block + 1;
+
+			// a match skips its block, the checksum starts over after it
+			pos += block_size;
+			if (pos + block_size > size) {
+				break;
+			}
+			weak = delta_weak(src + pos, block_size);
+			a = weak & 0xffff;
+			b = weak >> 16;
+			continue;
+		}
+
+		if (pos + block_size >= size) {
+			break;
+		}
+		unsigned int out = src[pos];
+		unsigned int in = src[pos + block_size];
+		a += in - out;
+		b += a - (block_size * out);
+		pos += 1;
+	}
+
+	*matches = list;
+	return count;
+}
+
+static unsigned char* delta_put_op(unsigned char *op, unsigned char *end, const unsigned char *literals, int literal_size,
+	int copy_size, unsigned long long base_offset) {
+	int needed = DELTA_OP_SIZE + literal_size + (copy_size > 0 ? DELTA_COPY_SIZE : 0);
+	if (op + needed > end) {
+		return NULL;
+	}
+
+	unsigned short sizes[2] = { literal_size, copy_size };
+	memcpy(op, sizes, DELTA_OP_SIZE);
+	op += DELTA_OP_SIZE;
+	memcpy(op, literals, literal_size);
+	op += literal_size;
+	if (copy_size > 0) {
+		memcpy(op, &base_offset, DELTA_COPY_SIZE);
+		op += DELTA_COPY_SIZE;
+	}
+	return op;
+}
+
+int delta_encode(const delta_match_t *matches, int match_count, const unsigned char *chunk, int size, unsigned long long offset,
+	unsigned char *dst, int capacity) {
+	// first match that ends past the start of the chunk
+	int low = 0;
+	int high = match_count;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (matches[mid].offset + matches[mid].size <= offset) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	unsigned char *op = dst;
+	unsigned char *end = dst + capacity;
+	unsigned long long chunk_end = offset + size;
+	int literal_start = 0;
+	int copies = 0;
+	for (int i = low; i < match_count && matches[i].offset < chunk_end; i++) {
+		unsigned long long from = matches[i].offset > offset ? matches[i].offset : offset;
+		unsigned long long to = matches[i].offset + matches[i].size;
+		if (to > chunk_end) {
+			to = chunk_end;
+		}
+		if (to - from < DELTA_MIN_COPY) {
+			continue;
+		}
+
+		int literal_size = (from - offset) - literal_start;
+		op = delta_put_op(op, end, chunk + literal_start, literal_size, to - from, matches[i].base_offset + (from - matches[i].offset));
+		if (op == NULL) {
+			return 0;
+		}
+		literal_start = to - offset;
+		copies += 1;
+	}
+	if (copies == 0) {
+		return 0;
+	}
+
+	if (literal_start < size) {
+		op = delta_put_op(op, end, chunk + literal_start, size - literal_start, 0, 0);
+		if (op == NULL) {
+			return 0;
+		}
+	}
+	return op - dst;
+}
+
+int delta_decode(const unsigned char *src, int size, const unsigned char *base, unsigned long long base_size,
+	unsigned char *dst, int capacity) {
+	const unsigned char *ip = src;
+	const unsigned char *ip_end = src + size;
+	unsigned char *op = dst;
+	unsigned char *op_end = dst + capacity;
+
+	while (ip < ip_end) {
+		if (ip_end - ip < DELTA_OP_SIZE) {
+			return -1;
+		}
+		unsigned short sizes[2];
+		memcpy(sizes, ip, DELTA_OP_SIZE);
+		ip += DELTA_OP_SIZE;
+
+		int literal_size = sizes[0];
+		if (literal_size > ip_end - ip || literal_size > op_end - op) {
+			return -1;
+		}
+		memcpy(op, ip, literal_size);
+		ip += literal_size;
+		op += literal_size;
+
+		int copy_size = sizes[1];
+		if (copy_size == 0) {
+			continue;
+		}
+		if (ip_end - ip < DELTA_COPY_SIZE) {
+			return -1;
+		}
+		unsigned long long base_offset;
+		memcpy(&base_offset, ip, DELTA_COPY_SIZE);
+		ip += DELTA_COPY_SIZE;
+		if (base_offset > base_size || copy_size > base_size - base_offset || copy_size > op_end - op) {
+			return -1;
+		}
+		memcpy(op, base + base_offset, copy_size);
+		op += copy_size;
+	}
+	return op - dst;
+}
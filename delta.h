@@ -0,0 +1,49 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+
+// rsync style delta against a copy of the file the receiver already has
+// the receiver signs its copy in fixed blocks, the sender rolls the weak checksum over its file a byte at a time,
+// and a block whose weak and strong checksums both match goes as a reference into the receiver's copy
+#define DELTA_MIN_COPY 16 // a match overlapping a chunk by less than this goes as literals
+#define DELTA_STRONG_SIZE 16 // bytes of the strong hash, a false match is copied in without anything else noticing
+
+typedef struct delta_signature {
+	unsigned int weak; // delta_weak of the block
+	unsigned char strong[DELTA_STRONG_SIZE]; // blake2b of the block
+} delta_signature_t;
+
+// a run of the sender's file that's at base_offset in the receiver's copy
+typedef struct delta_match {
+	unsigned long long offset;
+	unsigned long long base_offset;
+	unsigned long long size;
+} delta_match_t;
+
+typedef struct delta_index delta_index_t;
+
+// rsync's checksum: a is the byte sum, b the sum of the running a's, both mod 2^16
+unsigned int delta_weak(const unsigned char *buf, size_t size);
+
+// signatures of the size / block_size whole blocks, a short last block isn't signed
+void delta_sign(const unsigned char *buf, size_t size, size_t block_size, delta_signature_t *signatures);
+
+// looks blocks up by weak checksum, the signatures must outlive it
+delta_index_t* delta_index_create(const delta_signature_t *signatures, unsigned int count, size_t block_size);
+
+void delta_index_delete(delta_index_t *index);
+
+// finds the receiver's blocks anywhere in src (at file offset offset), adjacent blocks merged into runs
+// returns the match count, *matches is malloc'd and sorted by offset
+int delta_scan(delta_index_t *index, const unsigned char *src, size_t size, unsigned long long offset, delta_match_t **matches);
+
+// encodes the chunk at offset as copies and literals, returns the encoded size or 0 if nothing is copied or it doesn't fit
+int delta_encode(const delta_match_t *matches, int match_count, const unsigned char *chunk, int size, unsigned long long offset,
+	unsigned char *dst, int capacity);
+
+// rebuilds a chunk from its encoding and the receiver's copy, returns the size or -1 if src is malformed
+int delta_decode(const unsigned char *src, int size, const unsigned char *base, unsigned long long base_size,
+	unsigned char *dst, int capacity);
+
+#endif /* DELTA_H */
@@ -0,0 +1,238 @@
+#include "fec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define GF_POLY 0x11d // x^8 + x^4 + x^3 + x^2 + 1, 2 generates the field
+
+static unsigned char gf_exp[512]; // doubled, so a sum of two logs needs no mod
+static unsigned char gf_log[256];
+
+// c * x split by nibble, what a byte shuffle can look up 32 lanes at a time
+static unsigned char gf_mul_lo[256][16];
+static unsigned char gf_mul_hi[256][16];
+
+static unsigned char fec_matrix[FEC_MAX_REPAIR][FEC_MAX_DATA];
+
+static void (*fec_mul_add_region)(unsigned char *dst, const unsigned char *src, unsigned char c, size_t size);
+
+static unsigned char gf_mul(unsigned char a, unsigned char b) {
+	if (a == 0 || b == 0) {
+		return 0;
+	}
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a) {
+	return gf_exp[255 - gf_log[a]];
+}
+
+static void fec_xor_region(unsigned char *dst, const unsigned char *src, size_t size) {
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		unsigned long long d;
+		unsigned long long s;
+		memcpy(&d, dst + i, 8);
+		memcpy(&s, src + i, 8);
+		d ^= s;
+		memcpy(dst + i, &d, 8);
+	}
+	for (; i < size; i++) {
+		dst[i] ^= src[i];
+	}
+}
+
+static void fec_mul_add_scalar(unsigned char *dst, const unsigned char *src, unsigned char c, size_t size) {
+	const unsigned char *lo = gf_mul_lo[c];
+	const unsigned char *hi = gf_mul_hi[c];
+	for (size_t i = 0; i < size; i++) {
+		dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void fec_mul_add_avx2(unsigned char *dst, const unsigned char *src, unsigned char c, size_t size) {
+	__m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gf_mul_lo[c]));
+	__m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gf_mul_hi[c]));
+	__m256i mask = _mm256_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i s_lo = _mm256_and_si256(s, mask);
+		__m256i s_hi = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+		__m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(lo, s_lo), _mm256_shuffle_epi8(hi, s_hi));
+
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, product));
+	}
+	fec_mul_add_scalar(dst + i, src + i, c, size - i);
+}
+#endif
+
+void fec_init(void) {
+	if (fec_mul_add_region != NULL) {
+		return;
+	}
+
+	unsigned int x = 1;
+	for (int i = 0; i < 255; i++) {
+		gf_exp[i] = x;
+		gf_exp[i + 255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100) {
+			x ^= GF_POLY;
+		}
+	}
+
+	for (int c = 0; c < 256; c++) {
+		for (int n = 0; n < 16; n++) {
+			gf_mul_lo[c][n] = gf_mul(c, n);
+			gf_mul_hi[c][n] = gf_mul(c, n << 4);
+		}
+	}
+
+	// cauchy matrix 1 / (x_j + y_i), every square submatrix is invertible
+	// scaling each column so row 0 is all ones keeps that, and makes repair 0 a plain xor
+	for (int j = 0; j < FEC_MAX_REPAIR; j++) {
+		for (int i = 0; i < FEC_MAX_DATA; i++) {
+			unsigned char cauchy = gf_inv((FEC_MAX_DATA + j) ^ i);
+			unsigned char scale = (FEC_MAX_DATA + 0) ^ i; // 1 / cauchy[0][i]
+			fec_matrix[j][i] = gf_mul(cauchy, scale);
+		}
+	}
+
+	fec_mul_add_region = fec_mul_add_scalar;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		fec_mul_add_region = fec_mul_add_avx2;
+	}
+#endif
+}
+
+unsigned char fec_coefficient(int repair_index, int data_index) {
+	return fec_matrix[repair_index][data_index];
+}
+
+void fec_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t size) {
+	if (c == 0) {
+		return;
+	}
+	if (c == 1) {
+		fec_xor_region(dst, src, size);
+		return;
+	}
+	fec_mul_add_region(dst, src, c, size);
+}
+
+void fec_encode(unsigned char *repair, int repair_index, unsigned char **data, int data_count, size_t size) {
+	for (int i = 0; i < data_count; i++) {
+		fec_mul_add(repair, data[i], fec_coefficient(repair_index, i), size);
+	}
+}
+
+// inverts the m x m matrix in place, gauss-jordan
+static int gf_invert(unsigned char *matrix, int m) {
+	unsigned char inverse[FEC_MAX_REPAIR * FEC_MAX_REPAIR];
+	memset(inverse, 0, sizeof(inverse));
+	for (int i = 0; i < m; i++) {
+		inverse[(i * m) + i] = 1;
+	}
+
+	for (int col = 0; col < m; col++) {
+		int pivot = col;
+		while (pivot < m && matrix[(pivot * m) + col] == 0) {
+			pivot++;
+		}
+		if (pivot == m) {
+			return -1;
+		}
+		if (pivot != col) {
+			for (int k = 0; k < m; k++) {
+				unsigned char t = matrix[(col * m) + k];
+				matrix[(col * m) + k] = matrix[(pivot * m) + k];
+				matrix[(pivot * m) + k] = t;
+				t = inverse[(col * m) + k];
+				inverse[(col * m) + k] = inverse[(pivot * m) + k];
+				inverse[(pivot * m) + k] = t;
+			}
+		}
+
+		unsigned char scale = gf_inv(matrix[(col * m) + col]);
+		for (int k = 0; k < m; k++) {
+			matrix[(col * m) + k] = gf_mul(matrix[(col * m) + k], scale);
+			inverse[(col * m) + k] = gf_mul(inverse[(col * m) + k], scale);
+		}
+
+		for (int row = 0; row < m; row++) {
+			unsigned char factor = matrix[(row * m) + col];
+			if (row == col || factor == 0) {
+				continue;
+			}
+			for (int k = 0; k < m; k++) {
+				matrix[(row * m) + k] ^= gf_mul(factor, matrix[(col * m) + k]);
+				inverse[(row * m) + k] ^= gf_mul(factor, inverse[(col * m) + k]);
+			}
+		}
+	}
+
+	memcpy(matrix, inverse, m * m);
+	return 0;
+}
+
+int fec_decode(unsigned char **data, const int *present, int data_count,
+	unsigned char **repairs, const int *repair_indexes, int repair_count, size_t size) {
+	int missing[FEC_MAX_REPAIR];
+	int missing_count = 0;
+	for (int i = 0; i < data_count; i++) {
+		if (present[i]) {
+			continue;
+		}
+		if (missing_count == repair_count || missing_count == FEC_MAX_REPAIR) {
+			return -1;
+		}
+		missing[missing_count++] = i;
+	}
+	if (missing_count == 0) {
+		return 0;
+	}
+
+	// each repair minus the chunks we have leaves a combination of the missing ones only
+	int m = missing_count;
+	unsigned char *syndromes = malloc(m * size);
+	unsigned char matrix[FEC_MAX_REPAIR * FEC_MAX_REPAIR];
+	for (int r = 0; r < m; r++) {
+		unsigned char *syndrome = syndromes + (r * size);
+		memcpy(syndrome, repairs[r], size);
+		for (int i = 0; i < data_count; i++) {
+			if (present[i]) {
+				fec_mul_add(syndrome, data[i], fec_coefficient(repair_indexes[r], i), size);
+			}
+		}
+		for (int s = 0; s < m; s++) {
+			matrix[(r * m) + s] = fec_coefficient(repair_indexes[r], missing[s]);
+		}
+	}
+
+	if (gf_invert(matrix, m) == -1) {
+		free(syndromes);
+		return -1;
+	}
+
+	for (int s = 0; s < m; s++) {
+		unsigned char *chunk = data[missing[s]];
+		memset(chunk, 0, size);
+		for (int r = 0; r < m; r++) {
+			fec_mul_add(chunk, syndromes + (r * size), matrix[(s * m) + r], size);
+		}
+	}
+
+	free(syndromes);
+	return 0;
+}
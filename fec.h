@@ -0,0 +1,27 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+
+// reed-solomon erasure code over GF(256): a block of up to FEC_MAX_DATA chunks gets up to FEC_MAX_REPAIR
+// repair chunks, any FEC_MAX_REPAIR missing chunks can be rebuilt from the rest. repair 0 is plain xor parity
+#define FEC_MAX_DATA 64
+#define FEC_MAX_REPAIR 16
+
+void fec_init(void);
+
+// coefficient of data chunk i in repair chunk j
+unsigned char fec_coefficient(int repair_index, int data_index);
+
+// dst ^= c * src, the inner loop of encoding and decoding
+void fec_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t size);
+
+// repair chunk repair_index of data[0..data_count), repair must be zeroed or hold earlier data to add to
+void fec_encode(unsigned char *repair, int repair_index, unsigned char **data, int data_count, size_t size);
+
+// rebuilds the missing data chunks (present[i] == 0) into data[i] from the repairs
+// returns -1 if more chunks are missing than there are repairs
+int fec_decode(unsigned char **data, const int *present, int data_count,
+	unsigned char **repairs, const int *repair_indexes, int repair_count, size_t size);
+
+#endif /* FEC_H */
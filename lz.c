@@ -0,0 +1,191 @@
+#include "lz.h"
+
+#include <math.h>
+#include <string.h>
+
+#define LZ_LAST_LITERALS 5 // a block ends in literals, so the decoder's last step is a plain copy
+#define LZ_MAX_OFFSET 65535
+
+static unsigned int lz_hash(const unsigned char *p) {
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// a length that doesn't fit its 4 bits of the token goes on in 255s and a remainder
+static unsigned char* lz_put_length(unsigned char *op, int length) {
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+// token, literals, then the match (if match_length > 0), returns NULL if it doesn't fit before end
+static unsigned char* lz_put_sequence(unsigned char *op, unsigned char *end,
+	const unsigned char *literals, int literal_count, int offset, int match_length) {
+	// worst case: token, literal length, literals, offset, match length
+	int needed = 1 + (literal_count / 255) + 1 + literal_count + 2 + (match_length / 255) + 1;
+	if (op + needed > end) {
+		return NULL;
+	}
+
+	unsigned char *token = op++;
+	*token = (literal_count < 15 ? literal_count : 15) << 4;
+	if (literal_count >= 15) {
+		op = lz_put_length(op, literal_count - 15);
+	}
+	memcpy(op, literals, literal_count);
+	op += literal_count;
+
+	if (match_length == 0) {
+		return op;
+	}
+
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	int length = match_length - LZ_MIN_MATCH;
+	*token |= length < 15 ? length : 15;
+	if (length >= 15) {
+		op = lz_put_length(op, length - 15);
+	}
+	return op;
+}
+
+// greedy: the first match a hash lookup finds is taken and extended as far as it goes
+int lz_compress(const unsigned char *src, int size, unsigned char *dst, int capacity) {
+	int table[1 << LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	unsigned char *op = dst;
+	unsigned char *end = dst + capacity;
+	int match_limit = size - LZ_LAST_LITERALS;
+	int anchor = 0;
+	int ip = 0;
+
+	while (ip + LZ_MIN_MATCH <= match_limit) {
+		unsigned int h = lz_hash(src + ip);
+		int candidate = table[h];
+		table[h] = ip;
+
+		// stale or colliding entries are caught by comparing the bytes
+		if (candidate >= ip || ip - candidate > LZ_MAX_OFFSET || memcmp(src + candidate, src + ip, LZ_MIN_MATCH) != 0) {
+			ip += 1;
+			continue;
+		}
+
+		int length = LZ_MIN_MATCH;
+		while (ip + length < match_limit && src[candidate + length] == src[ip + length]) {
+			length += 1;
+		}
+
+		op = lz_put_sequence(op, end, src + anchor, ip - anchor, ip - candidate, length);
+		if (op == NULL) {
+			return 0;
+		}
+		ip += length;
+		anchor = ip;
+	}
+
+	op = lz_put_sequence(op, end, src + anchor, size - anchor, 0, 0);
+	if (op == NULL) {
+		return 0;
+	}
+	return op - dst;
+}
+
+// reads a length continued past its token bits, returns -1 if it runs off the end of src
+static int lz_get_length(const unsigned char **ip, const unsigned char *end) {
+	int length = 0;
+	unsigned char b;
+	do {
+		if (*ip >= end) {
+			return -1;
+		}
+		b = *(*ip)++;
+		length += b;
+	} while (b == 255);
+	return length;
+}
+
+int lz_decompress(const unsigned char *src, int size, unsigned char *dst, int capacity) {
+	const unsigned char *ip = src;
+	const unsigned char *ip_end = src + size;
+	unsigned char *op = dst;
+	unsigned char *op_end = dst + capacity;
+
+	while (ip < ip_end) {
+		unsigned char token = *ip++;
+
+		int literal_count = token >> 4;
+		if (literal_count == 15) {
+			int more = lz_get_length(&ip, ip_end);
+			if (more == -1) {
+				return -1;
+			}
+			literal_count += more;
+		}
+		if (literal_count > ip_end - ip || literal_count > op_end - op) {
+			return -1;
+		}
+		memcpy(op, ip, literal_count);
+		ip += literal_count;
+		op += literal_count;
+
+		if (ip == ip_end) {
+			break; // the last sequence is literals only
+		}
+
+		if (ip_end - ip < 2) {
+			return -1;
+		}
+		int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - dst) {
+			return -1;
+		}
+
+		int length = token & 15;
+		if (length == 15) {
+			int more = lz_get_length(&ip, ip_end);
+			if (more == -1) {
+				return -1;
+			}
+			length += more;
+		}
+		length += LZ_MIN_MATCH;
+		if (length > op_end - op) {
+			return -1;
+		}
+
+		// byte by byte, a match may overlap the bytes it produces (runs)
+		const unsigned char *match = op - offset;
+		for (int i = 0; i < length; i++) {
+			op[i] = match[i];
+		}
+		op += length;
+	}
+	return op - dst;
+}
+
+double lz_entropy(const unsigned char *src, int size) {
+	if (size <= 0) {
+		return 0;
+	}
+
+	int counts[256];
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < size; i++) {
+		counts[src[i]] += 1;
+	}
+
+	double entropy = 0;
+	for (int i = 0; i < 256; i++) {
+		if (counts[i] > 0) {
+			double p = (double)counts[i] / size;
+			entropy -= p * log2(p);
+		}
+	}
+	return entropy;
+}
@@ -0,0 +1,18 @@
+#ifndef LZ_H
+#define LZ_H
+
+// small lz77 codec in the lz4 block layout, meant for a single packet's worth of data
+// every chunk is compressed on its own, so any packet can be decoded no matter what was lost
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+// compresses src into at most capacity bytes, returns the compressed size or 0 if it doesn't fit
+int lz_compress(const unsigned char *src, int size, unsigned char *dst, int capacity);
+
+// returns the decompressed size, or -1 if src is malformed or doesn't fit into capacity bytes
+int lz_decompress(const unsigned char *src, int size, unsigned char *dst, int capacity);
+
+// shannon entropy of the bytes, in bits per byte (0 to 8)
+double lz_entropy(const unsigned char *src, int size);
+
+#endif /* LZ_H */
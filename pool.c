@@ -0,0 +1,65 @@
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void* pool_alloc(pool_t *pool) {
+	void *buffer = NULL;
+	if (posix_memalign(&buffer, pool->alignment, pool->buffer_size) != 0) {
+		return NULL;
+	}
+	pool->buffer_count += 1;
+	return buffer;
+}
+
+pool_t* pool_create(size_t buffer_size, size_t alignment, int preallocate, int max_buffers) {
+	pool_t *pool = malloc(sizeof(pool_t));
+	pool->buffer_size = buffer_size;
+	pool->alignment = alignment;
+	pool->free_buffers = malloc(max_buffers * sizeof(void*));
+	pool->free_count = 0;
+	pool->buffer_count = 0;
+	pool->max_buffers = max_buffers;
+
+	if (preallocate > max_buffers) {
+		preallocate = max_buffers;
+	}
+	for (int i = 0; i < preallocate; i++) {
+		void *buffer = pool_alloc(pool);
+		if (buffer == NULL) {
+			perror("pool_create");
+			break;
+		}
+		pool->free_buffers[pool->free_count++] = buffer;
+	}
+	return pool;
+}
+
+// a free buffer, or a new one until max_buffers are out, NULL after that
+void* pool_get(pool_t *pool) {
+	if (pool->free_count > 0) {
+		pool->free_count -= 1;
+		return pool->free_buffers[pool->free_count];
+	}
+	if (pool->buffer_count == pool->max_buffers) {
+		return NULL;
+	}
+	return pool_alloc(pool);
+}
+
+void pool_put(pool_t *pool, void *buffer) {
+	if (buffer != NULL) {
+		pool->free_buffers[pool->free_count++] = buffer;
+	}
+}
+
+// buffers still handed out are the caller's to free
+void pool_delete(pool_t *pool) {
+	if (pool != NULL) {
+		for (int i = 0; i < pool->free_count; i++) {
+			free(pool->free_buffers[i]);
+		}
+		free(pool->free_buffers);
+		free(pool);
+	}
+}
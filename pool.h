@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// fixed size aligned buffers, handed back out instead of freed so a long running receiver doesn't churn the allocator
+typedef struct pool {
+	size_t buffer_size;
+	size_t alignment;
+
+	void **free_buffers;
+	int free_count;
+	int buffer_count; // handed out + free
+	int max_buffers;
+} pool_t;
+
+pool_t* pool_create(size_t buffer_size, size_t alignment, int preallocate, int max_buffers);
+
+void* pool_get(pool_t *pool);
+
+void pool_put(pool_t *pool, void *buffer);
+
+void pool_delete(pool_t *pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+// sits between reliable_sender and reliable_receiver and makes the path look like a real network
+// each direction gets its own delay, loss, reordering, duplication and bottleneck, acks included
+
+#define MAX_DATAGRAM_SIZE 65536 // gso batches arrive as one datagram
+#define MAX_CLIENTS 64 // sender sockets, one per stream
+#define SOCKET_BUFFER_SIZE (8 << 20)
+
+#define TO_RECVR 0
+#define TO_SENDER 1
+
+typedef unsigned long long int ull64_t;
+
+/*** Settings ***/
+
+typedef struct impairment {
+	ull64_t delay_ns; // one way
+	ull64_t jitter_ns; // uniform on top of the delay, packets keep their order
+	double loss; // average share of packets lost
+	double burst; // mean lost run length, above 1 losses come in gilbert-elliott bursts
+	double reorder; // share of packets held back by reorder_ns
+	ull64_t reorder_ns;
+	double duplicate; // share of packets sent twice
+	double rate_bps; // bottleneck, 0 for none
+	ull64_t queue_bytes; // bottleneck buffer, tail drop past it
+} impairment_t;
+
+/*** Packets ***/
+
+typedef struct packet {
+	ull64_t release_ns; // CLOCK_MONOTONIC time it goes out
+	ull64_t order; // arrival order, breaks ties so equal release times stay in order
+	int fd; // socket it goes out on
+	struct sockaddr_in to;
+	size_t size;
+	char data[];
+} packet_t;
+
+// min heap on release time
+typedef struct packet_queue {
+	packet_t **packets;
+	int count;
+	int capacity;
+} packet_queue_t;
+
+int packet_before(packet_t *a, packet_t *b) {
+	if (a->release_ns != b->release_ns) {
+		return a->release_ns < b->release_ns;
+	}
+	return a->order < b->order;
+}
+
+void packet_queue_push(packet_queue_t *queue, packet_t *packet) {
+	if (queue->count == queue->capacity) {
+		queue->capacity = queue->capacity == 0 ? 1024 : queue->capacity * 2;
+		queue->packets = realloc(queue->packets, queue->capacity * sizeof(packet_t*));
+	}
+
+	int i = queue->count;
+	queue->count += 1;
+	while (i > 0 && packet_before(packet, queue->packets[(i - 1) / 2])) {
+		queue->packets[i] = queue->packets[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	queue->packets[i] = packet;
+}
+
+packet_t* packet_queue_pop(packet_queue_t *queue) {
+	packet_t *top = queue->packets[0];
+	packet_t *last = queue->packets[queue->count - 1];
+	queue->count -= 1;
+
+	int i = 0;
+	while (1) {
+		int child = (2 * i) + 1;
+		if (child >= queue->count) {
+			break;
+		}
+		if (child + 1 < queue->count && packet_before(queue->packets[child + 1], queue->packets[child])) {
+			child += 1;
+		}
+		if (!packet_before(queue->packets[child], last)) {
+			break;
+		}
+		queue->packets[i] = queue->packets[child];
+		i = child;
+	}
+	if (queue->count > 0) {
+		queue->packets[i] = last;
+	}
+	return top;
+}
+
+/*** Relay ***/
+
+// one direction of the path
+typedef struct link {
+	int bad; // gilbert-elliott state, every packet is lost while bad
+	ull64_t free_ns; // when the bottleneck has sent what is queued
+	ull64_t last_ns; // release of the last in order packet, jitter doesn't reorder
+	ull64_t forwarded;
+	ull64_t lost;
+	ull64_t dropped; // bottleneck queue full
+	ull64_t duplicated;
+	ull64_t reordered;
+	ull64_t bytes;
+} link_t;
+
+// a sender socket, with its own socket towards the recvr so the recvr still sees one peer per stream
+typedef struct client {
+	struct sockaddr_in addr;
+	int fd;
+} client_t;
+
+typedef struct relay {
+	int fd; // senders send here
+	struct sockaddr_in target; // the recvr
+	client_t clients[MAX_CLIENTS];
+	int client_count;
+
+	impairment_t impairment;
+	link_t links[2];
+	packet_queue_t queue;
+	ull64_t order;
+	ull64_t random_state;
+
+	int epoll_fd;
+	int timer_fd;
+	char *buffer;
+} relay_t;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int sig) {
+	stop_requested = 1;
+}
+
+ull64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// xorshift64*, uniform in [0, 1)
+double relay_random(relay_t *relay) {
+	ull64_t x = relay->random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	relay->random_state = x;
+	return ((x * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int relay_socket(int port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		perror("relay_socket");
+		exit(1);
+	}
+
+	int size = SOCKET_BUFFER_SIZE;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		perror("relay_socket: bind");
+		exit(1);
+	}
+	return fd;
+}
+
+void relay_watch(relay_t *relay, int fd) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(relay->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		perror("relay_watch");
+		exit(1);
+	}
+}
+
+relay_t* relay_create(int port, struct sockaddr_in target, impairment_t impairment, ull64_t seed) {
+	relay_t *relay = malloc(sizeof(relay_t));
+	memset(relay, 0, sizeof(relay_t));
+	relay->fd = relay_socket(port);
+	relay->target = target;
+	relay->impairment = impairment;
+	relay->random_state = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+	relay->buffer = malloc(MAX_DATAGRAM_SIZE);
+
+	relay->epoll_fd = epoll_create1(0);
+	relay->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (relay->epoll_fd == -1 || relay->timer_fd == -1) {
+		perror("relay_create: event loop");
+		exit(1);
+	}
+	relay_watch(relay, relay->fd);
+	relay_watch(relay, relay->timer_fd);
+	return relay;
+}
+
+// the client socket for a sender address, opened on its first packet
+client_t* relay_client(relay_t *relay, struct sockaddr_in *addr) {
+	for (int i = 0; i < relay->client_count; i++) {
+		client_t *client = &relay->clients[i];
+		if (client->addr.sin_addr.s_addr == addr->sin_addr.s_addr && client->addr.sin_port == addr->sin_port) {
+			return client;
+		}
+	}
+	if (relay->client_count == MAX_CLIENTS) {
+		return NULL;
+	}
+
+	client_t *client = &relay->clients[relay->client_count];
+	client->addr = *addr;
+	client->fd = relay_socket(0);
+	relay_watch(relay, client->fd);
+	relay->client_count += 1;
+	return client;
+}
+
+// gilbert-elliott: a good state that loses nothing, a bad one that loses everything
+// leaving bad with probability 1/burst gives runs of burst packets on average, the entry rate sets the average loss
+int relay_lost(relay_t *relay, link_t *link) {
+	impairment_t *impairment = &relay->impairment;
+	if (impairment->loss <= 0) {
+		return 0;
+	}
+	if (impairment->burst <= 1) {
+		return relay_random(relay) < impairment->loss;
+	}
+
+	if (link->bad) {
+		if (relay_random(relay) < 1 / impairment->burst) {
+			link->bad = 0;
+		}
+	} else if (relay_random(relay) < impairment->loss / (impairment->burst * (1 - impairment->loss))) {
+		link->bad = 1;
+	}
+	return link->bad;
+}
+
+// decides what happens to a packet, and when
+void relay_forward(relay_t *relay, int direction, int fd, struct sockaddr_in *to, size_t size) {
+	impairment_t *impairment = &relay->impairment;
+	link_t *link = &relay->links[direction];
+
+	if (relay_lost(relay, link)) {
+		link->lost += 1;
+		return;
+	}
+
+	int copies = 1;
+	if (impairment->duplicate > 0 && relay_random(relay) < impairment->duplicate) {
+		copies = 2;
+		link->duplicated += 1;
+	}
+
+	ull64_t now_ns = monotonic_ns();
+	for (int i = 0; i < copies; i++) {
+		// the bottleneck sends in arrival order, a packet leaves it once the ones ahead of it have
+		ull64_t sent_ns = now_ns;
+		if (impairment->rate_bps > 0) {
+			ull64_t start_ns = link->free_ns > now_ns ? link->free_ns : now_ns;
+			ull64_t queued_bytes = ((start_ns - now_ns) * impairment->rate_bps) / 8e9;
+			if (queued_bytes > impairment->queue_bytes) {
+				link->dropped += 1;
+				continue;
+			}
+			link->free_ns = start_ns + (ull64_t)((size * 8e9) / impairment->rate_bps);
+			sent_ns = link->free_ns;
+		}
+
+		ull64_t release_ns = sent_ns + impairment->delay_ns;
+		if (impairment->jitter_ns > 0) {
+			release_ns += relay_random(relay) * impairment->jitter_ns;
+		}
+		if (release_ns < link->last_ns) {
+			release_ns = link->last_ns;
+		}
+		link->last_ns = release_ns;
+		if (impairment->reorder > 0 && relay_random(relay) < impairment->reorder) {
+			release_ns += impairment->reorder_ns;
+			link->reordered += 1;
+		}
+
+		packet_t *packet = malloc(sizeof(packet_t) + size);
+		packet->release_ns = release_ns;
+		packet->order = relay->order;
+		packet->fd = fd;
+		packet->to = *to;
+		packet->size = size;
+		memcpy(packet->data, relay->buffer, size);
+		relay->order += 1;
+		packet_queue_push(&relay->queue, packet);
+
+		link->forwarded += 1;
+		link->bytes += size;
+	}
+}
+
+// drains a socket, senders' packets head for the recvr and the recvr's for whichever sender it answers
+void relay_receive(relay_t *relay, int fd) {
+	client_t *from_client = NULL;
+	for (int i = 0; i < relay->client_count; i++) {
+		if (relay->clients[i].fd == fd) {
+			from_client = &relay->clients[i];
+		}
+	}
+
+	while (1) {
+		struct sockaddr_in addr;
+		socklen_t addr_size = sizeof(addr);
+		ssize_t size = recvfrom(fd, relay->buffer, MAX_DATAGRAM_SIZE, MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_size);
+		if (size < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+				perror("relay_receive: recvfrom");
+			}
+			return;
+		}
+
+		if (from_client != NULL) {
+			relay_forward(relay, TO_SENDER, relay->fd, &from_client->addr, size);
+			continue;
+		}
+		client_t *client = relay_client(relay, &addr);
+		if (client != NULL) {
+			relay_forward(relay, TO_RECVR, client->fd, &relay->target, size);
+		}
+	}
+}
+
+// sends whatever is due, and sets the timer for the next one
+void relay_release(relay_t *relay) {
+	packet_queue_t *queue = &relay->queue;
+	ull64_t now_ns = monotonic_ns();
+	while (queue->count > 0 && queue->packets[0]->release_ns <= now_ns) {
+		packet_t *packet = packet_queue_pop(queue);
+		sendto(packet->fd, packet->data, packet->size, 0, (struct sockaddr *)&packet->to, sizeof(packet->to));
+		free(packet);
+	}
+
+	struct itimerspec timer;
+	memset(&timer, 0, sizeof(timer));
+	if (queue->count > 0) {
+		ull64_t release_ns = queue->packets[0]->release_ns;
+		timer.it_value.tv_sec = release_ns / 1000000000ULL;
+		timer.it_value.tv_nsec = release_ns % 1000000000ULL;
+	}
+	timerfd_settime(relay->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+void relay_run(relay_t *relay) {
+	while (!stop_requested) {
+		struct epoll_event events[MAX_CLIENTS + 2];
+		int event_count = epoll_wait(relay->epoll_fd, events, MAX_CLIENTS + 2, -1);
+		if (event_count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("relay_run: epoll_wait");
+			exit(1);
+		}
+
+		for (int i = 0; i < event_count; i++) {
+			int fd = events[i].data.fd;
+			if (fd == relay->timer_fd) {
+				ull64_t expirations;
+				read(fd, &expirations, sizeof(expirations));
+			} else {
+				relay_receive(relay, fd);
+			}
+		}
+		relay_release(relay);
+	}
+}
+
+void relay_print_stats(relay_t *relay) {
+	const char *names[2] = { "to recvr", "to sender" };
+	for (int i = 0; i < 2; i++) {
+		link_t *link = &relay->links[i];
+		fprintf(stderr, "%s: %llu packets (%llu bytes) forwarded, %llu lost, %llu dropped at the bottleneck, %llu duplicated, %llu reordered\n",
+			names[i], link->forwarded, link->bytes, link->lost, link->dropped, link->duplicated, link->reordered);
+	}
+}
+
+void relay_delete(relay_t *relay) {
+	while (relay->queue.count > 0) {
+		free(packet_queue_pop(&relay->queue));
+	}
+	free(relay->queue.packets);
+	for (int i = 0; i < relay->client_count; i++) {
+		close(relay->clients[i].fd);
+	}
+	close(relay->timer_fd);
+	close(relay->epoll_fd);
+	close(relay->fd);
+	free(relay->buffer);
+	free(relay);
+}
+
+/*** Main ***/
+
+int main(int argc, char** argv) {
+	impairment_t impairment;
+	memset(&impairment, 0, sizeof(impairment));
+	impairment.reorder_ns = 1000000;
+	impairment.queue_bytes = 1 << 20;
+	ull64_t seed = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:j:l:b:r:R:u:w:q:s:")) != -1) {
+		switch (opt) {
+			case 'd':
+				impairment.delay_ns = atof(optarg) * 1e6; // ms, one way
+				break;
+			case 'j':
+				impairment.jitter_ns = atof(optarg) * 1e6; // ms
+				break;
+			case 'l':
+				impairment.loss = atof(optarg) / 100; // percent
+				break;
+			case 'b':
+				impairment.burst = atof(optarg); // mean packets per loss burst
+				break;
+			case 'r':
+				impairment.reorder = atof(optarg) / 100; // percent
+				break;
+			case 'R':
+				impairment.reorder_ns = atof(optarg) * 1e6; // ms a reordered packet is held back
+				break;
+			case 'u':
+				impairment.duplicate = atof(optarg) / 100; // percent
+				break;
+			case 'w':
+				impairment.rate_bps = atof(optarg) * 1e6; // Mbit/s
+				break;
+			case 'q':
+				impairment.queue_bytes = atof(optarg) * 1024; // KB
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 10); // same seed, same losses
+				break;
+			default:
+				argc = -1; // print usage
+		}
+	}
+	if (impairment.loss >= 1) {
+		argc = -1;
+	}
+
+	if (argc - optind != 3) {
+		fprintf(stderr, "usage: %s [-d delay_ms] [-j jitter_ms] [-l loss_%%] [-b burst_packets] [-r reorder_%%] [-R reorder_ms] [-u duplicate_%%] [-w rate_mbit] [-q queue_kb] [-s seed] listen_port receiver_hostname receiver_port\n\n", argv[0]);
+		exit(1);
+	}
+	argv += optind - 1;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo *result;
+	if (getaddrinfo(argv[2], argv[3], &hints, &result) != 0) {
+		fprintf(stderr, "main: can't resolve %s\n", argv[2]);
+		exit(1);
+	}
+	struct sockaddr_in target = *(struct sockaddr_in *)result->ai_addr;
+	freeaddrinfo(result);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = request_stop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	relay_t *relay = relay_create(atoi(argv[1]), target, impairment, seed);
+	relay_run(relay);
+	relay_print_stats(relay);
+	relay_delete(relay);
+	return 0;
+}
@@ -1,175 +1,836 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "udp.h"
+#include "sack.h"
+#include "pool.h"
+#include "fec.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "blake2b.h"
+#include "delta.h"
+#include "stats.h"
+#include "trace.h"
+#include "tree.h"
 
-#define MAX_PACKET_SIZE 1472 // max size for payload MTU - udp header
-#define MAX_WINDOW_SIZE 64 // 64 frames (1/2 max seq), go back n - sliding window
+#define BASE_PACKET_SIZE 1472 // 1500 byte mtu - ip and udp headers, every path carries it, acks never exceed it
+#define MAX_PACKET_SIZE 8972 // 9000 byte jumbo frames - ip and udp headers
+#define MAX_WINDOW_SIZE 32768 // frames, selective repeat - sliding window
 #define MAX_TIMEOUT 10 // seconds for client losing connection
+#define POLL_TIMEOUT 100 * 1000 // microsecs, how often a thread checks whether the other streams are done
+#define EOF_LINGER 1000 // ms a thread stays after answering an eof, the answer may be lost and the eof come again
+#define ACK_DELAY 4 * 1000 // microsecs an ack may be held back, about what SO_RCVTIMEO can wait
+#define MAX_ACK_EVERY 64 // packets one ack may cover, whatever the sender asks for
+#define MAX_STREAMS 256 // stream ids are one byte
+#define BATCH_SIZE 64 // packets per recvmmsg/sendmmsg
+#define MAX_CONNECTIONS 256 // daemon: streams a thread keeps state for at once
+#define RING_PREALLOC 4 // daemon: write rings each thread allocates up front
+#define OUTPUT_BUCKETS 1024 // daemon: hash buckets for the transfers in progress
+#define DIGEST_SIZE 16 // blake2b, of each chunk and of a stream's chunk digests in file order
 
-#define EOF_SEQ_NUM -5 // random negative value
-#define TIMED_OUT 1
+#define PACKET_EOF 0x1 // sender header flag, last packet of the transfer, the stream's digest follows
+#define PACKET_FEC 0x2 // repair packet for the block starting at seq_num
+#define PACKET_RETRANSMIT 0x4 // not the first time this seq num is sent
+#define PACKET_COMPRESSED 0x8 // payload is the chunk run through lz_compress
+#define PACKET_RESUME 0x20 // asks where the checkpoint has the stream, offset is the segment start
+#define PACKET_SIGNATURES 0x40 // asks for a page of block signatures of the old copy, the payload is the first block
+#define PACKET_DELTA 0x80 // payload is the chunk as copies out of the old copy and literals
+#define PACKET_PROBE 0x100 // path mtu probe, padded to offset bytes, answered with the size that arrived
+#define PACKET_KEEPALIVE 0x200 // the sender's source is idle, nothing to do but not time out
+#define PACKET_SYN 0x400 // opens a stream: seq_num is its first, offset its segment start, a syn_t follows
+#define PACKET_MANIFEST 0x800 // a page of a directory's manifest, offset is where it goes in it
+
+#define ACK_RESUME 0x1 // ack flag, answers PACKET_RESUME: the stream picks up at next_seq_num
+#define ACK_SIGNATURES 0x2 // ack flag, answers PACKET_SIGNATURES: a signature_page_t and its signatures follow
+#define ACK_PROBE 0x4 // ack flag, answers PACKET_PROBE: the probe's size follows as an unsigned int
+#define ACK_SYN 0x8 // ack flag, answers PACKET_SYN: a syn_t with what this recvr takes follows
+#define ACK_MANIFEST 0x10 // ack flag, answers PACKET_MANIFEST: next_seq_num is the page's index
+#define ACK_EOF 0x20 // ack flag, answers PACKET_EOF: the stream matched the sender's digest, unless ACK_CORRUPT is set too
+#define ACK_CORRUPT 0x40 // with ACK_EOF, the stream didn't match
+
+#define SYN_FEC 0x1 // syn features, the sender's asks, the answer keeps what the recvr goes along with
+#define SYN_COMPRESS 0x2
+#define SYN_DELTA 0x4 // dropped when there's no old copy to send deltas against
+#define SYN_RESUME 0x8 // dropped when there's no checkpoint to resume from
+#define SYN_STREAM 0x10 // the sender's source is a stream, its size is known at its end
+#define SYN_TREE 0x20 // the sender's source is a directory, dropped unless a directory is being written
+
+#define MAX_MANIFEST_SIZE (256 << 20) // bytes, a syn asking for more is taken to be bogus
+
+#define CHECKPOINT_INTERVAL 2 // secs between checkpoints of a stream that made progress
+#define CHECKPOINT_MAGIC 0x54504b43 // "CKPT"
+
+#define FEC_SLOTS 16 // blocks a stream holds repairs for at once
+#define LOSS_INTERVAL 256 // seq nums per loss rate sample
+#define TIMED_OUT -1
 #define TRANSFER_COMPLETE 2
 #define TRANSFER_IN_PROGRESS 3
 
 /*** Sequence Utility Functions ***/
-typedef short seq_t;
-#define MAX_SEQ 256
+typedef unsigned int seq_t; // 32 bits, wraps around on its own
 typedef unsigned long long int ull64_t;
 
 seq_t safe_increment(seq_t current) {
-	current = (current + 1) % MAX_SEQ;
-	return current;
+	return current + 1;
 }
 
 seq_t safe_subtract(seq_t a, seq_t b) {
-	seq_t diff = (a - b) % MAX_SEQ;
-
-	if (diff < 0) {
-		diff += MAX_SEQ;
-	}
-
-	return diff;
+	return a - b;
 }
 
-seq_t safe_add(int current, int amount) {
-	current = (current + amount) % MAX_SEQ;
-	return current;
+seq_t safe_add(seq_t current, seq_t amount) {
+	return current + amount;
 }
 
-int has_wrapped(seq_t next, seq_t curr) {
-	return (next - curr) < 0;
+// serial number comparison, a comes before b (less than half the seq space behind)
+int seq_before(seq_t a, seq_t b) {
+	return (int)(a - b) < 0;
 }
 
 /*** Packet Header ***/
 typedef struct sender_packet_header {
 	seq_t seq_num;
+	unsigned short flags;
+	unsigned char stream_id;
+	unsigned char stream_count; // streams the file is split into
+	unsigned int conn_id; // random per transfer, tells concurrent senders apart
+	unsigned char fec_count; // repair packets: data chunks in the block
+	unsigned char fec_index; // repair packets: which repair of the block
+	unsigned short chunk_size; // payload of a full chunk, the same for the whole transfer
+	unsigned int checksum; // crc32c of the payload, then the header with this field 0
 	struct timeval timestamp;
+	ull64_t offset; // file offset of the data
+	unsigned short ack_every; // data packets: how many one ack may cover, 1 acks this one at once
 } sender_packet_header_t;
 
 typedef struct recvr_packet_header {
 	seq_t next_seq_num;
+	unsigned short sack_words; // window bitmap words after the header, bit i is next_seq_num + i
+	unsigned char stream_id; // stream being acked
+	unsigned char loss_rate; // 0 until there is an estimate, then 1 + originals lost in 1/256ths
+	unsigned int checksum; // crc32c of the sack words, then the header with this field 0
+	unsigned char flags;
+	unsigned short ack_delay; // us between the echoed packet arriving and the ack going out
 	struct timeval timestamp;
-	ull64_t window;
 } recvr_packet_header_t;
 
-const ull64_t max_file_chunk_size = MAX_PACKET_SIZE - sizeof(sender_packet_header_t);
+// the sender picks the chunk size from the path mtu, every stream carries its own
+#define BASE_CHUNK_SIZE (BASE_PACKET_SIZE - sizeof(sender_packet_header_t))
+#define MAX_CHUNK_SIZE (MAX_PACKET_SIZE - sizeof(sender_packet_header_t))
+
+// after the header of a PACKET_SYN and of the ACK_SYN answering it
+typedef struct syn {
+	ull64_t transfer_size; // of the whole transfer, 0 while it isn't known
+	unsigned int max_window; // chunks, the least of the two sides' goes
+	unsigned int features; // SYN_*
+	ull64_t manifest_size; // SYN_TREE: bytes of manifest to expect, 0 otherwise
+	ull64_t source_id; // the sender's file, as of its size and modification, 0 if it isn't a regular file
+} syn_t;
+
+// after the header of an ACK_SIGNATURES ack, then count signatures, the old copy is signed in chunk sized blocks
+typedef struct signature_page {
+	ull64_t base_size; // of the old copy
+	unsigned int block_count; // signed blocks in all
+	unsigned int first_block;
+	unsigned int count;
+} signature_page_t;
+
+#define SIGNATURES_PER_PAGE ((BASE_PACKET_SIZE - sizeof(recvr_packet_header_t) - sizeof(signature_page_t)) / sizeof(delta_signature_t))
+
+// as much of the window as fits in one ack, the rest reads as not received yet
+#define MAX_SACK_WORDS ((BASE_PACKET_SIZE - sizeof(recvr_packet_header_t)) / sizeof(ull64_t))
+
+// checks a packet's checksum, returns -1 if it was corrupted on the way
+int sender_packet_verify(const char *msg, ssize_t size) {
+	if (size < (ssize_t)sizeof(sender_packet_header_t)) {
+		return -1;
+	}
+
+	sender_packet_header_t header;
+	memcpy(&header, msg, sizeof(sender_packet_header_t));
+	unsigned int checksum = header.checksum;
+	header.checksum = 0;
+
+	unsigned int payload_crc = crc32c(0, msg + sizeof(sender_packet_header_t), size - sizeof(sender_packet_header_t));
+	if (crc32c(payload_crc, &header, sizeof(sender_packet_header_t)) != checksum) {
+		return -1;
+	}
+	return 0;
+}
+
+// the syn_t after a PACKET_SYN's header, returns 0 if the packet doesn't carry one
+int syn_load(const char *msg, ssize_t size, syn_t *syn) {
+	if (size != (ssize_t)(sizeof(sender_packet_header_t) + sizeof(syn_t))) {
+		return 0;
+	}
+	memcpy(syn, msg + sizeof(sender_packet_header_t), sizeof(syn_t));
+	return 1;
+}
+
+/*** Stats ***/
+
+// a receive thread's, written only by it, -j and SIGUSR1 dump them along with the other threads'
+typedef struct recvr_stats {
+	ull64_t packets; // passed their checksum
+	ull64_t corrupt_packets; // failed their checksum, dropped
+	ull64_t duplicates; // chunks already buffered
+	ull64_t out_of_window; // too far ahead of the window, dropped
+	ull64_t repairs; // fec repair packets
+	ull64_t rebuilt; // chunks fec rebuilt
+	ull64_t acks; // sent
+	ull64_t timer_acks; // held acks the ack timer sent, no packet came to trigger them
+	ull64_t probes; // path mtu probes answered
+	ull64_t bytes_written; // chunk bytes the writers took
+	ull64_t streams_started;
+	ull64_t streams_completed;
+	ull64_t streams_corrupt; // the digest didn't match
+	stats_histogram_t batch_histogram; // packets per receive
+	stats_histogram_t ack_histogram; // data packets per ack
+	stats_histogram_t ahead_histogram; // seq nums a chunk arrived ahead of the next one in order
+	stats_histogram_t flush_histogram; // bytes per flush from a write ring
+	stats_histogram_t flush_time_histogram; // us per flush that blocked
+} recvr_stats_t;
+
+ull64_t monotonic_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+void recvr_stats_add(recvr_stats_t *stats, const recvr_stats_t *other) {
+	stats->packets += other->packets;
+	stats->corrupt_packets += other->corrupt_packets;
+	stats->duplicates += other->duplicates;
+	stats->out_of_window += other->out_of_window;
+	stats->repairs += other->repairs;
+	stats->rebuilt += other->rebuilt;
+	stats->acks += other->acks;
+	stats->timer_acks += other->timer_acks;
+	stats->probes += other->probes;
+	stats->bytes_written += other->bytes_written;
+	stats->streams_started += other->streams_started;
+	stats->streams_completed += other->streams_completed;
+	stats->streams_corrupt += other->streams_corrupt;
+	stats_histogram_merge(&stats->batch_histogram, &other->batch_histogram);
+	stats_histogram_merge(&stats->ack_histogram, &other->ack_histogram);
+	stats_histogram_merge(&stats->ahead_histogram, &other->ahead_histogram);
+	stats_histogram_merge(&stats->flush_histogram, &other->flush_histogram);
+	stats_histogram_merge(&stats->flush_time_histogram, &other->flush_time_histogram);
+}
+
+void recvr_stats_write(const recvr_stats_t *stats, stats_json_t *json, const char *name) {
+	stats_json_object(json, name);
+	stats_json_uint(json, "packets", stats->packets);
+	stats_json_uint(json, "corrupt_packets", stats->corrupt_packets);
+	stats_json_uint(json, "duplicates", stats->duplicates);
+	stats_json_uint(json, "out_of_window", stats->out_of_window);
+	stats_json_uint(json, "fec_repairs", stats->repairs);
+	stats_json_uint(json, "fec_rebuilt", stats->rebuilt);
+	stats_json_uint(json, "acks", stats->acks);
+	stats_json_uint(json, "timer_acks", stats->timer_acks);
+	stats_json_uint(json, "mtu_probes", stats->probes);
+	stats_json_uint(json, "bytes_written", stats->bytes_written);
+	stats_json_uint(json, "streams_started", stats->streams_started);
+	stats_json_uint(json, "streams_completed", stats->streams_completed);
+	stats_json_uint(json, "streams_corrupt", stats->streams_corrupt);
+	stats_json_histogram(json, "batch_packets", &stats->batch_histogram);
+	stats_json_histogram(json, "ack_packets", &stats->ack_histogram);
+	stats_json_histogram(json, "ahead_seq_nums", &stats->ahead_histogram);
+	stats_json_histogram(json, "flush_bytes", &stats->flush_histogram);
+	stats_json_histogram(json, "flush_us", &stats->flush_time_histogram);
+	stats_json_close(json);
+}
 
 /*** Fwriter Functions ***/
 
+#define FWRITER_STDIO 0 // fseek + fwrite per packet
+#define FWRITER_PWRITEV 1 // stage in a ring, flush contiguous runs with pwritev
+#define FWRITER_DIRECT 2 // same as pwritev, but O_DIRECT so the page cache stays small
+#define FWRITER_STREAM 3 // stdout or a pipe, the ring's in order bytes go out with writev, nothing is read back from it
+#define FWRITER_TREE 4 // a directory, the ring's runs are split across its files, whose handles are cached
+
+#define FWRITER_ALIGN 4096 // O_DIRECT offset/length/buffer alignment
+#define FWRITER_FLUSH_SIZE (1 << 20) // bytes of in order data per pwritev
+
 typedef struct fwriter {
+	int engine;
+
+	// stdio engine
 	FILE *fp;
+	ull64_t cursor; // stdio position, so in order writes don't seek
+
+	// ring engines: the ring holds file bytes [flushed, flushed + ring_size)
+	int fd; // -1 for a tree, its files are opened as the runs reach them
+	tree_handles_t *tree; // tree engine, NULL until the manifest is in
+	int fd_tail; // buffered fd for the unaligned tail when fd is O_DIRECT
+	char *ring;
+	ull64_t ring_size;
+	pool_t *ring_pool; // the ring goes back here
+	ull64_t flushed; // everything before this is on disk
+	ull64_t committed; // everything before this is in the ring, no holes
+	ull64_t end; // one past the largest byte written
+
+	// io_uring: flushes are submitted and reaped later, at most one in flight
+	uring_t *uring;
+	int flush_pending;
+	ull64_t flush_start; // ring bytes from here can't be reused until the flush completes
+	struct iovec flush_iov[2];
+	size_t flush_size;
+
+	recvr_stats_t *stats; // the receive thread's
 } fwriter_t;
 
-fwriter_t* fwriter_create(char *filename) {
-	FILE *fp = fopen(filename, "w+"); // input files are read only
-	if (fp == NULL) {
+// whole window plus a flush worth of in order data, rounded to the alignment
+ull64_t fwriter_ring_size(ull64_t window_size) {
+	ull64_t ring_size = window_size + (2 * FWRITER_FLUSH_SIZE);
+	return (ring_size + FWRITER_ALIGN - 1) / FWRITER_ALIGN * FWRITER_ALIGN;
+}
+
+// the file must exist, every stream opens it separately and writes from base on
+// rings come from ring_pool (fwriter_ring_size bytes each), returns NULL if the file or a ring isn't available
+fwriter_t* fwriter_create(char *filename, int engine, ull64_t base, pool_t *ring_pool, recvr_stats_t *stats) {
+	fwriter_t *fwriter = malloc(sizeof(fwriter_t));
+	fwriter->engine = engine;
+	fwriter->fp = NULL;
+	fwriter->cursor = 0;
+	fwriter->fd = -1;
+	fwriter->fd_tail = -1;
+	fwriter->tree = NULL;
+	fwriter->ring = NULL;
+	fwriter->ring_pool = ring_pool;
+	fwriter->flushed = base;
+	fwriter->committed = base;
+	fwriter->end = base;
+	fwriter->uring = NULL;
+	fwriter->flush_pending = 0;
+	fwriter->flush_start = base;
+	fwriter->stats = stats;
+
+	if (engine == FWRITER_DIRECT && base % FWRITER_ALIGN != 0) {
+		fprintf(stderr, "fwriter_create: stream at %llu is not aligned for O_DIRECT, using pwritev\n", base);
+		engine = FWRITER_PWRITEV;
+		fwriter->engine = engine;
+	}
+
+	if (engine == FWRITER_DIRECT) {
+		fwriter->fd = open(filename, O_WRONLY | O_DIRECT);
+		if (fwriter->fd == -1) {
+			// e.g. tmpfs, fall back to the buffered ring
+			perror("fwriter_create: O_DIRECT, using pwritev");
+			engine = FWRITER_PWRITEV;
+			fwriter->engine = engine;
+		} else {
+			fwriter->fd_tail = open(filename, O_RDWR); // fec reads chunks back
+		}
+	}
+
+	if (engine == FWRITER_PWRITEV) {
+		fwriter->fd = open(filename, O_RDWR); // fec reads chunks back
+		fwriter->fd_tail = fwriter->fd;
+	}
+
+	if (engine == FWRITER_STREAM) {
+		// fec reads chunks back from the ring, the window never gets a ring's worth past them
+		fwriter->fd = strcmp(filename, "-") == 0 ? dup(STDOUT_FILENO) : open(filename, O_WRONLY);
+		fwriter->fd_tail = fwriter->fd;
+	}
+
+	if (engine == FWRITER_STDIO) {
+		FILE *fp = fopen(filename, "r+"); // no truncating, other streams write here too
+		if (fp == NULL) {
+			perror("fwriter_create");
+			free(fwriter);
+			return NULL;
+		}
+		fwriter->fp = fp;
+		return fwriter;
+	}
+
+	if (engine != FWRITER_TREE && (fwriter->fd == -1 || fwriter->fd_tail == -1)) {
 		perror("fwriter_create");
-		exit(1);
+	} else {
+		fwriter->ring = pool_get(ring_pool);
+		if (fwriter->ring == NULL) {
+			fprintf(stderr, "fwriter_create: out of write rings\n");
+		}
 	}
 
-	fwriter_t *fwriter = malloc(sizeof(fwriter_t));
-	fwriter->fp = fp;
+	if (fwriter->ring == NULL) {
+		if (fwriter->fd_tail != -1 && fwriter->fd_tail != fwriter->fd) {
+			close(fwriter->fd_tail);
+		}
+		if (fwriter->fd != -1) {
+			close(fwriter->fd);
+		}
+		free(fwriter);
+		return NULL;
+	}
+	fwriter->ring_size = ring_pool->buffer_size;
 
 	return fwriter;
 }
 
-void fwriter_offset_write(fwriter_t *fwriter, char *data, size_t data_size, ull64_t offset) {
-	FILE *file = fwriter->fp;
+// reserves the whole file up front, so it isn't fragmented by the streams' interleaved writes nor grown a write at a time
+void fwriter_preallocate(fwriter_t *fwriter, ull64_t size) {
+	int fd = fwriter->engine == FWRITER_STDIO ? fileno(fwriter->fp) : fwriter->fd;
+	if (fallocate(fd, 0, 0, size) == -1 && errno != EOPNOTSUPP) {
+		perror("fwriter_preallocate"); // the writes allocate as they go instead
+	}
+}
+
+// the tree the manifest describes, once every stream's writer may create its files
+void fwriter_use_tree(fwriter_t *fwriter, tree_t *tree) {
+	fwriter->tree = tree_handles_create(tree, 1);
+}
+
+// switches ring flushes to io_uring, so disk writes never block the receive loop
+int fwriter_use_uring(fwriter_t *fwriter) {
+	if (fwriter->engine == FWRITER_STDIO || fwriter->engine == FWRITER_TREE) {
+		return -1;
+	}
+	fwriter->uring = uring_create(4);
+	return fwriter->uring == NULL ? -1 : 0;
+}
+
+// waits for the in flight flush, redoing whatever part of it didn't make it
+void fwriter_reap(fwriter_t *fwriter) {
+	if (!fwriter->flush_pending) {
+		return;
+	}
 
-	long current_file_position = ftell(file);
-	if (current_file_position == -1) {
-		perror("fwriter_offset_write: ftell");
+	unsigned long long user_data;
+	int res;
+	unsigned flags;
+	int buffer_id;
+	while (uring_completion(fwriter->uring, &user_data, &res, &flags, &buffer_id) == -1) {
+		uring_submit(fwriter->uring, 1, NULL);
 	}
-	ull64_t offset_file_position = offset * max_file_chunk_size;
-	
-	int seek_result = fseek(file, offset_file_position, SEEK_CUR);
-	if (seek_result == -1) {
-		perror("fwriter_offset_write: fseek offset");
+	fwriter->flush_pending = 0;
+
+	if (res < 0 || (size_t)res < fwriter->flush_size) {
+		errno = res < 0 ? -res : EIO;
+		perror("fwriter_reap: writev");
+		fwriter->flushed = fwriter->flush_start; // still in the ring, the next flush retries it
+		return;
 	}
-	// printf("writing file at location %ld\n", ftell(file));
-	size_t bytes_written = fwrite(data, 1, data_size, file);
-	if (bytes_written < data_size) {
-		perror("fwriter_offset_write: fwrite");
+	fwriter->flush_start = fwriter->flushed;
+}
+
+// builds the iovecs for ring bytes [from, to), two when the ring wraps
+int fwriter_ring_iov(fwriter_t *fwriter, struct iovec *iov, ull64_t from, ull64_t to) {
+	ull64_t start = from % fwriter->ring_size;
+	ull64_t size = to - from;
+
+	iov[0].iov_base = fwriter->ring + start;
+	iov[0].iov_len = size;
+	if (start + size > fwriter->ring_size) {
+		iov[0].iov_len = fwriter->ring_size - start;
+		iov[1].iov_base = fwriter->ring;
+		iov[1].iov_len = size - iov[0].iov_len;
+		return 2;
 	}
+	return 1;
+}
 
-	seek_result = fseek(file, current_file_position, SEEK_SET);
-	if (seek_result == -1) {
-		perror("fwriter_offset_write: fseek reset");
+// pwritev, or for a tree, into whichever of its files the range covers
+ssize_t fwriter_pwritev(fwriter_t *fwriter, int fd, const struct iovec *iov, int iov_count, ull64_t offset) {
+	if (fwriter->engine == FWRITER_TREE) {
+		return fwriter->tree != NULL ? tree_pwritev(fwriter->tree, iov, iov_count, offset) : -1;
 	}
+	return pwritev(fd, iov, iov_count, offset);
 }
 
-// offset from last seq num of file
-void fwriter_set_position(fwriter_t *fwriter, seq_t offset) {
-	FILE *file = fwriter->fp;
-	// printf("moving file position from: %ld ", ftell(file));
-	ull64_t offset_bytes = offset * max_file_chunk_size;
-	
-	int seek_result = fseek(file, offset_bytes, SEEK_CUR);
-	if (seek_result == -1) {
-		perror("fwriter_offset_write: fseek offset");
+// writes [flushed, to) from the ring with at most two iovecs (the ring may wrap)
+void fwriter_flush(fwriter_t *fwriter, ull64_t to, int fd, int sync) {
+	if (fwriter->flushed < to) {
+		stats_histogram_record(&fwriter->stats->flush_histogram, to - fwriter->flushed);
+	}
+
+	if (fwriter->uring != NULL) {
+		fwriter_reap(fwriter);
+
+		if (!sync && fwriter->flushed < to) {
+			int iov_count = fwriter_ring_iov(fwriter, fwriter->flush_iov, fwriter->flushed, to);
+			fwriter->flush_size = to - fwriter->flushed;
+			if (uring_prep_writev(fwriter->uring, fd, fwriter->flush_iov, iov_count, fwriter->flushed, 0) == 0) {
+				uring_submit(fwriter->uring, 0, NULL);
+				fwriter->flush_pending = 1;
+				fwriter->flush_start = fwriter->flushed;
+				fwriter->flushed = to;
+				return;
+			}
+		}
+	}
+
+	ull64_t start_ns = monotonic_ns();
+	int blocked = fwriter->flushed < to;
+	while (fwriter->flushed < to) {
+		struct iovec iov[2];
+		int iov_count = fwriter_ring_iov(fwriter, iov, fwriter->flushed, to);
+
+		ssize_t bytes_written;
+		if (fwriter->engine == FWRITER_STREAM) {
+			bytes_written = writev(fd, iov, iov_count); // blocks while the reader is behind, and so does the window
+		} else {
+			bytes_written = fwriter_pwritev(fwriter, fd, iov, iov_count, fwriter->flushed);
+		}
+		if (bytes_written <= 0) {
+			perror(fwriter->engine == FWRITER_STREAM ? "fwriter_flush: writev" : "fwriter_flush: pwritev");
+			return;
+		}
+		fwriter->flushed += bytes_written;
+	}
+	fwriter->flush_start = fwriter->flushed;
+	if (blocked) {
+		stats_histogram_record(&fwriter->stats->flush_time_histogram, (monotonic_ns() - start_ns) / 1000);
+	}
+}
+
+// writes data at an absolute file offset, returns -1 if it couldn't be taken
+int fwriter_offset_write(fwriter_t *fwriter, char *data, size_t data_size, ull64_t offset) {
+	if (offset + data_size > fwriter->end) {
+		fwriter->end = offset + data_size;
+	}
+
+	if (fwriter->engine == FWRITER_STDIO) {
+		FILE *file = fwriter->fp;
+
+		// only out of order packets need a seek
+		if (offset != fwriter->cursor) {
+			int seek_result = fseek(file, offset, SEEK_SET);
+			if (seek_result == -1) {
+				perror("fwriter_offset_write: fseek offset");
+			}
+		}
+		// printf("writing file at location %ld\n", ftell(file));
+		size_t bytes_written = fwrite(data, 1, data_size, file);
+		if (bytes_written < data_size) {
+			perror("fwriter_offset_write: fwrite");
+		}
+		fwriter->cursor = offset + bytes_written;
+		return 0;
+	}
+
+	// bytes of an in flight flush can't be overwritten yet
+	if (fwriter->flush_pending && offset + data_size > fwriter->flush_start + fwriter->ring_size) {
+		fwriter_reap(fwriter);
+	}
+
+	// the ring is sized for the window, so this only happens for bogus offsets
+	if (offset < fwriter->flushed || offset + data_size > fwriter->flush_start + fwriter->ring_size) {
+		fprintf(stderr, "fwriter_offset_write: offset %llu outside of the ring\n", offset);
+		return -1;
+	}
+
+	ull64_t start = offset % fwriter->ring_size;
+	size_t first = data_size;
+	if (start + first > fwriter->ring_size) {
+		first = fwriter->ring_size - start;
+	}
+	memcpy(fwriter->ring + start, data, first);
+	memcpy(fwriter->ring, data + first, data_size - first);
+	return 0;
+}
+
+// everything before position has been written, in order data can go to disk
+void fwriter_set_position(fwriter_t *fwriter, ull64_t position) {
+	if (fwriter->engine == FWRITER_STDIO) {
+		return; // stdio already wrote it
+	}
+
+	// the last chunk is short, position can overshoot the end of the file
+	if (position > fwriter->end) {
+		position = fwriter->end;
+	}
+	fwriter->committed = position;
+
+	if (fwriter->committed - fwriter->flushed >= FWRITER_FLUSH_SIZE) {
+		// O_DIRECT needs aligned runs, the remainder waits for the next flush
+		ull64_t to = fwriter->committed / FWRITER_ALIGN * FWRITER_ALIGN;
+		fwriter_flush(fwriter, to, fwriter->fd, 0);
+	}
+}
+
+// reads from the file itself, whatever the ring has
+ssize_t fwriter_read_file(fwriter_t *fwriter, char *buffer, size_t size, ull64_t offset) {
+	int fd = fwriter->fd_tail;
+	if (fwriter->engine == FWRITER_STDIO) {
+		fflush(fwriter->fp);
+		fd = fileno(fwriter->fp);
+	}
+	if (fwriter->engine == FWRITER_TREE) {
+		return fwriter->tree != NULL ? tree_pread(fwriter->tree, buffer, size, offset) : -1;
+	}
+	return pread(fd, buffer, size, offset);
+}
+
+// reads back bytes already written, from the ring while they're there and the file before that
+void fwriter_read(fwriter_t *fwriter, char *buffer, size_t size, ull64_t offset) {
+	size_t disk_size = size;
+	if (fwriter->engine == FWRITER_STDIO) {
+		disk_size = size;
+	} else if (fwriter->engine == FWRITER_STREAM) {
+		disk_size = 0; // gone down the pipe, but still in the ring
+	} else if (offset + size <= fwriter->flush_start) {
+		disk_size = size;
+	} else if (offset >= fwriter->flush_start) {
+		disk_size = 0;
+	} else {
+		disk_size = fwriter->flush_start - offset;
+	}
+
+	if (disk_size > 0 && fwriter_read_file(fwriter, buffer, disk_size, offset) != (ssize_t)disk_size) {
+		perror("fwriter_read: pread");
+	}
+
+	// ring bytes from flush_start on are not reused until a flush from there completes
+	if (disk_size < size) {
+		struct iovec iov[2];
+		int iov_count = fwriter_ring_iov(fwriter, iov, offset + disk_size, offset + size);
+		memcpy(buffer + disk_size, iov[0].iov_base, iov[0].iov_len);
+		if (iov_count == 2) {
+			memcpy(buffer + disk_size + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+		}
+	}
+}
+
+// writes ring bytes [from, to) out of order, for data the receiver has past a hole
+void fwriter_write_range(fwriter_t *fwriter, ull64_t from, ull64_t to) {
+	if (fwriter->engine == FWRITER_STDIO || fwriter->engine == FWRITER_STREAM || from >= to) {
+		return; // stdio already wrote it, a stream only takes it in order
+	}
+
+	while (from < to) {
+		struct iovec iov[2];
+		int iov_count = fwriter_ring_iov(fwriter, iov, from, to);
+
+		ssize_t bytes_written = fwriter_pwritev(fwriter, fwriter->fd_tail, iov, iov_count, from);
+		if (bytes_written <= 0) {
+			perror("fwriter_write_range: pwritev");
+			return;
+		}
+		from += bytes_written;
+	}
+}
+
+// resume: the file is already there up to position, nothing has been written through the writer yet
+// flushes start aligned, the bytes from the alignment boundary up to position go back into the ring
+void fwriter_rebase(fwriter_t *fwriter, ull64_t position) {
+	ull64_t aligned = position;
+	if (fwriter->engine != FWRITER_STDIO) {
+		aligned = position / FWRITER_ALIGN * FWRITER_ALIGN;
+		struct iovec iov[2];
+		int iov_count = fwriter_ring_iov(fwriter, iov, aligned, position);
+		if (aligned < position && preadv(fwriter->fd_tail, iov, iov_count, aligned) != (ssize_t)(position - aligned)) {
+			perror("fwriter_rebase: preadv");
+		}
+	}
+	fwriter->flushed = aligned;
+	fwriter->committed = position;
+	fwriter->end = position;
+	fwriter->flush_start = aligned;
+}
+
+// everything in order to disk and synced now, for a checkpoint
+// the unaligned tail is written through fd_tail but stays in the ring, the next flush writes it again
+void fwriter_sync(fwriter_t *fwriter) {
+	if (fwriter->engine == FWRITER_STDIO) {
+		fflush(fwriter->fp);
+		fdatasync(fileno(fwriter->fp));
+		return;
+	}
+	if (fwriter->engine == FWRITER_STREAM || fwriter->engine == FWRITER_TREE) {
+		fwriter_flush(fwriter, fwriter->committed, fwriter->fd, 1); // no alignment, and nothing to sync (a tree isn't resumed)
+		return;
+	}
+
+	ull64_t to = fwriter->committed / FWRITER_ALIGN * FWRITER_ALIGN;
+	fwriter_flush(fwriter, to, fwriter->fd, 1);
+	fwriter_write_range(fwriter, fwriter->flushed, fwriter->committed);
+
+	fdatasync(fwriter->fd);
+	if (fwriter->fd_tail != fwriter->fd) {
+		fdatasync(fwriter->fd_tail);
 	}
-	// printf(" to %ld\n", ftell(file));
 }
 
 void fwriter_delete(fwriter_t *fwriter) {
 	if (fwriter != NULL) {
-		fclose(fwriter->fp);
+		if (fwriter->engine == FWRITER_STDIO) {
+			fclose(fwriter->fp);
+		} else {
+			// only the in order data, the ring has stale bytes in the holes past it
+			fwriter_flush(fwriter, fwriter->committed, fwriter->fd_tail, 1);
+			uring_delete(fwriter->uring);
+			if (fwriter->fd_tail != fwriter->fd) {
+				close(fwriter->fd_tail);
+			}
+			if (fwriter->fd != -1) {
+				close(fwriter->fd);
+			}
+			tree_handles_delete(fwriter->tree);
+			pool_put(fwriter->ring_pool, fwriter->ring);
+		}
 		free(fwriter);
 	}
 }
 
 /*** Recvr Functions ***/
 
+typedef struct output output_t;
+
 typedef struct recvr {
 	udp_t *udp;
 	fwriter_t* fwriter;
+	recvr_stats_t *stats; // the receive thread's
+	trace_t *trace; // the receive thread's, NULL unless tracing
 
+	seq_t first_seq_num; // the sender's initial seq num, from the syn
 	seq_t next_seq_num; // expected seq_num
+	ull64_t file_pos; // file offset of next_seq_num
+	ull64_t chunk_size; // the sender's, from the stream's first packet
+	seq_t window_size; // chunks the write ring has room for, fewer than MAX_WINDOW_SIZE when they're jumbo
 	sender_packet_header_t sender_header;
 
-	ull64_t window; // bit mask for receive window
+	char *msg; // current packet, points into the udp batch
+	ssize_t msg_size;
+
+	sack_t *window; // received packets ahead of next_seq_num
+	seq_t window_end; // one past the highest seq_num buffered
+
+	// loss the sender sizes its fec by: first transmissions that never arrived
+	seq_t highest_seq_num; // one past the highest first transmission
+	seq_t loss_mark; // highest_seq_num at the last sample
+	ull64_t originals_received;
+	ull64_t loss_mark_received;
+	double loss_rate; // negative until the first sample
+
+	// repairs held for blocks still missing chunks, NULL until the first repair
+	struct fec_slot *fec_slots;
+	unsigned char *fec_scratch; // a block's chunks for decoding
+
+	char *inflated; // a compressed or delta chunk decoded, NULL until the first one
+	const unsigned char *base; // the output's old copy, deltas copy out of it
+	ull64_t base_size;
+
+	// integrity: chunk digests are kept until the window passes them, then hashed into the stream's in file order
+	blake2b_t digest;
+	unsigned char *chunk_digests; // by seq num, a ring of MAX_WINDOW_SIZE
+
+	// delayed acks: in order packets are acked ack_every at a time, anything else at once
+	int ack_pending; // data packets since the last ack
+	ull64_t arrival_ns; // of the current packet, the one an ack echoes
+
+	// a stream is keyed by where it comes from, its transfer and its place in the transfer
+	struct sockaddr_in peer_addr; // acks go back to whoever sent the stream
+	unsigned int conn_id;
+	int stream_id;
+	ull64_t source_id; // from the syn, checkpoints are taken of it and only resumed for it
+
+	output_t *output;
+	int complete;
+	int intact; // once complete, whether the digest matched, every eof is answered with it
+	long checkpoint_time; // secs, when the last checkpoint was written
+	ull64_t checkpoint_pos; // file_pos and window_end then, a stream that hasn't moved isn't written again
+	seq_t checkpoint_window_end;
+	long last_active; // secs, for evicting streams whose sender went away
+	struct recvr *next; // hash chain, or the free list
 
 	int cycle_count; // for debugging only
-	int client_connected;
 } recvr_t;
 
-recvr_t* recvr_create(udp_t *udp, fwriter_t* fwriter) {
+// the window bitmap is allocated here and reused by every stream the recvr serves
+recvr_t* recvr_create(udp_t *udp, recvr_stats_t *stats, trace_t *trace) {
 	recvr_t *recvr = malloc(sizeof(recvr_t));
 	recvr->udp = udp;
+	recvr->stats = stats;
+	recvr->trace = trace;
+	recvr->window = sack_create(MAX_WINDOW_SIZE);
+	recvr->fec_slots = NULL;
+	recvr->fec_scratch = NULL;
+	recvr->inflated = NULL;
+	recvr->chunk_digests = malloc(MAX_WINDOW_SIZE * DIGEST_SIZE);
+	recvr->next = NULL;
+	return recvr;
+}
+
+// repairs received for one block, chunks [block_seq_num, block_seq_num + data_count)
+typedef struct fec_slot {
+	int in_use;
+	seq_t block_seq_num;
+	int data_count;
+	ull64_t block_end; // file offset one past the block, trims the short last chunk
+	int repair_count;
+	int repair_indexes[FEC_MAX_REPAIR];
+	unsigned char *repairs[FEC_MAX_REPAIR]; // allocated on first use, then kept
+} fec_slot_t;
+
+void recvr_fec_reset(recvr_t *recvr) {
+	if (recvr->fec_slots == NULL) {
+		return;
+	}
+	for (int i = 0; i < FEC_SLOTS; i++) {
+		recvr->fec_slots[i].in_use = 0;
+	}
+}
+
+// sets the recvr up for a new stream, first_seq_num's chunk at file_pos
+void recvr_reset(recvr_t *recvr, fwriter_t* fwriter, output_t *output, seq_t first_seq_num, ull64_t file_pos, ull64_t chunk_size) {
 	recvr->fwriter = fwriter;
+	recvr->output = output;
 	
-	recvr->next_seq_num = 0;
+	recvr->first_seq_num = first_seq_num;
+	recvr->next_seq_num = first_seq_num;
+	recvr->file_pos = file_pos;
+	recvr->chunk_size = chunk_size;
+	recvr->window_size = MAX_WINDOW_SIZE * BASE_CHUNK_SIZE / chunk_size; // the ring is sized for base chunks
+
+	recvr->msg = NULL;
+	recvr->msg_size = -1;
 	
-	recvr->window = 0x0;
+	memset(recvr->window->words, 0, recvr->window->word_count * sizeof(ull64_t));
+	recvr->window_end = first_seq_num;
+
+	recvr->highest_seq_num = first_seq_num;
+	recvr->loss_mark = first_seq_num;
+	recvr->originals_received = 0;
+	recvr->loss_mark_received = 0;
+	recvr->loss_rate = -1;
+	recvr_fec_reset(recvr);
+
+	blake2b_init(&recvr->digest, DIGEST_SIZE);
+
+	recvr->ack_pending = 0;
+
+	recvr->source_id = 0;
+	recvr->complete = 0;
+	recvr->intact = 0;
+	recvr->checkpoint_time = 0;
+	recvr->checkpoint_pos = file_pos;
+	recvr->checkpoint_window_end = first_seq_num;
 
-	recvr->client_connected = 0;
 	recvr->cycle_count = 0;
-	return recvr;
 }
 
 int is_eof(recvr_t *recvr) {
-	// last packet will have seq num of -1
-	seq_t recv_seq_num = recvr->sender_header.seq_num;
-	if (recv_seq_num == EOF_SEQ_NUM) {
+	// last packet is flagged, its seq num is one past the data
+	if (recvr->sender_header.flags & PACKET_EOF) {
 		// printf("eof found\n");
 		return 1;
 	}
 	return 0;
 }
 
-int is_timed_out(recvr_t *recvr) {
-	ssize_t bytes_recv = recvr->udp->bytes_recv;
-	if (bytes_recv == -1) {
-		perror("is_timed_out");
-		return 1;
-	}
-	return 0;
-}
-
 void parse_header(recvr_t *recvr) {
-	udp_t *udp = recvr->udp;
-	char *msg = udp->msg_recv;
+	char *msg = recvr->msg;
 	
 	memcpy(&recvr->sender_header, msg, sizeof(sender_packet_header_t));
 
@@ -177,13 +838,13 @@ void parse_header(recvr_t *recvr) {
 	// printf("parse_header: got seq num %d, expected %d\n", seq_num, recvr->next_seq_num);
 }
 
-int recvr_listen(recvr_t *recvr) {
+// points the recvr at packet i of the last batch
+int recvr_load(recvr_t *recvr, int i) {
 	udp_t *udp = recvr->udp;
 
-	udp_recv(udp);
-	if (is_timed_out(recvr)) {
-		return TIMED_OUT;
-	}
+	recvr->msg = udp->batch_msg_recv[i];
+	recvr->msg_size = udp->batch_bytes_recv[i];
+	recvr->peer_addr = udp->batch_client_addrs[i];
 
 	parse_header(recvr);
 	
@@ -193,75 +854,75 @@ int recvr_listen(recvr_t *recvr) {
 	return TRANSFER_IN_PROGRESS;
 }
 
-int is_window_complete(recvr_t *recvr) {
-	ull64_t full_window = 0xFFFFFFFFFFFFFFFF; //0xFFFF FFFF FFFF FFFF -- 64 bits of 1s
-	ull64_t current_window = recvr->window;
+void mark_written(recvr_t *recvr, seq_t offset) {
+	seq_t seq_num = safe_add(recvr->next_seq_num, offset);
+	sack_set(recvr->window, seq_num);
 
-	if (current_window == full_window) {
-		return 1; // window is full
+	if (!seq_before(seq_num, recvr->window_end)) {
+		recvr->window_end = safe_increment(seq_num);
 	}
-
-	return 0;
+	// printf("mark_written: seq num %u\n", seq_num);
 }
 
-void mark_written(recvr_t *recvr, int offset) {
-	ull64_t bit_mask = 1 << offset;
-	ull64_t current_window = recvr->window;
-	ull64_t next_window = current_window | bit_mask;
-	recvr->window = next_window;
-	// printf("mark_written: bitmask: %llx , window & bitmask: %llx\n", bit, recvr->window);
+int is_written(recvr_t *recvr, seq_t offset) {
+	return sack_test(recvr->window, safe_add(recvr->next_seq_num, offset));
 }
 
-int is_written(recvr_t *recvr, int offset) {
-	ull64_t bit = (recvr->window >> offset) & 1;
-	return bit;
+// slides past the in order run, skipping 64 received packets per step
+seq_t move_window(recvr_t *recvr) {
+	seq_t move_amount = sack_advance(recvr->window, recvr->next_seq_num, MAX_WINDOW_SIZE);
+	// printf("move_window: moved by %u\n", move_amount);
+	return move_amount;
 }
 
-seq_t move_window(recvr_t *recvr) {
-	seq_t move_amount = 0;
-	for (int i = 0; i < MAX_WINDOW_SIZE; i++) {
-		if (!is_written(recvr, i)) {
-			break;
-		}
-		move_amount += 1;
+// hashes the digests of the chunks the window just moved past into the stream's
+void recvr_fold_digest(recvr_t *recvr, seq_t seq_num, seq_t count) {
+	for (seq_t i = 0; i < count; i++) {
+		seq_t chunk_seq_num = safe_add(seq_num, i);
+		blake2b_update(&recvr->digest, recvr->chunk_digests + (chunk_seq_num % MAX_WINDOW_SIZE) * DIGEST_SIZE, DIGEST_SIZE);
 	}
-	ull64_t current_window = recvr->window;
-	ull64_t next_window = current_window >> move_amount;
-	recvr->window = next_window;
-	// printf("move_window: a - %016llx\n", recvr->window);
-	// printf("move_window: moved by %d\n", move_amount);
-	return move_amount;
 }
 
-void recvr_save_data(recvr_t *recvr) {
-	udp_t *udp = recvr->udp;
+// takes a chunk, whether it arrived or was rebuilt, and slides the window past the in order run
+void recvr_save_chunk(recvr_t *recvr, seq_t recv_seq_num, char *data_start, size_t data_size) {
 	fwriter_t *fwriter = recvr->fwriter;
-
-	seq_t recv_seq_num = recvr->sender_header.seq_num;
 	seq_t next_seq_num = recvr->next_seq_num;
 
-	char *data_start = udp->msg_recv + sizeof(sender_packet_header_t);
-	size_t data_size = udp->bytes_recv - sizeof(sender_packet_header_t);
-	// printf("recvr_save_data: data bytes recv : %zu\n", data_size);
-
 	seq_t offset = safe_subtract(recv_seq_num, next_seq_num);
-	if (offset >= MAX_WINDOW_SIZE) {
+	if (offset >= recvr->window_size) {
 		// printf("recvr_save_data: recv seq num: %d, next seq num: %d, offset: %d\n", recv_seq_num, next_seq_num, offset);
 		// printf("recvr_save_data: out of window - discarding\n");
 		// fprintf(stderr, "recvr_save_data: out of window - discarding\n");
+		if (seq_before(recv_seq_num, next_seq_num)) {
+			recvr->stats->duplicates += 1; // already written
+		} else {
+			recvr->stats->out_of_window += 1;
+		}
 		return;
 	}
 
 	if (is_written(recvr, offset)) {
 		// printf("recvr_save_data: already buffered for seq num %d\n", recv_seq_num);
+		recvr->stats->duplicates += 1;
 		return;
 	}
 	
+	ull64_t file_offset = recvr->file_pos + (offset * recvr->chunk_size);
+	if (fwriter_offset_write(fwriter, data_start, data_size, file_offset) == -1) {
+		return; // not taken, the sender will retransmit it
+	}
+	recvr->stats->bytes_written += data_size;
+	stats_histogram_record(&recvr->stats->ahead_histogram, offset);
+
+	// of the chunk as written, whatever packet checksum it came through
+	blake2b(recvr->chunk_digests + (recv_seq_num % MAX_WINDOW_SIZE) * DIGEST_SIZE, DIGEST_SIZE, data_start, data_size);
+
 	if (recv_seq_num == next_seq_num) {
-		recvr->window |= 1;
-		fwriter_offset_write(fwriter, data_start, data_size, 0);
+		mark_written(recvr, 0);
 		seq_t move_amount = move_window(recvr);
-		fwriter_set_position(fwriter, move_amount); // set file to position based on window
+		recvr_fold_digest(recvr, next_seq_num, move_amount);
+		recvr->file_pos += move_amount * recvr->chunk_size;
+		fwriter_set_position(fwriter, recvr->file_pos); // in order data is now complete up to here
 		next_seq_num = safe_add(next_seq_num, move_amount);
 		// if (has_wrapped(next_seq_num, recv_seq_num)) {
 		// 	printf("Begin Round %d\n", recvr->cycle_count);
@@ -270,98 +931,1664 @@ void recvr_save_data(recvr_t *recvr) {
 		// }
 		recvr->next_seq_num = next_seq_num;
 	} else {
-		fwriter_offset_write(fwriter, data_start, data_size, offset);
 		mark_written(recvr, offset);
 	}
 	
 }
 
-void recvr_respond(recvr_t *recvr) {
-	udp_t *udp = recvr->udp;
-	
-	if (!recvr->client_connected) {
-		recvr->client_connected = 1;
-		// sets it to the client address if not set already
-		udp_set_server_addr(udp, NULL, -1);
-	}
+void recvr_save_data(recvr_t *recvr) {
+	char *data_start = recvr->msg + sizeof(sender_packet_header_t);
+	size_t data_size = recvr->msg_size - sizeof(sender_packet_header_t);
+	trace_record(recvr->trace, TRACE_RECV, (recvr->sender_header.flags & PACKET_RETRANSMIT) ? TRACE_RETRANSMIT : 0, recvr->stream_id,
+		recvr->sender_header.seq_num, recvr->sender_header.flags, recvr->next_seq_num);
+	// printf("recvr_save_data: data bytes recv : %zu\n", data_size);
 
-	// prepares packet header: same timestamp but with expected seq num
-	// TODO: increase performance by caching the whole sender_packet_header
-	sender_packet_header_t sender_header;
-	memcpy(&sender_header, udp->msg_recv, sizeof(sender_packet_header_t));
-	
-	recvr_packet_header_t recvr_header;
-	recvr_header.next_seq_num = recvr->next_seq_num;
-	recvr_header.timestamp = sender_header.timestamp; // original timestamp
-	recvr_header.window = recvr->window;
+	if (recvr->sender_header.flags & (PACKET_COMPRESSED | PACKET_DELTA)) {
+		if (recvr->inflated == NULL) {
+			recvr->inflated = malloc(MAX_CHUNK_SIZE); // kept for the recvr's next streams, whatever their chunk size
+		}
+		int inflated_size;
+		if (recvr->sender_header.flags & PACKET_DELTA) {
+			inflated_size = delta_decode((unsigned char *)data_start, data_size, recvr->base, recvr->base_size,
+				(unsigned char *)recvr->inflated, recvr->chunk_size);
+		} else {
+			inflated_size = lz_decompress((unsigned char *)data_start, data_size, (unsigned char *)recvr->inflated, recvr->chunk_size);
+		}
+		if (inflated_size == -1) {
+			fprintf(stderr, "recvr_save_data: seq num %u doesn't decode, dropped\n", recvr->sender_header.seq_num);
+			return; // the sender retransmits it
+		}
+		data_start = recvr->inflated;
+		data_size = inflated_size;
+	}
 
-	char *msg = udp->msg_send;
-	memcpy(msg, &recvr_header, sizeof(recvr_packet_header_t));
-	udp->bytes_to_send = sizeof(recvr_packet_header_t);
-	udp_send(udp);
-	// printf("recvr_respond: sent next seq num: %d\n", recvr->next_seq_num);
+	recvr_save_chunk(recvr, recvr->sender_header.seq_num, data_start, data_size);
 }
 
-void recvr_delete(recvr_t *recvr) {
-	free(recvr);
+// samples the share of first transmissions missing every LOSS_INTERVAL seq nums, smoothed
+void recvr_track_loss(recvr_t *recvr) {
+	sender_packet_header_t *header = &recvr->sender_header;
+	if (header->flags & PACKET_RETRANSMIT) {
+		return;
+	}
+
+	recvr->originals_received += 1;
+	seq_t next_seq_num = safe_increment(header->seq_num);
+	if (seq_before(recvr->highest_seq_num, next_seq_num)) {
+		recvr->highest_seq_num = next_seq_num;
+	}
+
+	seq_t expected = safe_subtract(recvr->highest_seq_num, recvr->loss_mark);
+	if (expected < LOSS_INTERVAL) {
+		return;
+	}
+
+	// late arrivals from the last interval can push received past expected
+	ull64_t received = recvr->originals_received - recvr->loss_mark_received;
+	double sample = 0;
+	if (received < expected) {
+		sample = (double)(expected - received) / expected;
+	}
+
+	if (recvr->loss_rate < 0) {
+		recvr->loss_rate = sample;
+	} else {
+		recvr->loss_rate = (0.875 * recvr->loss_rate) + (0.125 * sample);
+	}
+	recvr->loss_mark = recvr->highest_seq_num;
+	recvr->loss_mark_received = recvr->originals_received;
 }
 
-void receive(recvr_t* recvr) {
-	
-	// printf("\n\n");
-	while(1) {
-		int listen_result = recvr_listen(recvr);
+// the ack's loss_rate byte
+unsigned char recvr_loss_report(recvr_t *recvr) {
+	if (recvr->loss_rate < 0) {
+		return 0;
+	}
 
-		if (listen_result == TIMED_OUT) {
-			break;
-		}
+	// rounded up, so any loss at all gets the sender to send repairs
+	double loss = recvr->loss_rate * 256;
+	int report = 1 + (int)loss + (loss > (int)loss);
+	return report > 255 ? 255 : report;
+}
 
-		if (listen_result == TRANSFER_COMPLETE) {
-			break;
-		}
+/*** Forward Error Correction ***/
 
-		recvr_save_data(recvr);
-		recvr_respond(recvr);
-		// printf("\n");
+int recvr_has_chunk(recvr_t *recvr, seq_t seq_num) {
+	if (seq_before(seq_num, recvr->next_seq_num)) {
+		return 1;
 	}
-	
+	return is_written(recvr, safe_subtract(seq_num, recvr->next_seq_num));
 }
 
-int main(int argc, char** argv)
-{	
-	if(argc != 3)
-	{
-		fprintf(stderr, "usage: %s UDP_port filename_to_write\n\n", argv[0]);
-		exit(1);
+// rebuilds the block's missing chunks once there are as many repairs as holes, returns how many
+int recvr_fec_decode(recvr_t *recvr, fec_slot_t *slot) {
+	int data_count = slot->data_count;
+	int present[FEC_MAX_DATA];
+	int missing_count = 0;
+	for (int i = 0; i < data_count; i++) {
+		present[i] = recvr_has_chunk(recvr, safe_add(slot->block_seq_num, i));
+		missing_count += !present[i];
 	}
-	
-	char *port = argv[1];
-	char *filename = argv[2];
 
-	// creating the udp
-	size_t recv_buffer_size = MAX_PACKET_SIZE;
-	size_t send_buffer_size = MAX_PACKET_SIZE;
-	udp_t *udp = udp_create(port, send_buffer_size, recv_buffer_size);
+	if (missing_count == 0) {
+		slot->in_use = 0; // nothing to do, arrived or retransmitted after all
+		return 0;
+	}
+	if (missing_count > slot->repair_count) {
+		return 0; // wait for more repairs, or the retransmits
+	}
 
-	// set max timeout for recv
-	struct timeval tv;
-	tv.tv_sec = MAX_TIMEOUT;
-	tv.tv_usec = 0;
-	
-	if (setsockopt(udp->sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-		perror("main: setting timeout failed");
+	// the chunks we have are read back from the writer, zero padded like the sender's
+	long long block_offset = (int)safe_subtract(slot->block_seq_num, recvr->next_seq_num);
+	ull64_t block_pos = recvr->file_pos + (block_offset * (long long)recvr->chunk_size);
+	unsigned char *data[FEC_MAX_DATA];
+	for (int i = 0; i < data_count; i++) {
+		data[i] = recvr->fec_scratch + (i * recvr->chunk_size);
+		memset(data[i], 0, recvr->chunk_size);
+
+		ull64_t chunk_pos = block_pos + (i * recvr->chunk_size);
+		if (present[i] && chunk_pos < slot->block_end) {
+			ull64_t chunk_size = slot->block_end - chunk_pos;
+			if (chunk_size > recvr->chunk_size) {
+				chunk_size = recvr->chunk_size;
+			}
+			fwriter_read(recvr->fwriter, (char *)data[i], chunk_size, chunk_pos);
+		}
+	}
+
+	if (fec_decode(data, present, data_count, slot->repairs, slot->repair_indexes, slot->repair_count, recvr->chunk_size) == -1) {
+		return 0;
 	}
+	slot->in_use = 0;
 
-	fwriter_t *fwriter = fwriter_create(filename);
+	for (int i = 0; i < data_count; i++) {
+		ull64_t chunk_pos = block_pos + (i * recvr->chunk_size);
+		if (present[i] || chunk_pos >= slot->block_end) {
+			continue;
+		}
+		ull64_t chunk_size = slot->block_end - chunk_pos;
+		if (chunk_size > recvr->chunk_size) {
+			chunk_size = recvr->chunk_size;
+		}
+		recvr_save_chunk(recvr, safe_add(slot->block_seq_num, i), (char *)data[i], chunk_size);
+	}
+	recvr->stats->rebuilt += missing_count;
+	return missing_count;
+}
 
-	recvr_t *recvr = recvr_create(udp, fwriter);
+// keeps a repair packet, and decodes its block if that's enough, returns the chunks rebuilt
+int recvr_save_repair(recvr_t *recvr) {
+	sender_packet_header_t *header = &recvr->sender_header;
+	seq_t block_seq_num = header->seq_num;
+	int data_count = header->fec_count;
+	int repair_index = header->fec_index;
 
-	receive(recvr);
+	if (data_count == 0 || data_count > FEC_MAX_DATA || repair_index >= FEC_MAX_REPAIR) {
+		return 0;
+	}
+	if (recvr->msg_size != (ssize_t)(sizeof(sender_packet_header_t) + recvr->chunk_size)) {
+		return 0;
+	}
+	recvr->stats->repairs += 1;
 
-	// clean up
-	udp_delete(udp);
-	fwriter_delete(fwriter);
-	recvr_delete(recvr);
-	
-	return 0;
+	// a block that is already in order, or that reaches past the window, is of no use
+	seq_t block_end = safe_add(block_seq_num, data_count);
+	if (!seq_before(recvr->next_seq_num, block_end)) {
+		return 0;
+	}
+	if (safe_subtract(block_end, recvr->next_seq_num) > recvr->window_size) {
+		return 0;
+	}
+
+	if (recvr->fec_slots == NULL) {
+		recvr->fec_slots = calloc(FEC_SLOTS, sizeof(fec_slot_t));
+		recvr->fec_scratch = malloc(FEC_MAX_DATA * MAX_CHUNK_SIZE);
+	}
+
+	// a newer block takes over the slot, the older one falls back to retransmits
+	fec_slot_t *slot = &recvr->fec_slots[(block_seq_num * 2654435761u) >> 28];
+	if (!slot->in_use || slot->block_seq_num != block_seq_num) {
+		slot->in_use = 1;
+		slot->block_seq_num = block_seq_num;
+		slot->data_count = data_count;
+		slot->block_end = header->offset;
+		slot->repair_count = 0;
+	}
+
+	for (int j = 0; j < slot->repair_count; j++) {
+		if (slot->repair_indexes[j] == repair_index) {
+			return 0; // duplicate
+		}
+	}
+
+	int j = slot->repair_count;
+	if (slot->repairs[j] == NULL) {
+		slot->repairs[j] = malloc(MAX_CHUNK_SIZE);
+	}
+	memcpy(slot->repairs[j], recvr->msg + sizeof(sender_packet_header_t), recvr->chunk_size);
+	slot->repair_indexes[j] = repair_index;
+	slot->repair_count += 1;
+
+	return recvr_fec_decode(recvr, slot);
+}
+
+// a chunk arrived late, its block may now have few enough holes to decode
+void recvr_fec_check(recvr_t *recvr, seq_t seq_num) {
+	if (recvr->fec_slots == NULL) {
+		return;
+	}
+	for (int i = 0; i < FEC_SLOTS; i++) {
+		fec_slot_t *slot = &recvr->fec_slots[i];
+		if (slot->in_use && safe_subtract(seq_num, slot->block_seq_num) < (seq_t)slot->data_count) {
+			recvr_fec_decode(recvr, slot);
+			return;
+		}
+	}
+}
+
+// seals the ack into the next send slot, its payload is already there after the header
+void queue_ack(udp_t *udp, recvr_packet_header_t *recvr_header, size_t payload_size, const struct sockaddr_in *addr) {
+	int slot = udp->batch_send_count;
+	char *msg = udp->batch_msg_send[slot];
+
+	recvr_header->checksum = 0;
+	unsigned int payload_crc = crc32c(0, msg + sizeof(recvr_packet_header_t), payload_size);
+	recvr_header->checksum = crc32c(payload_crc, recvr_header, sizeof(recvr_packet_header_t));
+
+	memcpy(msg, recvr_header, sizeof(recvr_packet_header_t));
+	udp->batch_bytes_to_send[slot] = sizeof(recvr_packet_header_t) + payload_size;
+	udp->batch_addr_send[slot] = addr;
+	udp->batch_send_count += 1;
+
+	// with GRO a batch can carry more packets than there are ack slots
+	if (udp->batch_send_count == udp->batch_size) {
+		udp_send_batch(udp);
+	}
+}
+
+void recvr_queue_ack(recvr_t *recvr, recvr_packet_header_t *recvr_header, size_t payload_size) {
+	queue_ack(recvr->udp, recvr_header, payload_size, &recvr->peer_addr);
+	recvr->stats->acks += 1;
+}
+
+// acks the last packet, now_ns tells the sender how long the ack was held so its rtt sample leaves that out
+void recvr_respond(recvr_t *recvr, ull64_t now_ns) {
+	udp_t *udp = recvr->udp;
+
+	// prepares packet header: same timestamp but with expected seq num
+	recvr_packet_header_t recvr_header;
+	recvr_header.next_seq_num = recvr->next_seq_num;
+	recvr_header.stream_id = recvr->stream_id;
+	recvr_header.loss_rate = recvr_loss_report(recvr);
+	recvr_header.flags = (recvr->sender_header.flags & PACKET_RESUME) ? ACK_RESUME : 0;
+	recvr_header.timestamp = recvr->sender_header.timestamp; // original timestamp
+	ull64_t held_us = now_ns > recvr->arrival_ns ? (now_ns - recvr->arrival_ns) / 1000 : 0;
+	recvr_header.ack_delay = held_us > 0xffff ? 0xffff : held_us;
+
+	// queued, the whole batch of acks goes out together in receive
+	int slot = udp->batch_send_count;
+	char *msg = udp->batch_msg_send[slot];
+
+	// sack bitmap up to the highest packet buffered, nothing when everything is in order
+	seq_t sack_bits = 0;
+	if (seq_before(recvr->next_seq_num, recvr->window_end)) {
+		sack_bits = safe_subtract(recvr->window_end, recvr->next_seq_num);
+	}
+	ull64_t *sack_words = (ull64_t *)(msg + sizeof(recvr_packet_header_t));
+	recvr_header.sack_words = sack_export(recvr->window, recvr->next_seq_num, sack_bits, sack_words, MAX_SACK_WORDS);
+
+	recvr_queue_ack(recvr, &recvr_header, recvr_header.sack_words * sizeof(ull64_t));
+	trace_record(recvr->trace, TRACE_RESPOND, 0, recvr->stream_id, recvr->next_seq_num, recvr_header.sack_words,
+		recvr_header.sack_words > 0 ? sack_words[0] : 0);
+	if (recvr->ack_pending > 0) {
+		stats_histogram_record(&recvr->stats->ack_histogram, recvr->ack_pending);
+		recvr->ack_pending = 0;
+	}
+	// printf("recvr_respond: sent next seq num: %d\n", recvr->next_seq_num);
+}
+
+// writes what arrived past the first hole, chunk by chunk, for a stream that won't finish
+void recvr_flush_window(recvr_t *recvr) {
+	fwriter_t *fwriter = recvr->fwriter;
+
+	seq_t window_size = safe_subtract(recvr->window_end, recvr->next_seq_num);
+	for (seq_t offset = 1; offset < window_size; offset++) {
+		if (!is_written(recvr, offset)) {
+			continue;
+		}
+
+		ull64_t from = recvr->file_pos + (offset * recvr->chunk_size);
+		ull64_t to = from + recvr->chunk_size;
+		if (to > fwriter->end) {
+			to = fwriter->end; // the last chunk is short
+		}
+		fwriter_write_range(fwriter, from, to);
+	}
+}
+
+void recvr_delete(recvr_t *recvr) {
+	if (recvr->fec_slots != NULL) {
+		for (int i = 0; i < FEC_SLOTS; i++) {
+			for (int j = 0; j < FEC_MAX_REPAIR; j++) {
+				free(recvr->fec_slots[i].repairs[j]);
+			}
+		}
+		free(recvr->fec_slots);
+		free(recvr->fec_scratch);
+	}
+	free(recvr->inflated);
+	free(recvr->chunk_digests);
+	sack_delete(recvr->window);
+	free(recvr);
+}
+
+/*** Outputs ***/
+
+// a file being received, shared by the receive threads its streams land on
+struct output {
+	char *filename;
+	struct in_addr peer; // daemon: transfers are keyed by sender host and conn id
+	unsigned int conn_id;
+
+	int stream_count; // from the headers, 0 until the first packet
+	int streams_complete;
+	int streams_corrupt; // complete, but the digest didn't match the sender's
+
+	// delta: the file as it was before this transfer, unlinked but mapped, NULL if there was none
+	unsigned char *base;
+	ull64_t base_size;
+	delta_signature_t *signatures; // signed when the sender first asks
+	unsigned int signature_count;
+
+	char *checkpoint; // filename.ckpt, a checkpoint_t per stream
+	int checkpoint_fd; // -1 if it couldn't be opened, the transfer just isn't resumable
+	int refs; // streams attached, under the server lock
+	int preallocated; // the first stream's syn reserves the file for all of them
+
+	// directory: filename is its root, the first stream's syn says how big the manifest is, its pages fill it in
+	// only that stream touches the manifest, the tree made from it is published to every thread's streams
+	int directory;
+	char *manifest; // NULL until the syn
+	size_t manifest_size;
+	unsigned char *manifest_pages; // received, by page
+	unsigned int manifest_pages_left;
+	tree_t *tree; // NULL until every page is in and the files are made
+
+	struct output *next; // hash chain
+};
+
+// settings and outputs shared by every receive thread
+typedef struct server {
+	int fwriter_engine;
+	int use_uring;
+	int max_connections; // streams per thread
+
+	output_t *output; // the single transfer, NULL for a daemon
+	char *dir; // daemon: every transfer gets a file in here
+
+	pthread_mutex_t lock; // guards the output table and refs
+	output_t *outputs[OUTPUT_BUCKETS];
+} server_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int signum) {
+	stop_requested = 1;
+}
+
+long monotonic_secs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+output_t* output_create(char *filename, struct in_addr peer, unsigned int conn_id) {
+	output_t *output = malloc(sizeof(output_t));
+	output->filename = strdup(filename);
+	output->peer = peer;
+	output->conn_id = conn_id;
+	output->stream_count = 0;
+	output->streams_complete = 0;
+	output->streams_corrupt = 0;
+
+	output->base = NULL;
+	output->base_size = 0;
+	output->signatures = NULL;
+	output->signature_count = 0;
+
+	output->checkpoint = malloc(strlen(filename) + sizeof(".ckpt"));
+	sprintf(output->checkpoint, "%s.ckpt", filename);
+	output->checkpoint_fd = -1;
+	struct stat st;
+	if (strcmp(filename, "-") != 0 && stat(filename, &st) == 0 && S_ISREG(st.st_mode)) { // stdout, a device or pipe can't be resumed into
+		output->checkpoint_fd = open(output->checkpoint, O_RDWR | O_CREAT, 0666);
+		if (output->checkpoint_fd == -1) {
+			perror("output_create: checkpoint");
+		}
+	}
+	output->refs = 0;
+	output->preallocated = 0;
+	output->directory = 0;
+	output->manifest = NULL;
+	output->manifest_size = 0;
+	output->manifest_pages = NULL;
+	output->manifest_pages_left = 0;
+	output->tree = NULL;
+	output->next = NULL;
+	return output;
+}
+
+// - is stdout, a pipe can't seek either
+int output_is_stream(char *filename) {
+	struct stat st;
+	if (strcmp(filename, "-") == 0) {
+		return 1;
+	}
+	return stat(filename, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+}
+
+int output_is_directory(char *filename) {
+	struct stat st;
+	return stat(filename, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int output_is_complete(output_t *output) {
+	int stream_count = __atomic_load_n(&output->stream_count, __ATOMIC_ACQUIRE);
+	int streams_complete = __atomic_load_n(&output->streams_complete, __ATOMIC_ACQUIRE);
+	return stream_count > 0 && streams_complete >= stream_count;
+}
+
+// keeps the old copy at fd around for deltas, the file itself is about to be replaced
+void output_set_base(output_t *output, int fd) {
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		return;
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		perror("output_set_base: mmap");
+		return;
+	}
+	output->base = base;
+	output->base_size = st.st_size;
+}
+
+void output_delete(output_t *output) {
+	if (output->base != NULL) {
+		munmap(output->base, output->base_size);
+	}
+	free(output->signatures);
+	if (output->checkpoint_fd != -1) {
+		close(output->checkpoint_fd);
+	}
+	free(output->checkpoint);
+	free(output->manifest);
+	free(output->manifest_pages);
+	tree_delete(output->tree);
+	free(output->filename);
+	free(output);
+}
+
+unsigned int output_hash(struct in_addr peer, unsigned int conn_id) {
+	ull64_t key = ((ull64_t)peer.s_addr << 32) | conn_id;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (key >> 32) % OUTPUT_BUCKETS;
+}
+
+int server_is_done(server_t *server) {
+	if (server->dir != NULL) {
+		return stop_requested;
+	}
+	return output_is_complete(server->output);
+}
+
+// daemon: the file, or directory, for a new transfer, named after the sender host and conn id
+output_t* server_open_output(server_t *server, const struct sockaddr_in *peer_addr, unsigned int conn_id, int directory) {
+	char host[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &peer_addr->sin_addr, host, sizeof(host));
+
+	char filename[4096];
+	snprintf(filename, sizeof(filename), "%s/%s-%08x", server->dir, host, conn_id);
+
+	if (directory) {
+		if (mkdir(filename, 0777) == -1 && errno != EEXIST) {
+			perror("server_open_output: mkdir");
+			return NULL;
+		}
+	} else {
+		// no truncating, a stray packet after the transfer was evicted must not wipe it
+		int fd = open(filename, O_WRONLY | O_CREAT, 0666);
+		if (fd == -1) {
+			perror("server_open_output");
+			return NULL;
+		}
+		close(fd);
+	}
+
+	fprintf(stderr, "server: receiving %s\n", filename);
+	output_t *output = output_create(filename, peer_addr->sin_addr, conn_id);
+	output->directory = directory;
+	return output;
+}
+
+// the output a new stream writes to, NULL if its file can't be opened
+output_t* server_attach(server_t *server, const struct sockaddr_in *peer_addr, sender_packet_header_t *header, int directory) {
+	pthread_mutex_lock(&server->lock);
+
+	output_t *output = server->output;
+	if (server->dir != NULL) {
+		unsigned int bucket = output_hash(peer_addr->sin_addr, header->conn_id);
+		output = server->outputs[bucket];
+		while (output != NULL && (output->peer.s_addr != peer_addr->sin_addr.s_addr || output->conn_id != header->conn_id)) {
+			output = output->next;
+		}
+
+		if (output == NULL) {
+			output = server_open_output(server, peer_addr, header->conn_id, directory);
+			if (output != NULL) {
+				output->next = server->outputs[bucket];
+				server->outputs[bucket] = output;
+			}
+		}
+	}
+
+	if (output != NULL) {
+		output->refs += 1;
+		__atomic_store_n(&output->stream_count, header->stream_count, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&server->lock);
+	return output;
+}
+
+void server_complete_stream(server_t *server, output_t *output, int intact) {
+	if (!intact) {
+		__atomic_add_fetch(&output->streams_corrupt, 1, __ATOMIC_RELEASE);
+	}
+	int streams_complete = __atomic_add_fetch(&output->streams_complete, 1, __ATOMIC_RELEASE);
+	if (output->checkpoint_fd != -1 && streams_complete == __atomic_load_n(&output->stream_count, __ATOMIC_ACQUIRE)) {
+		unlink(output->checkpoint); // nothing left to resume
+	}
+	if (server->dir != NULL && streams_complete == __atomic_load_n(&output->stream_count, __ATOMIC_ACQUIRE)) {
+		if (__atomic_load_n(&output->streams_corrupt, __ATOMIC_ACQUIRE) > 0) {
+			fprintf(stderr, "server: received %s, but it doesn't match the sender's digest\n", output->filename);
+		} else {
+			fprintf(stderr, "server: received %s\n", output->filename);
+		}
+	}
+}
+
+// a stream is done with its output, a daemon drops the transfer along with its last stream
+void server_detach(server_t *server, output_t *output) {
+	pthread_mutex_lock(&server->lock);
+
+	output->refs -= 1;
+	if (output->refs == 0 && server->dir != NULL) {
+		output_t **link = &server->outputs[output_hash(output->peer, output->conn_id)];
+		while (*link != output) {
+			link = &(*link)->next;
+		}
+		*link = output->next;
+
+		if (!output_is_complete(output)) {
+			fprintf(stderr, "server: dropped incomplete %s\n", output->filename);
+		}
+		output_delete(output);
+	}
+
+	pthread_mutex_unlock(&server->lock);
+}
+
+/*** Handshake ***/
+
+// answers a stream's syn with what this recvr takes of it, asked again, answered again
+void recvr_accept(recvr_t *recvr) {
+	output_t *output = recvr->output;
+	udp_t *udp = recvr->udp;
+
+	syn_t syn;
+	if (!syn_load(recvr->msg, recvr->msg_size, &syn)) {
+		return;
+	}
+
+	recvr->source_id = syn.source_id;
+
+	syn_t answer;
+	memset(&answer, 0, sizeof(answer));
+	answer.transfer_size = syn.transfer_size;
+	answer.max_window = syn.max_window < recvr->window_size ? syn.max_window : recvr->window_size;
+	answer.features = syn.features & (SYN_FEC | SYN_COMPRESS | SYN_DELTA | SYN_RESUME | SYN_STREAM | SYN_TREE);
+	if (output->base == NULL) {
+		answer.features &= ~SYN_DELTA;
+	}
+	if (output->checkpoint_fd == -1) {
+		answer.features &= ~SYN_RESUME;
+	}
+	if (!output->directory) {
+		answer.features &= ~SYN_TREE;
+	}
+
+	// the manifest's pages come over the stream that says how big it is
+	if ((answer.features & SYN_TREE) && syn.manifest_size > 0 && output->manifest == NULL) {
+		if (syn.manifest_size > MAX_MANIFEST_SIZE) {
+			fprintf(stderr, "recvr_accept: a %llu byte manifest is more than this recvr takes\n", syn.manifest_size);
+			answer.features &= ~SYN_TREE;
+		} else {
+			output->manifest_size = syn.manifest_size;
+			output->manifest = malloc(output->manifest_size);
+			output->manifest_pages_left = (output->manifest_size + recvr->chunk_size - 1) / recvr->chunk_size;
+			output->manifest_pages = calloc(output->manifest_pages_left, 1);
+		}
+	}
+
+	char *msg = udp->batch_msg_send[udp->batch_send_count];
+	memcpy(msg + sizeof(recvr_packet_header_t), &answer, sizeof(syn_t));
+
+	recvr_packet_header_t recvr_header;
+	recvr_header.next_seq_num = recvr->next_seq_num;
+	recvr_header.sack_words = 0;
+	recvr_header.stream_id = recvr->stream_id;
+	recvr_header.loss_rate = 0;
+	recvr_header.flags = ACK_SYN;
+	recvr_header.ack_delay = 0;
+	recvr_header.timestamp = recvr->sender_header.timestamp; // the sender's first rtt sample
+	recvr_queue_ack(recvr, &recvr_header, sizeof(syn_t));
+}
+
+/*** Manifest ***/
+
+// copies a page of the manifest in and acks it, the last one makes the tree
+// no ack for a manifest that doesn't parse, the sender gives up on its own
+void recvr_save_manifest(recvr_t *recvr) {
+	output_t *output = recvr->output;
+	ull64_t offset = recvr->sender_header.offset;
+	size_t size = recvr->msg_size - sizeof(sender_packet_header_t);
+	if (output->manifest == NULL || offset % recvr->chunk_size != 0 || offset >= output->manifest_size) {
+		return;
+	}
+	size_t page_size = output->manifest_size - offset < recvr->chunk_size ? output->manifest_size - offset : recvr->chunk_size;
+	if (size != page_size) {
+		return;
+	}
+
+	unsigned int page = offset / recvr->chunk_size;
+	if (!output->manifest_pages[page]) {
+		memcpy(output->manifest + offset, recvr->msg + sizeof(sender_packet_header_t), size);
+		output->manifest_pages[page] = 1;
+		output->manifest_pages_left -= 1;
+
+		if (output->manifest_pages_left == 0) {
+			tree_t *tree = tree_parse(output->filename, output->manifest, output->manifest_size);
+			if (tree == NULL || tree_make(tree) == -1) {
+				fprintf(stderr, "recvr_save_manifest: the manifest for %s is malformed, or its files can't be made\n", output->filename);
+				tree_delete(tree);
+				return;
+			}
+			fprintf(stderr, "receive: %u files, %llu bytes into %s\n", tree->file_count, tree->size, output->filename);
+			__atomic_store_n(&output->tree, tree, __ATOMIC_RELEASE);
+		}
+	}
+	if (output->manifest_pages_left == 0 && __atomic_load_n(&output->tree, __ATOMIC_ACQUIRE) == NULL) {
+		return;
+	}
+
+	recvr_packet_header_t recvr_header;
+	recvr_header.next_seq_num = page;
+	recvr_header.sack_words = 0;
+	recvr_header.stream_id = recvr->stream_id;
+	recvr_header.loss_rate = 0;
+	recvr_header.flags = ACK_MANIFEST;
+	recvr_header.ack_delay = 0;
+	recvr_header.timestamp = recvr->sender_header.timestamp;
+	recvr_queue_ack(recvr, &recvr_header, 0);
+}
+
+// whether the stream can write yet, the first time it can its writer gets handles on the tree
+int recvr_tree_ready(recvr_t *recvr) {
+	fwriter_t *fwriter = recvr->fwriter;
+	if (fwriter->tree != NULL) {
+		return 1;
+	}
+	tree_t *tree = __atomic_load_n(&recvr->output->tree, __ATOMIC_ACQUIRE);
+	if (tree == NULL) {
+		return 0;
+	}
+	fwriter_use_tree(fwriter, tree);
+	return 1;
+}
+
+/*** Checkpoints ***/
+
+// where a stream had gotten to, one per stream at stream_id * sizeof(checkpoint_t) in the .ckpt file
+// everything it describes was synced to disk before it was written
+typedef struct checkpoint {
+	unsigned int magic;
+	unsigned int checksum; // crc32c of the record with this field 0, a torn write doesn't match
+	unsigned int chunk_size;
+	unsigned char stream_id;
+	unsigned char stream_count;
+	ull64_t source_id; // the sender's file when it was taken, a different or changed one starts over
+	ull64_t segment_start; // the stream's first seq num
+	ull64_t committed; // on disk with no holes up to here, a chunk boundary
+	ull64_t end; // one past the largest byte on disk, trims a short last chunk
+	ull64_t bitmap[MAX_WINDOW_SIZE / SACK_WORD_BITS]; // chunks past committed on disk too, bit i is committed + i chunks
+} checkpoint_t;
+
+unsigned int checkpoint_checksum(checkpoint_t *checkpoint) {
+	unsigned int checksum = checkpoint->checksum;
+	checkpoint->checksum = 0;
+	unsigned int crc = crc32c(0, checkpoint, sizeof(checkpoint_t));
+	checkpoint->checksum = checksum;
+	return crc;
+}
+
+// puts what the stream has on disk, in order and past the first hole, then records it
+void recvr_checkpoint(recvr_t *recvr, long now) {
+	output_t *output = recvr->output;
+	if (output->checkpoint_fd == -1) {
+		return;
+	}
+
+	recvr_flush_window(recvr);
+	fwriter_sync(recvr->fwriter);
+
+	checkpoint_t checkpoint;
+	memset(&checkpoint, 0, sizeof(checkpoint));
+	checkpoint.magic = CHECKPOINT_MAGIC;
+	checkpoint.chunk_size = recvr->chunk_size;
+	checkpoint.stream_id = recvr->stream_id;
+	checkpoint.stream_count = output->stream_count;
+	checkpoint.source_id = recvr->source_id;
+	checkpoint.segment_start = recvr->file_pos - (safe_subtract(recvr->next_seq_num, recvr->first_seq_num) * recvr->chunk_size);
+	checkpoint.committed = recvr->file_pos;
+	checkpoint.end = recvr->fwriter->end;
+	if (checkpoint.committed > checkpoint.end) {
+		checkpoint.committed = checkpoint.end; // the last chunk is short
+	}
+
+	seq_t window_size = 0;
+	if (seq_before(recvr->next_seq_num, recvr->window_end)) {
+		window_size = safe_subtract(recvr->window_end, recvr->next_seq_num);
+	}
+	sack_export(recvr->window, recvr->next_seq_num, window_size, checkpoint.bitmap, MAX_WINDOW_SIZE / SACK_WORD_BITS);
+	checkpoint.checksum = checkpoint_checksum(&checkpoint);
+
+	off_t offset = recvr->stream_id * sizeof(checkpoint_t);
+	if (pwrite(output->checkpoint_fd, &checkpoint, sizeof(checkpoint), offset) != sizeof(checkpoint)) {
+		perror("recvr_checkpoint: pwrite");
+	}
+
+	recvr->checkpoint_time = now;
+	recvr->checkpoint_pos = recvr->file_pos;
+	recvr->checkpoint_window_end = recvr->window_end;
+}
+
+// a stream that asked to resume picks up where its checkpoint left off, if there is one that fits
+void recvr_resume(recvr_t *recvr) {
+	output_t *output = recvr->output;
+	sender_packet_header_t *header = &recvr->sender_header;
+	if (output->checkpoint_fd == -1 || recvr->next_seq_num != recvr->first_seq_num || recvr->window_end != recvr->first_seq_num) {
+		return; // nothing to go on, or data is already flowing
+	}
+
+	checkpoint_t checkpoint;
+	off_t offset = recvr->stream_id * sizeof(checkpoint_t);
+	if (pread(output->checkpoint_fd, &checkpoint, sizeof(checkpoint), offset) != sizeof(checkpoint)) {
+		return; // no checkpoint for this stream, it starts over
+	}
+	if (checkpoint.magic != CHECKPOINT_MAGIC || checkpoint.checksum != checkpoint_checksum(&checkpoint)
+		|| checkpoint.chunk_size != recvr->chunk_size || checkpoint.stream_count != header->stream_count
+		|| checkpoint.segment_start != header->offset || checkpoint.committed < checkpoint.segment_start
+		|| checkpoint.end < checkpoint.committed) {
+		return; // from another transfer, or torn
+	}
+	if (checkpoint.source_id == 0 || checkpoint.source_id != recvr->source_id) {
+		fprintf(stderr, "recvr_resume: stream %d's checkpoint is of another file, or the file changed, starting over\n", recvr->stream_id);
+		return;
+	}
+	ull64_t committed_size = checkpoint.committed - checkpoint.segment_start;
+	if (committed_size % recvr->chunk_size != 0 && checkpoint.committed != checkpoint.end) {
+		return;
+	}
+
+	// the digest covers the whole segment, what's on disk already is read back for it rather than taken on trust
+	blake2b_t digest;
+	blake2b_init(&digest, DIGEST_SIZE);
+	char *chunk = malloc(recvr->chunk_size);
+	for (ull64_t chunk_pos = checkpoint.segment_start; chunk_pos < checkpoint.committed; chunk_pos += recvr->chunk_size) {
+		ull64_t chunk_size = checkpoint.committed - chunk_pos;
+		if (chunk_size > recvr->chunk_size) {
+			chunk_size = recvr->chunk_size;
+		}
+		if (fwriter_read_file(recvr->fwriter, chunk, chunk_size, chunk_pos) != (ssize_t)chunk_size) {
+			free(chunk);
+			return; // it starts over
+		}
+		unsigned char chunk_digest[DIGEST_SIZE];
+		blake2b(chunk_digest, DIGEST_SIZE, chunk, chunk_size);
+		blake2b_update(&digest, chunk_digest, DIGEST_SIZE);
+	}
+
+	// a short last chunk counts as a whole one, the stream was complete
+	seq_t chunk_count = (committed_size + recvr->chunk_size - 1) / recvr->chunk_size;
+	seq_t seq_num = safe_add(recvr->first_seq_num, chunk_count);
+	fwriter_rebase(recvr->fwriter, checkpoint.committed);
+	recvr->next_seq_num = seq_num;
+	recvr->file_pos = checkpoint.segment_start + (chunk_count * recvr->chunk_size);
+	recvr->window_end = seq_num;
+	recvr->highest_seq_num = seq_num;
+	recvr->loss_mark = seq_num;
+	recvr->digest = digest;
+
+	// chunks past the hole go back into the ring, it writes over them once the window gets there
+	for (seq_t i = 1; i < MAX_WINDOW_SIZE; i++) {
+		if (!sack_words_test(checkpoint.bitmap, MAX_WINDOW_SIZE / SACK_WORD_BITS, i)) {
+			continue;
+		}
+
+		ull64_t chunk_pos = checkpoint.committed + (i * recvr->chunk_size);
+		if (chunk_pos >= checkpoint.end) {
+			break;
+		}
+		ull64_t chunk_size = checkpoint.end - chunk_pos;
+		if (chunk_size > recvr->chunk_size) {
+			chunk_size = recvr->chunk_size;
+		}
+		if (fwriter_read_file(recvr->fwriter, chunk, chunk_size, chunk_pos) != (ssize_t)chunk_size) {
+			continue; // the sender sends it again
+		}
+		recvr_save_chunk(recvr, safe_add(seq_num, i), chunk, chunk_size);
+	}
+	free(chunk);
+
+	recvr->checkpoint_pos = recvr->file_pos;
+	recvr->checkpoint_window_end = recvr->window_end;
+}
+
+/*** Signatures ***/
+
+// answers a PACKET_SIGNATURES with the page it asks for, the old copy is signed on the first request
+// only the stream a sender asks on touches the signatures, and it stays on one thread
+void recvr_send_signatures(recvr_t *recvr) {
+	output_t *output = recvr->output;
+	udp_t *udp = recvr->udp;
+
+	unsigned int first_block;
+	if (recvr->msg_size - (ssize_t)sizeof(sender_packet_header_t) != sizeof(first_block)) {
+		return;
+	}
+	memcpy(&first_block, recvr->msg + sizeof(sender_packet_header_t), sizeof(first_block));
+	if (first_block % SIGNATURES_PER_PAGE != 0) {
+		return;
+	}
+
+	if (output->signatures == NULL && output->base != NULL) {
+		output->signature_count = output->base_size / recvr->chunk_size;
+		output->signatures = malloc((output->signature_count + 1) * sizeof(delta_signature_t));
+		delta_sign(output->base, output->base_size, recvr->chunk_size, output->signatures);
+	}
+
+	signature_page_t page;
+	page.base_size = output->base_size;
+	page.block_count = output->signature_count;
+	page.first_block = first_block;
+	page.count = 0;
+	if (first_block < output->signature_count) {
+		page.count = output->signature_count - first_block;
+		if (page.count > SIGNATURES_PER_PAGE) {
+			page.count = SIGNATURES_PER_PAGE;
+		}
+	}
+
+	char *msg = udp->batch_msg_send[udp->batch_send_count];
+	memcpy(msg + sizeof(recvr_packet_header_t), &page, sizeof(signature_page_t));
+	memcpy(msg + sizeof(recvr_packet_header_t) + sizeof(signature_page_t), &output->signatures[first_block], page.count * sizeof(delta_signature_t));
+
+	recvr_packet_header_t recvr_header;
+	recvr_header.next_seq_num = recvr->next_seq_num;
+	recvr_header.sack_words = 0;
+	recvr_header.stream_id = recvr->stream_id;
+	recvr_header.loss_rate = 0;
+	recvr_header.flags = ACK_SIGNATURES;
+	recvr_header.ack_delay = 0;
+	recvr_header.timestamp = recvr->sender_header.timestamp;
+	recvr_queue_ack(recvr, &recvr_header, sizeof(signature_page_t) + (page.count * sizeof(delta_signature_t)));
+}
+
+/*** Receive Threads ***/
+
+// one per thread: a socket on the shared port (SO_REUSEPORT), and whichever streams the kernel hashes to it
+typedef struct worker {
+	pthread_t thread;
+	server_t *server;
+	udp_t *udp;
+
+	// streams by peer, conn id and stream id, recvrs and write rings are preallocated and recycled
+	recvr_t **streams;
+	unsigned int stream_mask; // buckets - 1
+	recvr_t *free_recvrs;
+	pool_t *rings;
+
+	long now; // secs, refreshed once per batch
+	ull64_t now_ns; // the same, in ns
+	long last_sweep;
+
+	ull64_t ack_due_ns; // when the held acks go out, 0 while none are held
+	int ack_timer; // the socket waits ACK_DELAY rather than POLL_TIMEOUT
+	ull64_t linger_ns; // when the thread may leave once every stream is done, EOF_LINGER after the last eof it answered
+
+	recvr_stats_t stats;
+	trace_t *trace; // NULL unless tracing
+} worker_t;
+
+worker_t* worker_create(server_t *server, udp_t *udp, trace_t *trace) {
+	worker_t *worker = calloc(1, sizeof(worker_t));
+	worker->server = server;
+	worker->udp = udp;
+	worker->trace = trace;
+
+	// at least twice the buckets as streams, so chains stay short
+	unsigned int bucket_count = 1;
+	while (bucket_count < 2 * (unsigned int)server->max_connections) {
+		bucket_count *= 2;
+	}
+	worker->streams = calloc(bucket_count, sizeof(recvr_t*));
+	worker->stream_mask = bucket_count - 1;
+
+	for (int i = 0; i < server->max_connections; i++) {
+		recvr_t *recvr = recvr_create(udp, &worker->stats, trace);
+		recvr->next = worker->free_recvrs;
+		worker->free_recvrs = recvr;
+	}
+
+	int preallocate = 0;
+	if (server->dir != NULL && server->fwriter_engine != FWRITER_STDIO) {
+		preallocate = RING_PREALLOC;
+	}
+	ull64_t ring_size = fwriter_ring_size(MAX_WINDOW_SIZE * BASE_CHUNK_SIZE);
+	worker->rings = pool_create(ring_size, FWRITER_ALIGN, preallocate, server->max_connections);
+
+	worker->now_ns = monotonic_ns();
+	worker->now = worker->now_ns / 1000000000ULL;
+	worker->last_sweep = worker->now;
+	return worker;
+}
+
+unsigned int stream_hash(const struct sockaddr_in *addr, unsigned int conn_id, int stream_id) {
+	ull64_t key = ((ull64_t)addr->sin_addr.s_addr << 32) | ((ull64_t)addr->sin_port << 16) | stream_id;
+	key ^= conn_id * 0x9E3779B97F4A7C15ULL;
+	key *= 0xFF51AFD7ED558CCDULL;
+	return key >> 32;
+}
+
+// waits for the next batch of packets, returns how many arrived
+int worker_listen(worker_t *worker) {
+	udp_t *udp = worker->udp;
+
+	// a held ack cuts the wait short
+	int ack_timer = worker->ack_due_ns != 0;
+	if (ack_timer != worker->ack_timer) {
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = ack_timer ? ACK_DELAY : POLL_TIMEOUT;
+		udp_set_timeout(udp, &tv);
+		worker->ack_timer = ack_timer;
+	}
+
+	int count = udp_recv_batch(udp, udp->batch_size);
+	if (count == -1) {
+		return TIMED_OUT;
+	}
+	stats_histogram_record(&worker->stats.batch_histogram, count);
+	return count;
+}
+
+// finds the stream packet i belongs to, its first packet sets it up
+recvr_t* worker_stream(worker_t *worker, int i) {
+	udp_t *udp = worker->udp;
+	server_t *server = worker->server;
+
+	if (udp->batch_bytes_recv[i] < (ssize_t)sizeof(sender_packet_header_t)) {
+		return NULL;
+	}
+
+	sender_packet_header_t header;
+	memcpy(&header, udp->batch_msg_recv[i], sizeof(sender_packet_header_t));
+	const struct sockaddr_in *addr = &udp->batch_client_addrs[i];
+
+	recvr_t **bucket = &worker->streams[stream_hash(addr, header.conn_id, header.stream_id) & worker->stream_mask];
+	for (recvr_t *recvr = *bucket; recvr != NULL; recvr = recvr->next) {
+		if (recvr->peer_addr.sin_addr.s_addr == addr->sin_addr.s_addr && recvr->peer_addr.sin_port == addr->sin_port
+			&& recvr->conn_id == header.conn_id && recvr->stream_id == header.stream_id) {
+			return recvr;
+		}
+	}
+
+	// a stream opens with its syn, anything else is from one this recvr no longer has
+	syn_t syn;
+	if (!(header.flags & PACKET_SYN) || !syn_load(udp->batch_msg_recv[i], udp->batch_bytes_recv[i], &syn)) {
+		return NULL;
+	}
+	if (worker->free_recvrs == NULL) {
+		return NULL; // full, the sender keeps retrying until a stream is evicted
+	}
+	if (header.chunk_size < BASE_CHUNK_SIZE || header.chunk_size > MAX_CHUNK_SIZE) {
+		return NULL; // nothing this recvr could take
+	}
+
+	int directory = (syn.features & SYN_TREE) != 0;
+	output_t *output = server_attach(server, addr, &header, directory);
+	if (output == NULL) {
+		return NULL;
+	}
+	if (output->directory != directory) {
+		if (server->dir == NULL) {
+			fprintf(stderr, "worker_stream: a directory is sent into a directory, and a file into a file\n");
+			exit(1);
+		}
+		server_detach(server, output);
+		return NULL;
+	}
+
+	// the syn's seq num is the stream's first, its offset where the stream's segment starts
+	ull64_t file_pos = header.offset;
+	if (server->fwriter_engine == FWRITER_STREAM && (header.stream_count != 1 || file_pos != 0)) {
+		fprintf(stderr, "worker_stream: stdout or a pipe takes the data in order, send it as one stream from the start\n");
+		exit(1);
+	}
+	int engine = directory ? FWRITER_TREE : server->fwriter_engine;
+	fwriter_t *fwriter = fwriter_create(output->filename, engine, file_pos, worker->rings, &worker->stats);
+	if (fwriter == NULL) {
+		if (server->dir == NULL) {
+			exit(1); // nowhere to write the one transfer
+		}
+		server_detach(server, output);
+		return NULL;
+	}
+	int ring_engine = engine == FWRITER_PWRITEV || engine == FWRITER_DIRECT;
+	if (server->use_uring && ring_engine && fwriter_use_uring(fwriter) == -1) {
+		fprintf(stderr, "worker_stream: io_uring not available for the file, using pwritev\n");
+	}
+	// a tree's files are reserved one by one as they're opened
+	if (syn.transfer_size > 0 && engine != FWRITER_STREAM && engine != FWRITER_TREE && !__atomic_exchange_n(&output->preallocated, 1, __ATOMIC_ACQ_REL)) {
+		fwriter_preallocate(fwriter, syn.transfer_size);
+	}
+
+	recvr_t *recvr = worker->free_recvrs;
+	worker->free_recvrs = recvr->next;
+
+	recvr_reset(recvr, fwriter, output, header.seq_num, file_pos, header.chunk_size);
+	recvr->base = output->base;
+	recvr->base_size = output->base_size;
+	recvr->peer_addr = *addr;
+	recvr->conn_id = header.conn_id;
+	recvr->stream_id = header.stream_id;
+	recvr->last_active = worker->now;
+	worker->stats.streams_started += 1;
+
+	recvr->next = *bucket;
+	*bucket = recvr;
+	return recvr;
+}
+
+// echoes the size of a path mtu probe that made it here, no stream involved, the sender picks its chunk size from these
+// returns 0 if packet i isn't a probe
+int worker_answer_probe(worker_t *worker, int i) {
+	udp_t *udp = worker->udp;
+	sender_packet_header_t header;
+	memcpy(&header, udp->batch_msg_recv[i], sizeof(sender_packet_header_t));
+	if (!(header.flags & PACKET_PROBE)) {
+		return 0;
+	}
+
+	// bigger than MAX_PACKET_SIZE makes a chunk no recvr takes
+	unsigned int probe_size = udp->batch_bytes_recv[i];
+	if (probe_size != header.offset || probe_size > MAX_PACKET_SIZE) {
+		return 1;
+	}
+
+	char *msg = udp->batch_msg_send[udp->batch_send_count];
+	memcpy(msg + sizeof(recvr_packet_header_t), &probe_size, sizeof(probe_size));
+
+	recvr_packet_header_t recvr_header;
+	memset(&recvr_header, 0, sizeof(recvr_header));
+	recvr_header.flags = ACK_PROBE;
+	recvr_header.timestamp = header.timestamp;
+	queue_ack(udp, &recvr_header, sizeof(probe_size), &udp->batch_client_addrs[i]);
+	worker->stats.probes += 1;
+	return 1;
+}
+
+// acks the packet just saved, or holds the ack back until the sender's ack_every packets are in or ACK_DELAY is up
+void worker_ack(worker_t *worker, recvr_t *recvr, seq_t expected) {
+	sender_packet_header_t *header = &recvr->sender_header;
+	recvr->ack_pending += 1;
+
+	// only in order data with nothing buffered past it can wait, a gap or a retransmit is what the sender's loss detection runs on
+	int in_order = header->seq_num == expected && recvr->next_seq_num == safe_increment(expected)
+		&& recvr->window_end == recvr->next_seq_num && !(header->flags & PACKET_RETRANSMIT);
+	int ack_every = header->ack_every > MAX_ACK_EVERY ? MAX_ACK_EVERY : header->ack_every;
+	if (!in_order || recvr->ack_pending >= ack_every) {
+		recvr_respond(recvr, worker->now_ns);
+		return;
+	}
+	if (worker->ack_due_ns == 0) {
+		worker->ack_due_ns = worker->now_ns + (ACK_DELAY * 1000ULL);
+	}
+}
+
+// the ack timer: every held ack goes, due or not, so none is held longer than ACK_DELAY
+void worker_send_held_acks(worker_t *worker) {
+	for (unsigned int i = 0; i <= worker->stream_mask; i++) {
+		for (recvr_t *recvr = worker->streams[i]; recvr != NULL; recvr = recvr->next) {
+			if (recvr->ack_pending > 0 && !recvr->complete) {
+				recvr_respond(recvr, worker->now_ns);
+				worker->stats.timer_acks += 1;
+			}
+		}
+	}
+	worker->ack_due_ns = 0;
+}
+
+// eof: everything is on disk once the writer is gone, the recvr stays until evicted to soak up duplicates
+void worker_finish_stream(worker_t *worker, recvr_t *recvr) {
+	recvr->complete = 1;
+	recvr_checkpoint(recvr, worker->now); // done, in case the other streams aren't
+	ull64_t end = recvr->fwriter->end;
+	fwriter_delete(recvr->fwriter);
+	recvr->fwriter = NULL;
+
+	// the file may be left over from a longer transfer, the last segment ends where the file does
+	if (recvr->output->checkpoint_fd != -1 && recvr->stream_id == recvr->sender_header.stream_count - 1
+		&& truncate(recvr->output->filename, end) == -1) {
+		perror("worker_finish_stream: truncate");
+	}
+
+	// the packet crcs only catch line noise, the digest is what says the segment on disk is the sender's
+	unsigned char digest[DIGEST_SIZE];
+	blake2b_final(&recvr->digest, digest);
+	int intact = recvr->msg_size == (ssize_t)(sizeof(sender_packet_header_t) + DIGEST_SIZE)
+		&& memcmp(digest, recvr->msg + sizeof(sender_packet_header_t), DIGEST_SIZE) == 0
+		&& recvr->next_seq_num == recvr->sender_header.seq_num;
+	recvr->intact = intact;
+	worker->stats.streams_completed += 1;
+	if (!intact) {
+		worker->stats.streams_corrupt += 1;
+		fprintf(stderr, "receive: stream %d doesn't match the sender's digest\n", recvr->stream_id);
+	}
+	server_complete_stream(worker->server, recvr->output, intact);
+}
+
+// tells the sender whether the stream matched its digest, again for every copy of the eof
+void worker_answer_eof(worker_t *worker, recvr_t *recvr) {
+	recvr_packet_header_t recvr_header;
+	recvr_header.next_seq_num = recvr->next_seq_num;
+	recvr_header.sack_words = 0;
+	recvr_header.stream_id = recvr->stream_id;
+	recvr_header.loss_rate = 0;
+	recvr_header.flags = ACK_EOF | (recvr->intact ? 0 : ACK_CORRUPT);
+	recvr_header.ack_delay = 0;
+	recvr_header.timestamp = recvr->sender_header.timestamp;
+	recvr_queue_ack(recvr, &recvr_header, 0);
+	worker->linger_ns = worker->now_ns + (EOF_LINGER * 1000000ULL);
+}
+
+// gives the recvr and its ring back, the caller has unlinked it
+void worker_release(worker_t *worker, recvr_t *recvr) {
+	if (recvr->fwriter != NULL) {
+		recvr_checkpoint(recvr, worker->now); // a sender that comes back resumes from here
+	}
+	fwriter_delete(recvr->fwriter);
+	recvr->fwriter = NULL;
+	server_detach(worker->server, recvr->output);
+
+	recvr->next = worker->free_recvrs;
+	worker->free_recvrs = recvr;
+}
+
+// daemon: evicts streams that haven't had a packet in MAX_TIMEOUT, finished ones included
+void worker_sweep(worker_t *worker) {
+	for (unsigned int i = 0; i <= worker->stream_mask; i++) {
+		recvr_t **link = &worker->streams[i];
+		while (*link != NULL) {
+			recvr_t *recvr = *link;
+			if (worker->now - recvr->last_active < MAX_TIMEOUT) {
+				link = &recvr->next;
+				continue;
+			}
+
+			*link = recvr->next;
+			worker_release(worker, recvr);
+		}
+	}
+}
+
+// checkpoints the streams that moved since their last one, every CHECKPOINT_INTERVAL
+void worker_checkpoint(worker_t *worker) {
+	for (unsigned int i = 0; i <= worker->stream_mask; i++) {
+		for (recvr_t *recvr = worker->streams[i]; recvr != NULL; recvr = recvr->next) {
+			if (recvr->complete || worker->now - recvr->checkpoint_time < CHECKPOINT_INTERVAL) {
+				continue;
+			}
+			if (recvr->file_pos == recvr->checkpoint_pos && recvr->window_end == recvr->checkpoint_window_end) {
+				continue;
+			}
+			recvr_checkpoint(recvr, worker->now);
+		}
+	}
+}
+
+// stdout or a pipe: once packets stop coming the reader gets everything in order, not only whole flushes
+void worker_flush_streams(worker_t *worker) {
+	for (unsigned int i = 0; i <= worker->stream_mask; i++) {
+		for (recvr_t *recvr = worker->streams[i]; recvr != NULL; recvr = recvr->next) {
+			if (recvr->fwriter != NULL) {
+				fwriter_sync(recvr->fwriter);
+			}
+		}
+	}
+}
+
+void worker_delete(worker_t *worker) {
+	for (unsigned int i = 0; i <= worker->stream_mask; i++) {
+		while (worker->streams[i] != NULL) {
+			recvr_t *recvr = worker->streams[i];
+			worker->streams[i] = recvr->next;
+			worker_release(worker, recvr);
+		}
+	}
+	while (worker->free_recvrs != NULL) {
+		recvr_t *recvr = worker->free_recvrs;
+		worker->free_recvrs = recvr->next;
+		recvr_delete(recvr);
+	}
+	if (worker->stats.corrupt_packets > 0) {
+		fprintf(stderr, "receive: dropped %llu corrupt packets\n", worker->stats.corrupt_packets);
+	}
+	pool_delete(worker->rings);
+	free(worker->streams);
+	udp_delete(worker->udp);
+	free(worker);
+}
+
+void* receive(void *arg) {
+	worker_t *worker = arg;
+	udp_t *udp = worker->udp;
+	server_t *server = worker->server;
+	
+	// printf("\n\n");
+	long idle = 0; // microsecs since the last packet
+	while (!server_is_done(server) || monotonic_ns() < worker->linger_ns) {
+		int listen_result = worker_listen(worker);
+
+		worker->now_ns = monotonic_ns();
+		worker->now = worker->now_ns / 1000000000ULL;
+		if (worker->now != worker->last_sweep) {
+			if (server->dir != NULL) {
+				worker_sweep(worker);
+			}
+			worker_checkpoint(worker);
+			worker->last_sweep = worker->now;
+		}
+
+		if (listen_result == TIMED_OUT) {
+			if (worker->ack_due_ns != 0) {
+				// the ack timer, not an idle wait
+				worker_send_held_acks(worker);
+				udp_send_batch(udp);
+				continue;
+			}
+			if (server->fwriter_engine == FWRITER_STREAM) {
+				worker_flush_streams(worker);
+			}
+			if (server->dir != NULL) {
+				continue; // a daemon waits for senders indefinitely
+			}
+			idle += POLL_TIMEOUT;
+			if (idle >= MAX_TIMEOUT * 1000L * 1000L) {
+				fprintf(stderr, "receive: timed out\n");
+				break;
+			}
+			continue;
+		}
+		idle = 0;
+
+		for (int i = 0; i < listen_result; i++) {
+			// checked before anything in the header is trusted, even which stream it's for
+			if (sender_packet_verify(udp->batch_msg_recv[i], udp->batch_bytes_recv[i]) == -1) {
+				worker->stats.corrupt_packets += 1;
+				continue;
+			}
+			worker->stats.packets += 1;
+
+			if (worker_answer_probe(worker, i)) {
+				continue;
+			}
+
+			recvr_t *recvr = worker_stream(worker, i);
+			if (recvr == NULL) {
+				continue;
+			}
+			if (recvr->complete) {
+				// the answer to the eof was lost, anything else is a duplicate
+				if (recvr_load(recvr, i) == TRANSFER_COMPLETE) {
+					worker_answer_eof(worker, recvr);
+				}
+				continue;
+			}
+			recvr->arrival_ns = worker->now_ns;
+			recvr->last_active = worker->now;
+
+			if (recvr_load(recvr, i) == TRANSFER_COMPLETE) {
+				worker_finish_stream(worker, recvr);
+				worker_answer_eof(worker, recvr);
+				continue;
+			}
+
+			if (recvr->sender_header.flags & PACKET_KEEPALIVE) {
+				continue; // the stream is still there, that's all
+			}
+			if (recvr->sender_header.flags & PACKET_SYN) {
+				recvr_accept(recvr);
+				continue;
+			}
+			if (recvr->sender_header.flags & PACKET_RESUME) {
+				recvr_resume(recvr);
+				recvr_respond(recvr, worker->now_ns); // asked again, answered again
+				continue;
+			}
+			if (recvr->sender_header.flags & PACKET_SIGNATURES) {
+				recvr_send_signatures(recvr);
+				continue;
+			}
+			if (recvr->sender_header.flags & PACKET_MANIFEST) {
+				recvr_save_manifest(recvr);
+				continue;
+			}
+			if (recvr->output->directory && !recvr_tree_ready(recvr)) {
+				continue; // nowhere to put it until the manifest is in, the sender sends it again
+			}
+
+			if (recvr->sender_header.flags & PACKET_FEC) {
+				// an ack that didn't move would look like a loss to the sender, one that did goes at once
+				if (recvr_save_repair(recvr) > 0) {
+					recvr_respond(recvr, worker->now_ns);
+				}
+				continue;
+			}
+			seq_t expected = recvr->next_seq_num;
+			recvr_track_loss(recvr);
+			recvr_save_data(recvr);
+			recvr_fec_check(recvr, recvr->sender_header.seq_num);
+			worker_ack(worker, recvr, expected);
+		}
+
+		if (worker->ack_due_ns != 0 && worker->now_ns >= worker->ack_due_ns) {
+			worker_send_held_acks(worker);
+		}
+
+		// an ack per ack_every packets, and one syscall per batch
+		udp_send_batch(udp);
+		// printf("\n");
+	}
+	
+	return NULL;
+}
+
+// what -j writes at exit and SIGUSR1 dumps at any time, json with each thread's counters and histograms and their sum
+typedef struct report {
+	pthread_mutex_t lock;
+	worker_t **workers;
+	int worker_count;
+	ull64_t start_time_ns;
+	char *path; // NULL for stderr, - for stdout
+	int closed; // written for the last time, the workers are going away
+} report_t;
+
+report_t* report_create(worker_t **workers, int worker_count, char *path) {
+	report_t *report = malloc(sizeof(report_t));
+	pthread_mutex_init(&report->lock, NULL);
+	report->workers = workers;
+	report->worker_count = worker_count;
+	report->start_time_ns = monotonic_ns();
+	report->path = path;
+	report->closed = 0;
+	return report;
+}
+
+// to a temporary file renamed over the last one, so a reader never sees half of it
+void report_write(report_t *report, int final) {
+	pthread_mutex_lock(&report->lock);
+	if (report->closed) {
+		pthread_mutex_unlock(&report->lock);
+		return;
+	}
+
+	FILE *file = stderr;
+	char temp_path[4096];
+	if (report->path != NULL && strcmp(report->path, "-") == 0) {
+		file = stdout;
+	} else if (report->path != NULL) {
+		snprintf(temp_path, sizeof(temp_path), "%s.tmp", report->path);
+		file = fopen(temp_path, "w");
+		if (file == NULL) {
+			perror("report_write");
+			pthread_mutex_unlock(&report->lock);
+			return;
+		}
+	}
+
+	recvr_stats_t *total = calloc(1, sizeof(recvr_stats_t));
+	for (int i = 0; i < report->worker_count; i++) {
+		recvr_stats_add(total, &report->workers[i]->stats);
+	}
+
+	stats_json_t json;
+	stats_json_begin(&json, file);
+	stats_json_string(&json, "program", "reliable_receiver");
+	stats_json_bool(&json, "final", final);
+	stats_json_double(&json, "secs", (monotonic_ns() - report->start_time_ns) / 1e9);
+	recvr_stats_write(total, &json, "total");
+	stats_json_array(&json, "threads");
+	for (int i = 0; i < report->worker_count; i++) {
+		recvr_stats_write(&report->workers[i]->stats, &json, NULL);
+	}
+	stats_json_close(&json);
+	stats_json_close(&json);
+	free(total);
+
+	if (file != stderr && file != stdout) {
+		fclose(file);
+		if (rename(temp_path, report->path) == -1) {
+			perror("report_write: rename");
+		}
+	}
+	report->closed = final;
+	pthread_mutex_unlock(&report->lock);
+}
+
+void report_signal(void *arg) {
+	report_write(arg, 0);
+}
+
+// the last dump if -j asked for one, SIGUSR1 is ignored from here on
+// the report itself stays, the watcher thread has it until exit
+void report_finish(report_t *report, int write) {
+	if (write) {
+		report_write(report, 1);
+	}
+	pthread_mutex_lock(&report->lock);
+	report->closed = 1;
+	pthread_mutex_unlock(&report->lock);
+}
+
+int main(int argc, char** argv)
+{	
+	int udp_flags = 0;
+	int fwriter_engine = FWRITER_PWRITEV;
+	int use_uring = 0;
+	int thread_count = 1;
+	int daemon_mode = 0;
+	int max_connections = MAX_CONNECTIONS;
+	char *stats_path = NULL;
+	char *trace_path = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "ow:un:dc:j:t:")) != -1) {
+		switch (opt) {
+			case 'o':
+				udp_flags |= UDP_FLAG_GRO; // receive offload, falls back if unsupported
+				break;
+			case 'w':
+				if (strcmp(optarg, "stdio") == 0) {
+					fwriter_engine = FWRITER_STDIO;
+				} else if (strcmp(optarg, "pwritev") == 0) {
+					fwriter_engine = FWRITER_PWRITEV;
+				} else if (strcmp(optarg, "direct") == 0) {
+					fwriter_engine = FWRITER_DIRECT;
+				} else {
+					argc = -1;
+				}
+				break;
+			case 'u':
+				use_uring = 1; // io_uring for the socket and disk flushes, falls back to syscalls
+				break;
+			case 'n':
+				thread_count = atoi(optarg); // receive threads, each with its own socket on the port
+				if (thread_count < 1) {
+					argc = -1;
+				}
+				break;
+			case 'd':
+				daemon_mode = 1; // serve senders until SIGINT/SIGTERM, one file per transfer in the directory
+				break;
+			case 'c':
+				max_connections = atoi(optarg); // streams a thread serves at once
+				if (max_connections < 1) {
+					argc = -1;
+				}
+				break;
+			case 'j':
+				stats_path = optarg; // json stats at exit, - for stdout, SIGUSR1 dumps them there any time
+				break;
+			case 't':
+				trace_path = optarg; // packet events, dumped at exit or on a crash, trace_decode reads them
+				break;
+			default:
+				argc = -1; // print usage
+		}
+	}
+
+	if(argc - optind != 2)
+	{
+		fprintf(stderr, "usage: %s [-o] [-w stdio|pwritev|direct] [-u] [-n threads] [-d [-c streams]] [-j stats.json] [-t trace_file] UDP_port filename_to_write|-|directory\n\n", argv[0]);
+		exit(1);
+	}
+	argv += optind - 1;
+	
+	char *port = argv[1];
+	char *filename = argv[2];
+
+	fec_init();
+	crc32c_init();
+
+	server_t server;
+	memset(&server, 0, sizeof(server));
+	server.fwriter_engine = fwriter_engine;
+	server.use_uring = use_uring;
+	server.max_connections = max_connections;
+	pthread_mutex_init(&server.lock, NULL);
+
+	if (daemon_mode) {
+		server.dir = filename;
+
+		// no SA_RESTART, a blocked receive returns and the loop sees the flag
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = request_stop;
+		sigaction(SIGINT, &action, NULL);
+		sigaction(SIGTERM, &action, NULL);
+	} else if (output_is_stream(filename)) {
+		// in order bytes go out as the window moves past them, there's nothing to create, truncate or resume
+		if (strcmp(filename, "-") == 0 && stats_path != NULL && strcmp(stats_path, "-") == 0) {
+			fprintf(stderr, "main: the data goes to stdout, the stats can't go there too\n");
+			exit(1);
+		}
+		server.fwriter_engine = FWRITER_STREAM;
+		struct in_addr any = { INADDR_ANY };
+		server.output = output_create(filename, any, 0);
+	} else if (output_is_directory(filename)) {
+		// a directory sent here is made in it from its manifest, files already there are overwritten
+		struct in_addr any = { INADDR_ANY };
+		server.output = output_create(filename, any, 0);
+		server.output->directory = 1;
+	} else {
+		// streams write at their own offsets, so the file is created (and truncated) once up front
+		// unless there's a checkpoint, then what's there may be resumed
+		char checkpoint[4096];
+		snprintf(checkpoint, sizeof(checkpoint), "%s.ckpt", filename);
+		int resumable = access(checkpoint, F_OK) == 0;
+
+		// otherwise the old copy is replaced by a new file, and kept mapped for a sender sending deltas
+		int base_fd = -1;
+		struct stat st;
+		if (!resumable && stat(filename, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			base_fd = open(filename, O_RDONLY);
+			if (base_fd != -1 && unlink(filename) == -1) {
+				perror("main: replacing output file");
+				exit(1);
+			}
+		}
+
+		int flags = O_WRONLY | O_CREAT;
+		if (!resumable) {
+			flags |= O_TRUNC;
+		}
+		int fd = open(filename, flags, base_fd != -1 ? st.st_mode & 07777 : 0666);
+		if (fd == -1) {
+			perror("main: creating output file");
+			exit(1);
+		}
+		close(fd);
+
+		struct in_addr any = { INADDR_ANY };
+		server.output = output_create(filename, any, 0);
+		if (base_fd != -1) {
+			output_set_base(server.output, base_fd);
+			close(base_fd);
+		}
+	}
+
+	// after the daemon's handlers, a daemon stopped by SIGINT dumps on its way out instead
+	if (trace_path != NULL) {
+		trace_init(trace_path);
+	}
+
+	worker_t **workers = malloc(thread_count * sizeof(worker_t*));
+	for (int i = 0; i < thread_count; i++) {
+		// creating the udp
+		size_t recv_buffer_size = MAX_PACKET_SIZE; // whatever chunk size a sender settles on
+		size_t send_buffer_size = BASE_PACKET_SIZE; // acks
+		udp_t *udp = udp_create(port, send_buffer_size, recv_buffer_size, udp_flags);
+		udp_enable_batch(udp, BATCH_SIZE);
+
+		// a whole window arriving at once, it's the same bytes at any chunk size, and an ack for each of its packets
+		size_t window_bytes = (size_t)MAX_WINDOW_SIZE * BASE_PACKET_SIZE;
+		if (udp_set_buffers(udp, window_bytes, window_bytes) == -1 && i == 0) {
+			fprintf(stderr, "main: socket buffers clamped to %d/%d of %zu bytes (send/recv), raise net.core.wmem_max/rmem_max\n",
+				udp->send_buffer_size, udp->recv_buffer_size, window_bytes);
+		}
+
+		// short timeout, so a thread notices when the streams on other threads are done
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = POLL_TIMEOUT;
+		
+		if (udp_set_timeout(udp, &tv) < 0) {
+			perror("main: setting timeout failed");
+		}
+
+		if (use_uring && udp_enable_uring(udp) == -1 && i == 0) {
+			fprintf(stderr, "main: io_uring not available for the socket, using plain syscalls\n");
+		}
+
+		char trace_name[sizeof("thread-") + 10]; // any int, trace_create keeps what fits in a ring's name
+		snprintf(trace_name, sizeof(trace_name), "thread-%d", i);
+		workers[i] = worker_create(&server, udp, trace_create(trace_name));
+	}
+
+	// before the other threads start, so SIGUSR1 only reaches the watcher
+	report_t *report = report_create(workers, thread_count, stats_path);
+	stats_watch(report_signal, report);
+
+	// the calling thread is the first worker
+	for (int i = 1; i < thread_count; i++) {
+		if (pthread_create(&workers[i]->thread, NULL, receive, workers[i]) != 0) {
+			perror("main: pthread_create");
+			exit(1);
+		}
+	}
+	receive(workers[0]);
+
+	// clean up once every thread is done, a closed socket would send its packets to the others
+	// a daemon drops the transfers still in progress along with their last stream
+	for (int i = 1; i < thread_count; i++) {
+		pthread_join(workers[i]->thread, NULL);
+	}
+	report_finish(report, stats_path != NULL);
+	for (int i = 0; i < thread_count; i++) {
+		worker_delete(workers[i]);
+	}
+	free(workers);
+
+	// a transfer whose digest didn't match is on disk, but the exit status says not to trust it
+	// nor one that timed out, the streams that never got to their eof were never checked
+	int status = 0;
+	if (server.output != NULL) {
+		status = server.output->streams_corrupt > 0 || !output_is_complete(server.output);
+		output_delete(server.output);
+	}
+	pthread_mutex_destroy(&server.lock);
+	
+	return status;
 }
@@ -1,49 +1,176 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/random.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "udp.h"
-
-#define MAX_PACKET_SIZE 1472 // max size for payload MTU - udp header
+#include "sack.h"
+#include "cc.h"
+#include "fec.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "blake2b.h"
+#include "delta.h"
+#include "stats.h"
+#include "trace.h"
+#include "tree.h"
+
+#define BASE_PACKET_SIZE 1472 // 1500 byte mtu - ip and udp headers, every path carries it, acks never exceed it
+#define MAX_PACKET_SIZE 8972 // 9000 byte jumbo frames - ip and udp headers
 #define MAX_TIMEOUT 10 * 1000 * 1000 // 10 secs in microseconds
-#define MAX_WINDOW_SIZE 64 // go back n, sliding window
+#define MAX_WINDOW_SIZE 32768 // selective repeat, sliding window
 #define MAX_RTT 80 * 1000 // 80 ms in microsecs
-
-#define EOF_SEQ_NUM -5
+#define MIN_RTO 4 * 1000 // 4 ms in microsecs, about what SO_RCVTIMEO rounded up to
+#define DUP_ACK_THRESHOLD 3 // packets sacked past a hole before it's fast retransmitted
+#define ACK_DELAY 4 * 1000 // us the recvr may hold an ack back, the rto allows for it
+#define ACK_FRACTION 4 // acks asked for per window
+#define MAX_ACK_EVERY 64 // packets one ack may cover, the recvr's limit too
+
+#define PACING_BURST 8 // packets a late pacing timer may catch up at once
+
+#define MAX_STREAMS 256 // stream ids are one byte
+#define STREAM_ALIGN 4096 // what O_DIRECT needs on the receiver, segments start on it when that costs little
+#define DIGEST_SIZE 16 // blake2b, of each chunk and of a stream's chunk digests in file order
+#define BATCH_SIZE 64 // packets per sendmmsg/recvmmsg
+
+#define PACKET_EOF 0x1 // header flag, last packet of the transfer, the stream's digest follows
+#define PACKET_FEC 0x2 // repair packet for the block starting at seq_num
+#define PACKET_RETRANSMIT 0x4 // not the first time this seq num is sent
+#define PACKET_COMPRESSED 0x8 // payload is the chunk run through lz_compress
+#define PACKET_RESUME 0x20 // asks where the recvr's checkpoint has the stream, offset is the segment start
+#define PACKET_SIGNATURES 0x40 // asks for a page of the recvr's block signatures, the payload is the first block
+#define PACKET_DELTA 0x80 // payload is the chunk as copies out of the recvr's old copy and literals
+#define PACKET_PROBE 0x100 // path mtu probe, padded to offset bytes, the recvr echoes the size it got
+#define PACKET_KEEPALIVE 0x200 // nothing in flight while a stream's source is idle, keeps the recvr from timing out
+#define PACKET_SYN 0x400 // opens a stream: seq_num is its first, offset its segment start, a syn_t follows
+#define PACKET_MANIFEST 0x800 // a page of a directory's manifest, offset is where it goes in it
+
+#define ACK_RESUME 0x1 // ack flag, answers PACKET_RESUME: the stream picks up at next_seq_num
+#define ACK_SIGNATURES 0x2 // ack flag, answers PACKET_SIGNATURES: a signature_page_t and its signatures follow
+#define ACK_PROBE 0x4 // ack flag, answers PACKET_PROBE: the probe's size follows as an unsigned int
+#define ACK_SYN 0x8 // ack flag, answers PACKET_SYN: a syn_t with what the recvr takes follows
+#define ACK_MANIFEST 0x10 // ack flag, answers PACKET_MANIFEST: next_seq_num is the page's index
+#define ACK_EOF 0x20 // ack flag, answers PACKET_EOF: the stream matched the digest, unless ACK_CORRUPT is set too
+#define ACK_CORRUPT 0x40 // with ACK_EOF, what the recvr has doesn't match
+
+#define SYN_FEC 0x1 // syn features, what the sender asks for, the answer keeps what the recvr goes along with
+#define SYN_COMPRESS 0x2
+#define SYN_DELTA 0x4 // the recvr drops it when it has no old copy
+#define SYN_RESUME 0x8 // the recvr drops it when it has no checkpoint
+#define SYN_STREAM 0x10 // the source is a stream, its size is known at its end
+#define SYN_TREE 0x20 // the source is a directory, its manifest follows the syn, the recvr drops it if it isn't writing one
+
+#define SYN_RETRY 200 // ms between syns
+#define SYN_ATTEMPTS 50 // then the recvr is taken to be gone
+
+#define EOF_RETRY 200 // ms between eofs at most, the rto when it's shorter
+#define EOF_ATTEMPTS 50 // then the stream is left unverified, the recvr only stays a while after its answer
+
+#define RESUME_RETRY 200 // ms between resume requests
+#define RESUME_ATTEMPTS 150 // then the recvr is taken to be gone, it reads back and hashes what it has before answering
+
+#define PROBE_RETRY 100 // ms a round of path mtu probes waits for answers
+#define PROBE_ATTEMPTS 3 // rounds, then packets stay at BASE_PACKET_SIZE
+
+#define SIGNATURE_BURST 32 // page requests out at once
+#define SIGNATURE_RETRY 200 // ms without a reply before the missing pages are asked for again
+#define SIGNATURE_ATTEMPTS 50
+
+#define MANIFEST_BURST 32 // pages out at once
+#define MANIFEST_RETRY 200 // ms without an ack before the unacked pages go again
+#define MANIFEST_ATTEMPTS 50
+
+#define FEC_BLOCK 32 // data chunks per fec block
+#define FEC_MARGIN 2 // repairs cover this many times the loss rate
+#define FEC_INITIAL_LOSS 3 // in 1/256ths, until the recvr has an estimate
+
+#define COMPRESS_PROBE_SIZE (64 * 1024) // bytes at the start of a stream the entropy check looks at
+#define COMPRESS_MAX_ENTROPY 7.5 // bits per byte, above this the stream is sent as is
+#define COMPRESS_SAMPLE 256 // chunks per check of what compression saves
+#define COMPRESS_MIN_SAVING 8 // a sample has to save 1/8 of its bytes, or compression pauses
+#define COMPRESS_BACKOFF 4096 // chunks sent as is before compression is tried again
+
+#define CACHE_HUGE_PAGE (2 * 1024 * 1024) // the cache is mapped in multiples of it, what MAP_HUGETLB needs
+
+#define STREAM_MAX_SIZE (1ULL << 62) // a stream's transfer size until its end is read
+#define KEEPALIVE_INTERVAL 1000 // ms a stream's source can be idle before the recvr hears from the sender anyway
 
 typedef unsigned long long int ull64_t; 
 
 /*** Sequence Utility Functions ***/
-typedef short seq_t;
-#define MAX_SEQ 256
+typedef unsigned int seq_t; // 32 bits, wraps around on its own
 
 seq_t safe_increment(seq_t current) {
-	current = (current + 1) % MAX_SEQ;
-	return current;
+	return current + 1;
 }
 
 seq_t safe_subtract(seq_t a, seq_t b) {
-	seq_t diff = (a - b) % MAX_SEQ;
-
-	if (diff < 0) {
-		diff += MAX_SEQ;
-	}
+	return a - b;
+}
 
-	return diff;
+seq_t safe_add(seq_t current, seq_t amount) {
+	return current + amount;
 }
 
-int has_wrapped(seq_t next, seq_t curr) {
-	return (next - curr) < 0;
+// serial number comparison, a comes before b (less than half the seq space behind)
+int seq_before(seq_t a, seq_t b) {
+	return (int)(a - b) < 0;
 }
 
 /*** File Functions ***/
 
 typedef struct file {
 	FILE *fp;
+
+	// mmap backend, map is NULL when reading through stdio
+	char *map;
+	ull64_t map_size;
+	ull64_t pos; // read position in the map, moving it is just arithmetic
+
+	// stream: stdin or a pipe, read once front to back without blocking, pos counts what was taken
+	int stream;
+	int stream_flags; // the fd's flags before O_NONBLOCK, put back at the end
+	size_t stream_fill; // bytes of the next chunk read so far
+	int stream_eof;
+
+	// directory: its files back to back, read through handles of the scanned tree, fp is NULL
+	tree_handles_t *tree;
 } file_t;
 
-file_t* file_create(char *filename) {
-	FILE *fp = fopen(filename, "r"); // input files are read only
+// - is stdin, a pipe can't seek or tell its size either
+int file_is_stream(char *filename) {
+	struct stat st;
+	if (strcmp(filename, "-") == 0) {
+		return 1;
+	}
+	return stat(filename, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode));
+}
+
+// which file, at which size and modification, is being sent, 0 if it can't be told
+// a recvr only resumes from a checkpoint of the same one
+ull64_t file_identity(char *filename, ull64_t transfer_size) {
+	struct stat st;
+	if (stat(filename, &st) == -1) {
+		return 0;
+	}
+	ull64_t fields[6] = { st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, transfer_size };
+	ull64_t identity;
+	blake2b(&identity, sizeof(identity), fields, sizeof(fields));
+	return identity;
+}
+
+file_t* file_create(char *filename, int use_mmap) {
+	int stream = file_is_stream(filename);
+	FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r"); // input files are read only
 	if (fp == NULL) {
 		perror("file_create");
 		exit(1);
@@ -51,11 +178,61 @@ file_t* file_create(char *filename) {
 
 	file_t *file = malloc(sizeof(file_t));
 	file->fp = fp;
+	file->map = NULL;
+	file->map_size = 0;
+	file->pos = 0;
+	file->stream = stream;
+	file->stream_flags = 0;
+	file->stream_fill = 0;
+	file->stream_eof = 0;
+	file->tree = NULL;
+
+	if (stream) {
+		// the event loop waits for it to be readable, a read never holds up the acks
+		file->stream_flags = fcntl(fileno(fp), F_GETFL);
+		if (file->stream_flags == -1 || fcntl(fileno(fp), F_SETFL, file->stream_flags | O_NONBLOCK) == -1) {
+			perror("file_create: O_NONBLOCK");
+			exit(1);
+		}
+		return file;
+	}
+
+	if (use_mmap) {
+		struct stat st;
+		if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+			if (map != MAP_FAILED) {
+				// chunks are read front to back, let the kernel read ahead aggressively
+				madvise(map, st.st_size, MADV_SEQUENTIAL);
+				madvise(map, st.st_size, MADV_WILLNEED);
+				file->map = map;
+				file->map_size = st.st_size;
+			} else {
+				perror("file_create: mmap, reading with stdio");
+			}
+		}
+	}
+
+	return file;
+}
 
+// a directory's files as one, every stream gets its own handles on the tree
+file_t* file_create_tree(tree_t *tree) {
+	file_t *file = calloc(1, sizeof(file_t));
+	file->map_size = tree->size;
+	file->tree = tree_handles_create(tree, 0);
 	return file;
 }
 
+// mmap, streams and directories keep their own position instead of the stdio one
+int file_is_positional(file_t *file) {
+	return file->map != NULL || file->stream || file->tree != NULL;
+}
+
 ull64_t file_get_size(file_t *file) {
+	if (file_is_positional(file)) {
+		return file->map_size;
+	}
 
 	fseek(file->fp, 0L, SEEK_END);
 	long size = ftell(file->fp);
@@ -69,6 +246,10 @@ ull64_t file_get_size(file_t *file) {
 }
 
 ull64_t file_get_position(file_t *file) {
+	if (file_is_positional(file)) {
+		return file->pos;
+	}
+
 	long position = ftell(file->fp);
 	if (position < 0) {
 		perror("file_get_position");
@@ -78,7 +259,39 @@ ull64_t file_get_position(file_t *file) {
 	return position;
 }
 
+// zero copy read for the mmap backend, points chunk into the mapping and advances
+ull64_t file_map_chunk(file_t *file, const char **chunk, size_t chunk_size) {
+	ull64_t bytes_read = 0;
+	if (file->pos < file->map_size) {
+		bytes_read = file->map_size - file->pos;
+	}
+	if (bytes_read > chunk_size) {
+		bytes_read = chunk_size;
+	}
+
+	*chunk = file->map + file->pos;
+	file->pos += bytes_read;
+	return bytes_read;
+}
+
 ull64_t file_read(file_t *file, char *buffer, size_t buffer_size) {
+	if (file->map != NULL) {
+		const char *chunk;
+		ull64_t bytes_read = file_map_chunk(file, &chunk, buffer_size);
+		memcpy(buffer, chunk, bytes_read);
+		return bytes_read;
+	}
+
+	if (file->tree != NULL) {
+		ssize_t bytes_read = tree_pread(file->tree, buffer, buffer_size, file->pos);
+		if (bytes_read < 0) {
+			fprintf(stderr, "file_read: can't read the directory at %llu\n", file->pos);
+			return 0;
+		}
+		file->pos += bytes_read;
+		return bytes_read;
+	}
+
 	size_t item_size = 1; // 1 byte
 	size_t item_count = buffer_size;
 
@@ -100,14 +313,81 @@ ull64_t file_read(file_t *file, char *buffer, size_t buffer_size) {
 	return bytes_read;
 }
 
+// reads at offset without moving the read position, e.g. a block back for fec
+ull64_t file_pread(file_t *file, char *buffer, size_t size, ull64_t offset) {
+	if (file->map != NULL) {
+		if (offset >= file->map_size) {
+			return 0;
+		}
+		if (offset + size > file->map_size) {
+			size = file->map_size - offset;
+		}
+		memcpy(buffer, file->map + offset, size);
+		return size;
+	}
+
+	ssize_t bytes_read;
+	if (file->tree != NULL) {
+		bytes_read = tree_pread(file->tree, buffer, size, offset);
+	} else {
+		bytes_read = pread(fileno(file->fp), buffer, size, offset);
+	}
+	if (bytes_read < 0) {
+		perror("file_pread");
+		return 0;
+	}
+	return bytes_read;
+}
+
+// tops buffer up towards size bytes with what the stream has, never blocking
+// returns 1 once it holds size bytes or the stream has ended, stream_fill says how many, 0 if it has to wait
+int file_stream_fill(file_t *file, char *buffer, size_t size) {
+	while (file->stream_fill < size && !file->stream_eof) {
+		ssize_t bytes_read = read(fileno(file->fp), buffer + file->stream_fill, size - file->stream_fill);
+		if (bytes_read > 0) {
+			file->stream_fill += bytes_read;
+		} else if (bytes_read == 0) {
+			file->stream_eof = 1;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		} else if (errno != EINTR) {
+			perror("file_stream_fill");
+			exit(1);
+		}
+	}
+	return 1;
+}
+
+// the chunk file_stream_fill put together, the next one starts empty
+ull64_t file_stream_take(file_t *file) {
+	ull64_t bytes_read = file->stream_fill;
+	file->pos += bytes_read;
+	file->stream_fill = 0;
+	return bytes_read;
+}
+
 void file_delete(file_t *file) {
 	if (file != NULL) {
-		fclose(file->fp);
+		if (file->map != NULL) {
+			munmap(file->map, file->map_size);
+		}
+		if (file->stream) {
+			fcntl(fileno(file->fp), F_SETFL, file->stream_flags); // stdin may be shared, e.g. a terminal
+		}
+		if (file->fp != NULL) {
+			fclose(file->fp);
+		}
+		tree_handles_delete(file->tree);
 		free(file);
 	}
 }
 
 void file_moveto(file_t *file, ull64_t pos) {
+	if (file_is_positional(file)) {
+		file->pos = pos;
+		return;
+	}
+
 	FILE *fp = file->fp;
 	int fseek_result = fseek(fp ,pos, SEEK_SET);
 	if (fseek_result == -1) {
@@ -116,6 +396,11 @@ void file_moveto(file_t *file, ull64_t pos) {
 }
 
 void file_moveby(file_t *file, ull64_t offset) {
+	if (file_is_positional(file)) {
+		file->pos += offset;
+		return;
+	}
+
 	FILE *fp = file->fp;
 	int fseek_result = fseek(fp ,offset, SEEK_CUR);
 	if (fseek_result == -1) {
@@ -126,19 +411,61 @@ void file_moveby(file_t *file, ull64_t offset) {
 /*** Packet Header ***/
 typedef struct sender_packet_header {
 	seq_t seq_num;
+	unsigned short flags;
+	unsigned char stream_id;
+	unsigned char stream_count; // streams the file is split into
+	unsigned int conn_id; // random per transfer, tells concurrent senders apart
+	unsigned char fec_count; // repair packets: data chunks in the block
+	unsigned char fec_index; // repair packets: which repair of the block
+	unsigned short chunk_size; // payload of a full chunk, the same for the whole transfer
+	unsigned int checksum; // crc32c of the payload, then the header with this field 0
 	struct timeval timestamp;
+	ull64_t offset; // file offset of the data
+	unsigned short ack_every; // data packets: how many one ack may cover, 1 acks this one at once
 } sender_packet_header_t;
 
 typedef struct recvr_packet_header {
 	seq_t expected_seq_num;
+	unsigned short sack_words; // window bitmap words after the header, bit i is expected_seq_num + i
+	unsigned char stream_id; // stream being acked
+	unsigned char loss_rate; // 0 until the recvr has an estimate, then 1 + originals lost in 1/256ths
+	unsigned int checksum; // crc32c of the sack words, then the header with this field 0
+	unsigned char flags;
+	unsigned short ack_delay; // us between the echoed packet arriving and the ack going out
 	struct timeval timestamp;
-	ull64_t window;
 } recvr_packet_header_t;
 
-const ull64_t max_file_chunk_size = MAX_PACKET_SIZE - sizeof(sender_packet_header_t);
+#define BASE_CHUNK_SIZE (BASE_PACKET_SIZE - sizeof(sender_packet_header_t))
+
+// set once in main from the packet size the path mtu probe settled on, before any stream starts
+ull64_t max_file_chunk_size = BASE_CHUNK_SIZE;
+
+// after the header of a PACKET_SYN and of the ACK_SYN answering it
+typedef struct syn {
+	ull64_t transfer_size; // of the whole transfer, 0 while it isn't known, the recvr reserves that much
+	unsigned int max_window; // chunks, the least of the two sides' goes
+	unsigned int features; // SYN_*
+	ull64_t manifest_size; // SYN_TREE: bytes of manifest the recvr is to expect, 0 otherwise
+	ull64_t source_id; // file_identity of a regular file, the recvr ties its checkpoint to it, 0 otherwise
+} syn_t;
+
+// after the header of an ACK_SIGNATURES ack, then count signatures, the recvr signs its copy in chunk sized blocks
+typedef struct signature_page {
+	ull64_t base_size; // of the recvr's copy
+	unsigned int block_count; // signed blocks in all
+	unsigned int first_block;
+	unsigned int count;
+} signature_page_t;
+
+#define SIGNATURES_PER_PAGE ((BASE_PACKET_SIZE - sizeof(recvr_packet_header_t) - sizeof(signature_page_t)) / sizeof(delta_signature_t))
+
+#define MAX_SACK_WORDS ((BASE_PACKET_SIZE - sizeof(recvr_packet_header_t)) / sizeof(ull64_t))
 
 void sender_packet_header_load(sender_packet_header_t* packet_header, seq_t seq_num) {
 	packet_header->seq_num = seq_num;
+	packet_header->flags = 0;
+	packet_header->chunk_size = max_file_chunk_size; // the recvr takes a stream's from its first packet
+	packet_header->ack_every = 1;
 	
 	int result = gettimeofday(&packet_header->timestamp, NULL);
 	if (result == -1) {
@@ -146,34 +473,237 @@ void sender_packet_header_load(sender_packet_header_t* packet_header, seq_t seq_
 	}
 }
 
+// fills in the checksum of the header at msg, given the crc of the payload that follows it
+void sender_packet_seal(char *msg, unsigned int payload_crc) {
+	sender_packet_header_t packet_header;
+	memcpy(&packet_header, msg, sizeof(sender_packet_header_t));
+	packet_header.checksum = 0;
+	packet_header.checksum = crc32c(payload_crc, &packet_header, sizeof(sender_packet_header_t));
+	memcpy(msg, &packet_header, sizeof(sender_packet_header_t));
+}
+
+// checks an ack's checksum, 0 if it was corrupted on the way
+int recvr_packet_verify(const char *msg, ssize_t size) {
+	recvr_packet_header_t header;
+	memcpy(&header, msg, sizeof(recvr_packet_header_t));
+	unsigned int checksum = header.checksum;
+	header.checksum = 0;
+
+	unsigned int crc = crc32c(0, msg + sizeof(recvr_packet_header_t), size - sizeof(recvr_packet_header_t));
+	return crc32c(crc, &header, sizeof(recvr_packet_header_t)) == checksum;
+}
+
+/*** Retransmission Cache ***/
+
+// every packet in the window as it first went out, so a resend needs no seek, read, compression or delta again
+// indexed by seq num, a slot is taken over once the window has moved a whole cache past it
+typedef struct cache_entry {
+	seq_t seq_num;
+	int valid;
+	unsigned short flags; // PACKET_COMPRESSED or PACKET_DELTA, as it was sent
+	unsigned int payload_crc;
+	ull64_t file_position;
+	ull64_t file_data_size; // of the chunk in the file
+	ull64_t data_size; // what goes after the header
+	const char *payload; // the slot's buffer, or the file mapping for a chunk sent as is
+} cache_entry_t;
+
+typedef struct cache {
+	cache_entry_t *entries;
+	char *buffers; // a chunk per entry, in one mapping
+	size_t buffer_size;
+	size_t map_size;
+	int count;
+	seq_t first_seq_num; // slots count from the stream's first seq num, wherever in the seq space it starts
+	int huge; // on reserved huge pages, otherwise transparent ones if the kernel hands them out
+} cache_t;
+
+// count chunks of chunk_size, NULL if they can't be mapped and resends read the file again
+cache_t* cache_create(int count, size_t chunk_size, seq_t first_seq_num) {
+	cache_t *cache = malloc(sizeof(cache_t));
+	cache->buffer_size = (chunk_size + 63) & ~(size_t)63; // cache line aligned
+	cache->map_size = ((count * cache->buffer_size) + CACHE_HUGE_PAGE - 1) & ~(size_t)(CACHE_HUGE_PAGE - 1);
+	cache->count = count;
+	cache->first_seq_num = first_seq_num;
+	cache->huge = 1;
+	cache->buffers = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (cache->buffers == MAP_FAILED) {
+		// none reserved, a tlb entry per 4KB page of a window is what this is meant to avoid
+		cache->huge = 0;
+		cache->buffers = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (cache->buffers == MAP_FAILED) {
+			perror("cache_create: mmap, resending from the file");
+			free(cache);
+			return NULL;
+		}
+		madvise(cache->buffers, cache->map_size, MADV_HUGEPAGE);
+	}
+	cache->entries = calloc(count, sizeof(cache_entry_t));
+	return cache;
+}
+
+int cache_slot(cache_t *cache, seq_t seq_num) {
+	return safe_subtract(seq_num, cache->first_seq_num) % cache->count;
+}
+
+// seq_num's packet, NULL if it was never cached or its slot has been taken over
+cache_entry_t* cache_lookup(cache_t *cache, seq_t seq_num) {
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache_entry_t *entry = &cache->entries[cache_slot(cache, seq_num)];
+	return entry->valid && entry->seq_num == seq_num ? entry : NULL;
+}
+
+// the buffer for seq_num's payload, whatever the slot held before is dropped
+char* cache_claim(cache_t *cache, seq_t seq_num) {
+	int slot = cache_slot(cache, seq_num);
+	cache->entries[slot].valid = 0;
+	return cache->buffers + (slot * cache->buffer_size);
+}
+
+// the packet sealed at msg, its payload where it stays put until the slot is taken over
+void cache_store(cache_t *cache, seq_t seq_num, const char *msg, const char *payload, ull64_t data_size, unsigned int payload_crc,
+	ull64_t file_data_size) {
+	sender_packet_header_t packet_header;
+	memcpy(&packet_header, msg, sizeof(sender_packet_header_t));
+
+	cache_entry_t *entry = &cache->entries[cache_slot(cache, seq_num)];
+	entry->seq_num = seq_num;
+	entry->valid = 1;
+	entry->flags = packet_header.flags & (PACKET_COMPRESSED | PACKET_DELTA);
+	entry->payload_crc = payload_crc;
+	entry->file_position = packet_header.offset;
+	entry->file_data_size = file_data_size;
+	entry->data_size = data_size;
+	entry->payload = payload;
+}
+
+void cache_delete(cache_t *cache) {
+	if (cache != NULL) {
+		munmap(cache->buffers, cache->map_size);
+		free(cache->entries);
+		free(cache);
+	}
+}
+
 /*** Sender Functions ***/
 
 typedef struct sender {
 	udp_t *udp;
 	file_t *file;
 	
-	ull64_t transfer_size;
+	ull64_t transfer_size; // one past the last byte to send
+	ull64_t transfer_start;
+	ull64_t total_size; // of the whole transfer, every stream's segment, 0 for a stream
+
+	int stream_id;
+	int stream_count;
+	unsigned int conn_id;
 	
-	seq_t start_seq_num; // current sequence number
-	seq_t end_seq_num;
+	seq_t first_seq_num; // seq num of the first chunk, fec blocks count from here
+	seq_t start_seq_num; // oldest unacked sequence number
+	seq_t end_seq_num; // next sequence number to send
 	ull64_t start_file_pos;
 
 	seq_t last_ack;
-	ull64_t recvr_window;
-
-	int window_size; // max amount of packets sent
-	int optimal_window_size;
-
-	int packets_sent; // actual amount of packets sent
-	int packets_recv;
+	ull64_t recvr_window[MAX_SACK_WORDS]; // sack bitmap from the last ack, bit i is last_ack + i
+	int recvr_window_words;
+
+	cc_t *cc; // congestion control, owns the window
+
+	int sacked_count; // packets past the hole at last_ack that say it's lost
+	int sacked_total; // set bits in recvr_window
+	int ack_every; // what data packets ask the recvr for, set per window
+	int in_recovery; // fast recovery, until recover_seq_num is acked
+	seq_t recover_seq_num;
+	seq_t retransmit_seq_num; // holes before this went out again in this recovery
+	seq_t timeout_seq_num; // highest_seq_num when the last timeout went back
+
+	ull64_t packets_sent; // actual amount of packets sent
+	ull64_t packets_recv;
+	ull64_t packets_retransmitted;
+	seq_t highest_seq_num; // one past the highest seq num ever sent
+	int timeouts;
+	int fast_retransmits;
+	ull64_t dup_acks; // acks that didn't move the window
+	ull64_t stale_acks; // reordered behind a newer ack, ignored
+	ull64_t start_time_ns;
+	stats_histogram_t rtt_histogram; // us, every sample
+	stats_histogram_t window_histogram; // packets, the window after every ack that moved it
+	trace_t *trace; // this stream's events, NULL unless tracing
+	int traced_window; // the window in the last TRACE_WINDOW
 
 	long rtt_est; // estimated round trip time
 	long rtt_dev;
-
-	int cycle_count; // purely for debugging, 1 cycle = after each recv
+	int rtt_measured; // 0 until the first sample, the estimate is a guess until then
+
+	// event loop: acks and the rto timer wake the sender up
+	int epoll_fd;
+	int timer_fd;
+	int timer_armed;
+	seq_t timer_seq_num; // start_seq_num when the timer was armed
+	int timer_restart; // the oldest unacked packet went out again, its ack gets a whole rto
+
+	// pacing: spreads the window over an rtt instead of sending it back to back
+	int pacing;
+	int pacing_fd; // fires when the next paced packet may go out
+	int pacing_armed;
+	ull64_t pacing_interval_ns; // between packets, 0 sends unpaced
+	ull64_t pacing_next_ns; // CLOCK_MONOTONIC time the next packet may go out
+
+	// forward error correction: repairs after every FEC_BLOCK chunks, so most losses need no round trip
+	int fec;
+	int fec_loss_rate; // originals lost, in 1/256ths, as the recvr last reported
+	int fec_repair_count; // repairs for the last block, sized by the loss rate
+	unsigned char *fec_block; // the block's chunks, read back from the file to encode
+	ull64_t fec_repairs_sent;
+
+	// compression: every chunk on its own, so each packet still decodes by itself
+	int compress;
+	double compress_entropy; // of the start of the stream, decides whether compress stays on
+	int compress_skip; // chunks to send as is before trying again
+	int compress_sample_chunks;
+	ull64_t compress_sample_in;
+	ull64_t compress_sample_out;
+	ull64_t compress_bytes_in; // totals over the chunks that were tried
+	ull64_t compress_bytes_out;
+	unsigned char *compress_buffer;
+
+	// delta: stretches the recvr's old copy has go as references into it
+	delta_index_t *delta_index; // the recvr's signatures, shared by the streams
+	delta_match_t *delta_matches; // the stream's segment, scanned before sending
+	int delta_match_count;
+	ull64_t delta_bytes_in; // chunks sent as deltas, and what went on the wire for them
+	ull64_t delta_bytes_out;
+	unsigned char *delta_buffer;
+
+	int connected; // the recvr answered the syn
+	tree_t *tree; // the directory being sent, NULL for a file, the first stream sends its manifest
+	int delta; // ask the recvr for its signatures, unless the syn says it has no old copy
+	int resume; // ask the recvr for its checkpoint before sending
+	ull64_t source_id; // file_identity, the checkpoint has to be of the same file
+	ull64_t resumed_bytes; // the recvr already had these
+
+	cache_t *cache; // the window's packets as sent, NULL if it couldn't be mapped
+	ull64_t cached_resends; // retransmissions that went out of the cache
+
+	// stream: chunks are read into the cache as the window opens, it's the only copy of what's unacked
+	int stream_watched; // the source is in the epoll set, not if it's a regular file behind stdin
+	int stream_armed; // waiting for the source to be readable
+	ull64_t keepalives_sent;
+
+	// integrity: a digest of every chunk on its first transmission, hashed into the stream's in file order
+	blake2b_t digest;
+	ull64_t corrupt_acks;
+	int verified; // the recvr's answer to the eof: 1 the digest matched, -1 it didn't, 0 no answer
+
+	pthread_t thread; // streams after the first run on their own thread
+
+	int cycle_count; // purely for debugging
 } sender_t;
 
-sender_t* sender_create(udp_t* udp, file_t* file, ull64_t transfer_size) {
+sender_t* sender_create(udp_t* udp, file_t* file, ull64_t transfer_size, cc_t *cc, int pacing, int fec, int compress) {
 	sender_t *sender = malloc(sizeof(sender_t));
 	sender->udp = udp;
 	sender->file = file;
@@ -186,31 +716,161 @@ sender_t* sender_create(udp_t* udp, file_t* file, ull64_t transfer_size) {
 	// 	sender->transfer_size = file_get_size(file);
 	// }
 
-	// TODO: random initial seqeunce number
-	sender->start_seq_num = 0;
-	sender->end_seq_num = 0;
+	// a packet left over from an earlier transfer through the same port won't fall in this one's window
+	if (getrandom(&sender->first_seq_num, sizeof(seq_t), 0) != sizeof(seq_t)) {
+		sender->first_seq_num = getpid() ^ time(NULL);
+	}
+	sender->start_seq_num = sender->first_seq_num;
+	sender->end_seq_num = sender->first_seq_num;
 	sender->start_file_pos = file_get_position(file);
+	sender->transfer_start = sender->start_file_pos;
+	sender->total_size = 0;
+
+	sender->stream_id = 0;
+	sender->stream_count = 1;
+	sender->conn_id = 0;
 
-	sender->last_ack = -1;
-	sender->recvr_window = 0x0; // bit mask of recvrs window
+	sender->last_ack = sender->start_seq_num;
+	sender->recvr_window_words = 0; // nothing sacked yet
 	
-	// implementing TCP slow start/congestion control
-	sender->optimal_window_size = MAX_WINDOW_SIZE;
-	sender->window_size = 1;
+	sender->cc = cc;
+
+	sender->sacked_count = 0;
+	sender->sacked_total = 0;
+	sender->ack_every = 1;
+	sender->in_recovery = 0;
+	sender->recover_seq_num = sender->start_seq_num;
+	sender->retransmit_seq_num = sender->start_seq_num;
+	sender->timeout_seq_num = sender->start_seq_num;
 
 	sender->packets_sent = 0;
-	sender->packets_recv = 0; // for debugging only
+	sender->packets_recv = 0;
+	sender->packets_retransmitted = 0;
+	sender->highest_seq_num = sender->start_seq_num;
+	sender->timeouts = 0;
+	sender->fast_retransmits = 0;
+	sender->dup_acks = 0;
+	sender->stale_acks = 0;
+	sender->start_time_ns = 0;
+	stats_histogram_reset(&sender->rtt_histogram);
+	stats_histogram_reset(&sender->window_histogram);
+	sender->trace = NULL;
+	sender->traced_window = 0;
 
 	sender->cycle_count = 0;
 
 	// jacobsen algorithm
 	sender->rtt_est = 1000 * 1000; //predicted rtt 30ms in microseconds
 	sender->rtt_dev = 200; // predicted deviation for rtt
+	sender->rtt_measured = 0;
+
+	sender->epoll_fd = epoll_create1(0);
+	sender->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (sender->epoll_fd == -1 || sender->timer_fd == -1) {
+		perror("sender_create: event loop");
+		exit(1);
+	}
+	sender->timer_armed = 0;
+	sender->timer_seq_num = sender->start_seq_num;
+	sender->timer_restart = 0;
+
+	sender->pacing = pacing;
+	sender->pacing_fd = -1;
+	sender->pacing_armed = 0;
+	sender->pacing_interval_ns = 0;
+	sender->pacing_next_ns = 0;
+	if (pacing) {
+		sender->pacing_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (sender->pacing_fd == -1) {
+			perror("sender_create: pacing timer");
+			exit(1);
+		}
+		// default timer slack is 50 us, far coarser than the gaps between packets
+		prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+	}
+
+	sender->fec = fec;
+	sender->fec_loss_rate = FEC_INITIAL_LOSS;
+	sender->fec_repair_count = 0;
+	sender->fec_block = NULL;
+	sender->fec_repairs_sent = 0;
+	if (fec) {
+		sender->fec_block = malloc(FEC_BLOCK * max_file_chunk_size);
+	}
+
+	sender->compress = compress;
+	sender->compress_entropy = 0;
+	sender->compress_skip = 0;
+	sender->compress_sample_chunks = 0;
+	sender->compress_sample_in = 0;
+	sender->compress_sample_out = 0;
+	sender->compress_bytes_in = 0;
+	sender->compress_bytes_out = 0;
+	sender->compress_buffer = NULL;
+	if (compress) {
+		sender->compress_buffer = malloc(max_file_chunk_size);
+	}
+
+	sender->delta_index = NULL;
+	sender->delta_matches = NULL;
+	sender->delta_match_count = 0;
+	sender->delta_bytes_in = 0;
+	sender->delta_bytes_out = 0;
+	sender->delta_buffer = NULL;
+
+	sender->connected = 0;
+	sender->delta = 0;
+	sender->resume = 0;
+	sender->source_id = 0;
+	sender->tree = NULL;
+	sender->resumed_bytes = 0;
+
+	// the window never gets past the cc's maximum, nor past the end of the segment
+	sender->cache = NULL;
+	sender->cached_resends = 0;
+	if (transfer_size > sender->start_file_pos) {
+		int cache_count = cc->max_window_size;
+		ull64_t chunk_count = ((transfer_size - sender->start_file_pos) + max_file_chunk_size - 1) / max_file_chunk_size;
+		if (chunk_count < (ull64_t)cache_count) {
+			cache_count = chunk_count;
+		}
+		if (file->stream) {
+			// a power of two, so no two seq nums in the window share a slot when they wrap around
+			int power = 1;
+			while (power < cache_count) {
+				power *= 2;
+			}
+			cache_count = power;
+		}
+		sender->cache = cache_create(cache_count, max_file_chunk_size, sender->first_seq_num);
+		if (sender->cache == NULL && file->stream) {
+			fprintf(stderr, "sender_create: a stream can't be read again, it needs the cache\n");
+			exit(1);
+		}
+	}
+	sender->stream_watched = 0;
+	sender->stream_armed = 0;
+	sender->keepalives_sent = 0;
+
+	blake2b_init(&sender->digest, DIGEST_SIZE);
+	sender->corrupt_acks = 0;
+	sender->verified = 0;
 	return sender;
 }
 
-int is_transferred(ull64_t window, int offset) {
-	return (window >> offset) & 1;
+ull64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+int is_transferred(sender_t *sender, int offset) {
+	return sack_words_test(sender->recvr_window, sender->recvr_window_words, offset);
+}
+
+// first offset at or after offset the recvr is still missing
+int next_untransferred(sender_t *sender, int offset) {
+	return sack_words_next_clear(sender->recvr_window, sender->recvr_window_words, offset);
 }
 
 // gets the bytes left based on current file position
@@ -227,16 +887,29 @@ ull64_t get_bytes_left(sender_t *sender) {
 	return num_bytes - at_byte;
 }
 
-ull64_t send_chunk(sender_t *sender, seq_t seq_num) {
+// the header of a data packet for the chunk at file_position
+void sender_data_header_load(sender_t *sender, sender_packet_header_t *packet_header, seq_t seq_num, ull64_t file_position) {
+	sender_packet_header_load(packet_header, seq_num);
+	packet_header->stream_id = sender->stream_id;
+	packet_header->stream_count = sender->stream_count;
+	packet_header->conn_id = sender->conn_id;
+	packet_header->offset = file_position;
+	packet_header->ack_every = sender->ack_every;
+	if (seq_before(seq_num, sender->highest_seq_num)) {
+		packet_header->flags |= PACKET_RETRANSMIT; // keeps the recvr's loss estimate to first transmissions
+	}
+}
+
+// loads the packet header into a batch slot, and the file chunk either after it or (mmap, cache) into payload
+ull64_t load_chunk(sender_t *sender, seq_t seq_num, int slot, const char **payload) {
 	// precondition: File should already be pointing at the chunk to send
 	// must call moveto or moveby, otherwise sends at current position
-	udp_t *udp = sender->udp;
 	file_t *file = sender->file;
+	char *msg = sender->udp->batch_msg_send[slot];
 
-	char *msg = udp->msg_send;
 	// prepare packet: load packet header
 	sender_packet_header_t packet_header;
-	sender_packet_header_load(&packet_header, seq_num);
+	sender_data_header_load(sender, &packet_header, seq_num, file_get_position(file));
 
 	size_t packet_header_size = sizeof(sender_packet_header_t);
 	memcpy(msg, &packet_header, packet_header_size);
@@ -244,10 +917,30 @@ ull64_t send_chunk(sender_t *sender, seq_t seq_num) {
 	// prepare packet: load file chunk
 	char *data_start = msg + packet_header_size;
 	ull64_t bytes_left = get_bytes_left(sender); // !!! Must call before file_read
-	ull64_t file_data_size = file_read(file, data_start, max_file_chunk_size);
+	ull64_t file_data_size;
+	if (file->map != NULL) {
+		file_data_size = file_map_chunk(file, payload, max_file_chunk_size);
+	} else if (file->stream) {
+		// sender_stream_ready read it into the cache already, the only other place it ever was is the pipe
+		if (seq_before(seq_num, sender->highest_seq_num)) {
+			fprintf(stderr, "load_chunk: seq num %u is gone from the cache, a stream can't be read again\n", seq_num);
+			exit(1);
+		}
+		*payload = cache_claim(sender->cache, seq_num);
+		file_data_size = file_stream_take(file);
+	} else if (sender->cache != NULL) {
+		// read the one time, straight into the cache the packet is sent and resent from
+		char *buffer = cache_claim(sender->cache, seq_num);
+		*payload = buffer;
+		file_data_size = file_read(file, buffer, max_file_chunk_size);
+	} else {
+		*payload = NULL;
+		file_data_size = file_read(file, data_start, max_file_chunk_size);
+	}
 	// printf("send chunk: file_data_size: %llu, bytes_left: %llu\n", file_data_size, bytes_left);
 
-	int shouldTruncateFileData = max_file_chunk_size > bytes_left;
+	// never up, past the end of a short file there's nothing to read (or compress)
+	int shouldTruncateFileData = file_data_size > bytes_left;
 	if (shouldTruncateFileData) {
 		// ex. size = 1000, file pos = 1004, 1000 - 1004 = 4 bytes, current file size is 4 btyes over 
 		//long overflow_amount = get_bytes_left(sender);
@@ -255,400 +948,2063 @@ ull64_t send_chunk(sender_t *sender, seq_t seq_num) {
 		// printf("send_chunk: truncating\n");
 	}
 
-	// send packet
-	udp->bytes_to_send = packet_header_size + file_data_size;
-	udp_send(udp);
-
-	// printf("send_chunk: sending seq num %d \n", seq_num);
 	return file_data_size;
 }
 
-void sender_send_data(sender_t *sender) {
-	udp_t* udp = sender->udp;
-	file_t* file = sender->file;
-	
-	seq_t seq_num = sender->start_seq_num;
-
-	int packets_sent = 0;
-	int max_packets_to_send = sender->window_size;
+/*** Compression ***/
 
-	for (int i = 0; i < max_packets_to_send; i ++) {
-		if (get_bytes_left(sender) == 0) {
-			// printf("sender_send_data: no more bytes need to be sent\n");
-			break;
-		}
+// entropy of the start of the stream, data that looks random (already compressed, encrypted) is sent as is
+void sender_compress_probe(sender_t *sender) {
+	if (!sender->compress || sender->file->stream) {
+		return; // a stream can't be read ahead, its chunks are all tried
+	}
 
-		// // move file to next chunk if recvr has this chunk (selective n sliding window)
-		if (is_transferred(sender->recvr_window, i)) {
-			// printf("sender_send_data: skip seq num %d\n", seq_num);
-			file_moveby(file, max_file_chunk_size);
-			seq_num = safe_increment(seq_num);
-			continue;
-		}
+	ull64_t probe_size = sender->transfer_size - sender->start_file_pos;
+	if (probe_size > COMPRESS_PROBE_SIZE) {
+		probe_size = COMPRESS_PROBE_SIZE;
+	}
+	unsigned char *probe = malloc(COMPRESS_PROBE_SIZE);
+	probe_size = file_pread(sender->file, (char *)probe, probe_size, sender->start_file_pos);
+	sender->compress_entropy = lz_entropy(probe, probe_size);
+	free(probe);
 
-		send_chunk(sender, seq_num);
-		seq_num = safe_increment(seq_num);
-		packets_sent += 1;
+	if (sender->compress_entropy > COMPRESS_MAX_ENTROPY) {
+		sender->compress = 0;
 	}
-	
-	sender->end_seq_num = seq_num;
-	sender->packets_sent = packets_sent;
 }
 
-// source: https://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
-int timeval_subtract (struct timeval *result, struct timeval *x, struct timeval *y) {
-  /* Perform the carry for the later subtraction by updating y. */
-  if (x->tv_usec < y->tv_usec) {
-    int nsec = (y->tv_usec - x->tv_usec) / 1000000 + 1;
-    y->tv_usec -= 1000000 * nsec;
-    y->tv_sec += nsec;
-  }
-  if (x->tv_usec - y->tv_usec > 1000000) {
-    int nsec = (x->tv_usec - y->tv_usec) / 1000000;
-    y->tv_usec += 1000000 * nsec;
-    y->tv_sec -= nsec;
-  }
+// compresses the chunk loaded into slot (or mapped at payload), returns the bytes to send after the header
+ull64_t sender_compress_chunk(sender_t *sender, int slot, const char **payload, ull64_t size) {
+	if (!sender->compress || size == 0) {
+		return size;
+	}
+	if (sender->compress_skip > 0) {
+		sender->compress_skip -= 1;
+		return size;
+	}
 
-  /* Compute the time remaining to wait.
-     tv_usec is certainly positive. */
-  result->tv_sec = x->tv_sec - y->tv_sec;
-  result->tv_usec = x->tv_usec - y->tv_usec;
+	char *msg = sender->udp->batch_msg_send[slot];
+	const char *data = *payload != NULL ? *payload : msg + sizeof(sender_packet_header_t);
+	// only worth it if it saves a byte, otherwise the chunk goes as is
+	int compressed_size = lz_compress((const unsigned char *)data, size, sender->compress_buffer, size - 1);
+	ull64_t sent_size = compressed_size > 0 ? (ull64_t)compressed_size : size;
+
+	sender->compress_bytes_in += size;
+	sender->compress_bytes_out += sent_size;
+	sender->compress_sample_in += size;
+	sender->compress_sample_out += sent_size;
+	sender->compress_sample_chunks += 1;
+	if (sender->compress_sample_chunks == COMPRESS_SAMPLE) {
+		// a stretch that doesn't compress costs cpu for nothing, back off for a while
+		if (sender->compress_sample_in - sender->compress_sample_out < sender->compress_sample_in / COMPRESS_MIN_SAVING) {
+			sender->compress_skip = COMPRESS_BACKOFF;
+		}
+		sender->compress_sample_chunks = 0;
+		sender->compress_sample_in = 0;
+		sender->compress_sample_out = 0;
+	}
 
-  /* Return 1 if result is negative. */
-  return x->tv_sec < y->tv_sec;
+	if (compressed_size == 0) {
+		return size;
+	}
+
+	sender_packet_header_t packet_header;
+	memcpy(&packet_header, msg, sizeof(sender_packet_header_t));
+	packet_header.flags |= PACKET_COMPRESSED;
+	memcpy(msg, &packet_header, sizeof(sender_packet_header_t));
+	memcpy(msg + sizeof(sender_packet_header_t), sender->compress_buffer, compressed_size);
+	*payload = NULL;
+	return compressed_size;
 }
 
-void update_rtt(sender_t* sender, recvr_packet_header_t *header) {
-	struct timeval now;
+/*** Delta ***/
 
-	int result = gettimeofday(&now, NULL);
-	if (result == -1) {
-		perror("update_rtt");
-	}
+// asks for the page of signatures starting at first_block
+void sender_request_signatures(sender_t *sender, unsigned int first_block) {
+	udp_t *udp = sender->udp;
 
-	struct timeval rtt;
-	struct timeval before = header->timestamp;
-	int sign = timeval_subtract(&rtt, &now, &before);
-	if (sign == 1) {
-		fprintf(stderr, "update_rtt: negative result\n");
-	}
-	// assume all RTT are less than 1 sec
-	// printf("rtt is %ld secs and %d microsecs\n", rtt.tv_sec, rtt.tv_usec);
-	
-	// jacobson's algorithm for time out value
-	float a = 0.125f;
-	float b = 0.25f;
-	long rtt_est = sender->rtt_est;
-	long rtt_sample = rtt.tv_usec;
+	sender_packet_header_t packet_header;
+	sender_packet_header_load(&packet_header, sender->first_seq_num);
+	packet_header.flags |= PACKET_SIGNATURES;
+	packet_header.stream_id = sender->stream_id;
+	packet_header.stream_count = sender->stream_count;
+	packet_header.conn_id = sender->conn_id;
+	packet_header.offset = sender->start_file_pos; // the recvr places the stream by it, as for data
+	memcpy(udp->msg_send, &packet_header, sizeof(sender_packet_header_t));
+	memcpy(udp->msg_send + sizeof(sender_packet_header_t), &first_block, sizeof(first_block));
+
+	sender_packet_seal(udp->msg_send, crc32c(0, &first_block, sizeof(first_block)));
+	udp->bytes_to_send = sizeof(sender_packet_header_t) + sizeof(first_block);
+	udp_send(udp);
+}
 
-	long diff = labs(rtt_sample - rtt_est);
-	long rtt_dev = sender->rtt_dev;
+// the recvr's block signatures for its copy of the file, SIGNATURE_BURST pages asked for at a time
+// *count is 0 if it has no copy
+delta_signature_t* sender_fetch_signatures(sender_t *sender, unsigned int *count) {
+	udp_t *udp = sender->udp;
+	delta_signature_t *signatures = NULL;
+	unsigned int block_count = 0;
+	unsigned int page_count = 1; // until the first reply tells
+	unsigned char *pages_received = calloc(1, 1);
+	unsigned int pages_left = 1;
+
+	struct pollfd poll_fd;
+	poll_fd.fd = udp_event_fd(udp);
+	poll_fd.events = POLLIN;
+
+	for (int attempt = 0; attempt < SIGNATURE_ATTEMPTS && pages_left > 0; attempt++) {
+		int requested = 0;
+		for (unsigned int page = 0; page < page_count && requested < SIGNATURE_BURST; page++) {
+			if (!pages_received[page]) {
+				sender_request_signatures(sender, page * SIGNATURES_PER_PAGE);
+				requested += 1;
+			}
+		}
 
-	rtt_est = (a * rtt_est) + ((1 - a) * rtt_sample);
-	rtt_dev = (b * rtt_dev) + ((1 - b) * diff);
-	
-	sender->rtt_est = rtt_est;
-	sender->rtt_dev = rtt_dev;
-	// printf("update rtt: new avg is %ld\n", rtt_est);
-}
+		// the next burst goes out once this one is answered, or lost
+		while (requested > 0 && pages_left > 0 && poll(&poll_fd, 1, SIGNATURE_RETRY) > 0) {
+			int batch_count = udp_poll_batch(udp, udp->batch_size);
+			for (int i = 0; i < batch_count; i++) {
+				char *msg = udp->batch_msg_recv[i];
+				ssize_t size = udp->batch_bytes_recv[i];
+				if (size < (ssize_t)(sizeof(recvr_packet_header_t) + sizeof(signature_page_t)) || !recvr_packet_verify(msg, size)) {
+					continue;
+				}
+				recvr_packet_header_t header;
+				memcpy(&header, msg, sizeof(recvr_packet_header_t));
+				if (header.stream_id != sender->stream_id || !(header.flags & ACK_SIGNATURES)) {
+					continue;
+				}
+
+				signature_page_t page;
+				memcpy(&page, msg + sizeof(recvr_packet_header_t), sizeof(signature_page_t));
+				size_t signatures_size = size - sizeof(recvr_packet_header_t) - sizeof(signature_page_t);
+				if (page.count > SIGNATURES_PER_PAGE || signatures_size != page.count * sizeof(delta_signature_t)
+					|| page.first_block % SIGNATURES_PER_PAGE != 0 || page.first_block + page.count > page.block_count) {
+					continue;
+				}
+
+				if (signatures == NULL) {
+					block_count = page.block_count;
+					page_count = (block_count + SIGNATURES_PER_PAGE - 1) / SIGNATURES_PER_PAGE;
+					if (page_count == 0) {
+						page_count = 1;
+					}
+					free(pages_received);
+					pages_received = calloc(page_count, 1);
+					pages_left = page_count;
+					signatures = malloc((block_count + 1) * sizeof(delta_signature_t));
+				}
+				unsigned int page_index = page.first_block / SIGNATURES_PER_PAGE;
+				if (page.block_count != block_count || page_index >= page_count || pages_received[page_index]) {
+					continue;
+				}
+
+				memcpy(&signatures[page.first_block], msg + sizeof(recvr_packet_header_t) + sizeof(signature_page_t), signatures_size);
+				pages_received[page_index] = 1;
+				pages_left -= 1;
+				requested -= 1;
+			}
+		}
+	}
+	free(pages_received);
 
-void increase_rtt_timeout(sender_t *sender) {
-	sender->rtt_est = sender->rtt_est * 2;
-	if (sender->rtt_est > MAX_TIMEOUT) {
-		fprintf(stderr, "increase_rtt_timeout: timed out\n");
+	if (pages_left > 0) {
+		fprintf(stderr, "sender_fetch_signatures: no answer from the recvr\n");
 		exit(1);
 	}
+	*count = block_count;
+	return signatures;
 }
 
-void fast_retransmit(sender_t *sender, recvr_packet_header_t *header) {
-	// fast retransmit
-	// setting file position for the chunk to be retransmitted
-	seq_t start_seq_num = sender->start_seq_num;
-	seq_t seq_num_to_retranmist = header->expected_seq_num;
-
-	seq_t diff = safe_subtract(seq_num_to_retranmist, start_seq_num);
-	
-	ull64_t offset = diff * max_file_chunk_size;
-	ull64_t file_position = sender->start_file_pos + offset;
+// finds the recvr's blocks in the stream's segment, before anything is sent
+void sender_delta_scan(sender_t *sender) {
+	if (sender->delta_index == NULL || sender->start_file_pos >= sender->transfer_size) {
+		return;
+	}
 
-	file_t *file = sender->file;
-	file_moveto(file, file_position);
+	// rolling needs the bytes on both sides of every chunk, so the segment is mapped whole
+	struct stat file_stat;
+	int fd = fileno(sender->file->fp);
+	if (fstat(fd, &file_stat) == -1 || (ull64_t)file_stat.st_size <= sender->start_file_pos) {
+		return;
+	}
+	ull64_t map_size = sender->transfer_size < (ull64_t)file_stat.st_size ? sender->transfer_size : (ull64_t)file_stat.st_size;
+	unsigned char *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("sender_delta_scan: mmap");
+		return;
+	}
+	madvise(map, map_size, MADV_SEQUENTIAL);
 
-	send_chunk(sender, seq_num_to_retranmist);
-	// printf("fast_retransmit: seq_num %d\n", seq_num_to_retranmist);
-}
+	ull64_t start = sender->start_file_pos;
+	sender->delta_match_count = delta_scan(sender->delta_index, map + start, map_size - start, start, &sender->delta_matches);
+	munmap(map, map_size);
 
-void cc_fast_recovery(sender_t *sender) {
-	int window_size = sender->window_size / 2;
-	if (window_size == 0) {
-		window_size = 1;
+	if (sender->delta_match_count > 0) {
+		sender->delta_buffer = malloc(max_file_chunk_size);
 	}
-	sender->optimal_window_size = window_size;
-	sender->window_size = window_size;
-	// printf("cc_fast_recovery: window size: %d, optimal window size: %d\n", sender->window_size, sender->optimal_window_size);
 }
 
-// cogestion control exponential increase 
-void cc_incr(sender_t *sender) {
-	int window_size = sender->window_size;
-	int optimal_window_size = sender->optimal_window_size;
-
-	// additive incr: //additive incr if over congestion threshold (optimal window size)
-	if (window_size >=  optimal_window_size) {
-		window_size += 1;
-	}
-	// exp incr if under congestion threshold (optimal window size)
-	else {
-		window_size *= 2;
-		// max window size can be is the optimal window size, when doing exponential increase
-		// if (window_size > optimal_window_size) {
-		// 	window_size = optimal_window_size;
-		// }
+// encodes the chunk loaded into slot (or mapped at payload) against the recvr's copy
+// returns the bytes to send after the header, size if it goes as is
+ull64_t sender_delta_chunk(sender_t *sender, int slot, const char **payload, ull64_t size, ull64_t file_position) {
+	if (sender->delta_match_count == 0 || size == 0) {
+		return size;
 	}
 
-	// don't increase past max window size
-	if (window_size > MAX_WINDOW_SIZE) {
-		window_size = MAX_WINDOW_SIZE; 
+	char *msg = sender->udp->batch_msg_send[slot];
+	const char *data = *payload != NULL ? *payload : msg + sizeof(sender_packet_header_t);
+	int encoded_size = delta_encode(sender->delta_matches, sender->delta_match_count, (const unsigned char *)data, size, file_position,
+		sender->delta_buffer, size - 1);
+	if (encoded_size == 0) {
+		return size;
 	}
+	sender->delta_bytes_in += size;
+	sender->delta_bytes_out += encoded_size;
 
-	sender->window_size = window_size;
-	// printf("cc_incr: window size: %d, optimal window size: %d\n", sender->window_size, sender->optimal_window_size);
+	sender_packet_header_t packet_header;
+	memcpy(&packet_header, msg, sizeof(sender_packet_header_t));
+	packet_header.flags |= PACKET_DELTA;
+	memcpy(msg, &packet_header, sizeof(sender_packet_header_t));
+	memcpy(msg + sizeof(sender_packet_header_t), sender->delta_buffer, encoded_size);
+	*payload = NULL;
+	return encoded_size;
 }
 
-// TCP slow start 
-void cc_slow_start(sender_t *sender) {
-	// start window size at 1
-	
-	// half congestion window size threshold (optimal_window_size)
-	int optimal_window_size = sender->optimal_window_size / 2;
-	
-	if (optimal_window_size == 0) {
-		optimal_window_size = 1; // don't let it get to 0
+// queues a resend of the cached packet: a new header (timestamp, ack_every) in front of the payload as it first went out
+ull64_t queue_cached_chunk(sender_t *sender, seq_t seq_num, cache_entry_t *entry) {
+	udp_t *udp = sender->udp;
+
+	int slot = udp->batch_send_count;
+	char *msg = udp->batch_msg_send[slot];
+	sender_packet_header_t packet_header;
+	sender_data_header_load(sender, &packet_header, seq_num, entry->file_position);
+	packet_header.flags |= entry->flags;
+	memcpy(msg, &packet_header, sizeof(sender_packet_header_t));
+	sender_packet_seal(msg, entry->payload_crc);
+	trace_record(sender->trace, TRACE_SEND, TRACE_RETRANSMIT, sender->stream_id, seq_num, entry->data_size, entry->file_position);
+
+	udp->batch_bytes_to_send[slot] = sizeof(sender_packet_header_t);
+	udp->batch_payload_send[slot] = entry->payload;
+	udp->batch_payload_size[slot] = entry->data_size;
+	udp->batch_send_count += 1;
+	sender->cached_resends += 1;
+
+	if (udp->batch_send_count == udp->batch_size) {
+		udp_send_batch(udp);
 	}
 
-	sender->window_size = 1;
-	sender->optimal_window_size = optimal_window_size;
-	// printf("cc_slow_start: window size: %d, optimal window size: %d\n", sender->window_size, sender->optimal_window_size);
+	return entry->file_data_size;
 }
 
-void update_last_ack(sender_t* sender, recvr_packet_header_t *header) {
-	seq_t prev_ack = sender->last_ack;
-	seq_t next_ack = header->expected_seq_num;
-	//seq_t start_seq = sender->start_seq_num;
-	//offset from the start_seq
-	// printf("update_last_ack: prev ack: %d, next ack: %d\n", prev_ack, next_ack);
-	
-	int window_size = sender->window_size;
-	int diff = safe_subtract(next_ack, prev_ack);
-	
-	// if (diff >= MAX_WINDOW_SIZE && prev_ack != -1) {
-	// 	// printf("update_last_ack: out of window, diff %d\n", diff);
-	// 	// fprintf(stderr, "update_last_ack: out of window\n");
-	// 	return; // this ack is out of the window/not most up to date
-	// 	// TODO: maybe update recvr_window...?
-	// }
+// hashes a chunk's digest into the stream's, independent of the packet checksums
+void sender_fold_digest(sender_t *sender, const void *chunk, ull64_t size) {
+	unsigned char chunk_digest[DIGEST_SIZE];
+	blake2b(chunk_digest, DIGEST_SIZE, chunk, size);
+	blake2b_update(&sender->digest, chunk_digest, DIGEST_SIZE);
+}
 
-	sender->last_ack = next_ack;
-	sender->recvr_window = header->window;
-	// printf("last ack is now: %d\n", sender->last_ack);
+// the stream's digest so far, the state is left to go on
+void sender_digest(sender_t *sender, unsigned char *digest) {
+	blake2b_t state = sender->digest;
+	blake2b_final(&state, digest);
 }
 
-void sender_recv_acks(sender_t *sender) {
+// queues the packet, sent once the batch is full or flushed
+ull64_t queue_chunk(sender_t *sender, seq_t seq_num) {
 	udp_t *udp = sender->udp;
 
-	int max_packets_to_recv = sender->packets_sent;
-	int packets_recv = 0;
-	int should_slow_start = 0;
-	int should_recover_fast = 0;
-	int dup_count = 0;
-	// reads incoming acks, up to the amount sent
-	for (int i = 0; i < max_packets_to_recv; i ++) {
-		udp_recv(udp);
-
-		// if there's a timeout
-		if (udp->bytes_recv == -1) {
-			//perror("sender_recv_acks");
-			// int packets_lost = max_packets_to_recv - packets_recv;
-			// printf("sender_recv_acks: %d packets lost\n", packets_lost);
-			should_slow_start = 1;
+	cache_entry_t *entry = cache_lookup(sender->cache, seq_num);
+	if (entry != NULL) {
+		return queue_cached_chunk(sender, seq_num, entry);
+	}
+
+	int slot = udp->batch_send_count;
+	char *msg = udp->batch_msg_send[slot];
+	ull64_t file_position = file_get_position(sender->file);
+	const char *payload;
+	ull64_t file_data_size = load_chunk(sender, seq_num, slot, &payload);
+
+	int first_transmission = !seq_before(seq_num, sender->highest_seq_num);
+	const char *data = payload != NULL ? payload : msg + sizeof(sender_packet_header_t);
+	unsigned int data_crc = crc32c(0, data, file_data_size);
+
+	// first transmissions go out in seq num order, so the digest is in file order
+	if (first_transmission) {
+		sender_fold_digest(sender, data, file_data_size);
+	}
+
+	// a chunk the recvr mostly has goes as a delta, the rest may still compress
+	ull64_t data_size = sender_delta_chunk(sender, slot, &payload, file_data_size, file_position);
+	if (data_size == file_data_size) {
+		data_size = sender_compress_chunk(sender, slot, &payload, file_data_size);
+	}
+	unsigned int payload_crc = data_crc;
+	if (data_size < file_data_size) {
+		payload_crc = crc32c(0, msg + sizeof(sender_packet_header_t), data_size); // delta or compressed
+	}
+	sender_packet_seal(msg, payload_crc);
+	if (sender->cache != NULL) {
+		if (payload == NULL) {
+			// delta or compressed into the batch buffer, which the next batch reuses
+			char *buffer = cache_claim(sender->cache, seq_num);
+			memcpy(buffer, msg + sizeof(sender_packet_header_t), data_size);
+			payload = buffer;
+		}
+		cache_store(sender->cache, seq_num, msg, payload, data_size, payload_crc, file_data_size);
+	}
+	trace_record(sender->trace, TRACE_SEND, first_transmission ? 0 : TRACE_RETRANSMIT, sender->stream_id, seq_num, data_size, file_position);
+
+	if (payload != NULL) {
+		// scatter/gather: header from the batch buffer, data straight from the mapping
+		udp->batch_bytes_to_send[slot] = sizeof(sender_packet_header_t);
+		udp->batch_payload_send[slot] = payload;
+		udp->batch_payload_size[slot] = data_size;
+	} else {
+		udp->batch_bytes_to_send[slot] = sizeof(sender_packet_header_t) + data_size;
+	}
+	udp->batch_send_count += 1;
+
+	if (udp->batch_send_count == udp->batch_size) {
+		udp_send_batch(udp);
+	}
+
+	return file_data_size;
+}
+
+ull64_t send_chunk(sender_t *sender, seq_t seq_num) {
+	// a batch of one, so mapped chunks go out without a copy too
+	ull64_t file_data_size = queue_chunk(sender, seq_num);
+	udp_send_batch(sender->udp);
+
+	// printf("send_chunk: sending seq num %d \n", seq_num);
+	return file_data_size;
+}
+
+// pacing rate comes from the congestion control, packets per sec
+void sender_update_pacing(sender_t *sender) {
+	double rate = cc_pacing_rate(sender->cc);
+	sender->pacing_interval_ns = 0;
+	if (rate > 0) {
+		sender->pacing_interval_ns = 1e9 / rate;
+	}
+}
+
+// returns 1 and books a slot if a packet may go out now, 0 if it has to wait for pacing_next_ns
+int sender_pace(sender_t *sender, ull64_t now_ns) {
+	if (!sender->pacing) {
+		return 1;
+	}
+
+	// credit for a late timer or idle time is capped at a small burst
+	ull64_t burst_ns = PACING_BURST * sender->pacing_interval_ns;
+	if (sender->pacing_next_ns + burst_ns < now_ns) {
+		sender->pacing_next_ns = now_ns - burst_ns;
+	}
+
+	if (sender->pacing_next_ns > now_ns) {
+		return 0;
+	}
+	sender->pacing_next_ns += sender->pacing_interval_ns;
+	return 1;
+}
+
+void sender_arm_pacing(sender_t *sender) {
+	if (sender->pacing_armed) {
+		return;
+	}
+
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = sender->pacing_next_ns / 1000000000ULL;
+	its.it_value.tv_nsec = sender->pacing_next_ns % 1000000000ULL;
+	if (timerfd_settime(sender->pacing_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		perror("sender_arm_pacing");
+		return;
+	}
+	sender->pacing_armed = 1;
+}
+
+/*** Forward Error Correction ***/
+
+// enough repairs for FEC_MARGIN times the reported loss, none on a clean path
+int sender_fec_repair_count(sender_t *sender, int data_count) {
+	int count = ((data_count * sender->fec_loss_rate * FEC_MARGIN) + 255) / 256;
+	if (count > FEC_MAX_REPAIR) {
+		count = FEC_MAX_REPAIR;
+	}
+	return count;
+}
+
+// queues the repairs for the data_count chunks from block_seq_num, out of the cache or read back from the file
+void sender_send_repairs(sender_t *sender, seq_t block_seq_num, int data_count) {
+	udp_t *udp = sender->udp;
+
+	int repair_count = sender_fec_repair_count(sender, data_count);
+	sender->fec_repair_count = repair_count;
+	if (repair_count == 0) {
+		return;
+	}
+
+	// the block can start before the oldest unacked chunk, if its first chunks are acked already
+	long long block_offset = (int)safe_subtract(block_seq_num, sender->start_seq_num);
+	ull64_t block_pos = sender->start_file_pos + (block_offset * (long long)max_file_chunk_size);
+	ull64_t block_end = block_pos + (data_count * max_file_chunk_size);
+	if (block_end > sender->transfer_size) {
+		block_end = sender->transfer_size;
+	}
+
+	// the short last chunk is zero padded, the recvr trims it again with block_end
+	// chunks the cache has as read are encoded from there, compressed or delta ones are read again
+	unsigned char *data[FEC_BLOCK];
+	for (int i = 0; i < data_count; i++) {
+		cache_entry_t *entry = cache_lookup(sender->cache, safe_add(block_seq_num, i));
+		if (entry != NULL && entry->flags == 0 && entry->data_size == max_file_chunk_size) {
+			data[i] = (unsigned char *)entry->payload;
+			continue;
+		}
+		ull64_t chunk_pos = block_pos + (i * max_file_chunk_size);
+		ull64_t chunk_size = block_end - chunk_pos < max_file_chunk_size ? block_end - chunk_pos : max_file_chunk_size;
+		data[i] = sender->fec_block + (i * max_file_chunk_size);
+		memset(data[i], 0, max_file_chunk_size);
+		if (entry != NULL && entry->flags == 0) {
+			memcpy(data[i], entry->payload, entry->data_size); // short, and a stream has no file to read it from
+		} else {
+			file_pread(sender->file, (char *)data[i], chunk_size, chunk_pos);
+		}
+	}
+
+	for (int j = 0; j < repair_count; j++) {
+		int slot = udp->batch_send_count;
+		char *msg = udp->batch_msg_send[slot];
+
+		sender_packet_header_t packet_header;
+		sender_packet_header_load(&packet_header, block_seq_num);
+		packet_header.flags |= PACKET_FEC;
+		packet_header.stream_id = sender->stream_id;
+		packet_header.stream_count = sender->stream_count;
+		packet_header.conn_id = sender->conn_id;
+		packet_header.fec_count = data_count;
+		packet_header.fec_index = j;
+		packet_header.offset = block_end;
+		memcpy(msg, &packet_header, sizeof(sender_packet_header_t));
+
+		unsigned char *repair = (unsigned char *)msg + sizeof(sender_packet_header_t);
+		memset(repair, 0, max_file_chunk_size);
+		fec_encode(repair, j, data, data_count, max_file_chunk_size);
+		sender_packet_seal(msg, crc32c(0, repair, max_file_chunk_size));
+
+		udp->batch_bytes_to_send[slot] = sizeof(sender_packet_header_t) + max_file_chunk_size;
+		udp->batch_send_count += 1;
+		if (udp->batch_send_count == udp->batch_size) {
+			udp_send_batch(udp);
+		}
+	}
+	sender->fec_repairs_sent += repair_count;
+}
+
+// first transmission of seq_num, the repairs follow the last chunk of its block
+void sender_fec_chunk_sent(sender_t *sender, seq_t seq_num, ull64_t file_position) {
+	int index = safe_subtract(seq_num, sender->first_seq_num) % FEC_BLOCK;
+	if (index != FEC_BLOCK - 1 && file_position + max_file_chunk_size < sender->transfer_size) {
+		return;
+	}
+	sender_send_repairs(sender, safe_subtract(seq_num, index), index + 1);
+}
+
+// packets sacked past the hole before it is retransmitted: with fec, the rest of its block and the repairs may rebuild it
+int sender_loss_threshold(sender_t *sender, seq_t hole_seq_num) {
+	if (!sender->fec || sender->fec_repair_count == 0) {
+		return DUP_ACK_THRESHOLD;
+	}
+
+	int index = safe_subtract(hole_seq_num, sender->first_seq_num) % FEC_BLOCK;
+	seq_t block_end = safe_add(safe_subtract(hole_seq_num, index), FEC_BLOCK);
+	if (seq_before(sender->highest_seq_num, block_end)) {
+		return DUP_ACK_THRESHOLD; // repairs not sent yet
+	}
+	return DUP_ACK_THRESHOLD + (FEC_BLOCK - 1 - index) + sender->fec_repair_count;
+}
+
+// the chunks of [start, end) the recvr already has, read from the file for the digest
+// the digest covers the whole segment, so a resumed prefix that differs from the file is caught too
+void sender_fold_file(sender_t *sender, ull64_t start, ull64_t end) {
+	char *chunk = malloc(max_file_chunk_size);
+	for (ull64_t file_position = start; file_position < end; file_position += max_file_chunk_size) {
+		ull64_t chunk_size = end - file_position;
+		if (chunk_size > max_file_chunk_size) {
+			chunk_size = max_file_chunk_size;
+		}
+		chunk_size = file_pread(sender->file, chunk, chunk_size, file_position);
+		sender_fold_digest(sender, chunk, chunk_size);
+	}
+	free(chunk);
+}
+
+// chunks past the resume point the recvr already has, never sent, only read for the digest
+// folds from highest_seq_num up to end_seq_num, called before the window moves past them
+void sender_resume_skip(sender_t *sender, seq_t end_seq_num) {
+	char *chunk = NULL;
+	while (seq_before(sender->highest_seq_num, end_seq_num)) {
+		seq_t offset = safe_subtract(sender->highest_seq_num, sender->start_seq_num);
+		ull64_t file_position = sender->start_file_pos + (offset * max_file_chunk_size);
+		if (file_position >= sender->transfer_size) {
+			break;
+		}
+		ull64_t chunk_size = sender->transfer_size - file_position;
+		if (chunk_size > max_file_chunk_size) {
+			chunk_size = max_file_chunk_size;
+		}
+		if (chunk == NULL) {
+			chunk = malloc(max_file_chunk_size);
+		}
+		chunk_size = file_pread(sender->file, chunk, chunk_size, file_position);
+
+		sender_fold_digest(sender, chunk, chunk_size);
+		sender->highest_seq_num = safe_increment(sender->highest_seq_num);
+		sender->resumed_bytes += chunk_size;
+	}
+	free(chunk);
+}
+
+/*** Streams ***/
+
+// the source wakes the event loop only while a chunk waits on it, a pipe with data in it would otherwise never let it sleep
+void sender_arm_stream(sender_t *sender, int armed) {
+	if (!sender->stream_watched || sender->stream_armed == armed) {
+		return;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = armed ? EPOLLIN : 0;
+	event.data.fd = fileno(sender->file->fp);
+	if (epoll_ctl(sender->epoll_fd, EPOLL_CTL_MOD, event.data.fd, &event) == -1) {
+		perror("sender_arm_stream");
+		exit(1);
+	}
+	sender->stream_armed = armed;
+}
+
+// a first transmission from a stream goes once its whole chunk has been read into the cache, or the stream ended
+// returns 0 if it has to wait, the source is armed and sending picks up again when it's readable
+int sender_stream_ready(sender_t *sender, seq_t seq_num, ull64_t file_position) {
+	file_t *file = sender->file;
+	ull64_t size = sender->transfer_size - file_position;
+	if (size > max_file_chunk_size) {
+		size = max_file_chunk_size;
+	}
+	if (!file_stream_fill(file, cache_claim(sender->cache, seq_num), size)) {
+		sender_arm_stream(sender, 1);
+		return 0;
+	}
+
+	if (file->stream_eof && sender->transfer_size == STREAM_MAX_SIZE) {
+		// the size is known now, the eof follows once the window is acked
+		sender->transfer_size = file_position + file->stream_fill;
+		int index = safe_subtract(seq_num, sender->first_seq_num) % FEC_BLOCK;
+		if (sender->fec && file->stream_fill == 0 && index > 0) {
+			sender_send_repairs(sender, safe_subtract(seq_num, index), index); // the chunk before was the last of its block
+		}
+	}
+	return file->stream_fill > 0;
+}
+
+// packets per ack the recvr is asked for: a window is about a round trip of packets, so a quarter of it is a quarter rtt whatever the rtt
+int sender_ack_every(int window) {
+	int ack_every = window / ACK_FRACTION;
+	if (ack_every < 1) {
+		return 1;
+	}
+	return ack_every > MAX_ACK_EVERY ? MAX_ACK_EVERY : ack_every;
+}
+
+// fills the window, sends from end_seq_num until the congestion window is in flight
+void sender_send_data(sender_t *sender) {
+	udp_t* udp = sender->udp;
+	file_t* file = sender->file;
+	
+	seq_t seq_num = sender->end_seq_num;
+
+	int packets_sent = 0;
+	seq_t max_packets_in_flight = cc_window(sender->cc);
+	int ack_every = sender_ack_every(max_packets_in_flight);
+
+	ull64_t now_ns = 0;
+	if (sender->pacing) {
+		sender_update_pacing(sender);
+		now_ns = monotonic_ns();
+	}
+
+	while (1) {
+		seq_t offset = safe_subtract(seq_num, sender->start_seq_num);
+		if (offset >= max_packets_in_flight) {
+			break;
+		}
+
+		ull64_t file_position = sender->start_file_pos + (offset * max_file_chunk_size);
+		if (file_position >= sender->transfer_size) {
+			// printf("sender_send_data: no more bytes need to be sent\n");
+			break;
+		}
+
+		// skip the chunks the recvr has (selective repeat), a whole run at once
+		if (is_transferred(sender, offset)) {
+			// printf("sender_send_data: skip from seq num %u\n", seq_num);
+			seq_t skip = next_untransferred(sender, offset) - offset;
+			sender_resume_skip(sender, seq_num + skip); // past highest_seq_num only after a resume
+			seq_num += skip;
+			continue;
+		}
+
+		// a stream's chunk is read as the window gets to it, the window is how far ahead of the recvr the source is read
+		int first_transmission = !seq_before(seq_num, sender->highest_seq_num);
+		if (sender->file->stream && first_transmission && !sender_stream_ready(sender, seq_num, file_position)) {
+			break;
+		}
+
+		if (!sender_pace(sender, now_ns)) {
+			sender_arm_pacing(sender); // window is open, but not yet
 			break;
 		}
 
-		packets_recv += 1;
+		// sequential unless going back after a loss, a cached packet isn't read at all
+		if (cache_lookup(sender->cache, seq_num) == NULL && file_get_position(file) != file_position) {
+			file_moveto(file, file_position);
+		}
+
+		// the last packet before the window or the data runs out is acked at once, nothing follows it to fill up an ack
+		int last = offset + 1 >= max_packets_in_flight || file_position + max_file_chunk_size >= sender->transfer_size;
+		sender->ack_every = last ? 1 : ack_every;
+		queue_chunk(sender, seq_num);
+		if (!first_transmission) {
+			sender->packets_retransmitted += 1;
+		} else {
+			sender->highest_seq_num = safe_increment(seq_num);
+			if (sender->fec) {
+				sender_fec_chunk_sent(sender, seq_num, file_position);
+			}
+		}
+		seq_num = safe_increment(seq_num);
+		packets_sent += 1;
+	}
+
+	// whatever is left in the batch goes out in one last syscall
+	udp_send_batch(udp);
+	
+	sender->end_seq_num = seq_num;
+	sender->packets_sent += packets_sent;
+}
+
+// source: https://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
+int timeval_subtract (struct timeval *result, struct timeval *x, struct timeval *y) {
+  /* Perform the carry for the later subtraction by updating y. */
+  if (x->tv_usec < y->tv_usec) {
+    int nsec = (y->tv_usec - x->tv_usec) / 1000000 + 1;
+    y->tv_usec -= 1000000 * nsec;
+    y->tv_sec += nsec;
+  }
+  if (x->tv_usec - y->tv_usec > 1000000) {
+    int nsec = (x->tv_usec - y->tv_usec) / 1000000;
+    y->tv_usec += 1000000 * nsec;
+    y->tv_sec -= nsec;
+  }
+
+  /* Compute the time remaining to wait.
+     tv_usec is certainly positive. */
+  result->tv_sec = x->tv_sec - y->tv_sec;
+  result->tv_usec = x->tv_usec - y->tv_usec;
+
+  /* Return 1 if result is negative. */
+  return x->tv_sec < y->tv_sec;
+}
+
+void update_rtt(sender_t* sender, recvr_packet_header_t *header) {
+	struct timeval now;
+
+	int result = gettimeofday(&now, NULL);
+	if (result == -1) {
+		perror("update_rtt");
+	}
+
+	struct timeval rtt;
+	struct timeval before = header->timestamp;
+	int sign = timeval_subtract(&rtt, &now, &before);
+	if (sign == 1) {
+		fprintf(stderr, "update_rtt: negative result\n");
+		return; // the clock stepped back, the sample means nothing
+	}
+	
+	// jacobson's algorithm for time out value
+	float a = 0.125f;
+	float b = 0.25f;
+	long rtt_est = sender->rtt_est;
+	long rtt_sample = (rtt.tv_sec * 1000000L) + rtt.tv_usec; // a syn answered after a second or more is a sample too
+
+	// the time the recvr held the ack isn't the path's, a sample it would take below 0 is left out
+	if (rtt_sample <= header->ack_delay) {
+		return;
+	}
+	rtt_sample -= header->ack_delay;
+
+	cc_on_rtt(sender->cc, rtt_sample);
+	stats_histogram_record(&sender->rtt_histogram, rtt_sample);
+
+	// the first sample replaces the 1 s guess outright (rfc 6298), smoothed into it a lost packet early on waits out a 3 s rto
+	if (!sender->rtt_measured) {
+		sender->rtt_measured = 1;
+		sender->rtt_est = rtt_sample;
+		sender->rtt_dev = rtt_sample / 2;
+		return;
+	}
+
+	long diff = labs(rtt_sample - rtt_est);
+	long rtt_dev = sender->rtt_dev;
+
+	rtt_est = (a * rtt_est) + ((1 - a) * rtt_sample);
+	rtt_dev = (b * rtt_dev) + ((1 - b) * diff);
+	
+	sender->rtt_est = rtt_est;
+	sender->rtt_dev = rtt_dev;
+	// printf("update rtt: new avg is %ld\n", rtt_est);
+}
+
+void increase_rtt_timeout(sender_t *sender) {
+	sender->rtt_est = sender->rtt_est * 2;
+	if (sender->rtt_est > MAX_TIMEOUT) {
+		fprintf(stderr, "increase_rtt_timeout: timed out\n");
+		exit(1);
+	}
+}
+
+void fast_retransmit(sender_t *sender, seq_t seq_num_to_retranmist) {
+	// fast retransmit
+	// setting file position for the chunk to be retransmitted
+	seq_t start_seq_num = sender->start_seq_num;
+
+	seq_t diff = safe_subtract(seq_num_to_retranmist, start_seq_num);
+	
+	ull64_t offset = diff * max_file_chunk_size;
+	ull64_t file_position = sender->start_file_pos + offset;
+
+	if (cache_lookup(sender->cache, seq_num_to_retranmist) == NULL) {
+		file_moveto(sender->file, file_position);
+	}
+
+	trace_record(sender->trace, TRACE_FAST_RETRANSMIT, 0, sender->stream_id, seq_num_to_retranmist, sender->sacked_count, 0);
+	send_chunk(sender, seq_num_to_retranmist);
+	sender->packets_sent += 1;
+	sender->packets_retransmitted += 1;
+	sender->fast_retransmits += 1;
+	sender->timer_restart |= seq_num_to_retranmist == start_seq_num;
+	// printf("fast_retransmit: seq_num %d\n", seq_num_to_retranmist);
+}
+
+// returns 0 for a stale ack, which is ignored
+int update_last_ack(sender_t* sender, recvr_packet_header_t *header, const char *sack) {
+	seq_t prev_ack = sender->last_ack;
+	seq_t next_ack = header->expected_seq_num;
+	// printf("update_last_ack: prev ack: %u, next ack: %u\n", prev_ack, next_ack);
+
+	if (seq_before(next_ack, prev_ack)) {
+		// printf("update_last_ack: stale ack, diff %u\n", safe_subtract(prev_ack, next_ack));
+		trace_record(sender->trace, TRACE_STALE_ACK, 0, sender->stream_id, next_ack, prev_ack, 0);
+		return 0; // reordered, an older ack would move the window backwards
+	}
+
+	int sack_words = header->sack_words;
+	if (sack_words > MAX_SACK_WORDS) {
+		sack_words = MAX_SACK_WORDS;
+	}
+
+	sender->last_ack = next_ack;
+	memcpy(sender->recvr_window, sack, sack_words * sizeof(ull64_t));
+	sender->recvr_window_words = sack_words;
+	// printf("last ack is now: %u\n", sender->last_ack);
+	return 1;
+}
+
+// slides the start of the window up to the last ack, sender_send_data moves the file
+void sender_reset(sender_t *sender) {
+	seq_t start_seq_num = sender->start_seq_num;
+	seq_t next_seq_num = sender->last_ack;
+	seq_t diff = safe_subtract(next_seq_num, start_seq_num);
+
+	ull64_t offset = diff * max_file_chunk_size;
+	sender->start_file_pos += offset;
+	
+	sender->start_seq_num = next_seq_num;
+	// printf("sender_reset: start seq num: %d, file pos: %llu\n", sender->start_seq_num, sender->start_file_pos);
+	// if (has_wrapped(next_seq_num, start_seq_num)) {
+	
+	// 	printf("Begin Round %d\n", sender->cycle_count);
+	// 	printf("File Position %llu\n", file_get_position(sender->file));
+
+	// 	ull64_t bytes_left = get_bytes_left(sender);
+	// 	float mB_left = bytes_left / (1000.0f * 1000.0f);
+	// 	printf("sender_send_data: %0.6f mB left\n\n", mB_left);
+	// 	sender->cycle_count += 1;
+	// }
+}
+
+// recovery: every hole with enough sacked past it goes out once, in seq order, so a burst of losses is repaired
+// in a round trip rather than a hole per partial ack
+void sender_retransmit_holes(sender_t *sender) {
+	int sacked_above = sender->sacked_total;
+	int budget = cc_window(sender->cc);
+	seq_t bits = sender->recvr_window_words * 64;
+	for (seq_t offset = 0; offset < bits && sacked_above > 0 && budget > 0; offset++) {
+		if ((sender->recvr_window[offset / 64] >> (offset % 64)) & 1) {
+			sacked_above -= 1;
+			continue;
+		}
+
+		seq_t seq_num = safe_add(sender->last_ack, offset);
+		if (seq_before(seq_num, sender->retransmit_seq_num)) {
+			continue; // already went out in this recovery
+		}
+		if (!seq_before(seq_num, sender->end_seq_num) || sacked_above < sender_loss_threshold(sender, seq_num)) {
+			break;
+		}
+		if (seq_before(seq_num, sender->timeout_seq_num)
+			&& (seq_num != sender->last_ack || sender->sacked_count < sender_loss_threshold(sender, seq_num))) {
+			break; // the go back after the timeout may have resent it, only what arrived since counts
+		}
+		fast_retransmit(sender, seq_num);
+		sender->retransmit_seq_num = safe_increment(seq_num);
+		budget -= 1;
+	}
+}
+
+// the hole at last_ack is lost once enough packets past it have arrived, counted from the sack bitmap rather than
+// from duplicate acks: one ack can cover several packets, and the ack that first shows the hole may also move the window
+void sender_detect_loss(sender_t *sender, int moved) {
+	seq_t hole_seq_num = sender->last_ack;
+
+	int sacked_total = 0;
+	for (int i = 0; i < sender->recvr_window_words; i++) {
+		sacked_total += __builtin_popcountll(sender->recvr_window[i]);
+	}
+	if (moved) {
+		// before timeout_seq_num the go back may have just resent the hole, only what arrives from now on counts
+		sender->sacked_count = seq_before(hole_seq_num, sender->timeout_seq_num) ? 0 : sacked_total;
+	} else if (sacked_total > sender->sacked_total) {
+		sender->sacked_count += sacked_total - sender->sacked_total;
+	}
+	sender->sacked_total = sacked_total;
+
+	if (sender->in_recovery) {
+		sender_retransmit_holes(sender); // the next holes, or ones this ack is the first to show
+		return;
+	}
+	if (!seq_before(hole_seq_num, sender->end_seq_num)) {
+		return; // it goes out again anyway after a timeout
+	}
+	if (sender->sacked_count >= sender_loss_threshold(sender, hole_seq_num)) {
+		cc_on_loss(sender->cc);
+		sender->in_recovery = 1;
+		sender->recover_seq_num = sender->end_seq_num;
+		sender->retransmit_seq_num = hole_seq_num;
+		sender_retransmit_holes(sender);
+	}
+}
+
+// slides the window on every new ack, the event loop then clocks out new packets
+void sender_recv_ack(sender_t *sender, recvr_packet_header_t *header, const char *sack) {
+	seq_t prev_ack = sender->last_ack;
+	seq_t next_ack = header->expected_seq_num;
+
+	sender->packets_recv += 1;
+	update_rtt(sender, header);
+	if (header->loss_rate > 0) {
+		sender->fec_loss_rate = header->loss_rate - 1;
+	}
+	if (!update_last_ack(sender, header, sack)) {
+		sender->stale_acks += 1;
+		return;
+	}
+
+	if (prev_ack == next_ack) {
+		if (sender->end_seq_num == prev_ack) {
+			return; // nothing in flight, e.g. the ack for a retransmit after a timeout
+		}
+
+		// most likely a dropped packet
+		// printf("sender_recv_ack: duplicate ack (either out of order or dropped)\n");
+		sender->dup_acks += 1;
+		sender_detect_loss(sender, 0);
+		return;
+	}
+
+	seq_t acked = safe_subtract(next_ack, prev_ack);
+	sender_resume_skip(sender, next_ack); // the recvr's checkpoint can ack what was never sent
+	sender_reset(sender);
+	if (seq_before(sender->end_seq_num, next_ack)) {
+		sender->end_seq_num = next_ack; // originals acked after going back on a timeout
+	}
+
+	if (sender->in_recovery && !seq_before(next_ack, sender->recover_seq_num)) {
+		sender->in_recovery = 0; // a partial ack stays in recovery, sender_detect_loss resends the holes left
+	}
+
+	int in_flight = safe_subtract(sender->end_seq_num, sender->start_seq_num);
+	cc_on_ack(sender->cc, acked, in_flight, sender->in_recovery);
+	int window = cc_window(sender->cc);
+	stats_histogram_record(&sender->window_histogram, window);
+	if (window != sender->traced_window) {
+		trace_record(sender->trace, TRACE_WINDOW, 0, sender->stream_id, sender->start_seq_num, window, in_flight);
+		sender->traced_window = window;
+	}
+
+	// an ack that moved the window can still show a hole past it
+	sender_detect_loss(sender, 1);
+}
+
+// reads the acks that have arrived, one batch per wake up so sending keeps up
+void sender_recv_acks(sender_t *sender) {
+	udp_t *udp = sender->udp;
 
-		char *msg = udp->msg_recv;
+	int count = udp_poll_batch(udp, udp->batch_size);
+	for (int i = 0; i < count; i ++) {
+		char *msg = udp->batch_msg_recv[i];
 		recvr_packet_header_t header;
 		memcpy(&header, msg, sizeof(recvr_packet_header_t));
 
-		seq_t prev_ack = sender->last_ack;
-		seq_t next_ack = header.expected_seq_num;
-		if (prev_ack == next_ack) {
-			// most likely a dropped packet
-			// should recv data/packet
-			// printf("sender_recv_acks: duplicate ack (either out of order or dropped)\n");	
-			
-			dup_count += 1;
-			if (dup_count == 2) {
-				fast_retransmit(sender, &header);
-				should_recover_fast = 1;
+		// a truncated ack keeps only the sack words that arrived
+		ssize_t sack_bytes = udp->batch_bytes_recv[i] - (ssize_t)sizeof(recvr_packet_header_t);
+		if (sack_bytes < 0 || header.stream_id != sender->stream_id) {
+			continue; // runt, or meant for another stream behind the same address
+		}
+		if (!recvr_packet_verify(msg, udp->batch_bytes_recv[i])) {
+			sender->corrupt_acks += 1;
+			continue;
+		}
+		if (header.flags & (ACK_SIGNATURES | ACK_SYN | ACK_MANIFEST)) {
+			continue; // a late answer from before the transfer started
+		}
+		if (header.sack_words * sizeof(ull64_t) > (size_t)sack_bytes) {
+			header.sack_words = sack_bytes / sizeof(ull64_t);
+		}
+
+		if (sender->trace != NULL) {
+			ull64_t first_word = 0;
+			if (header.sack_words > 0) {
+				memcpy(&first_word, msg + sizeof(recvr_packet_header_t), sizeof(ull64_t));
 			}
-			// max_packets_to_recv += 1;
-			// should_slow_start = 1;
-		} else {
-			dup_count = 0;
+			trace_record(sender->trace, TRACE_ACK, 0, sender->stream_id, header.expected_seq_num, header.sack_words, first_word);
 		}
-		update_last_ack(sender, &header);
-		update_rtt(sender, &header);
-		// if (next_ack == sender->end_seq_num) {
-		// 	break;
-		// }
+		sender_recv_ack(sender, &header, msg + sizeof(recvr_packet_header_t));
 	}
+}
 
-	
-	if (should_slow_start) {
-		cc_slow_start(sender);
-		// increase_rtt_timeout(sender);
-	} else if (should_recover_fast) {
-		cc_fast_recovery(sender);
-	} else {
-		cc_incr(sender);
+/*** Handshake ***/
+
+// opens the stream on the recvr: where its seq nums start, where its segment does, the chunk size, the window and the features
+// the answer caps the window, turns off what the recvr won't go along with, and is the stream's first rtt sample
+void sender_connect(sender_t *sender) {
+	udp_t *udp = sender->udp;
+
+	syn_t syn;
+	memset(&syn, 0, sizeof(syn));
+	syn.transfer_size = sender->total_size;
+	syn.max_window = sender->cc->max_window_size;
+	syn.features = (sender->fec ? SYN_FEC : 0) | (sender->compress ? SYN_COMPRESS : 0) | (sender->delta ? SYN_DELTA : 0)
+		| (sender->resume ? SYN_RESUME : 0) | (sender->file->stream ? SYN_STREAM : 0) | (sender->tree != NULL ? SYN_TREE : 0);
+	if (sender->tree != NULL && sender->stream_id == 0) {
+		syn.manifest_size = sender->tree->manifest_size;
+	}
+	syn.source_id = sender->source_id;
+
+	// the socket isn't in the event loop yet when main connects the first stream for its signatures
+	struct pollfd poll_fd;
+	poll_fd.fd = udp_event_fd(udp);
+	poll_fd.events = POLLIN;
+
+	for (int attempt = 0; attempt < SYN_ATTEMPTS; attempt++) {
+		sender_packet_header_t packet_header;
+		sender_packet_header_load(&packet_header, sender->first_seq_num);
+		packet_header.flags |= PACKET_SYN;
+		packet_header.stream_id = sender->stream_id;
+		packet_header.stream_count = sender->stream_count;
+		packet_header.conn_id = sender->conn_id;
+		packet_header.offset = sender->start_file_pos;
+		memcpy(udp->msg_send, &packet_header, sizeof(sender_packet_header_t));
+		memcpy(udp->msg_send + sizeof(sender_packet_header_t), &syn, sizeof(syn_t));
+		sender_packet_seal(udp->msg_send, crc32c(0, &syn, sizeof(syn_t)));
+		udp->bytes_to_send = sizeof(sender_packet_header_t) + sizeof(syn_t);
+		udp_send(udp);
+
+		if (poll(&poll_fd, 1, SYN_RETRY) <= 0) {
+			continue;
+		}
+
+		int count = udp_poll_batch(udp, udp->batch_size);
+		for (int i = 0; i < count; i++) {
+			char *msg = udp->batch_msg_recv[i];
+			ssize_t size = udp->batch_bytes_recv[i];
+			if (size != (ssize_t)(sizeof(recvr_packet_header_t) + sizeof(syn_t)) || !recvr_packet_verify(msg, size)) {
+				continue;
+			}
+
+			recvr_packet_header_t header;
+			memcpy(&header, msg, sizeof(recvr_packet_header_t));
+			if (header.stream_id != sender->stream_id || !(header.flags & ACK_SYN)) {
+				continue;
+			}
+			syn_t answer;
+			memcpy(&answer, msg + sizeof(recvr_packet_header_t), sizeof(syn_t));
+
+			update_rtt(sender, &header);
+			if (answer.max_window > 0 && answer.max_window < (unsigned int)sender->cc->max_window_size) {
+				cc_limit_window(sender->cc, answer.max_window);
+			}
+			sender->fec = sender->fec && (answer.features & SYN_FEC);
+			sender->compress = sender->compress && (answer.features & SYN_COMPRESS);
+			sender->delta = sender->delta && (answer.features & SYN_DELTA);
+			sender->resume = sender->resume && (answer.features & SYN_RESUME);
+			if (sender->tree != NULL && !(answer.features & SYN_TREE)) {
+				fprintf(stderr, "sender_connect: the recvr is writing a file, not a directory\n");
+				exit(1);
+			}
+			sender->connected = 1;
+			return;
+		}
+	}
+
+	fprintf(stderr, "sender_connect: no answer from the recvr\n");
+	exit(1);
+}
+
+/*** Manifest ***/
+
+// sends the manifest page at offset, a chunk of it at most
+void sender_send_manifest_page(sender_t *sender, ull64_t offset) {
+	udp_t *udp = sender->udp;
+	tree_t *tree = sender->tree;
+	size_t size = tree->manifest_size - offset;
+	if (size > max_file_chunk_size) {
+		size = max_file_chunk_size;
+	}
+
+	sender_packet_header_t packet_header;
+	sender_packet_header_load(&packet_header, sender->first_seq_num);
+	packet_header.flags |= PACKET_MANIFEST;
+	packet_header.stream_id = sender->stream_id;
+	packet_header.stream_count = sender->stream_count;
+	packet_header.conn_id = sender->conn_id;
+	packet_header.offset = offset;
+	memcpy(udp->msg_send, &packet_header, sizeof(sender_packet_header_t));
+	memcpy(udp->msg_send + sizeof(sender_packet_header_t), tree->manifest + offset, size);
+
+	sender_packet_seal(udp->msg_send, crc32c(0, tree->manifest + offset, size));
+	udp->bytes_to_send = sizeof(sender_packet_header_t) + size;
+	udp_send(udp);
+}
+
+// the directory's manifest, MANIFEST_BURST pages at a time, before any stream sends data
+// the recvr makes the tree once it has every page, so data never arrives for a file that isn't there
+void sender_send_manifest(sender_t *sender) {
+	udp_t *udp = sender->udp;
+	unsigned int page_count = (sender->tree->manifest_size + max_file_chunk_size - 1) / max_file_chunk_size;
+	unsigned char *pages_acked = calloc(page_count, 1);
+	unsigned int pages_left = page_count;
+
+	struct pollfd poll_fd;
+	poll_fd.fd = udp_event_fd(udp);
+	poll_fd.events = POLLIN;
+
+	for (int attempt = 0; attempt < MANIFEST_ATTEMPTS && pages_left > 0; attempt++) {
+		int sent = 0;
+		for (unsigned int page = 0; page < page_count && sent < MANIFEST_BURST; page++) {
+			if (!pages_acked[page]) {
+				sender_send_manifest_page(sender, (ull64_t)page * max_file_chunk_size);
+				sent += 1;
+			}
+		}
+
+		// the next burst goes out once this one is acked, or lost
+		unsigned int before = pages_left;
+		while (sent > 0 && pages_left > 0 && poll(&poll_fd, 1, MANIFEST_RETRY) > 0) {
+			int batch_count = udp_poll_batch(udp, udp->batch_size);
+			for (int i = 0; i < batch_count; i++) {
+				char *msg = udp->batch_msg_recv[i];
+				ssize_t size = udp->batch_bytes_recv[i];
+				if (size != sizeof(recvr_packet_header_t) || !recvr_packet_verify(msg, size)) {
+					continue;
+				}
+				recvr_packet_header_t header;
+				memcpy(&header, msg, sizeof(recvr_packet_header_t));
+				if (header.stream_id != sender->stream_id || !(header.flags & ACK_MANIFEST)) {
+					continue;
+				}
+				unsigned int page = header.expected_seq_num;
+				if (page >= page_count || pages_acked[page]) {
+					continue;
+				}
+				pages_acked[page] = 1;
+				pages_left -= 1;
+				sent -= 1;
+			}
+		}
+		if (pages_left < before) {
+			attempt = 0; // only a recvr that stopped answering gives up, not a long manifest
+		}
+	}
+	free(pages_acked);
+
+	if (pages_left > 0) {
+		fprintf(stderr, "sender_send_manifest: no answer from the recvr\n");
+		exit(1);
+	}
+}
+
+/*** Resume ***/
+
+// asks the recvr where its checkpoint has the stream, and starts from there
+void sender_resume(sender_t *sender) {
+	udp_t *udp = sender->udp;
+
+	for (int attempt = 0; attempt < RESUME_ATTEMPTS; attempt++) {
+		sender_packet_header_t packet_header;
+		sender_packet_header_load(&packet_header, sender->first_seq_num);
+		packet_header.flags |= PACKET_RESUME;
+		packet_header.stream_id = sender->stream_id;
+		packet_header.stream_count = sender->stream_count;
+		packet_header.conn_id = sender->conn_id;
+		packet_header.offset = sender->start_file_pos;
+		memcpy(udp->msg_send, &packet_header, sizeof(sender_packet_header_t));
+		sender_packet_seal(udp->msg_send, 0);
+		udp->bytes_to_send = sizeof(sender_packet_header_t);
+		udp_send(udp);
+
+		struct epoll_event event;
+		if (epoll_wait(sender->epoll_fd, &event, 1, RESUME_RETRY) <= 0) {
+			continue;
+		}
+
+		int count = udp_poll_batch(udp, udp->batch_size);
+		for (int i = 0; i < count; i++) {
+			char *msg = udp->batch_msg_recv[i];
+			ssize_t sack_bytes = udp->batch_bytes_recv[i] - (ssize_t)sizeof(recvr_packet_header_t);
+			if (sack_bytes < 0 || !recvr_packet_verify(msg, udp->batch_bytes_recv[i])) {
+				continue;
+			}
+
+			recvr_packet_header_t header;
+			memcpy(&header, msg, sizeof(recvr_packet_header_t));
+			if (header.stream_id != sender->stream_id || !(header.flags & ACK_RESUME)) {
+				continue;
+			}
+			if (header.sack_words * sizeof(ull64_t) > (size_t)sack_bytes) {
+				header.sack_words = sack_bytes / sizeof(ull64_t);
+			}
+
+			// as if everything up to there had been sent and acked, the sack has what arrived past it
+			ull64_t segment_start = sender->start_file_pos;
+			update_last_ack(sender, &header, msg + sizeof(recvr_packet_header_t));
+			seq_t resume_seq_num = sender->last_ack;
+			sender->resumed_bytes = safe_subtract(resume_seq_num, sender->start_seq_num) * max_file_chunk_size;
+			sender_reset(sender);
+			if (sender->start_file_pos > sender->transfer_size) {
+				sender->start_file_pos = sender->transfer_size;
+			}
+			sender->transfer_start = sender->start_file_pos;
+			sender_fold_file(sender, segment_start, sender->start_file_pos);
+			sender->first_seq_num = resume_seq_num;
+			sender->end_seq_num = resume_seq_num;
+			sender->highest_seq_num = resume_seq_num;
+			sender->recover_seq_num = resume_seq_num;
+			sender->retransmit_seq_num = resume_seq_num;
+			sender->timer_seq_num = resume_seq_num;
+			sender->sacked_total = 0;
+			// what the checkpoint has past the holes predates every packet sent, it's no sign they were lost
+			sender->timeout_seq_num = safe_add(resume_seq_num, sender->recvr_window_words * 64);
+			return;
+		}
 	}
 
-	sender->packets_recv = packets_recv;
+	fprintf(stderr, "sender_resume: no answer from the recvr\n");
+	exit(1);
+}
+
+// rto expired: everything in flight is presumed lost
+void sender_timeout(sender_t *sender) {
+	// printf("sender_timeout: going back to seq num %u\n", sender->start_seq_num);
+	sender->timeouts += 1;
+	trace_record(sender->trace, TRACE_TIMEOUT, 0, sender->stream_id, sender->start_seq_num, sender->rtt_est * 2, 0);
+	cc_on_timeout(sender->cc);
+	increase_rtt_timeout(sender);
+
+	// go back to the oldest unacked packet, sacked chunks are skipped when resending
+	// every hole sent so far goes out again that way, only later arrivals count against them
+	sender->timeout_seq_num = sender->highest_seq_num;
+	sender->end_seq_num = sender->start_seq_num;
+	sender->sacked_count = 0;
+	sender->in_recovery = 0;
 }
 
 void sender_set_timeout(sender_t *sender) {
-	// jacobson's algorithm for time out value
-	suseconds_t microsecs = (4 * sender->rtt_dev) + sender->rtt_est;
+	// jacobson's algorithm for time out value, and the longest the recvr may sit on an ack
+	suseconds_t microsecs = (4 * sender->rtt_dev) + sender->rtt_est + ACK_DELAY;
+	if (microsecs < MIN_RTO) {
+		microsecs = MIN_RTO;
+	}
 	
-	// will error out if microseconds > 1 sec, must split into seconds and microseconds
 	long microsecs_in_sec = 1000*1000;
 
-	time_t secs = microsecs / microsecs_in_sec;
-	suseconds_t adjusted_microsecs = microsecs % microsecs_in_sec; 
-
-	// sets the timeout
-	struct timeval tv;
-	tv.tv_sec = secs;
-	tv.tv_usec = adjusted_microsecs;
+	// armed only while packets are in flight, all zeros disarms
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	int in_flight = sender->end_seq_num != sender->start_seq_num;
+	if (in_flight) {
+		its.it_value.tv_sec = microsecs / microsecs_in_sec;
+		its.it_value.tv_nsec = (microsecs % microsecs_in_sec) * 1000;
+	}
 
-	// printf("sender_set_timeout: timeout set to: %ld s , %d ms\n", tv.tv_sec, tv.tv_usec / 1000);
+	// printf("sender_set_timeout: timeout set to: %ld s , %ld ms\n", its.it_value.tv_sec, its.it_value.tv_nsec / 1000000);
 
-	if (setsockopt(sender->udp->sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv,sizeof(tv)) < 0) {
+	if (timerfd_settime(sender->timer_fd, 0, &its, NULL) < 0) {
 		perror("sender_set_timeout: setting timeout failed");
 	}
+	sender->timer_armed = in_flight;
+	sender->timer_seq_num = sender->start_seq_num;
+	sender->timer_restart = 0;
+}
+
+// restarts the rto when the window slid, one timerfd_settime per wake up instead of per ack
+void sender_update_timeout(sender_t *sender) {
+	int in_flight = sender->end_seq_num != sender->start_seq_num;
+	if (in_flight == sender->timer_armed && sender->timer_seq_num == sender->start_seq_num && !sender->timer_restart) {
+		return;
+	}
+	sender_set_timeout(sender);
 }
 
 int sender_is_complete(sender_t *sender) {
 	return sender->start_file_pos >= sender->transfer_size;
 }
 
+// the eof goes again every rto until the recvr answers whether the stream matched the digest
 void sender_send_eof(sender_t *sender) {
 	udp_t *udp = sender->udp;
 	char *msg = udp->msg_send;
 
-	//prepare packet: load eof seq num
-	seq_t seq_num = EOF_SEQ_NUM;
+	//prepare packet: flag eof, seq num is one past the data
 	sender_packet_header_t packet_header;
-	sender_packet_header_load(&packet_header, seq_num);
+	sender_packet_header_load(&packet_header, sender->start_seq_num);
+	packet_header.flags |= PACKET_EOF;
+	packet_header.stream_id = sender->stream_id;
+	packet_header.stream_count = sender->stream_count;
+	packet_header.conn_id = sender->conn_id;
+	packet_header.offset = sender->start_file_pos;
 	
 	memcpy(msg, &packet_header, sizeof(sender_packet_header_t));
+	unsigned char *digest = (unsigned char *)msg + sizeof(sender_packet_header_t);
+	sender_digest(sender, digest);
+	sender_packet_seal(msg, crc32c(0, digest, DIGEST_SIZE));
+
+	udp->bytes_to_send = sizeof(sender_packet_header_t) + DIGEST_SIZE;
+
+	long retry = ((4 * sender->rtt_dev) + sender->rtt_est + ACK_DELAY) / 1000;
+	if (retry < 1) {
+		retry = 1;
+	} else if (retry > EOF_RETRY) {
+		retry = EOF_RETRY;
+	}
+
+	struct pollfd poll_fd;
+	poll_fd.fd = udp_event_fd(udp);
+	poll_fd.events = POLLIN;
+
+	for (int attempt = 0; attempt < EOF_ATTEMPTS; attempt++) {
+		udp_send(udp);
+
+		// acks for the last of the data can still be on their way, they don't cut the wait short
+		ull64_t deadline_ns = monotonic_ns() + (retry * 1000000ULL);
+		ull64_t now_ns;
+		while ((now_ns = monotonic_ns()) < deadline_ns) {
+			if (poll(&poll_fd, 1, (deadline_ns - now_ns + 999999) / 1000000) <= 0) {
+				break;
+			}
+
+			int count = udp_poll_batch(udp, udp->batch_size);
+			for (int i = 0; i < count; i++) {
+				char *ack = udp->batch_msg_recv[i];
+				ssize_t size = udp->batch_bytes_recv[i];
+				if (size < (ssize_t)sizeof(recvr_packet_header_t) || !recvr_packet_verify(ack, size)) {
+					continue;
+				}
+
+				recvr_packet_header_t header;
+				memcpy(&header, ack, sizeof(recvr_packet_header_t));
+				if (header.stream_id != sender->stream_id || !(header.flags & ACK_EOF)) {
+					continue;
+				}
+				sender->verified = (header.flags & ACK_CORRUPT) ? -1 : 1;
+				if (sender->verified == -1) {
+					fprintf(stderr, "sender_send_eof: stream %d doesn't match on the recvr\n", sender->stream_id);
+				}
+				return;
+			}
+		}
+	}
+
+	fprintf(stderr, "sender_send_eof: no answer from the recvr, stream %d is unverified\n", sender->stream_id);
+}
+
+// a header only packet, the recvr takes it as a sign of life and nothing more
+void sender_send_keepalive(sender_t *sender) {
+	udp_t *udp = sender->udp;
 
+	sender_packet_header_t packet_header;
+	sender_packet_header_load(&packet_header, sender->start_seq_num);
+	packet_header.flags |= PACKET_KEEPALIVE;
+	packet_header.stream_id = sender->stream_id;
+	packet_header.stream_count = sender->stream_count;
+	packet_header.conn_id = sender->conn_id;
+	packet_header.offset = sender->start_file_pos;
+	memcpy(udp->msg_send, &packet_header, sizeof(sender_packet_header_t));
+	sender_packet_seal(udp->msg_send, 0);
 	udp->bytes_to_send = sizeof(sender_packet_header_t);
 	udp_send(udp);
-	udp_send(udp);
-	udp_send(udp);
-	udp_send(udp);
+	sender->keepalives_sent += 1;
 }
 
-void sender_reset(sender_t *sender) {
-	seq_t start_seq_num = sender->start_seq_num;
-	seq_t next_seq_num = sender->last_ack;
-	if (next_seq_num == -1) {
-		next_seq_num = 0;
+void sender_print_stats(sender_t *sender) {
+	double secs = (monotonic_ns() - sender->start_time_ns) / 1e9;
+	ull64_t transfer_bytes = sender->transfer_size - sender->transfer_start;
+	double goodput = (transfer_bytes * 8) / secs / 1e6;
+	double loss = 0;
+	if (sender->packets_sent > 0) {
+		loss = (100.0 * sender->packets_retransmitted) / sender->packets_sent;
 	}
-	seq_t diff = safe_subtract(next_seq_num, start_seq_num);
-
-	ull64_t offset = diff * max_file_chunk_size;
-	ull64_t next_file_position = sender->start_file_pos + offset;
-	
-	file_t *file = sender->file;
-	file_moveto(file, next_file_position);
-
-	sender->start_file_pos = file_get_position(file);
-	
-	sender->start_seq_num = next_seq_num;
-	// printf("sender_reset: start seq num: %d, file pos: %llu\n", sender->start_seq_num, sender->start_file_pos);
-	// if (has_wrapped(next_seq_num, start_seq_num)) {
-	
-	// 	printf("Begin Round %d\n", sender->cycle_count);
-	// 	printf("File Position %llu\n", file_get_position(sender->file));
 
-	// 	ull64_t bytes_left = get_bytes_left(sender);
-	// 	float mB_left = bytes_left / (1000.0f * 1000.0f);
-	// 	printf("sender_send_data: %0.6f mB left\n\n", mB_left);
-	// 	sender->cycle_count += 1;
-	// }
+	if (sender->stream_count > 1) {
+		fprintf(stderr, "stream %d:\n", sender->stream_id);
+	}
+	if (sender->resume) {
+		fprintf(stderr, "resume: %llu bytes already at the recvr, from %llu on\n", sender->resumed_bytes, sender->transfer_start);
+	}
+	fprintf(stderr, "transfer: %llu bytes in %.3f s, goodput %.1f Mbit/s\n", transfer_bytes, secs, goodput);
+	fprintf(stderr, "packets: %llu sent, %llu acks, %llu retransmitted (%.2f%%), %d fast retransmits, %d timeouts\n",
+		sender->packets_sent, sender->packets_recv, sender->packets_retransmitted, loss, sender->fast_retransmits, sender->timeouts);
+	fprintf(stderr, "window: %s, %d packets, srtt %ld us, ", cc_name(sender->cc), cc_window(sender->cc), sender->rtt_est);
+	if (sender->pacing) {
+		double rate = (cc_pacing_rate(sender->cc) * (sizeof(sender_packet_header_t) + max_file_chunk_size) * 8) / 1e6;
+		fprintf(stderr, "pacing at %.1f Mbit/s\n", rate);
+	} else {
+		fprintf(stderr, "pacing off\n");
+	}
+	if (sender->fec) {
+		fprintf(stderr, "fec: %llu repair packets, last block had %d at %.1f%% reported loss\n",
+			sender->fec_repairs_sent, sender->fec_repair_count, (100.0 * sender->fec_loss_rate) / 256);
+	}
+	if (sender->corrupt_acks > 0) {
+		fprintf(stderr, "integrity: %llu corrupt acks dropped\n", sender->corrupt_acks);
+	}
+	if (sender->file->stream) {
+		fprintf(stderr, "stream: read to its %s, %llu keepalives while the source was idle\n",
+			sender->file->stream_eof ? "end" : "size limit", sender->keepalives_sent);
+	}
+	if (sender->cache != NULL) {
+		fprintf(stderr, "cache: %d packets, %.1f MB on %s pages, %llu retransmits sent from it\n", sender->cache->count,
+			sender->cache->map_size / 1e6, sender->cache->huge ? "huge" : "transparent huge", sender->cached_resends);
+	}
+	if (sender->delta_index != NULL) {
+		double ratio = 100;
+		if (sender->delta_bytes_in > 0) {
+			ratio = (100.0 * sender->delta_bytes_out) / sender->delta_bytes_in;
+		}
+		fprintf(stderr, "delta: %d runs found in the recvr's copy, %llu bytes of chunks sent as %llu (%.1f%%)\n",
+			sender->delta_match_count, sender->delta_bytes_in, sender->delta_bytes_out, ratio);
+	}
+	if (sender->compress) {
+		double ratio = 100;
+		if (sender->compress_bytes_in > 0) {
+			ratio = (100.0 * sender->compress_bytes_out) / sender->compress_bytes_in;
+		}
+		fprintf(stderr, "compress: %llu bytes sent as %llu (%.1f%%), entropy %.2f bits/byte\n",
+			sender->compress_bytes_in, sender->compress_bytes_out, ratio, sender->compress_entropy);
+	} else if (sender->compress_entropy > 0) {
+		fprintf(stderr, "compress: off, entropy %.2f bits/byte\n", sender->compress_entropy);
+	}
 }
 
 void sender_delete(sender_t *sender) {
+	if (sender->pacing_fd != -1) {
+		close(sender->pacing_fd);
+	}
+	close(sender->timer_fd);
+	close(sender->epoll_fd);
+	free(sender->fec_block);
+	free(sender->compress_buffer);
+	free(sender->delta_matches);
+	free(sender->delta_buffer);
+	cache_delete(sender->cache);
 	free(sender);
 }
 
+/*** Path MTU ***/
+
+#define IP_UDP_HEADERS 28 // what an mtu loses to the ipv4 and udp headers
+
+// link mtus worth a probe below the route's own: jumbo frames, then smaller jumbo setups and tunnels over them
+static const int probe_mtus[] = { 9000, 8192, 4096 };
+
+// the largest packet that makes it to the recvr, BASE_PACKET_SIZE if nothing bigger does or it doesn't answer
+// a round sends a probe of every candidate size at once, the largest the recvr echoes wins
+size_t probe_packet_size(char *address, int port, size_t max_packet_size) {
+	if (max_packet_size <= BASE_PACKET_SIZE) {
+		return BASE_PACKET_SIZE;
+	}
+
+	udp_t *udp = udp_create("0", max_packet_size, BASE_PACKET_SIZE, 0);
+	udp_set_server_addr(udp, address, port);
+	int mtu = udp_enable_mtu_probe(udp);
+	if (mtu == -1) {
+		udp_delete(udp);
+		return BASE_PACKET_SIZE;
+	}
+
+	// nothing bigger than the route allows, the kernel would refuse it with EMSGSIZE anyway
+	size_t candidates[1 + sizeof(probe_mtus) / sizeof(int)];
+	int candidate_count = 0;
+	size_t largest = mtu - IP_UDP_HEADERS;
+	if (largest > max_packet_size) {
+		largest = max_packet_size;
+	}
+	if (largest > BASE_PACKET_SIZE) {
+		candidates[candidate_count++] = largest;
+	}
+	for (size_t i = 0; i < sizeof(probe_mtus) / sizeof(int); i++) {
+		size_t size = probe_mtus[i] - IP_UDP_HEADERS;
+		if (size < largest && size > BASE_PACKET_SIZE) {
+			candidates[candidate_count++] = size;
+		}
+	}
+
+	struct timeval timeout = { 0, PROBE_RETRY * 1000 };
+	udp_set_timeout(udp, &timeout);
+
+	size_t packet_size = BASE_PACKET_SIZE;
+	for (int attempt = 0; attempt < PROBE_ATTEMPTS && candidate_count > 0 && packet_size == BASE_PACKET_SIZE; attempt++) {
+		for (int i = 0; i < candidate_count; i++) {
+			sender_packet_header_t packet_header;
+			sender_packet_header_load(&packet_header, 0);
+			packet_header.flags |= PACKET_PROBE;
+			packet_header.stream_id = 0;
+			packet_header.stream_count = 0;
+			packet_header.conn_id = 0;
+			packet_header.offset = candidates[i];
+
+			size_t padding = candidates[i] - sizeof(sender_packet_header_t);
+			memcpy(udp->msg_send, &packet_header, sizeof(sender_packet_header_t));
+			memset(udp->msg_send + sizeof(sender_packet_header_t), 0, padding);
+			sender_packet_seal(udp->msg_send, crc32c(0, udp->msg_send + sizeof(sender_packet_header_t), padding));
+			udp->bytes_to_send = candidates[i];
+			udp_send(udp);
+		}
+
+		// answers are back within a round trip, a probe the path dropped never is
+		while (packet_size < candidates[0] && udp_recv(udp) == 0) {
+			if (udp->bytes_recv != sizeof(recvr_packet_header_t) + sizeof(unsigned int) || !recvr_packet_verify(udp->msg_recv, udp->bytes_recv)) {
+				continue;
+			}
+			recvr_packet_header_t header;
+			memcpy(&header, udp->msg_recv, sizeof(recvr_packet_header_t));
+			unsigned int probe_size;
+			memcpy(&probe_size, udp->msg_recv + sizeof(recvr_packet_header_t), sizeof(probe_size));
+			if ((header.flags & ACK_PROBE) && probe_size > packet_size && probe_size <= candidates[0]) {
+				packet_size = probe_size;
+			}
+		}
+	}
+
+	udp_delete(udp);
+	return packet_size;
+}
+
+/*** Stats ***/
+
+// what -j writes at exit and SIGUSR1 dumps at any time, json with every stream's counters and histograms
+typedef struct report {
+	pthread_mutex_t lock;
+	sender_t **senders;
+	int stream_count;
+	ull64_t transfer_size;
+	ull64_t start_time_ns; // 0 until the streams start
+	char *path; // NULL for stderr, - for stdout
+	int closed; // written for the last time, the senders are going away
+} report_t;
+
+report_t* report_create(sender_t **senders, int stream_count, ull64_t transfer_size, char *path) {
+	report_t *report = malloc(sizeof(report_t));
+	pthread_mutex_init(&report->lock, NULL);
+	report->senders = senders;
+	report->stream_count = stream_count;
+	report->transfer_size = transfer_size;
+	report->start_time_ns = 0;
+	report->path = path;
+	report->closed = 0;
+	return report;
+}
+
+void sender_write_stats(sender_t *sender, stats_json_t *json) {
+	ull64_t acked_pos = sender->start_file_pos < sender->transfer_size ? sender->start_file_pos : sender->transfer_size;
+	double secs = 0;
+	if (sender->start_time_ns > 0) {
+		secs = (monotonic_ns() - sender->start_time_ns) / 1e9;
+	}
+
+	// a stream's size isn't known until its end, until then it's what has been read
+	ull64_t transfer_size = sender->transfer_size;
+	if (transfer_size == STREAM_MAX_SIZE) {
+		transfer_size = sender->file->pos;
+	}
+
+	stats_json_object(json, NULL);
+	stats_json_int(json, "stream_id", sender->stream_id);
+	stats_json_uint(json, "bytes", transfer_size - sender->transfer_start);
+	stats_json_uint(json, "bytes_acked", acked_pos - sender->transfer_start);
+	stats_json_double(json, "secs", secs);
+	stats_json_uint(json, "packets_sent", sender->packets_sent);
+	stats_json_uint(json, "acks", sender->packets_recv);
+	stats_json_uint(json, "retransmitted", sender->packets_retransmitted);
+	stats_json_int(json, "fast_retransmits", sender->fast_retransmits);
+	stats_json_int(json, "timeouts", sender->timeouts);
+	stats_json_uint(json, "dup_acks", sender->dup_acks);
+	stats_json_uint(json, "stale_acks", sender->stale_acks);
+	stats_json_uint(json, "corrupt_acks", sender->corrupt_acks);
+	stats_json_uint(json, "fec_repairs", sender->fec_repairs_sent);
+	stats_json_uint(json, "cached_retransmits", sender->cached_resends);
+	if (sender->file->stream) {
+		stats_json_uint(json, "keepalives", sender->keepalives_sent);
+	}
+	stats_json_string(json, "cc", cc_name(sender->cc));
+	stats_json_int(json, "window", cc_window(sender->cc));
+	stats_json_int(json, "srtt_us", sender->rtt_est);
+	stats_json_int(json, "rttvar_us", sender->rtt_dev);
+	if (sender->pacing) {
+		stats_json_double(json, "pacing_mbit", (cc_pacing_rate(sender->cc) * (sizeof(sender_packet_header_t) + max_file_chunk_size) * 8) / 1e6);
+	}
+	stats_json_histogram(json, "rtt_us", &sender->rtt_histogram);
+	stats_json_histogram(json, "window_packets", &sender->window_histogram);
+	stats_json_close(json);
+}
+
+// to a temporary file renamed over the last one, so a reader never sees half of it
+void report_write(report_t *report, int final) {
+	pthread_mutex_lock(&report->lock);
+	if (report->closed) {
+		pthread_mutex_unlock(&report->lock);
+		return;
+	}
+
+	FILE *file = stderr;
+	char temp_path[4096];
+	if (report->path != NULL && strcmp(report->path, "-") == 0) {
+		file = stdout;
+	} else if (report->path != NULL) {
+		snprintf(temp_path, sizeof(temp_path), "%s.tmp", report->path);
+		file = fopen(temp_path, "w");
+		if (file == NULL) {
+			perror("report_write");
+			pthread_mutex_unlock(&report->lock);
+			return;
+		}
+	}
+
+	ull64_t packets_sent = 0;
+	ull64_t retransmitted = 0;
+	ull64_t timeouts = 0;
+	for (int i = 0; i < report->stream_count; i++) {
+		packets_sent += report->senders[i]->packets_sent;
+		retransmitted += report->senders[i]->packets_retransmitted;
+		timeouts += report->senders[i]->timeouts;
+	}
+	double secs = 0;
+	if (report->start_time_ns > 0) {
+		secs = (monotonic_ns() - report->start_time_ns) / 1e9;
+	}
+
+	stats_json_t json;
+	stats_json_begin(&json, file);
+	stats_json_string(&json, "program", "reliable_sender");
+	stats_json_bool(&json, "final", final);
+	stats_json_uint(&json, "transfer_size", report->transfer_size);
+	stats_json_uint(&json, "chunk_size", max_file_chunk_size);
+	stats_json_double(&json, "secs", secs);
+	stats_json_uint(&json, "packets_sent", packets_sent);
+	stats_json_uint(&json, "retransmitted", retransmitted);
+	stats_json_uint(&json, "timeouts", timeouts);
+	stats_json_array(&json, "streams");
+	for (int i = 0; i < report->stream_count; i++) {
+		sender_write_stats(report->senders[i], &json);
+	}
+	stats_json_close(&json);
+	stats_json_close(&json);
+
+	if (file != stderr && file != stdout) {
+		fclose(file);
+		if (rename(temp_path, report->path) == -1) {
+			perror("report_write: rename");
+		}
+	}
+	report->closed = final;
+	pthread_mutex_unlock(&report->lock);
+}
+
+void report_signal(void *arg) {
+	report_write(arg, 0);
+}
+
+// the last dump if -j asked for one, SIGUSR1 is ignored from here on
+// the report itself stays, the watcher thread has it until exit
+void report_finish(report_t *report, int write) {
+	if (write) {
+		report_write(report, 1);
+	}
+	pthread_mutex_lock(&report->lock);
+	report->closed = 1;
+	pthread_mutex_unlock(&report->lock);
+}
+
 /*** Main Loop ***/
 
+void sender_watch(sender_t *sender, int fd) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(sender->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		perror("sender_watch");
+		exit(1);
+	}
+}
+
 void transfer(sender_t *sender) {
-	// initial timeouts based on predicitions
+	int timer_fd = sender->timer_fd;
+	sender_watch(sender, udp_event_fd(sender->udp));
+	sender_watch(sender, timer_fd);
+	if (sender->pacing) {
+		sender_watch(sender, sender->pacing_fd);
+	}
+	if (sender->file->stream) {
+		// disarmed until a chunk waits on it, stdin can be a regular file too, which epoll won't take but never blocks on
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.data.fd = fileno(sender->file->fp);
+		if (epoll_ctl(sender->epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) == 0) {
+			sender->stream_watched = 1;
+		} else if (errno != EPERM) {
+			perror("transfer: watching the stream");
+			exit(1);
+		}
+	}
+	sender_delta_scan(sender);
+	sender->start_time_ns = monotonic_ns();
+
+	if (!sender->connected) {
+		sender_connect(sender);
+	}
+	if (sender->resume) {
+		sender_resume(sender);
+	}
+
+	sender_send_data(sender);
 	sender_set_timeout(sender);
 	// printf("max chunk size is %llu\n", max_file_chunk_size);
-	// printf("\n\n");
 	while (!sender_is_complete(sender)) {
-		sender_send_data(sender);
-
-		sender_recv_acks(sender);
+		// with nothing in flight only the source can wake the sender, the recvr hears from it every so often meanwhile
+		int idle = sender->stream_armed && sender->end_seq_num == sender->start_seq_num;
+		struct epoll_event events[4];
+		int event_count = epoll_wait(sender->epoll_fd, events, 4, idle ? KEEPALIVE_INTERVAL : -1);
+		if (event_count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("transfer: epoll_wait");
+			exit(1);
+		}
+		if (event_count == 0) {
+			sender_send_keepalive(sender);
+		}
 
-		sender_set_timeout(sender);
+		for (int i = 0; i < event_count; i++) {
+			if (sender->stream_watched && events[i].data.fd == fileno(sender->file->fp)) {
+				if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+					// the writer is gone, reads return what's left and then the end without ever blocking
+					epoll_ctl(sender->epoll_fd, EPOLL_CTL_DEL, events[i].data.fd, NULL);
+					sender->stream_watched = 0;
+					sender->stream_armed = 0;
+				} else {
+					sender_arm_stream(sender, 0); // sender_send_data below reads it
+				}
+			} else if (events[i].data.fd == timer_fd) {
+				ull64_t expirations;
+				if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+					sender->timer_armed = 0;
+					sender_timeout(sender);
+				}
+			} else if (events[i].data.fd == sender->pacing_fd) {
+				ull64_t expirations;
+				if (read(sender->pacing_fd, &expirations, sizeof(expirations)) > 0) {
+					sender->pacing_armed = 0; // sender_send_data below picks up
+				}
+			} else {
+				sender_recv_acks(sender);
+			}
+		}
 
-		sender_reset(sender);
-		// printf("\n");
+		// clock out a packet for every one acked, then restart the rto if the window slid
+		sender_send_data(sender);
+		sender_update_timeout(sender);
 	}
 
 	sender_send_eof(sender);
 	// printf("file transfer complete\n");
 }
 
+void* stream_transfer(void *arg) {
+	transfer(arg);
+	return NULL;
+}
+
+// where stream i's segment starts: the chunks split evenly, whole chunks each
+// a boundary only moves to a STREAM_ALIGN one if that's under an eighth of a segment, small transfers still split
+ull64_t stream_segment_start(ull64_t transfer_size, int stream_count, int i) {
+	if (i >= stream_count) {
+		return transfer_size;
+	}
+
+	// gcd of the chunk size and the alignment
+	ull64_t a = max_file_chunk_size;
+	ull64_t b = STREAM_ALIGN;
+	while (b != 0) {
+		ull64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	ull64_t align_chunks = STREAM_ALIGN / a;
+
+	ull64_t chunks = (transfer_size + max_file_chunk_size - 1) / max_file_chunk_size;
+	ull64_t boundary = chunks * i / stream_count;
+	if (align_chunks * 8 <= chunks / stream_count) {
+		boundary = (boundary + align_chunks / 2) / align_chunks * align_chunks;
+	}
+
+	ull64_t segment_start = boundary * max_file_chunk_size;
+	return segment_start < transfer_size ? segment_start : transfer_size;
+}
+
 int main(int argc, char** argv) {
+	int udp_flags = 0;
+	int use_mmap = 0;
+	int use_uring = 0;
+	int use_pacing = 0;
+	int print_stats = 0;
+	char *cc_algorithm = "reno";
+	int stream_count = 1;
+	int use_fec = 0;
+	int use_compress = 0;
+	int use_resume = 0;
+	int use_delta = 0;
+	char *stats_path = NULL;
+	char *trace_path = NULL;
+	size_t max_packet_size = MAX_PACKET_SIZE;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "omupsc:n:fzrdj:t:M:")) != -1) {
+		switch (opt) {
+			case 'o':
+				udp_flags |= UDP_FLAG_GSO; // segmentation offload, falls back if unsupported
+				break;
+			case 'm':
+				use_mmap = 1; // zero copy reads from a mapping, falls back to stdio
+				break;
+			case 'u':
+				use_uring = 1; // io_uring for the sockets, falls back to syscalls
+				break;
+			case 'p':
+				use_pacing = 1; // spread packets at cwnd/rtt instead of bursting the window
+				break;
+			case 's':
+				print_stats = 1; // summary on stderr once done
+				break;
+			case 'c':
+				cc_algorithm = optarg; // reno, cubic or bbr
+				break;
+			case 'n':
+				stream_count = atoi(optarg); // parallel streams, a thread and socket each
+				if (stream_count < 1 || stream_count > MAX_STREAMS) {
+					argc = -1;
+				}
+				break;
+			case 'f':
+				use_fec = 1; // repair packets sized to the loss rate, lost chunks are rebuilt without a retransmit
+				break;
+			case 'z':
+				use_compress = 1; // lz per chunk, turns itself off on data that doesn't compress
+				break;
+			case 'r':
+				use_resume = 1; // pick up where the recvr's checkpoint left off
+				break;
+			case 'd':
+				use_delta = 1; // only what the recvr's old copy doesn't have
+				break;
+			case 'j':
+				stats_path = optarg; // json stats at exit, - for stdout, SIGUSR1 dumps them there any time
+				break;
+			case 't':
+				trace_path = optarg; // packet events, dumped at exit or on a crash, trace_decode reads them
+				break;
+			case 'M':
+				max_packet_size = atoi(optarg); // largest packet the path mtu probe tries, 1472 skips it
+				if (max_packet_size < BASE_PACKET_SIZE || max_packet_size > MAX_PACKET_SIZE) {
+					argc = -1;
+				}
+				break;
+			default:
+				argc = -1; // print usage
+		}
+	}
+
+	cc_t *cc = cc_create(cc_algorithm, MAX_WINDOW_SIZE);
+	if (cc == NULL) {
+		fprintf(stderr, "%s: unknown congestion control %s\n", argv[0], cc_algorithm);
+		argc = -1;
+	}
 
-	if(argc != 5) {
-		fprintf(stderr, "usage: %s receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n\n", argv[0]);
+	if(argc - optind != 4) {
+		fprintf(stderr, "usage: %s [-o] [-m] [-u] [-p] [-s] [-c reno|cubic|bbr] [-n streams] [-f] [-z] [-r] [-d] [-j stats.json] [-t trace_file] [-M max_packet_size] receiver_hostname receiver_port filename_to_xfer|-|directory bytes_to_xfer\n\n", argv[0]);
 		exit(1);
 	}
+	argv += optind - 1;
 	// parsing args
 	int port = atoi(argv[2]);
 	ull64_t transfer_size = atoll(argv[4]);
 	char *address = argv[1];
 	char *filename = argv[3];
 
+	if (cc_is_paced(cc)) {
+		use_pacing = 1; // bbr sets its rate through pacing, its window is only a cap
+	}
+
+	// stdin or a pipe is read once, front to back, as the window opens, and ends wherever it ends
+	int use_stream = file_is_stream(filename);
+	if (use_stream) {
+		if (stream_count > 1 || use_resume || use_delta) {
+			fprintf(stderr, "main: %s is a stream, it goes as one stream, without resume or deltas\n", filename);
+		}
+		stream_count = 1;
+		use_resume = 0;
+		use_delta = 0;
+		if (use_fec && use_compress) {
+			// repairs are encoded from the cache, which holds the chunks as sent
+			fprintf(stderr, "main: fec on a stream needs its chunks as read, no compression with it\n");
+			use_compress = 0;
+		}
+		if (transfer_size == 0) {
+			transfer_size = STREAM_MAX_SIZE; // until the end, otherwise no more than that
+		}
+	}
+
+	// a directory goes whole, its files back to back as one range the streams split up like a file's
+	tree_t *tree = NULL;
+	struct stat st;
+	if (!use_stream && stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+		tree = tree_scan(filename);
+		if (tree == NULL) {
+			fprintf(stderr, "main: can't read the directory %s\n", filename);
+			exit(1);
+		}
+		if (use_resume || use_delta) {
+			fprintf(stderr, "main: %s is a directory, it goes without resume or deltas\n", filename);
+		}
+		use_resume = 0;
+		use_delta = 0;
+		transfer_size = tree->size;
+	}
+
+	fec_init();
+	crc32c_init();
+
+	// the chunk size holds for the whole transfer, every stream and the recvr go by it
+	size_t packet_size = probe_packet_size(address, port, max_packet_size);
+	max_file_chunk_size = packet_size - sizeof(sender_packet_header_t);
 
-	// udp
-	char *udp_port = "0"; // 0 for any open port
-	size_t recv_buffer_size = MAX_PACKET_SIZE;
-	size_t send_buffer_size = MAX_PACKET_SIZE;
+	// the recvr's write ring holds MAX_WINDOW_SIZE base sized chunks, so that many fewer bigger ones
+	int max_window_size = MAX_WINDOW_SIZE * BASE_CHUNK_SIZE / max_file_chunk_size;
+	cc_delete(cc); // only there to check the algorithm, the streams get their own
+	if (trace_path != NULL) {
+		trace_init(trace_path);
+	}
+
+	// the file as it is now, a checkpoint the recvr took of anything else isn't resumed from
+	ull64_t source_id = 0;
+	if (!use_stream && tree == NULL) {
+		source_id = file_identity(filename, transfer_size);
+	}
+
+	// every stream of the transfer carries the same id, a receiver daemon tells transfers apart by it
+	unsigned int conn_id;
+	if (use_resume && source_id != 0) {
+		// a restarted transfer of the same file has to land in the same place on a daemon, another file elsewhere
+		conn_id = (unsigned int)source_id;
+	} else if (getrandom(&conn_id, sizeof(conn_id), 0) != sizeof(conn_id)) {
+		conn_id = getpid() ^ time(NULL);
+	}
+
+	// the byte range is split into contiguous segments, each sent by its own thread and socket
+	sender_t **senders = malloc(stream_count * sizeof(sender_t*));
+	for (int i = 0; i < stream_count; i++) {
+		// udp
+		char *udp_port = "0"; // 0 for any open port
+		size_t recv_buffer_size = BASE_PACKET_SIZE; // acks
+		size_t send_buffer_size = packet_size; // also the GSO segment size
+
+		udp_t *udp = udp_create(udp_port, send_buffer_size, recv_buffer_size, udp_flags);
+		udp_set_server_addr(udp, address, port); 
+		udp_enable_batch(udp, BATCH_SIZE);
+
+		// a window in flight, and up to an ack for each of its packets coming back
+		size_t window_bytes = (size_t)max_window_size * packet_size;
+		size_t ack_bytes = (size_t)max_window_size * BASE_PACKET_SIZE;
+		if (udp_set_buffers(udp, window_bytes, ack_bytes) == -1 && i == 0) {
+			fprintf(stderr, "main: socket buffers clamped to %d/%d of %zu/%zu bytes (send/recv), raise net.core.wmem_max/rmem_max\n",
+				udp->send_buffer_size, udp->recv_buffer_size, window_bytes, ack_bytes);
+		}
+
+		file_t *file = tree != NULL ? file_create_tree(tree) : file_create(filename, use_mmap);
+
+		if (use_uring) {
+			if (udp_enable_uring(udp) == -1 && i == 0) {
+				fprintf(stderr, "main: io_uring not available, using plain syscalls\n");
+			}
+		}
+
+		ull64_t segment_start = stream_segment_start(transfer_size, stream_count, i);
+		ull64_t segment_end = stream_segment_start(transfer_size, stream_count, i + 1);
+		file_moveto(file, segment_start);
+
+		cc = cc_create(cc_algorithm, max_window_size);
+		senders[i] = sender_create(udp, file, segment_end, cc, use_pacing, use_fec, use_compress);
+		sender_compress_probe(senders[i]);
+		senders[i]->stream_id = i;
+		senders[i]->stream_count = stream_count;
+		senders[i]->conn_id = conn_id;
+		senders[i]->total_size = transfer_size == STREAM_MAX_SIZE ? 0 : transfer_size;
+		senders[i]->delta = use_delta;
+		senders[i]->resume = use_resume;
+		senders[i]->source_id = source_id;
+		senders[i]->tree = tree;
+
+		char trace_name[TRACE_NAME_SIZE];
+		snprintf(trace_name, sizeof(trace_name), "stream-%u", (unsigned char)i); // stream ids are one byte, i < MAX_STREAMS
+		senders[i]->trace = trace_create(trace_name);
+	}
+
+	// before the other threads start, so SIGUSR1 only reaches the watcher
+	report_t *report = report_create(senders, stream_count, transfer_size == STREAM_MAX_SIZE ? 0 : transfer_size, stats_path);
+	stats_watch(report_signal, report);
+
+	// the recvr's signatures come over the first stream's socket, every stream matches against them
+	// its syn goes first, the answer says whether the recvr has an old copy to sign at all
+	delta_signature_t *signatures = NULL;
+	delta_index_t *delta_index = NULL;
+	if (use_delta) {
+		unsigned int block_count = 0;
+		sender_connect(senders[0]);
+		if (senders[0]->delta) {
+			signatures = sender_fetch_signatures(senders[0], &block_count);
+		}
+		if (block_count == 0) {
+			fprintf(stderr, "main: the recvr has no copy of the file, sending all of it\n");
+		}
+		delta_index = delta_index_create(signatures, block_count, max_file_chunk_size);
+		for (int i = 0; i < stream_count; i++) {
+			senders[i]->delta_index = delta_index;
+		}
+	}
 
-	udp_t *udp = udp_create(udp_port, send_buffer_size, recv_buffer_size);
-	udp_set_server_addr(udp, address, port); 
+	// the recvr makes the directory's files from the manifest, every page is in before any data goes
+	if (tree != NULL) {
+		sender_connect(senders[0]);
+		sender_send_manifest(senders[0]);
+	}
 
-	file_t *file = file_create(filename);
+	// main loop, the calling thread runs the first stream
+	ull64_t start_time_ns = monotonic_ns();
+	report->start_time_ns = start_time_ns;
+	for (int i = 1; i < stream_count; i++) {
+		if (pthread_create(&senders[i]->thread, NULL, stream_transfer, senders[i]) != 0) {
+			perror("main: pthread_create");
+			exit(1);
+		}
+	}
+	transfer(senders[0]);
+	for (int i = 1; i < stream_count; i++) {
+		pthread_join(senders[i]->thread, NULL);
+	}
+	if (use_stream) {
+		transfer_size = senders[0]->transfer_size; // where the stream ended
+		pthread_mutex_lock(&report->lock);
+		report->transfer_size = transfer_size;
+		pthread_mutex_unlock(&report->lock);
+	}
 
-	sender_t *sender = sender_create(udp, file, transfer_size);
+	if (print_stats) {
+		// the segments' digests hashed in file order, the same for the same file split the same way
+		blake2b_t file_digest;
+		blake2b_init(&file_digest, DIGEST_SIZE);
+		for (int i = 0; i < stream_count; i++) {
+			sender_print_stats(senders[i]);
+			unsigned char digest[DIGEST_SIZE];
+			sender_digest(senders[i], digest);
+			blake2b_update(&file_digest, digest, DIGEST_SIZE);
+		}
+		unsigned char digest[DIGEST_SIZE];
+		blake2b_final(&file_digest, digest);
+		fprintf(stderr, "digest: blake2b ");
+		for (int i = 0; i < DIGEST_SIZE; i++) {
+			fprintf(stderr, "%02x", digest[i]);
+		}
+		fprintf(stderr, "\n");
+		if (tree != NULL) {
+			ull64_t opened = 0;
+			for (int i = 0; i < stream_count; i++) {
+				opened += tree_handles_opened(senders[i]->file->tree);
+			}
+			fprintf(stderr, "tree: %u files, %u directories, %zu manifest bytes, %llu opens\n",
+				tree->file_count, tree->count - tree->file_count, tree->manifest_size, opened);
+		}
+		fprintf(stderr, "path: %zu byte packets, %llu byte chunks\n", packet_size, max_file_chunk_size);
+		if (stream_count > 1) {
+			double secs = (monotonic_ns() - start_time_ns) / 1e9;
+			fprintf(stderr, "total: %llu bytes in %.3f s, goodput %.1f Mbit/s\n", transfer_size, secs, (transfer_size * 8) / secs / 1e6);
+		}
+	}
 
-	// main loop
-	transfer(sender);
+	report_finish(report, stats_path != NULL);
 
 	// clean up
-	file_delete(file);
-	udp_delete(udp);
-	sender_delete(sender);
+	int status = 0;
+	for (int i = 0; i < stream_count; i++) {
+		sender_t *sender = senders[i];
+		if (sender->verified != 1) {
+			status = 1;
+		}
+		file_delete(sender->file);
+		udp_delete(sender->udp);
+		cc_delete(sender->cc);
+		sender_delete(sender);
+	}
+	free(senders);
+	delta_index_delete(delta_index);
+	free(signatures);
+	tree_delete(tree);
 
-	return 0;
+	// the recvr didn't have every stream as it was sent, or never said
+	return status;
 }
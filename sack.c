@@ -0,0 +1,123 @@
+#include "sack.h"
+
+#include <stdlib.h>
+
+sack_t* sack_create(unsigned int bits) {
+	// power of 2 words, so a seq num maps to its bit with a mask
+	unsigned int word_count = 1;
+	while (word_count * SACK_WORD_BITS < bits) {
+		word_count *= 2;
+	}
+
+	sack_t *sack = malloc(sizeof(sack_t));
+	sack->words = calloc(word_count, sizeof(unsigned long long));
+	sack->word_count = word_count;
+	sack->mask = (word_count * SACK_WORD_BITS) - 1;
+	return sack;
+}
+
+void sack_set(sack_t *sack, unsigned int seq) {
+	unsigned int bit = seq & sack->mask;
+	sack->words[bit / SACK_WORD_BITS] |= 1ULL << (bit % SACK_WORD_BITS);
+}
+
+int sack_test(sack_t *sack, unsigned int seq) {
+	unsigned int bit = seq & sack->mask;
+	return (sack->words[bit / SACK_WORD_BITS] >> (bit % SACK_WORD_BITS)) & 1;
+}
+
+// the 64 bits starting at seq, stitched across a word (or the end of the ring) if unaligned
+static unsigned long long sack_word_at(sack_t *sack, unsigned int seq) {
+	unsigned int bit = seq & sack->mask;
+	unsigned int index = bit / SACK_WORD_BITS;
+	unsigned int shift = bit % SACK_WORD_BITS;
+
+	unsigned long long word = sack->words[index] >> shift;
+	if (shift != 0) {
+		unsigned int next = (index + 1) & (sack->word_count - 1);
+		word |= sack->words[next] << (SACK_WORD_BITS - shift);
+	}
+	return word;
+}
+
+static void sack_clear(sack_t *sack, unsigned int seq, unsigned int count) {
+	while (count > 0) {
+		unsigned int bit = seq & sack->mask;
+		unsigned int shift = bit % SACK_WORD_BITS;
+		unsigned int run = SACK_WORD_BITS - shift;
+		if (run > count) {
+			run = count;
+		}
+
+		unsigned long long bits = run == SACK_WORD_BITS ? ~0ULL : (1ULL << run) - 1;
+		sack->words[bit / SACK_WORD_BITS] &= ~(bits << shift);
+
+		seq += run;
+		count -= run;
+	}
+}
+
+// counts the run of set bits from seq (up to limit) and clears it, a word at a time
+unsigned int sack_advance(sack_t *sack, unsigned int seq, unsigned int limit) {
+	unsigned int count = 0;
+	while (count < limit) {
+		unsigned long long missing = ~sack_word_at(sack, seq + count);
+		if (missing != 0) {
+			count += __builtin_ctzll(missing);
+			break;
+		}
+		count += SACK_WORD_BITS;
+	}
+
+	if (count > limit) {
+		count = limit;
+	}
+	sack_clear(sack, seq, count);
+	return count;
+}
+
+// copies bits [seq, seq + limit) into words, bit i is seq + i
+// trailing empty words are dropped, returns the words used (at most max_words)
+int sack_export(sack_t *sack, unsigned int seq, unsigned int limit, unsigned long long *words, int max_words) {
+	int used = 0;
+	for (int i = 0; i < max_words && (unsigned int)i * SACK_WORD_BITS < limit; i++) {
+		unsigned long long word = sack_word_at(sack, seq + (i * SACK_WORD_BITS));
+
+		unsigned int remaining = limit - (i * SACK_WORD_BITS);
+		if (remaining < SACK_WORD_BITS) {
+			word &= (1ULL << remaining) - 1;
+		}
+
+		words[i] = word;
+		if (word != 0) {
+			used = i + 1;
+		}
+	}
+	return used;
+}
+
+void sack_delete(sack_t *sack) {
+	if (sack != NULL) {
+		free(sack->words);
+		free(sack);
+	}
+}
+
+int sack_words_test(const unsigned long long *words, int word_count, unsigned int offset) {
+	if (offset / SACK_WORD_BITS >= (unsigned int)word_count) {
+		return 0;
+	}
+	return (words[offset / SACK_WORD_BITS] >> (offset % SACK_WORD_BITS)) & 1;
+}
+
+// first offset at or after offset with a clear bit, everything past the words is clear
+unsigned int sack_words_next_clear(const unsigned long long *words, int word_count, unsigned int offset) {
+	while (offset / SACK_WORD_BITS < (unsigned int)word_count) {
+		unsigned long long missing = ~words[offset / SACK_WORD_BITS] >> (offset % SACK_WORD_BITS);
+		if (missing != 0) {
+			return offset + __builtin_ctzll(missing);
+		}
+		offset = ((offset / SACK_WORD_BITS) + 1) * SACK_WORD_BITS;
+	}
+	return offset;
+}
@@ -0,0 +1,30 @@
+#ifndef SACK_H
+#define SACK_H
+
+#define SACK_WORD_BITS 64
+
+// selective ack bitmap over 32 bit sequence numbers, used as a ring: seq maps to bit (seq & mask)
+typedef struct sack {
+	unsigned long long *words;
+	unsigned int word_count; // power of 2
+	unsigned int mask; // bits in the ring - 1
+} sack_t;
+
+sack_t* sack_create(unsigned int bits);
+
+void sack_set(sack_t *sack, unsigned int seq);
+
+int sack_test(sack_t *sack, unsigned int seq);
+
+unsigned int sack_advance(sack_t *sack, unsigned int seq, unsigned int limit);
+
+int sack_export(sack_t *sack, unsigned int seq, unsigned int limit, unsigned long long *words, int max_words);
+
+void sack_delete(sack_t *sack);
+
+// plain bitmaps, as carried in an ack: bit i of words is offset i
+int sack_words_test(const unsigned long long *words, int word_count, unsigned int offset);
+
+unsigned int sack_words_next_clear(const unsigned long long *words, int word_count, unsigned int offset);
+
+#endif /* SACK_H */
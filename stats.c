@@ -0,0 +1,243 @@
+#include "stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*** Histograms ***/
+
+// values below STATS_SUB_BUCKETS get a bucket each, above that the top STATS_SUB_BITS + 1 bits pick it
+static int stats_bucket(unsigned long long value) {
+	if (value < STATS_SUB_BUCKETS) {
+		return value;
+	}
+	int shift = 63 - __builtin_clzll(value) - STATS_SUB_BITS;
+	return ((shift + 1) << STATS_SUB_BITS) + ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+static unsigned long long stats_bucket_high(int bucket) {
+	if (bucket < STATS_SUB_BUCKETS) {
+		return bucket;
+	}
+	int shift = (bucket >> STATS_SUB_BITS) - 1;
+	unsigned long long low = (unsigned long long)(STATS_SUB_BUCKETS + (bucket & (STATS_SUB_BUCKETS - 1))) << shift;
+	return low + ((1ULL << shift) - 1);
+}
+
+void stats_histogram_reset(stats_histogram_t *histogram) {
+	memset(histogram, 0, sizeof(stats_histogram_t));
+}
+
+void stats_histogram_record(stats_histogram_t *histogram, unsigned long long value) {
+	if (histogram->count == 0 || value < histogram->min) {
+		histogram->min = value;
+	}
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+	histogram->count += 1;
+	histogram->sum += value;
+	histogram->buckets[stats_bucket(value)] += 1;
+}
+
+void stats_histogram_merge(stats_histogram_t *histogram, const stats_histogram_t *other) {
+	if (other->count == 0) {
+		return;
+	}
+	if (histogram->count == 0 || other->min < histogram->min) {
+		histogram->min = other->min;
+	}
+	if (other->max > histogram->max) {
+		histogram->max = other->max;
+	}
+	histogram->count += other->count;
+	histogram->sum += other->sum;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		histogram->buckets[i] += other->buckets[i];
+	}
+}
+
+unsigned long long stats_histogram_percentile(const stats_histogram_t *histogram, double percentile) {
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	// the rank'th smallest value, 1 based
+	unsigned long long rank = (percentile / 100) * histogram->count + 0.5;
+	if (rank < 1) {
+		rank = 1;
+	}
+
+	unsigned long long seen = 0;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			unsigned long long value = stats_bucket_high(i);
+			if (value < histogram->min) {
+				return histogram->min;
+			}
+			return value > histogram->max ? histogram->max : value;
+		}
+	}
+	return histogram->max; // counted while we read, the buckets are behind
+}
+
+/*** Json ***/
+
+static void stats_json_member(stats_json_t *json, const char *name) {
+	fputs(json->members[json->depth] > 0 ? ",\n" : "\n", json->file);
+	for (int i = 0; i <= json->depth; i++) {
+		fputc('\t', json->file);
+	}
+	if (name != NULL) {
+		fprintf(json->file, "\"%s\": ", name);
+	}
+	json->members[json->depth] += 1;
+}
+
+static void stats_json_open(stats_json_t *json, const char *name, char opener, char closer) {
+	if (json->depth + 1 >= STATS_JSON_DEPTH) {
+		fprintf(stderr, "stats_json_open: nested too deep\n");
+		exit(1);
+	}
+	stats_json_member(json, name);
+	fputc(opener, json->file);
+	json->depth += 1;
+	json->members[json->depth] = 0;
+	json->closers[json->depth] = closer;
+}
+
+void stats_json_begin(stats_json_t *json, FILE *file) {
+	json->file = file;
+	json->depth = 0;
+	json->members[0] = 0;
+	json->closers[0] = '}';
+	fputc('{', file);
+}
+
+void stats_json_object(stats_json_t *json, const char *name) {
+	stats_json_open(json, name, '{', '}');
+}
+
+void stats_json_array(stats_json_t *json, const char *name) {
+	stats_json_open(json, name, '[', ']');
+}
+
+void stats_json_close(stats_json_t *json) {
+	if (json->members[json->depth] > 0) {
+		fputc('\n', json->file);
+		for (int i = 0; i < json->depth; i++) {
+			fputc('\t', json->file);
+		}
+	}
+	fputc(json->closers[json->depth], json->file);
+	if (json->depth == 0) {
+		fputc('\n', json->file);
+		fflush(json->file);
+		return;
+	}
+	json->depth -= 1;
+}
+
+void stats_json_uint(stats_json_t *json, const char *name, unsigned long long value) {
+	stats_json_member(json, name);
+	fprintf(json->file, "%llu", value);
+}
+
+void stats_json_int(stats_json_t *json, const char *name, long long value) {
+	stats_json_member(json, name);
+	fprintf(json->file, "%lld", value);
+}
+
+void stats_json_double(stats_json_t *json, const char *name, double value) {
+	stats_json_member(json, name);
+	fprintf(json->file, "%.6g", value);
+}
+
+void stats_json_string(stats_json_t *json, const char *name, const char *value) {
+	stats_json_member(json, name);
+	fputc('"', json->file);
+	for (const char *c = value; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', json->file);
+			fputc(*c, json->file);
+		} else if ((unsigned char)*c < 0x20) {
+			fprintf(json->file, "\\u%04x", *c);
+		} else {
+			fputc(*c, json->file);
+		}
+	}
+	fputc('"', json->file);
+}
+
+void stats_json_bool(stats_json_t *json, const char *name, int value) {
+	stats_json_member(json, name);
+	fputs(value ? "true" : "false", json->file);
+}
+
+void stats_json_histogram(stats_json_t *json, const char *name, const stats_histogram_t *histogram) {
+	stats_json_object(json, name);
+	stats_json_uint(json, "count", histogram->count);
+	stats_json_double(json, "mean", histogram->count > 0 ? (double)histogram->sum / histogram->count : 0);
+	stats_json_uint(json, "min", histogram->min);
+	stats_json_uint(json, "p50", stats_histogram_percentile(histogram, 50));
+	stats_json_uint(json, "p90", stats_histogram_percentile(histogram, 90));
+	stats_json_uint(json, "p99", stats_histogram_percentile(histogram, 99));
+	stats_json_uint(json, "p999", stats_histogram_percentile(histogram, 99.9));
+	stats_json_uint(json, "max", histogram->max);
+
+	// one line, there can be a few hundred
+	stats_json_member(json, "buckets");
+	fputc('[', json->file);
+	int first = 1;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		if (histogram->buckets[i] == 0) {
+			continue;
+		}
+		fprintf(json->file, "%s[%llu, %llu]", first ? "" : ", ", stats_bucket_high(i), histogram->buckets[i]);
+		first = 0;
+	}
+	fputc(']', json->file);
+	stats_json_close(json);
+}
+
+/*** Signal ***/
+
+typedef struct stats_watcher {
+	sigset_t signals;
+	void (*dump)(void *arg);
+	void *arg;
+} stats_watcher_t;
+
+static void* stats_wait(void *arg) {
+	stats_watcher_t *watcher = arg;
+	while (1) {
+		int signum;
+		if (sigwait(&watcher->signals, &signum) == 0) {
+			watcher->dump(watcher->arg);
+		}
+	}
+	return NULL;
+}
+
+void stats_watch(void (*dump)(void *arg), void *arg) {
+	stats_watcher_t *watcher = malloc(sizeof(stats_watcher_t));
+	sigemptyset(&watcher->signals);
+	sigaddset(&watcher->signals, SIGUSR1);
+	watcher->dump = dump;
+	watcher->arg = arg;
+
+	if (pthread_sigmask(SIG_BLOCK, &watcher->signals, NULL) != 0) {
+		perror("stats_watch: pthread_sigmask");
+		exit(1);
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, stats_wait, watcher) != 0) {
+		perror("stats_watch: pthread_create");
+		exit(1);
+	}
+	pthread_detach(thread);
+}
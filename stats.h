@@ -0,0 +1,65 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// log bucketed histograms, hdr histogram style: every power of two is split into STATS_SUB_BUCKETS linear buckets,
+// so a recorded value is known to within 1/STATS_SUB_BUCKETS (12.5%) whatever its size, in a fixed 4KB
+#define STATS_SUB_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+#define STATS_JSON_DEPTH 8
+
+typedef struct stats_histogram {
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long buckets[STATS_BUCKETS];
+} stats_histogram_t;
+
+void stats_histogram_reset(stats_histogram_t *histogram);
+
+void stats_histogram_record(stats_histogram_t *histogram, unsigned long long value);
+
+void stats_histogram_merge(stats_histogram_t *histogram, const stats_histogram_t *other);
+
+// the highest value in the bucket the percentile (0 to 100) falls in, within min and max
+unsigned long long stats_histogram_percentile(const stats_histogram_t *histogram, double percentile);
+
+// json written as it goes, the writer keeps track of nesting and commas, names are NULL inside arrays
+typedef struct stats_json {
+	FILE *file;
+	int depth;
+	int members[STATS_JSON_DEPTH]; // written so far at each depth
+	char closers[STATS_JSON_DEPTH];
+} stats_json_t;
+
+// opens the top level object, stats_json_close on it ends the document
+void stats_json_begin(stats_json_t *json, FILE *file);
+
+void stats_json_object(stats_json_t *json, const char *name);
+
+void stats_json_array(stats_json_t *json, const char *name);
+
+void stats_json_close(stats_json_t *json);
+
+void stats_json_uint(stats_json_t *json, const char *name, unsigned long long value);
+
+void stats_json_int(stats_json_t *json, const char *name, long long value);
+
+void stats_json_double(stats_json_t *json, const char *name, double value);
+
+void stats_json_string(stats_json_t *json, const char *name, const char *value);
+
+void stats_json_bool(stats_json_t *json, const char *name, int value);
+
+// count, mean, min, percentiles and max, then the non empty buckets as [highest value, count] pairs
+void stats_json_histogram(stats_json_t *json, const char *name, const stats_histogram_t *histogram);
+
+// SIGUSR1 calls dump(arg) from a thread of its own, the counters are read while they're being updated
+// blocks the signal in the calling thread, so call it before starting the others and they inherit the mask
+void stats_watch(void (*dump)(void *arg), void *arg);
+
+#endif /* STATS_H */
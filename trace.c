@@ -0,0 +1,153 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char trace_path[4096];
+static int trace_enabled = 0;
+static unsigned long long trace_start_ticks;
+static unsigned long long trace_start_ns;
+
+static trace_t *traces[TRACE_MAX_RINGS];
+static int trace_count = 0;
+static int trace_dumped = 0;
+
+static const int trace_fatal_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+static const int trace_stop_signals[] = { SIGINT, SIGTERM };
+
+static void trace_crash(int signum) {
+	trace_dump();
+	raise(signum); // SA_RESETHAND put the default back, it dies as it would have
+}
+
+static void trace_exit(void) {
+	trace_dump();
+}
+
+void trace_init(const char *path) {
+	snprintf(trace_path, sizeof(trace_path), "%s", path);
+	trace_start_ticks = trace_clock();
+	trace_start_ns = trace_clock_ns();
+	trace_enabled = 1;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = trace_crash;
+	action.sa_flags = SA_RESETHAND;
+	for (size_t i = 0; i < sizeof(trace_fatal_signals) / sizeof(int); i++) {
+		sigaction(trace_fatal_signals[i], &action, NULL);
+	}
+
+	// a stalled transfer is stopped by hand, the trace is why it stalled
+	for (size_t i = 0; i < sizeof(trace_stop_signals) / sizeof(int); i++) {
+		struct sigaction current;
+		if (sigaction(trace_stop_signals[i], NULL, &current) == 0 && current.sa_handler == SIG_DFL) {
+			sigaction(trace_stop_signals[i], &action, NULL);
+		}
+	}
+
+	// exit(1) on a timeout is the other way a stall ends
+	atexit(trace_exit);
+}
+
+trace_t* trace_create(const char *name) {
+	if (!trace_enabled) {
+		return NULL;
+	}
+
+	int index = __atomic_fetch_add(&trace_count, 1, __ATOMIC_ACQ_REL);
+	if (index >= TRACE_MAX_RINGS) {
+		fprintf(stderr, "trace_create: more than %d rings, %s isn't traced\n", TRACE_MAX_RINGS, name);
+		return NULL;
+	}
+
+	trace_t *trace = malloc(sizeof(trace_t));
+	trace->events = malloc(TRACE_EVENTS * sizeof(trace_event_t));
+	if (trace->events == NULL) {
+		perror("trace_create");
+		exit(1);
+	}
+	memset(trace->events, 0, TRACE_EVENTS * sizeof(trace_event_t)); // faulted in now, not under the first events
+	trace->mask = TRACE_EVENTS - 1;
+	trace->head = 0;
+	snprintf(trace->name, sizeof(trace->name), "%s", name);
+	__atomic_store_n(&traces[index], trace, __ATOMIC_RELEASE);
+	return trace;
+}
+
+static int trace_write(int fd, const void *buf, size_t size) {
+	const char *p = buf;
+	while (size > 0) {
+		ssize_t written = write(fd, p, size);
+		if (written <= 0) {
+			return -1;
+		}
+		p += written;
+		size -= written;
+	}
+	return 0;
+}
+
+// only open, write, close and clock_gettime, so it's fine in a signal handler
+void trace_dump(void) {
+	if (!trace_enabled || __atomic_exchange_n(&trace_dumped, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return;
+	}
+
+	int ring_count = __atomic_load_n(&trace_count, __ATOMIC_ACQUIRE);
+	if (ring_count > TRACE_MAX_RINGS) {
+		ring_count = TRACE_MAX_RINGS;
+	}
+	trace_t *rings[TRACE_MAX_RINGS];
+	int count = 0;
+	for (int i = 0; i < ring_count; i++) {
+		rings[count] = __atomic_load_n(&traces[i], __ATOMIC_ACQUIRE);
+		count += rings[count] != NULL; // registered, not yet stored
+	}
+
+	trace_file_t file;
+	memset(&file, 0, sizeof(file));
+	file.magic = TRACE_MAGIC;
+	file.version = TRACE_VERSION;
+	file.ring_count = count;
+	file.event_size = sizeof(trace_event_t);
+	file.start_ticks = trace_start_ticks;
+	file.start_ns = trace_start_ns;
+	file.end_ticks = trace_clock();
+	file.end_ns = trace_clock_ns();
+	if (trace_write(fd, &file, sizeof(file)) == -1) {
+		close(fd);
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		trace_t *trace = rings[i];
+		unsigned long long head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+		unsigned long long capacity = trace->mask + 1;
+
+		trace_ring_t ring;
+		memset(&ring, 0, sizeof(ring));
+		memcpy(ring.name, trace->name, sizeof(ring.name));
+		ring.recorded = head;
+		ring.count = head < capacity ? head : capacity;
+
+		// oldest first: from the head to the end of the array, then from the start
+		unsigned long long first = (head - ring.count) & trace->mask;
+		unsigned long long tail = capacity - first < ring.count ? capacity - first : ring.count;
+		if (trace_write(fd, &ring, sizeof(ring)) == -1
+			|| trace_write(fd, trace->events + first, tail * sizeof(trace_event_t)) == -1
+			|| trace_write(fd, trace->events, (ring.count - tail) * sizeof(trace_event_t)) == -1) {
+			break;
+		}
+	}
+	close(fd);
+}
@@ -0,0 +1,109 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// packet event trace: every thread records into a ring of its own, fixed size records, the oldest overwritten
+// the file written at exit or on a fatal signal holds each ring oldest first, trace_decode turns it into csv
+#define TRACE_MAGIC 0x45435254 // "TRCE"
+#define TRACE_VERSION 1
+#define TRACE_EVENTS (1 << 18) // per ring, 8MB
+#define TRACE_MAX_RINGS 128
+#define TRACE_NAME_SIZE 16
+
+// what seq, a and b are for each event
+#define TRACE_SEND 1 // data packet queued: seq, a payload bytes, b file offset, flags TRACE_RETRANSMIT
+#define TRACE_ACK 2 // ack in: seq the recvr expects next, a sack words, b first sack word
+#define TRACE_STALE_ACK 3 // ack behind the last one, ignored: seq it expects, a the last ack's
+#define TRACE_WINDOW 4 // window changed: seq start of the window, a window, b in flight
+#define TRACE_TIMEOUT 5 // rto expired: seq start of the window, a the srtt backed off to, us
+#define TRACE_FAST_RETRANSMIT 6 // seq the hole, a packets sacked past it
+#define TRACE_RECV 7 // data packet in: seq, a the packet's flags, b the recvr's next seq num
+#define TRACE_RESPOND 8 // ack out: seq next seq num, a sack words, b first sack word
+
+#define TRACE_RETRANSMIT 0x1
+
+typedef struct trace_event {
+	unsigned long long time; // trace_clock ticks
+	unsigned long long b;
+	unsigned int seq;
+	unsigned int a;
+	unsigned short stream_id;
+	unsigned char type;
+	unsigned char flags;
+	unsigned int unused;
+} trace_event_t;
+
+// one writer, the dump only reads head and what's behind it
+typedef struct trace {
+	trace_event_t *events;
+	unsigned long long mask; // capacity - 1
+	unsigned long long head; // events recorded so far
+	char name[TRACE_NAME_SIZE];
+} trace_t;
+
+// the file: a trace_file_t, then per ring a trace_ring_t and its count events
+// ticks convert to ns through the two (ticks, ns) pairs taken at trace_init and at the dump
+typedef struct trace_file {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int ring_count;
+	unsigned int event_size;
+	unsigned long long start_ticks;
+	unsigned long long start_ns;
+	unsigned long long end_ticks;
+	unsigned long long end_ns;
+} trace_file_t;
+
+typedef struct trace_ring {
+	char name[TRACE_NAME_SIZE];
+	unsigned long long recorded; // lost to the ring when more than count
+	unsigned long long count;
+} trace_ring_t;
+
+static inline unsigned long long trace_clock_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+// the tsc where there is one, a few ns against a clock_gettime's 20
+static inline unsigned long long trace_clock(void) {
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	return trace_clock_ns();
+#endif
+}
+
+// inline, and a NULL trace is off, so the calls can stay in the hot paths
+static inline void trace_record(trace_t *trace, int type, int flags, int stream_id, unsigned int seq, unsigned int a, unsigned long long b) {
+	if (trace == NULL) {
+		return;
+	}
+	unsigned long long head = trace->head;
+	trace_event_t *event = &trace->events[head & trace->mask];
+	event->time = trace_clock();
+	event->b = b;
+	event->seq = seq;
+	event->a = a;
+	event->stream_id = stream_id;
+	event->type = type;
+	event->flags = flags;
+	__atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// the file dumped to at exit and on SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, and SIGINT and SIGTERM unless handled already
+void trace_init(const char *path);
+
+// a ring for the calling thread, written into the dump, NULL if tracing is off
+trace_t* trace_create(const char *name);
+
+// async signal safe, the crash handler calls it
+void trace_dump(void);
+
+#endif /* TRACE_H */
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// turns a trace dump into csv, every ring's events merged into one timeline
+// time_us is from when tracing started, a and b mean what trace.h says for the event
+
+typedef struct decoded_event {
+	trace_event_t event;
+	int ring;
+} decoded_event_t;
+
+static const char *event_names[] = {
+	[TRACE_SEND] = "send",
+	[TRACE_ACK] = "ack",
+	[TRACE_STALE_ACK] = "stale_ack",
+	[TRACE_WINDOW] = "window",
+	[TRACE_TIMEOUT] = "timeout",
+	[TRACE_FAST_RETRANSMIT] = "fast_retransmit",
+	[TRACE_RECV] = "recv",
+	[TRACE_RESPOND] = "respond",
+};
+
+static int compare_time(const void *a, const void *b) {
+	const decoded_event_t *x = a;
+	const decoded_event_t *y = b;
+	if (x->event.time != y->event.time) {
+		return x->event.time < y->event.time ? -1 : 1;
+	}
+	return x->ring - y->ring; // qsort isn't stable, ties keep ring order
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace_file > trace.csv\n\n", argv[0]);
+		exit(1);
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		perror("main: opening trace");
+		exit(1);
+	}
+
+	trace_file_t file;
+	if (fread(&file, sizeof(file), 1, in) != 1 || file.magic != TRACE_MAGIC) {
+		fprintf(stderr, "main: %s is not a trace\n", argv[1]);
+		exit(1);
+	}
+	if (file.version != TRACE_VERSION || file.event_size != sizeof(trace_event_t)) {
+		fprintf(stderr, "main: trace version %u with %u byte events, this reads version %d with %zu\n",
+			file.version, file.event_size, TRACE_VERSION, sizeof(trace_event_t));
+		exit(1);
+	}
+
+	char (*names)[TRACE_NAME_SIZE] = calloc(file.ring_count, TRACE_NAME_SIZE);
+	decoded_event_t *events = NULL;
+	size_t event_count = 0;
+	for (unsigned int i = 0; i < file.ring_count; i++) {
+		trace_ring_t ring;
+		if (fread(&ring, sizeof(ring), 1, in) != 1) {
+			fprintf(stderr, "main: trace ends after %u of %u rings\n", i, file.ring_count);
+			break;
+		}
+		memcpy(names[i], ring.name, TRACE_NAME_SIZE);
+		names[i][TRACE_NAME_SIZE - 1] = '\0';
+		if (ring.recorded > ring.count) {
+			fprintf(stderr, "%s: %llu events, the first %llu were overwritten\n", names[i], ring.recorded, ring.recorded - ring.count);
+		}
+
+		events = realloc(events, (event_count + ring.count) * sizeof(decoded_event_t));
+		if (events == NULL) {
+			perror("main: realloc");
+			exit(1);
+		}
+		size_t read_count = 0;
+		for (; read_count < ring.count; read_count++) {
+			decoded_event_t *decoded = &events[event_count + read_count];
+			if (fread(&decoded->event, sizeof(trace_event_t), 1, in) != 1) {
+				break;
+			}
+			decoded->ring = i;
+		}
+		event_count += read_count;
+		if (read_count < ring.count) {
+			fprintf(stderr, "main: trace ends inside %s\n", names[i]);
+			break;
+		}
+	}
+	fclose(in);
+
+	qsort(events, event_count, sizeof(decoded_event_t), compare_time);
+
+	// ticks to ns, from the two points the tracer took
+	double ns_per_tick = 1;
+	if (file.end_ticks > file.start_ticks) {
+		ns_per_tick = (double)(file.end_ns - file.start_ns) / (file.end_ticks - file.start_ticks);
+	}
+
+	printf("time_us,thread,stream,event,seq,retransmit,a,b\n");
+	for (size_t i = 0; i < event_count; i++) {
+		trace_event_t *event = &events[i].event;
+		double time_us = ((long long)(event->time - file.start_ticks) * ns_per_tick) / 1000;
+		const char *name = "unknown";
+		if (event->type < sizeof(event_names) / sizeof(char *) && event_names[event->type] != NULL) {
+			name = event_names[event->type];
+		}
+		printf("%.3f,%s,%u,%s,%u,%d,%u,%llu\n", time_us, names[events[i].ring], event->stream_id, name, event->seq,
+			(event->flags & TRACE_RETRANSMIT) != 0, event->a, event->b);
+	}
+
+	free(events);
+	free(names);
+	return 0;
+}
@@ -0,0 +1,530 @@
+#include "tree.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// paths are resolved by the kernel where it can, without following symlinks or leaving the root
+#if defined(__has_include) && defined(SYS_openat2)
+#if __has_include(<linux/openat2.h>)
+#define TREE_OPENAT2 1
+#include <linux/openat2.h>
+#endif
+#endif
+
+// manifest: magic and entry count, then per entry its size (64 bits), mode (32 bits), path size (16 bits) and path
+#define TREE_HEADER_SIZE 8
+#define TREE_RECORD_SIZE 14
+#define TREE_MAX_PATH 4096
+
+#define TREE_HANDLES 16 // files open at once, a chunk spans a handful of small ones at most
+#define TREE_PREALLOC_SIZE (1 << 20) // files this big are reserved whole on first open, smaller ones aren't worth the syscall
+
+struct tree_handles {
+	tree_t *tree;
+	int writable;
+	int fds[TREE_HANDLES];
+	unsigned int entries[TREE_HANDLES];
+	unsigned long long used[TREE_HANDLES]; // lru clock, 0 is a free slot
+	unsigned long long clock;
+	unsigned int last; // entry of the last access, chunks in a row mostly land in the same file
+	unsigned long long opened;
+};
+
+/*** Trees ***/
+
+static tree_t* tree_alloc() {
+	tree_t *tree = calloc(1, sizeof(tree_t));
+	tree->root_fd = -1;
+	return tree;
+}
+
+static void tree_add(tree_t *tree, unsigned int *capacity, const char *path, unsigned long long size, unsigned int mode) {
+	if (tree->count == *capacity) {
+		*capacity = *capacity == 0 ? 64 : *capacity * 2;
+		tree->entries = realloc(tree->entries, *capacity * sizeof(tree_entry_t));
+	}
+	tree_entry_t *entry = &tree->entries[tree->count];
+	entry->path = strdup(path);
+	entry->offset = tree->size;
+	entry->size = size;
+	entry->mode = mode;
+	tree->count += 1;
+	tree->size += size;
+	tree->manifest_size += TREE_RECORD_SIZE + strlen(path);
+	if (S_ISREG(mode)) {
+		tree->file_count += 1;
+	}
+}
+
+static int tree_compare_names(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// dir is relative to the root, "" for the root itself
+static int tree_walk(tree_t *tree, unsigned int *capacity, const char *dir) {
+	int dir_fd = *dir == '\0' ? dup(tree->root_fd) : openat(tree->root_fd, dir, O_RDONLY | O_DIRECTORY);
+	if (dir_fd == -1) {
+		perror("tree_scan: opendir");
+		return -1;
+	}
+	DIR *dp = fdopendir(dir_fd);
+	if (dp == NULL) {
+		perror("tree_scan: fdopendir");
+		close(dir_fd);
+		return -1;
+	}
+
+	// names sorted, so the same tree always lays out the same
+	char **names = NULL;
+	int name_count = 0;
+	int name_capacity = 0;
+	struct dirent *dirent;
+	while ((dirent = readdir(dp)) != NULL) {
+		if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+			continue;
+		}
+		if (name_count == name_capacity) {
+			name_capacity = name_capacity == 0 ? 16 : name_capacity * 2;
+			names = realloc(names, name_capacity * sizeof(char *));
+		}
+		names[name_count++] = strdup(dirent->d_name);
+	}
+	qsort(names, name_count, sizeof(char *), tree_compare_names);
+
+	int result = 0;
+	for (int i = 0; i < name_count; i++) {
+		char path[TREE_MAX_PATH];
+		if (snprintf(path, sizeof(path), "%s%s%s", dir, *dir == '\0' ? "" : "/", names[i]) >= (int)sizeof(path)) {
+			fprintf(stderr, "tree_scan: %s/%s is too long, left out\n", dir, names[i]);
+			continue;
+		}
+
+		struct stat st;
+		if (fstatat(dirfd(dp), names[i], &st, AT_SYMLINK_NOFOLLOW) == -1) {
+			perror("tree_scan: stat");
+			result = -1;
+			break;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			tree_add(tree, capacity, path, 0, st.st_mode);
+			if (tree_walk(tree, capacity, path) == -1) {
+				result = -1;
+				break;
+			}
+		} else if (S_ISREG(st.st_mode)) {
+			tree_add(tree, capacity, path, st.st_size, st.st_mode);
+		} else {
+			fprintf(stderr, "tree_scan: %s is not a file or directory, left out\n", path);
+		}
+	}
+
+	for (int i = 0; i < name_count; i++) {
+		free(names[i]);
+	}
+	free(names);
+	closedir(dp);
+	return result;
+}
+
+tree_t* tree_scan(const char *root) {
+	tree_t *tree = tree_alloc();
+	tree->root_fd = open(root, O_RDONLY | O_DIRECTORY);
+	if (tree->root_fd == -1) {
+		perror("tree_scan");
+		tree_delete(tree);
+		return NULL;
+	}
+
+	unsigned int capacity = 0;
+	tree->manifest_size = TREE_HEADER_SIZE;
+	if (tree_walk(tree, &capacity, "") == -1) {
+		tree_delete(tree);
+		return NULL;
+	}
+
+	tree->manifest = malloc(tree->manifest_size);
+	char *p = tree->manifest;
+	unsigned int magic = TREE_MAGIC;
+	memcpy(p, &magic, 4);
+	memcpy(p + 4, &tree->count, 4);
+	p += TREE_HEADER_SIZE;
+	for (unsigned int i = 0; i < tree->count; i++) {
+		tree_entry_t *entry = &tree->entries[i];
+		unsigned short path_size = strlen(entry->path);
+		memcpy(p, &entry->size, 8);
+		memcpy(p + 8, &entry->mode, 4);
+		memcpy(p + 12, &path_size, 2);
+		memcpy(p + TREE_RECORD_SIZE, entry->path, path_size);
+		p += TREE_RECORD_SIZE + path_size;
+	}
+	return tree;
+}
+
+// relative, and no component that's empty, . or ..
+static int tree_path_is_safe(const char *path) {
+	if (*path == '\0' || *path == '/') {
+		return 0;
+	}
+	const char *component = path;
+	while (1) {
+		const char *end = strchr(component, '/');
+		size_t size = end != NULL ? (size_t)(end - component) : strlen(component);
+		if (size == 0 || (size == 1 && component[0] == '.') || (size == 2 && component[0] == '.' && component[1] == '.')) {
+			return 0;
+		}
+		if (end == NULL) {
+			return 1;
+		}
+		component = end + 1;
+	}
+}
+
+// a component at a time, none of them a symlink, for kernels without openat2
+static int tree_walk_open(int root_fd, const char *path, int flags, mode_t mode) {
+	int dir_fd = root_fd;
+	const char *component = path;
+	const char *end;
+	while ((end = strchr(component, '/')) != NULL) {
+		char name[TREE_MAX_PATH];
+		size_t size = end - component;
+		if (size >= sizeof(name)) {
+			errno = ENAMETOOLONG;
+			break;
+		}
+		memcpy(name, component, size);
+		name[size] = '\0';
+		int next_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+		if (dir_fd != root_fd) {
+			close(dir_fd);
+		}
+		if (next_fd == -1) {
+			return -1;
+		}
+		dir_fd = next_fd;
+		component = end + 1;
+	}
+
+	int fd = end == NULL ? openat(dir_fd, component, flags | O_NOFOLLOW, mode) : -1;
+	int saved_errno = errno;
+	if (dir_fd != root_fd) {
+		close(dir_fd);
+	}
+	errno = saved_errno;
+	return fd;
+}
+
+// opens path under root the way openat would, except a symlink anywhere on it fails with ELOOP
+// the manifest's paths are only checked as strings, what's already on disk under root may point anywhere
+static int tree_openat(int root_fd, const char *path, int flags, mode_t mode) {
+#ifdef TREE_OPENAT2
+	struct open_how how;
+	memset(&how, 0, sizeof(how));
+	how.flags = flags;
+	how.mode = (flags & O_CREAT) ? mode : 0;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+	int fd = syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+	if (fd != -1 || errno != ENOSYS) {
+		return fd;
+	}
+#endif
+	return tree_walk_open(root_fd, path, flags, mode);
+}
+
+// makes the directory at path, the directories above it are resolved like tree_openat's
+// one that's already there has to be a directory, not a symlink to one
+static int tree_mkdirat(int root_fd, const char *path, mode_t mode) {
+	const char *name = strrchr(path, '/');
+	int parent_fd = root_fd;
+	if (name != NULL) {
+		char parent[TREE_MAX_PATH];
+		size_t size = name - path;
+		if (size >= sizeof(parent)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		memcpy(parent, path, size);
+		parent[size] = '\0';
+		parent_fd = tree_openat(root_fd, parent, O_RDONLY | O_DIRECTORY, 0);
+		if (parent_fd == -1) {
+			return -1;
+		}
+		name += 1;
+	} else {
+		name = path;
+	}
+
+	int result = mkdirat(parent_fd, name, mode);
+	struct stat st;
+	if (result == -1 && errno == EEXIST && fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+		if (S_ISDIR(st.st_mode)) {
+			result = 0;
+		} else {
+			errno = S_ISLNK(st.st_mode) ? ELOOP : ENOTDIR;
+		}
+	}
+	int saved_errno = errno;
+	if (parent_fd != root_fd) {
+		close(parent_fd);
+	}
+	errno = saved_errno;
+	return result;
+}
+
+tree_t* tree_parse(const char *root, const char *manifest, size_t size) {
+	unsigned int magic;
+	unsigned int count;
+	if (size < TREE_HEADER_SIZE) {
+		return NULL;
+	}
+	memcpy(&magic, manifest, 4);
+	memcpy(&count, manifest + 4, 4);
+	if (magic != TREE_MAGIC || count > (size - TREE_HEADER_SIZE) / TREE_RECORD_SIZE) {
+		return NULL;
+	}
+
+	tree_t *tree = tree_alloc();
+	unsigned int capacity = count;
+	tree->entries = malloc((count > 0 ? count : 1) * sizeof(tree_entry_t));
+	tree->manifest_size = TREE_HEADER_SIZE;
+
+	size_t pos = TREE_HEADER_SIZE;
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned long long entry_size;
+		unsigned int mode;
+		unsigned short path_size;
+		if (size - pos < TREE_RECORD_SIZE) {
+			tree_delete(tree);
+			return NULL;
+		}
+		memcpy(&entry_size, manifest + pos, 8);
+		memcpy(&mode, manifest + pos + 8, 4);
+		memcpy(&path_size, manifest + pos + 12, 2);
+		pos += TREE_RECORD_SIZE;
+		if (size - pos < path_size || (!S_ISDIR(mode) && !S_ISREG(mode)) || (S_ISDIR(mode) && entry_size != 0)) {
+			tree_delete(tree);
+			return NULL;
+		}
+
+		char path[TREE_MAX_PATH];
+		if (path_size >= sizeof(path)) {
+			tree_delete(tree);
+			return NULL;
+		}
+		memcpy(path, manifest + pos, path_size);
+		path[path_size] = '\0';
+		pos += path_size;
+		if (strlen(path) != path_size || !tree_path_is_safe(path)) {
+			tree_delete(tree);
+			return NULL;
+		}
+		tree_add(tree, &capacity, path, entry_size, mode);
+	}
+	if (pos != size) {
+		tree_delete(tree);
+		return NULL;
+	}
+
+	tree->root_fd = open(root, O_RDONLY | O_DIRECTORY);
+	if (tree->root_fd == -1) {
+		perror("tree_parse");
+		tree_delete(tree);
+		return NULL;
+	}
+	return tree;
+}
+
+int tree_make(tree_t *tree) {
+	for (unsigned int i = 0; i < tree->count; i++) {
+		tree_entry_t *entry = &tree->entries[i];
+		if (S_ISDIR(entry->mode)) {
+			// the owner keeps write access, files are still to be made in it
+			if (tree_mkdirat(tree->root_fd, entry->path, (entry->mode & 07777) | 0700) == -1) {
+				perror("tree_make: mkdir");
+				return -1;
+			}
+		} else {
+			// every file, so one that can't be made fails the manifest rather than its writes, empty ones no write will create
+			int flags = O_WRONLY | O_CREAT | (entry->size == 0 ? O_TRUNC : 0);
+			int fd = tree_openat(tree->root_fd, entry->path, flags, (entry->mode & 07777) | 0600);
+			if (fd == -1) {
+				perror("tree_make: creating a file");
+				return -1;
+			}
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+void tree_delete(tree_t *tree) {
+	if (tree == NULL) {
+		return;
+	}
+	for (unsigned int i = 0; i < tree->count; i++) {
+		free(tree->entries[i].path);
+	}
+	free(tree->entries);
+	free(tree->manifest);
+	if (tree->root_fd != -1) {
+		close(tree->root_fd);
+	}
+	free(tree);
+}
+
+/*** Handles ***/
+
+tree_handles_t* tree_handles_create(tree_t *tree, int writable) {
+	tree_handles_t *handles = calloc(1, sizeof(tree_handles_t));
+	handles->tree = tree;
+	handles->writable = writable;
+	for (int i = 0; i < TREE_HANDLES; i++) {
+		handles->fds[i] = -1;
+	}
+	return handles;
+}
+
+// the file offset is in, which has to be inside the range
+// the last entry starting at or before it, empty files and directories there end before it
+static unsigned int tree_find(tree_handles_t *handles, unsigned long long offset) {
+	tree_t *tree = handles->tree;
+	tree_entry_t *last = &tree->entries[handles->last];
+	if (last->offset <= offset && offset < last->offset + last->size) {
+		return handles->last;
+	}
+
+	unsigned int low = 0;
+	unsigned int high = tree->count;
+	while (high - low > 1) {
+		unsigned int middle = low + ((high - low) / 2);
+		if (tree->entries[middle].offset <= offset) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	handles->last = low;
+	return low;
+}
+
+// a writer makes the file, trims what an earlier, longer copy left past its end, and reserves a big one whole
+static int tree_open(tree_handles_t *handles, tree_entry_t *entry) {
+	int flags = handles->writable ? O_RDWR | O_CREAT : O_RDONLY;
+	int fd = tree_openat(handles->tree->root_fd, entry->path, flags, (entry->mode & 07777) | 0600);
+	if (fd == -1) {
+		perror("tree_open");
+		return -1;
+	}
+	handles->opened += 1;
+
+	struct stat st;
+	if (handles->writable && fstat(fd, &st) == 0) {
+		if ((unsigned long long)st.st_size > entry->size && ftruncate(fd, entry->size) == -1) {
+			perror("tree_open: ftruncate");
+		} else if ((unsigned long long)st.st_size < entry->size && entry->size >= TREE_PREALLOC_SIZE
+			&& fallocate(fd, 0, 0, entry->size) == -1 && errno != EOPNOTSUPP) {
+			perror("tree_open: fallocate");
+		}
+	}
+	return fd;
+}
+
+// entry's fd, opened in the least recently used slot if it isn't open already
+static int tree_handle(tree_handles_t *handles, unsigned int entry) {
+	handles->clock += 1;
+	int victim = 0;
+	for (int i = 0; i < TREE_HANDLES; i++) {
+		if (handles->used[i] != 0 && handles->entries[i] == entry) {
+			handles->used[i] = handles->clock;
+			return handles->fds[i];
+		}
+		if (handles->used[i] < handles->used[victim]) {
+			victim = i;
+		}
+	}
+
+	if (handles->fds[victim] != -1) {
+		close(handles->fds[victim]);
+	}
+	handles->fds[victim] = tree_open(handles, &handles->tree->entries[entry]);
+	handles->entries[victim] = entry;
+	handles->used[victim] = handles->fds[victim] == -1 ? 0 : handles->clock;
+	return handles->fds[victim];
+}
+
+// reads or writes [offset, offset + size) of the range, a file at a time
+// a file that shrank since the scan reads as zeros up to its old size, the manifest has the rest laid out after it
+static ssize_t tree_io(tree_handles_t *handles, char *buffer, size_t size, unsigned long long offset, int writing) {
+	tree_t *tree = handles->tree;
+	size_t done = 0;
+	while (done < size && offset < tree->size) {
+		unsigned int index = tree_find(handles, offset);
+		tree_entry_t *entry = &tree->entries[index];
+		int fd = tree_handle(handles, index);
+		if (fd == -1) {
+			break;
+		}
+
+		size_t piece = size - done;
+		if (piece > entry->offset + entry->size - offset) {
+			piece = entry->offset + entry->size - offset;
+		}
+		ssize_t bytes;
+		if (writing) {
+			bytes = pwrite(fd, buffer + done, piece, offset - entry->offset);
+		} else {
+			bytes = pread(fd, buffer + done, piece, offset - entry->offset);
+			if (bytes == 0) {
+				memset(buffer + done, 0, piece);
+				bytes = piece;
+			}
+		}
+		if (bytes <= 0) {
+			break;
+		}
+		done += bytes;
+		offset += bytes;
+	}
+	return done == 0 && size > 0 && offset < tree->size ? -1 : (ssize_t)done;
+}
+
+ssize_t tree_pread(tree_handles_t *handles, void *buffer, size_t size, unsigned long long offset) {
+	return tree_io(handles, buffer, size, offset, 0);
+}
+
+ssize_t tree_pwritev(tree_handles_t *handles, const struct iovec *iov, int iov_count, unsigned long long offset) {
+	size_t done = 0;
+	for (int i = 0; i < iov_count; i++) {
+		ssize_t bytes = tree_io(handles, iov[i].iov_base, iov[i].iov_len, offset + done, 1);
+		if (bytes < 0) {
+			return done > 0 ? (ssize_t)done : -1;
+		}
+		done += bytes;
+		if ((size_t)bytes < iov[i].iov_len) {
+			break;
+		}
+	}
+	return done;
+}
+
+unsigned long long tree_handles_opened(tree_handles_t *handles) {
+	return handles->opened;
+}
+
+void tree_handles_delete(tree_handles_t *handles) {
+	if (handles == NULL) {
+		return;
+	}
+	for (int i = 0; i < TREE_HANDLES; i++) {
+		if (handles->fds[i] != -1) {
+			close(handles->fds[i]);
+		}
+	}
+	free(handles);
+}
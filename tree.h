@@ -0,0 +1,60 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// a directory sent as one transfer: its files back to back in one byte range, described by a manifest sent ahead of them
+// small files share chunks with their neighbours, so packets go out full, and the window carries over from file to file
+#define TREE_MAGIC 0x45455254 // "TREE"
+
+typedef struct tree_entry {
+	char *path; // relative to the root
+	unsigned long long offset; // of the file's first byte in the range
+	unsigned long long size; // 0 for a directory
+	unsigned int mode; // st_mode, type bits included
+} tree_entry_t;
+
+typedef struct tree {
+	int root_fd; // entries are opened relative to it
+	tree_entry_t *entries; // a directory before what's in it, files in the order their bytes are
+	unsigned int count;
+	unsigned int file_count;
+	unsigned long long size; // every file's bytes
+	char *manifest; // the entries serialized, the receiver rebuilds the tree from it
+	size_t manifest_size;
+} tree_t;
+
+typedef struct tree_handles tree_handles_t;
+
+// walks root depth first in name order, NULL if it can't be read
+// only regular files and directories go, anything else is left out with a note
+tree_t* tree_scan(const char *root);
+
+// the tree a manifest describes, to be made under root
+// NULL if it's malformed or any path would lead out of root
+tree_t* tree_parse(const char *root, const char *manifest, size_t size);
+
+// makes the directories and files, returns -1 if one can't be made
+// nothing is made through a symlink, or one already there under root taken for a directory or file
+int tree_make(tree_t *tree);
+
+void tree_delete(tree_t *tree);
+
+// files opened as the range is read or written and kept open, the least recently used closed to make room
+// one per thread, the tree must outlive it
+// a writer creates files on first use, and reserves big ones whole
+tree_handles_t* tree_handles_create(tree_t *tree, int writable);
+
+// like pread and pwritev on the range, short past its end, -1 if nothing could be read or written
+ssize_t tree_pread(tree_handles_t *handles, void *buffer, size_t size, unsigned long long offset);
+
+ssize_t tree_pwritev(tree_handles_t *handles, const struct iovec *iov, int iov_count, unsigned long long offset);
+
+// files opened so far, reopens after an eviction included
+unsigned long long tree_handles_opened(tree_handles_t *handles);
+
+void tree_handles_delete(tree_handles_t *handles);
+
+#endif /* TREE_H */
@@ -1,6 +1,9 @@
 #include "udp.h"
 
-udp_t* udp_create(const char *port, size_t msg_send_size, size_t msg_recv_size) {
+#include <errno.h>
+#include <limits.h>
+
+udp_t* udp_create(const char *port, size_t msg_send_size, size_t msg_recv_size, int flags) {
     struct addrinfo hints, *res;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
@@ -43,6 +46,42 @@ udp_t* udp_create(const char *port, size_t msg_send_size, size_t msg_recv_size)
     udp->msg_recv_size = msg_recv_size;
     udp->bytes_recv = -1;
     udp->client_addr_size = sizeof(struct sockaddr_in);
+
+    udp->batch_size = 0;
+    udp->batch_send_count = 0;
+    udp->batch_recv_count = 0;
+    udp->batch_recv_slots = 0;
+
+    udp->recv_timeout.tv_sec = 0;
+    udp->recv_timeout.tv_usec = 0;
+    udp->send_buffer_size = 0;
+    udp->recv_buffer_size = 0;
+    udp->uring_send = NULL;
+    udp->uring_recv = NULL;
+    udp->uring_recv_armed = 0;
+    udp->uring_recv_buffers = NULL;
+    udp->uring_recv_buffer_count = 0;
+
+    // offload is best effort, older kernels reject the options and we stay on the plain path
+    udp->gso_size = 0;
+    if (flags & UDP_FLAG_GSO) {
+        int gso_size = msg_send_size;
+        if (setsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &gso_size, sizeof(gso_size)) == 0) {
+            udp->gso_size = gso_size;
+        } else {
+            perror("udp_create: UDP_SEGMENT not supported, sending unsegmented");
+        }
+    }
+
+    udp->gro_enabled = 0;
+    if (flags & UDP_FLAG_GRO) {
+        int gro = 1;
+        if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &gro, sizeof(gro)) == 0) {
+            udp->gro_enabled = 1;
+        } else {
+            perror("udp_create: UDP_GRO not supported, receiving unsegmented");
+        }
+    }
 	return udp;
 }
 
@@ -64,6 +103,30 @@ int udp_set_server_addr(udp_t *udp, char *addr, int port) {
     return 0;
 }
 
+// sets DF on everything sent to server_addr, so a packet too big for the path is dropped instead of fragmented
+// returns the mtu of the route there as the kernel knows it (the interface's, unless an icmp lowered it), -1 on failure
+int udp_enable_mtu_probe(udp_t *udp) {
+    // PROBE rather than DO: the kernel's cached path mtu must not veto a probe bigger than it
+    int discover = IP_PMTUDISC_PROBE;
+    if (setsockopt(udp->sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)) == -1) {
+        perror("udp_enable_mtu_probe: IP_MTU_DISCOVER");
+        return -1;
+    }
+
+    // IP_MTU is only there on a connected socket
+    if (connect(udp->sockfd, (struct sockaddr*)&udp->server_addr, udp->server_addr_size) == -1) {
+        perror("udp_enable_mtu_probe: connect");
+        return -1;
+    }
+    int mtu;
+    socklen_t mtu_size = sizeof(mtu);
+    if (getsockopt(udp->sockfd, IPPROTO_IP, IP_MTU, &mtu, &mtu_size) == -1) {
+        perror("udp_enable_mtu_probe: IP_MTU");
+        return -1;
+    }
+    return mtu;
+}
+
 int udp_send(udp_t* udp) {
     // if (udp->server_addr == NULL) {
     //     fprintf(stderr, "udp_send: no send address set");
@@ -110,11 +173,502 @@ int udp_recv(udp_t* udp) {
 	return 0;
 }
 
+int udp_enable_batch(udp_t *udp, int batch_size) {
+    // with GRO one datagram can hold up to UDP_MAX_SEGMENTS messages
+    size_t recv_buffer_size = udp->gro_enabled ? UDP_MAX_DATAGRAM : udp->msg_recv_size;
+    int recv_slots = udp->gro_enabled ? batch_size * UDP_MAX_SEGMENTS : batch_size;
+    size_t control_size = CMSG_SPACE(sizeof(int));
+
+    // one contiguous allocation per direction, sliced into batch_size buffers
+    char *send_buffers = malloc(batch_size * udp->msg_send_size);
+    char *recv_buffers = malloc(batch_size * recv_buffer_size);
+
+    udp->batch_msg_send = malloc(batch_size * sizeof(char*));
+    udp->batch_bytes_to_send = malloc(batch_size * sizeof(size_t));
+    udp->batch_payload_send = calloc(batch_size, sizeof(char*));
+    udp->batch_payload_size = calloc(batch_size, sizeof(size_t));
+    udp->batch_addr_send = calloc(batch_size, sizeof(struct sockaddr_in*));
+    udp->batch_msg_recv = malloc(recv_slots * sizeof(char*));
+    udp->batch_bytes_recv = malloc(recv_slots * sizeof(ssize_t));
+
+    udp->batch_send_hdrs = calloc(batch_size, sizeof(struct mmsghdr));
+    udp->batch_send_iovs = calloc(2 * batch_size, sizeof(struct iovec));
+    udp->batch_send_iov_start = calloc(batch_size + 1, sizeof(int));
+    udp->batch_send_msg_count = calloc(batch_size, sizeof(int));
+    udp->batch_recv_hdrs = calloc(batch_size, sizeof(struct mmsghdr));
+    udp->batch_recv_iovs = calloc(batch_size, sizeof(struct iovec));
+    // the tail batch_size entries hold the datagram addresses, copied per message on split
+    udp->batch_client_addrs = calloc(recv_slots + batch_size, sizeof(struct sockaddr_in));
+    udp->batch_recv_control = calloc(batch_size, control_size);
+
+    if (send_buffers == NULL || recv_buffers == NULL) {
+        perror("udp_enable_batch");
+        exit(1);
+    }
+
+    for (int i = 0; i < batch_size; i++) {
+        udp->batch_msg_send[i] = send_buffers + (i * udp->msg_send_size);
+        udp->batch_bytes_to_send[i] = 0;
+
+        // recv headers never change, only the returned lengths do
+        struct iovec *iov = &udp->batch_recv_iovs[i];
+        iov->iov_base = recv_buffers + (i * recv_buffer_size);
+        iov->iov_len = recv_buffer_size;
+
+        struct msghdr *hdr = &udp->batch_recv_hdrs[i].msg_hdr;
+        hdr->msg_iov = iov;
+        hdr->msg_iovlen = 1;
+        hdr->msg_name = &udp->batch_client_addrs[recv_slots + i];
+    }
+
+    udp->batch_size = batch_size;
+    udp->batch_recv_slots = recv_slots;
+    udp->batch_send_count = 0;
+    udp->batch_recv_count = 0;
+    return 0;
+}
+
+static size_t udp_batch_msg_size(udp_t *udp, int i) {
+    return udp->batch_bytes_to_send[i] + udp->batch_payload_size[i];
+}
+
+static const struct sockaddr_in* udp_batch_addr(udp_t *udp, int i) {
+    if (udp->batch_addr_send[i] != NULL) {
+        return udp->batch_addr_send[i];
+    }
+    return &udp->server_addr;
+}
+
+// groups queued messages into mmsghdrs, one per message, or one per GSO run
+static int udp_batch_group(udp_t *udp, int first, int count) {
+    int gso_size = udp->gso_size;
+    int max_segments = 1;
+    if (gso_size > 0) {
+        max_segments = UDP_MAX_DATAGRAM / gso_size;
+        if (max_segments > UDP_MAX_SEGMENTS) {
+            max_segments = UDP_MAX_SEGMENTS;
+        }
+    }
+
+    int hdr_count = 0;
+    int i = first;
+    while (i < count) {
+        int start = i;
+
+        // a GSO run is full sized segments with an optional shorter tail
+        do {
+            i += 1;
+        } while (i < count && i - start < max_segments
+            && udp_batch_msg_size(udp, i - 1) == (size_t)gso_size
+            && udp_batch_msg_size(udp, i) <= (size_t)gso_size
+            && udp_batch_addr(udp, i) == udp_batch_addr(udp, start));
+
+        struct msghdr *hdr = &udp->batch_send_hdrs[hdr_count].msg_hdr;
+        hdr->msg_iov = &udp->batch_send_iovs[udp->batch_send_iov_start[start]];
+        hdr->msg_iovlen = udp->batch_send_iov_start[i] - udp->batch_send_iov_start[start];
+        hdr->msg_name = (struct sockaddr_in*)udp_batch_addr(udp, start);
+        hdr->msg_namelen = sizeof(struct sockaddr_in);
+
+        udp->batch_send_msg_count[hdr_count] = i - start;
+        hdr_count += 1;
+    }
+
+    return hdr_count;
+}
+
+int udp_enable_uring(udp_t *udp) {
+    if (udp->batch_size == 0) {
+        fprintf(stderr, "udp_enable_uring: call udp_enable_batch first\n");
+        return -1;
+    }
+
+    // room for a batch's sends, and provided buffers for two batches of datagrams
+    unsigned entries = 1;
+    while (entries < 2 * (unsigned)udp->batch_size) {
+        entries *= 2;
+    }
+
+    uring_t *uring_send = uring_create(entries);
+    uring_t *uring_recv = uring_create(entries);
+    if (uring_send == NULL || uring_recv == NULL) {
+        uring_delete(uring_send);
+        uring_delete(uring_recv);
+        return -1;
+    }
+
+    // each provided buffer holds the recvmsg header, address, cmsg and the datagram
+    memset(&udp->uring_recv_msg, 0, sizeof(struct msghdr));
+    udp->uring_recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    udp->uring_recv_msg.msg_controllen = udp->gro_enabled ? CMSG_SPACE(sizeof(int)) : 0;
+
+    size_t datagram_size = udp->batch_recv_iovs[0].iov_len;
+    size_t buffer_size = uring_recvmsg_buffer_size(&udp->uring_recv_msg, datagram_size);
+    int provided = uring_provide_buffers(uring_recv, entries, buffer_size, 0);
+
+    if (provided == -1) {
+        uring_delete(uring_send);
+        uring_delete(uring_recv);
+        return -1;
+    }
+
+    udp->uring_send = uring_send;
+    udp->uring_recv = uring_recv;
+    udp->uring_recv_armed = 0;
+    udp->uring_recv_buffers = malloc(entries * sizeof(int));
+    udp->uring_recv_buffer_count = 0;
+    return 0;
+}
+
+int udp_set_timeout(udp_t *udp, struct timeval *timeout) {
+    // SO_RCVTIMEO rounds up to a jiffy, give io_uring waits the same floor
+    udp->recv_timeout = *timeout;
+    if (udp->recv_timeout.tv_sec == 0 && udp->recv_timeout.tv_usec > 0 && udp->recv_timeout.tv_usec < UDP_MIN_TIMEOUT) {
+        udp->recv_timeout.tv_usec = UDP_MIN_TIMEOUT;
+    }
+    if (setsockopt(udp->sockfd, SOL_SOCKET, SO_RCVTIMEO, timeout, sizeof(struct timeval)) < 0) {
+        perror("udp_set_timeout");
+        return -1;
+    }
+    return 0;
+}
+
+// the *FORCE options go past net.core.wmem_max/rmem_max with CAP_NET_ADMIN, the plain ones are capped by them
+// returns -1 if the kernel gave less than size, granted is what it gave
+static int udp_set_buffer(int sockfd, int force_option, int option, size_t size, int *granted) {
+    int value = size < INT_MAX / 2 ? (int)size : INT_MAX / 2; // the kernel doubles it
+    if (setsockopt(sockfd, SOL_SOCKET, force_option, &value, sizeof(value)) == -1) {
+        setsockopt(sockfd, SOL_SOCKET, option, &value, sizeof(value));
+    }
+
+    socklen_t length = sizeof(*granted);
+    if (getsockopt(sockfd, SOL_SOCKET, option, granted, &length) == -1) {
+        perror("udp_set_buffers: getsockopt");
+        return -1;
+    }
+    *granted /= 2; // the doubled value covers the kernel's bookkeeping
+    return *granted < value ? -1 : 0;
+}
+
+// sizes the socket buffers, 0 leaves one as it is
+// returns -1 if the kernel clamped either, send_buffer_size and recv_buffer_size say to what
+int udp_set_buffers(udp_t *udp, size_t send_size, size_t recv_size) {
+    int result = 0;
+    if (send_size > 0 && udp_set_buffer(udp->sockfd, SO_SNDBUFFORCE, SO_SNDBUF, send_size, &udp->send_buffer_size) == -1) {
+        result = -1;
+    }
+    if (recv_size > 0 && udp_set_buffer(udp->sockfd, SO_RCVBUFFORCE, SO_RCVBUF, recv_size, &udp->recv_buffer_size) == -1) {
+        result = -1;
+    }
+    return result;
+}
+
+// submits the grouped mmsghdrs with a single io_uring_enter
+static int udp_send_batch_uring(udp_t *udp, int hdr_count) {
+    uring_t *uring = udp->uring_send;
+    for (int i = 0; i < hdr_count; i++) {
+        uring_prep_sendmsg(uring, udp->sockfd, &udp->batch_send_hdrs[i].msg_hdr, 0, i + 1);
+    }
+
+    // every buffer stays in use until its completion, so wait for all of them
+    int pending = hdr_count;
+    int result = uring_submit(uring, pending, NULL);
+    if (result < 0) {
+        errno = -result;
+        perror("udp_send_batch: io_uring_enter");
+        return 0;
+    }
+
+    int sent = 0;
+    while (pending > 0) {
+        unsigned long long user_data;
+        int res;
+        unsigned flags;
+        int buffer_id;
+        if (uring_completion(uring, &user_data, &res, &flags, &buffer_id) == -1) {
+            uring_submit(uring, pending, NULL);
+            continue;
+        }
+        pending -= 1;
+
+        if (res < 0) {
+            errno = -res;
+            perror("udp_send_batch: sendmsg");
+            if (udp->gso_size > 0 && (res == -EIO || res == -EINVAL)) {
+                // no resend here, the lost batch is recovered like any other loss
+                int gso_off = 0;
+                setsockopt(udp->sockfd, SOL_UDP, UDP_SEGMENT, &gso_off, sizeof(gso_off));
+                udp->gso_size = 0;
+            }
+            continue;
+        }
+        sent += udp->batch_send_msg_count[user_data - 1];
+    }
+
+    return sent;
+}
+
+int udp_send_batch(udp_t *udp) {
+    int count = udp->batch_send_count;
+    udp->batch_send_count = 0;
+    if (count == 0) {
+        return 0;
+    }
+
+    // header from the batch buffer, payload (if any) straight from wherever the caller points
+    int iov_count = 0;
+    for (int i = 0; i < count; i++) {
+        udp->batch_send_iov_start[i] = iov_count;
+
+        struct iovec *iov = &udp->batch_send_iovs[iov_count++];
+        iov->iov_base = udp->batch_msg_send[i];
+        iov->iov_len = udp->batch_bytes_to_send[i];
+
+        if (udp->batch_payload_send[i] != NULL) {
+            iov = &udp->batch_send_iovs[iov_count++];
+            iov->iov_base = (char*)udp->batch_payload_send[i];
+            iov->iov_len = udp->batch_payload_size[i];
+        }
+    }
+    udp->batch_send_iov_start[count] = iov_count;
+
+    int sent = 0; // messages, not mmsghdrs
+    int hdr_count = udp_batch_group(udp, 0, count);
+    int hdr_sent = 0;
+
+    if (udp->uring_send != NULL) {
+        sent = udp_send_batch_uring(udp, hdr_count);
+        hdr_sent = hdr_count;
+    }
+
+    // sendmmsg can stop short when the socket buffer fills, keep going
+    while (hdr_sent < hdr_count) {
+        int result = sendmmsg(udp->sockfd, udp->batch_send_hdrs + hdr_sent, hdr_count - hdr_sent, 0);
+        if (result == -1 && udp->gso_size > 0 && (errno == EIO || errno == EINVAL)) {
+            // the device can't segment (no checksum offload), resend the rest unsegmented
+            perror("udp_send_batch: GSO rejected, sending unsegmented");
+            int gso_off = 0;
+            setsockopt(udp->sockfd, SOL_UDP, UDP_SEGMENT, &gso_off, sizeof(gso_off));
+            udp->gso_size = 0;
+
+            hdr_count = udp_batch_group(udp, sent, count);
+            hdr_sent = 0;
+            continue;
+        }
+        if (result == -1) {
+            perror("udp_send_batch");
+            break;
+        }
+
+        for (int i = 0; i < result; i++) {
+            sent += udp->batch_send_msg_count[hdr_sent + i];
+        }
+        hdr_sent += result;
+    }
+
+    // payloads and destinations are per send, callers only set them when they have one
+    for (int i = 0; i < count; i++) {
+        udp->batch_payload_send[i] = NULL;
+        udp->batch_payload_size[i] = 0;
+        udp->batch_addr_send[i] = NULL;
+    }
+
+    if (sent == 0 && hdr_sent < hdr_count) {
+        return -1;
+    }
+    return sent;
+}
+
+// splits a datagram (coalesced by GRO or not) into the messages the peer sent
+static int udp_split_datagram(udp_t *udp, int count, char *datagram, size_t datagram_size, struct msghdr *hdr, struct sockaddr_in *addr) {
+    size_t segment_size = datagram_size;
+    if (udp->gro_enabled) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int gro_size;
+                memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(int));
+                segment_size = gro_size;
+            }
+        }
+    }
+
+    for (size_t offset = 0; offset < datagram_size && count < udp->batch_recv_slots; offset += segment_size) {
+        size_t size = datagram_size - offset;
+        if (size > segment_size) {
+            size = segment_size;
+        }
+        udp->batch_msg_recv[count] = datagram + offset;
+        udp->batch_bytes_recv[count] = size;
+        udp->batch_client_addrs[count] = *addr;
+        count += 1;
+    }
+    return count;
+}
+
+// pulls completions of the multishot recvmsg, buffers stay ours until the next call
+static void udp_arm_uring_recv(udp_t *udp) {
+    if (!udp->uring_recv_armed) {
+        uring_prep_recvmsg_multishot(udp->uring_recv, udp->sockfd, &udp->uring_recv_msg, 1);
+        uring_submit(udp->uring_recv, 0, NULL);
+        udp->uring_recv_armed = 1;
+    }
+}
+
+static int udp_recv_batch_uring(udp_t *udp, int max_count, int wait) {
+    uring_t *uring = udp->uring_recv;
+
+    for (int i = 0; i < udp->uring_recv_buffer_count; i++) {
+        uring_recycle_buffer(uring, udp->uring_recv_buffers[i]);
+    }
+    udp->uring_recv_buffer_count = 0;
+
+    int count = 0;
+    int datagram_count = 0;
+    int waited = 0;
+    while (datagram_count < max_count) {
+        udp_arm_uring_recv(udp);
+
+        unsigned long long user_data;
+        int res;
+        unsigned flags;
+        int buffer_id;
+        if (uring_completion(uring, &user_data, &res, &flags, &buffer_id) == -1) {
+            if (datagram_count > 0 || waited || !wait) {
+                break; // drained what was queued
+            }
+            // same contract as recvmmsg + MSG_WAITFORONE: block for the first datagram only
+            int result = uring_submit(uring, 1, &udp->recv_timeout);
+            waited = 1;
+            if (result == -ETIME) {
+                break;
+            }
+            continue;
+        }
+
+        if (!(flags & URING_MORE)) {
+            udp->uring_recv_armed = 0; // e.g. ran out of provided buffers, rearm
+        }
+        if (res < 0 || buffer_id < 0) {
+            if (res < 0 && res != -ENOBUFS) {
+                errno = -res;
+                perror("udp_recv_batch: recvmsg");
+            }
+            waited = 0; // nothing came of it, wait again
+            continue;
+        }
+
+        udp->uring_recv_buffers[udp->uring_recv_buffer_count++] = buffer_id;
+
+        void *addr;
+        struct msghdr control;
+        size_t datagram_size;
+        char *datagram = uring_recvmsg_parse(uring_buffer(uring, buffer_id), &udp->uring_recv_msg, &addr, &control, &datagram_size);
+
+        count = udp_split_datagram(udp, count, datagram, datagram_size, &control, addr);
+        datagram_count += 1;
+    }
+
+    // stay armed, an event loop polls the ring fd for the next datagram
+    udp_arm_uring_recv(udp);
+    return count;
+}
+
+static int udp_recv_batch_wait(udp_t *udp, int max_count, int wait) {
+    if (max_count > udp->batch_size) {
+        max_count = udp->batch_size;
+    }
+
+    int count = 0;
+    if (udp->uring_recv != NULL) {
+        count = udp_recv_batch_uring(udp, max_count, wait);
+    } else {
+        size_t control_size = CMSG_SPACE(sizeof(int));
+        for (int i = 0; i < max_count; i++) {
+            struct msghdr *hdr = &udp->batch_recv_hdrs[i].msg_hdr;
+            hdr->msg_namelen = sizeof(struct sockaddr_in);
+            if (udp->gro_enabled) {
+                hdr->msg_control = udp->batch_recv_control + (i * control_size);
+                hdr->msg_controllen = control_size;
+            }
+        }
+
+        // blocks (up to SO_RCVTIMEO) for the first message only, then drains what is queued
+        int recv_flags = wait ? MSG_WAITFORONE : MSG_DONTWAIT;
+        int datagram_count = recvmmsg(udp->sockfd, udp->batch_recv_hdrs, max_count, recv_flags, NULL);
+
+        // split coalesced datagrams back into the messages the peer sent
+        for (int i = 0; i < datagram_count; i++) {
+            struct msghdr *hdr = &udp->batch_recv_hdrs[i].msg_hdr;
+            char *datagram = udp->batch_recv_iovs[i].iov_base;
+            size_t datagram_size = udp->batch_recv_hdrs[i].msg_len;
+            struct sockaddr_in *addr = &udp->batch_client_addrs[udp->batch_recv_slots + i];
+            count = udp_split_datagram(udp, count, datagram, datagram_size, hdr, addr);
+        }
+    }
+
+    udp->batch_recv_count = count;
+    if (count == 0) {
+        udp->bytes_recv = -1;
+        return 0;
+    }
+
+    // keep the single message fields in sync so udp_set_server_addr(udp, NULL, -1) works
+    udp->client_addr = udp->batch_client_addrs[0];
+    udp->client_addr_size = sizeof(struct sockaddr_in);
+    udp->bytes_recv = udp->batch_bytes_recv[0];
+    return count;
+}
+
+int udp_recv_batch(udp_t *udp, int max_count) {
+    int count = udp_recv_batch_wait(udp, max_count, 1);
+    if (count == 0) {
+        return -1; // timed out (or only empty datagrams)
+    }
+    return count;
+}
+
+// never blocks, returns 0 when nothing is queued
+int udp_poll_batch(udp_t *udp, int max_count) {
+    return udp_recv_batch_wait(udp, max_count, 0);
+}
+
+// readable whenever udp_poll_batch has something, for epoll
+int udp_event_fd(udp_t *udp) {
+    if (udp->uring_recv != NULL) {
+        udp_arm_uring_recv(udp);
+        return udp->uring_recv->ring_fd; // completions, not the socket, signal new datagrams
+    }
+    return udp->sockfd;
+}
+
 int udp_delete(udp_t* udp) {
 	if (udp == NULL) {
         return -1;
     }
 
+    if (udp->batch_size > 0) {
+        free(udp->batch_msg_send[0]);
+        free(udp->batch_recv_iovs[0].iov_base);
+        free(udp->batch_msg_send);
+        free(udp->batch_bytes_to_send);
+        free(udp->batch_msg_recv);
+        free(udp->batch_bytes_recv);
+        free(udp->batch_send_hdrs);
+        free(udp->batch_send_iovs);
+        free(udp->batch_send_iov_start);
+        free(udp->batch_send_msg_count);
+        free(udp->batch_payload_send);
+        free(udp->batch_payload_size);
+        free(udp->batch_addr_send);
+        free(udp->batch_recv_hdrs);
+        free(udp->batch_recv_iovs);
+        free(udp->batch_client_addrs);
+        free(udp->batch_recv_control);
+    }
+
+    uring_delete(udp->uring_send);
+    uring_delete(udp->uring_recv);
+    free(udp->uring_recv_buffers);
+
     free(udp->msg_recv);
     free(udp->msg_send);
 
@@ -10,6 +10,28 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include "uring.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// udp_create flags
+#define UDP_FLAG_GSO 0x1 // segment batches of full sized messages in the kernel (sender)
+#define UDP_FLAG_GRO 0x2 // accept coalesced datagrams and split them (receiver)
+
+#define UDP_MAX_SEGMENTS 64 // kernel limit on segments per GSO send
+#define UDP_MAX_DATAGRAM 65507 // largest udp payload, bounds a GSO/GRO super-datagram
+#define UDP_MIN_TIMEOUT 4000 // microsecs, about a jiffy at HZ=250
 
 typedef struct udp {
 	int sockfd;
@@ -28,16 +50,74 @@ typedef struct udp {
 
     struct sockaddr_in client_addr;
     socklen_t client_addr_size;
+
+    // batch mode: arrays of message buffers for sendmmsg/recvmmsg
+    int batch_size;
+
+    char **batch_msg_send;
+    size_t *batch_bytes_to_send;
+    const char **batch_payload_send; // optional data sent after batch_msg_send[i], e.g. a mapped file chunk
+    size_t *batch_payload_size;
+    const struct sockaddr_in **batch_addr_send; // optional destination per message, server_addr otherwise
+    int batch_send_count; // messages queued for the next udp_send_batch
+
+    char **batch_msg_recv;
+    ssize_t *batch_bytes_recv;
+    int batch_recv_count; // messages filled by the last udp_recv_batch
+
+    struct mmsghdr *batch_send_hdrs;
+    struct iovec *batch_send_iovs; // 2 per message, header and payload
+    int *batch_send_iov_start; // first iovec of each message
+    int *batch_send_msg_count; // messages in each mmsghdr
+    struct mmsghdr *batch_recv_hdrs;
+    struct iovec *batch_recv_iovs;
+    struct sockaddr_in *batch_client_addrs;
+
+    // segmentation offload, both stay 0 when not requested or rejected by the kernel
+    int gso_size;
+    int gro_enabled;
+    int batch_recv_slots; // messages udp_recv_batch can return, more than batch_size with GRO
+    char *batch_recv_control; // cmsg space for the GRO segment size
+
+    struct timeval recv_timeout; // SO_RCVTIMEO, also used for io_uring waits
+    int send_buffer_size; // SO_SNDBUF/SO_RCVBUF as the kernel granted them, 0 until udp_set_buffers
+    int recv_buffer_size;
+
+    // io_uring backend, both NULL when off or unsupported by the kernel
+    uring_t *uring_send;
+    uring_t *uring_recv;
+    struct msghdr uring_recv_msg; // template for the multishot recvmsg
+    int uring_recv_armed;
+    int *uring_recv_buffers; // provided buffers handed out by the last udp_recv_batch
+    int uring_recv_buffer_count;
 } udp_t;
 
-udp_t* udp_create(const char *port, size_t msg_send_size, size_t msg_recv_size);
+udp_t* udp_create(const char *port, size_t msg_send_size, size_t msg_recv_size, int flags);
 
 int udp_set_server_addr(udp_t * udp, char *addr, int port);
 
+int udp_enable_mtu_probe(udp_t *udp);
+
 int udp_send(udp_t* udp);
 
 int udp_recv(udp_t* udp);
 
+int udp_enable_batch(udp_t *udp, int batch_size);
+
+int udp_enable_uring(udp_t *udp);
+
+int udp_set_timeout(udp_t *udp, struct timeval *timeout);
+
+int udp_set_buffers(udp_t *udp, size_t send_size, size_t recv_size);
+
+int udp_send_batch(udp_t *udp);
+
+int udp_recv_batch(udp_t *udp, int max_count);
+
+int udp_poll_batch(udp_t *udp, int max_count);
+
+int udp_event_fd(udp_t *udp);
+
 int udp_delete(udp_t* udp);
 
 #endif /* UDP_H */
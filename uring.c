@@ -0,0 +1,298 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef URING_SUPPORTED
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+uring_t* uring_create(unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int ring_fd = uring_setup(entries, &params);
+	if (ring_fd < 0) {
+		return NULL; // ENOSYS, EPERM (io_uring_disabled), ...
+	}
+
+	// we rely on one mmap for both rings and on timed waits (5.11+)
+	unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+	if ((params.features & required) != required) {
+		close(ring_fd);
+		return NULL;
+	}
+
+	uring_t *uring = calloc(1, sizeof(uring_t));
+	uring->ring_fd = ring_fd;
+
+	size_t sq_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+	size_t cq_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+	size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+	void *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (ring == MAP_FAILED || sqes == MAP_FAILED) {
+		perror("uring_create: mmap");
+		close(ring_fd);
+		free(uring);
+		return NULL;
+	}
+
+	uring->sq_ring = ring;
+	uring->sq_ring_size = ring_size;
+	uring->cq_ring = ring; // single mmap
+	uring->cq_ring_size = 0;
+
+	char *base = ring;
+	uring->sq_head = (unsigned*)(base + params.sq_off.head);
+	uring->sq_tail = (unsigned*)(base + params.sq_off.tail);
+	uring->sq_mask = (unsigned*)(base + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned*)(base + params.sq_off.array);
+	uring->sq_entries = params.sq_entries;
+	uring->sqe_tail = *uring->sq_tail;
+	uring->sqes = sqes;
+	uring->sqes_size = sqes_size;
+
+	uring->cq_head = (unsigned*)(base + params.cq_off.head);
+	uring->cq_tail = (unsigned*)(base + params.cq_off.tail);
+	uring->cq_mask = (unsigned*)(base + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+	uring->buf_ring = NULL;
+	return uring;
+}
+
+// returns NULL when the submission queue is full
+static struct io_uring_sqe* uring_get_sqe(uring_t *uring) {
+	unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	if (uring->sqe_tail - head >= uring->sq_entries) {
+		return NULL;
+	}
+
+	unsigned index = uring->sqe_tail & *uring->sq_mask;
+	uring->sq_array[index] = index;
+	uring->sqe_tail += 1;
+
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+int uring_prep_sendmsg(uring_t *uring, int fd, struct msghdr *msg, int flags, unsigned long long user_data) {
+	struct io_uring_sqe *sqe = uring_get_sqe(uring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)msg;
+	sqe->len = 1;
+	sqe->flags = flags;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+// keeps receiving into provided buffers until it runs out of them (no URING_MORE)
+int uring_prep_recvmsg_multishot(uring_t *uring, int fd, struct msghdr *msg, unsigned long long user_data) {
+	struct io_uring_sqe *sqe = uring_get_sqe(uring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = uring->buf_group;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+int uring_prep_writev(uring_t *uring, int fd, const struct iovec *iov, int iov_count, off_t offset, unsigned long long user_data) {
+	struct io_uring_sqe *sqe = uring_get_sqe(uring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long long)iov;
+	sqe->len = iov_count;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	return 0;
+}
+
+// submits queued sqes and waits for wait_count completions, -ETIME if the timeout hits first
+int uring_submit(uring_t *uring, unsigned wait_count, struct timeval *timeout) {
+	unsigned to_submit = uring->sqe_tail - *uring->sq_tail;
+	__atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+
+	unsigned flags = 0;
+	if (wait_count > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void *arg_ptr = NULL;
+	size_t arg_size = 0;
+	if (timeout != NULL && (timeout->tv_sec > 0 || timeout->tv_usec > 0)) {
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_usec * 1000;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (unsigned long long)&ts;
+		arg_ptr = &arg;
+		arg_size = sizeof(arg);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	int result;
+	do {
+		result = uring_enter(uring->ring_fd, to_submit, wait_count, flags, arg_ptr, arg_size);
+	} while (result == -1 && errno == EINTR);
+
+	if (result == -1) {
+		return -errno;
+	}
+	return result;
+}
+
+// pops one completion, returns -1 when there is none, buffer_id is -1 without a provided buffer
+int uring_completion(uring_t *uring, unsigned long long *user_data, int *result, unsigned *flags, int *buffer_id) {
+	unsigned head = *uring->cq_head;
+	unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return -1;
+	}
+
+	struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+	*user_data = cqe->user_data;
+	*result = cqe->res;
+	*flags = cqe->flags;
+	*buffer_id = -1;
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		*buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	}
+
+	__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// sets up a ring of count buffers the kernel picks from (count must be a power of 2)
+int uring_provide_buffers(uring_t *uring, unsigned count, size_t size, int group) {
+	size_t ring_size = count * sizeof(struct io_uring_buf);
+	void *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)ring;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if (uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		munmap(ring, ring_size); // before 5.19
+		return -1;
+	}
+
+	uring->buf_ring = ring;
+	uring->buf_ring_size = ring_size;
+	uring->buf_count = count;
+	uring->buf_size = size;
+	uring->buf_group = group;
+	uring->bufs = malloc(count * size);
+	uring->buf_ring->tail = 0;
+
+	for (unsigned id = 0; id < count; id++) {
+		uring_recycle_buffer(uring, id);
+	}
+	return 0;
+}
+
+char* uring_buffer(uring_t *uring, unsigned id) {
+	return uring->bufs + (id * uring->buf_size);
+}
+
+// hands a provided buffer back to the kernel
+void uring_recycle_buffer(uring_t *uring, unsigned id) {
+	struct io_uring_buf_ring *ring = uring->buf_ring;
+	unsigned short tail = ring->tail;
+
+	struct io_uring_buf *buf = &ring->bufs[tail & (uring->buf_count - 1)];
+	buf->addr = (unsigned long long)uring_buffer(uring, id);
+	buf->len = uring->buf_size;
+	buf->bid = id;
+
+	__atomic_store_n(&ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// a multishot recvmsg buffer is: io_uring_recvmsg_out, name, control data, payload
+size_t uring_recvmsg_buffer_size(struct msghdr *msg, size_t payload_size) {
+	return sizeof(struct io_uring_recvmsg_out) + msg->msg_namelen + msg->msg_controllen + payload_size;
+}
+
+// returns the payload, control gets just enough of a msghdr for the CMSG_* macros
+char* uring_recvmsg_parse(char *buffer, struct msghdr *msg, void **name, struct msghdr *control, size_t *payload_size) {
+	struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out*)buffer;
+	char *name_start = buffer + sizeof(struct io_uring_recvmsg_out);
+	char *control_start = name_start + msg->msg_namelen;
+
+	*name = name_start;
+	memset(control, 0, sizeof(struct msghdr));
+	control->msg_control = control_start;
+	control->msg_controllen = out->controllen;
+	*payload_size = out->payloadlen;
+	return control_start + msg->msg_controllen;
+}
+
+void uring_delete(uring_t *uring) {
+	if (uring == NULL) {
+		return;
+	}
+
+	close(uring->ring_fd);
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->sq_ring, uring->sq_ring_size);
+	if (uring->buf_ring != NULL) {
+		munmap(uring->buf_ring, uring->buf_ring_size);
+		free(uring->bufs);
+	}
+	free(uring);
+}
+
+#else
+
+// built without io_uring, callers see it as unsupported and stay on plain syscalls
+uring_t* uring_create(unsigned entries) { return NULL; }
+int uring_prep_sendmsg(uring_t *uring, int fd, struct msghdr *msg, int flags, unsigned long long user_data) { return -1; }
+int uring_prep_recvmsg_multishot(uring_t *uring, int fd, struct msghdr *msg, unsigned long long user_data) { return -1; }
+int uring_prep_writev(uring_t *uring, int fd, const struct iovec *iov, int iov_count, off_t offset, unsigned long long user_data) { return -1; }
+int uring_submit(uring_t *uring, unsigned wait_count, struct timeval *timeout) { return -ENOSYS; }
+int uring_completion(uring_t *uring, unsigned long long *user_data, int *result, unsigned *flags, int *buffer_id) { return -1; }
+int uring_provide_buffers(uring_t *uring, unsigned count, size_t size, int group) { return -1; }
+char* uring_buffer(uring_t *uring, unsigned id) { return NULL; }
+void uring_recycle_buffer(uring_t *uring, unsigned id) {}
+size_t uring_recvmsg_buffer_size(struct msghdr *msg, size_t payload_size) { return 0; }
+char* uring_recvmsg_parse(char *buffer, struct msghdr *msg, void **name, struct msghdr *control, size_t *payload_size) { return NULL; }
+void uring_delete(uring_t *uring) {}
+
+#endif /* URING_SUPPORTED */
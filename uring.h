@@ -0,0 +1,88 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+// build with -DNO_URING (make URING_BACKEND=0) to leave the io_uring backend out
+#if !defined(NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_SUPPORTED 1
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifndef URING_SUPPORTED
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+#endif
+
+// minimal io_uring wrapper on the raw syscalls, no liburing needed
+typedef struct uring {
+	int ring_fd;
+
+	// submission queue
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned sqe_tail; // sqes handed out, published to sq_tail on submit
+	struct io_uring_sqe *sqes;
+
+	// completion queue
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	// provided buffers for multishot receives
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	unsigned buf_count;
+	size_t buf_size;
+	char *bufs;
+	int buf_group;
+} uring_t;
+
+// sqe flags, mirror IOSQE_*
+#define URING_LINK 0x4 // next sqe starts once this one completes
+
+// completion flags, mirror IORING_CQE_F_*
+#define URING_MORE 0x2 // multishot request is still armed
+
+uring_t* uring_create(unsigned entries);
+
+int uring_prep_sendmsg(uring_t *uring, int fd, struct msghdr *msg, int flags, unsigned long long user_data);
+
+int uring_prep_recvmsg_multishot(uring_t *uring, int fd, struct msghdr *msg, unsigned long long user_data);
+
+int uring_prep_writev(uring_t *uring, int fd, const struct iovec *iov, int iov_count, off_t offset, unsigned long long user_data);
+
+int uring_submit(uring_t *uring, unsigned wait_count, struct timeval *timeout);
+
+int uring_completion(uring_t *uring, unsigned long long *user_data, int *result, unsigned *flags, int *buffer_id);
+
+int uring_provide_buffers(uring_t *uring, unsigned count, size_t size, int group);
+
+char* uring_buffer(uring_t *uring, unsigned id);
+
+void uring_recycle_buffer(uring_t *uring, unsigned id);
+
+size_t uring_recvmsg_buffer_size(struct msghdr *msg, size_t payload_size);
+
+char* uring_recvmsg_parse(char *buffer, struct msghdr *msg, void **name, struct msghdr *control, size_t *payload_size);
+
+void uring_delete(uring_t *uring);
+
+#endif /* URING_H */